@@ -0,0 +1,165 @@
+// UDP video over loopback: keyframe-sized access units cut by rtp_packetize
+// and sent back to back, per send path:
+//   unbatched  one sendto per datagram, one recv per datagram
+//   sendmmsg   send_datagrams without segmentation, recvmmsg
+//   gso        send_datagrams with UDP_SEGMENT, recvmmsg with UDP_GRO
+// Prints datagrams per second and thread CPU per frame on both sides.
+//
+//   gso_bench [frames] [frame KiB]
+#include <poll.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "shared/rtp.h"
+#include "shared/socket.h"
+
+enum class SendPath { UNBATCHED, SENDMMSG, GSO };
+
+static const char* path_name(SendPath path) {
+    switch (path) {
+        case SendPath::UNBATCHED: return "unbatched";
+        case SendPath::SENDMMSG: return "sendmmsg";
+        case SendPath::GSO: return "gso";
+    }
+    return "?";
+}
+
+static double thread_cpu_seconds() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double wall_seconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// One IDR slice of random bytes, none of them 0 so it holds no start codes
+static std::vector<uint8_t> make_access_unit(size_t size) {
+    std::mt19937 random(1);
+    std::vector<uint8_t> au = { 0, 0, 0, 1, 0x65 };
+    while (au.size() < size) au.push_back((uint8_t)(1 + random() % 255));
+    return au;
+}
+
+static void run(SendPath path, int frames, const std::vector<uint8_t>& au) {
+    socket_t receiver = socket(AF_INET, SOCK_DGRAM, 0);
+    socket_t sender = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    bind(receiver, (sockaddr*)&addr, sizeof(addr));
+    getsockname(receiver, (sockaddr*)&addr, &len);
+    // Back to back frames overrun the default buffers long before any path
+    // runs out of CPU, FORCE needs CAP_NET_ADMIN and falls back to rmem_max
+    int buffer = 64 << 20;
+    setsockopt(receiver, SOL_SOCKET, SO_RCVBUFFORCE, &buffer, sizeof(buffer));
+    setsockopt(receiver, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+    setsockopt(sender, SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+    set_nonblocking(receiver);
+
+    if (path == SendPath::GSO && !udp_segmentation_supported(sender)) {
+        std::printf("%-10s UDP_SEGMENT unsupported\n", path_name(path));
+        close_socket(sender);
+        close_socket(receiver);
+        return;
+    }
+
+    RtpPacketizer packetizer;
+    init_rtp_packetizer(packetizer);
+    VideoFrameHead head;
+    head.header.type = MSG_VIDEO_FRAME;
+    head.header.flags = MSG_FLAG_KEYFRAME;
+    rtp_packetize(packetizer, head, au.data(), au.size());
+    const size_t per_frame = packetizer.datagrams.size();
+
+    std::atomic<bool> done{false};
+    uint64_t received = 0, recv_calls = 0;
+    double recv_cpu = 0;
+    std::thread reader([&] {
+        DatagramReceiver batch;
+        init_datagram_receiver(batch, receiver, RTP_DATAGRAM_SIZE * 2, path == SendPath::GSO);
+        std::vector<uint8_t> buf(RTP_DATAGRAM_SIZE * 2);
+        const double cpu_start = thread_cpu_seconds();
+        while (true) {
+            if (path == SendPath::UNBATCHED) {
+                size_t size = 0;
+                if (try_recv(receiver, buf.data(), buf.size(), size) && size > 0) {
+                    ++received;
+                    ++recv_calls;
+                    continue;
+                }
+            } else if (recv_datagrams(batch, receiver) && !batch.datagrams.empty()) {
+                continue;
+            }
+            if (done) break;
+            pollfd pfd{ receiver, POLLIN, 0 };
+            poll(&pfd, 1, 10);
+        }
+        recv_cpu = thread_cpu_seconds() - cpu_start;
+        if (path != SendPath::UNBATCHED) {
+            received = batch.received;
+            recv_calls = batch.calls;
+        }
+    });
+
+    const double cpu_start = thread_cpu_seconds();
+    const double wall_start = wall_seconds();
+    for (int f = 0; f < frames; ++f) {
+        head.header.timestamp_us = f;
+        rtp_packetize(packetizer, head, au.data(), au.size());
+        if (path == SendPath::UNBATCHED) {
+            for (const SendBuffer& datagram : packetizer.datagrams) {
+                sendto(sender, (const char*)datagram.data, (int)datagram.size, 0, (const sockaddr*)&addr, sizeof(addr));
+            }
+        } else {
+            send_datagrams(sender, addr, packetizer.datagrams.data(), packetizer.datagrams.size(),
+                           path == SendPath::GSO);
+        }
+    }
+    const double send_cpu = thread_cpu_seconds() - cpu_start;
+    const double send_wall = wall_seconds() - wall_start;
+
+    // Whatever has not arrived by now was dropped
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    done = true;
+    reader.join();
+
+    const double sent = (double)frames * per_frame;
+    std::printf("%-10s %.0f kpps sent, %.1f%% received, send %.1f us CPU/frame, receive %.1f us CPU/frame, "
+                "%.1f datagrams per receive call\n",
+                path_name(path), sent / send_wall / 1000, 100.0 * received / sent, send_cpu / frames * 1e6,
+                recv_cpu / frames * 1e6, recv_calls ? (double)received / recv_calls : 0.0);
+
+    close_socket(sender);
+    close_socket(receiver);
+}
+
+int main(int argc, char** argv) {
+    const int frames = argc > 1 ? std::atoi(argv[1]) : 2000;
+    const int frame_kib = argc > 2 ? std::atoi(argv[2]) : 200;
+    if (frames <= 0 || frame_kib <= 0) {
+        std::fprintf(stderr, "usage: gso_bench [frames] [frame KiB]\n");
+        return 1;
+    }
+    const std::vector<uint8_t> au = make_access_unit((size_t)frame_kib * 1024);
+    RtpPacketizer packetizer;
+    init_rtp_packetizer(packetizer);
+    VideoFrameHead head;
+    rtp_packetize(packetizer, head, au.data(), au.size());
+    std::printf("%d frames of %d KiB, %zu datagrams each\n", frames, frame_kib, packetizer.datagrams.size());
+
+    run(SendPath::UNBATCHED, frames, au);
+    run(SendPath::SENDMMSG, frames, au);
+    run(SendPath::GSO, frames, au);
+    return 0;
+}
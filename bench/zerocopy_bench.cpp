@@ -0,0 +1,132 @@
+// Sender CPU for large encoded packets over TCP loopback, copied through the
+// transport and sent with MSG_ZEROCOPY (send_zerocopy). Each packet is a
+// freshly allocated AVPacket, as the encoder hands them out, and the reader
+// checks every payload byte.
+//
+//   zerocopy_bench [packet KiB] [packets]
+//
+// Loopback delivers by copying either way, the kernel reports those
+// completions as copied. Run it across a real NIC to see the saving.
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <thread>
+#include <vector>
+
+#include "host/zerocopy.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+static double thread_cpu_seconds() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double wall_seconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Connected loopback TCP pair
+static bool connect_loopback(socket_t& sender, socket_t& receiver) {
+    socket_t listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 1) != 0 ||
+        getsockname(listener, (sockaddr*)&addr, &len) != 0) {
+        close_socket(listener);
+        return false;
+    }
+    receiver = socket(AF_INET, SOCK_STREAM, 0);
+    const bool connected = connect(receiver, (sockaddr*)&addr, sizeof(addr)) == 0;
+    sender = connected ? accept(listener, nullptr, nullptr) : (socket_t)-1;
+    close_socket(listener);
+    return sender != (socket_t)-1;
+}
+
+static bool run(bool zerocopy, int packet_size, int packets) {
+    socket_t sender, receiver;
+    if (!connect_loopback(sender, receiver)) {
+        std::fprintf(stderr, "loopback connection failed\n");
+        return false;
+    }
+
+    // Packet i is filled with byte i
+    std::atomic<int> corrupt{0};
+    std::thread reader([&] {
+        Transport transport;
+        init_transport(transport, receiver);
+        MessageHeader header;
+        std::vector<uint8_t> payload;
+        const size_t head = sizeof(VideoFrameHead) - sizeof(MessageHeader);
+        for (int i = 0; i < packets; ++i) {
+            if (!recv_protocol_message(transport, header, payload) || payload.size() != head + packet_size) {
+                corrupt += packets - i;
+                return;
+            }
+            for (size_t k = head; k < payload.size(); ++k) {
+                if (payload[k] != (uint8_t)i) {
+                    ++corrupt;
+                    break;
+                }
+            }
+        }
+    });
+
+    Transport transport;
+    init_transport(transport, sender);
+    ZeroCopySender zc;
+    if (zerocopy && !init_zerocopy(zc, sender)) {
+        std::fprintf(stderr, "SO_ZEROCOPY unavailable\n");
+    }
+
+    const double cpu_start = thread_cpu_seconds();
+    const double wall_start = wall_seconds();
+    for (int i = 0; i < packets; ++i) {
+        AVPacket* pkt = av_packet_alloc();
+        if (!pkt || av_new_packet(pkt, packet_size) < 0) break;
+        std::memset(pkt->data, (uint8_t)i, packet_size);
+        VideoFrameHead head;
+        head.header.type = MSG_VIDEO_FRAME;
+        send_zerocopy(zc, transport, head.header, sizeof(head), pkt);
+        av_packet_free(&pkt);
+    }
+    const double cpu = thread_cpu_seconds() - cpu_start;
+    const double wall = wall_seconds() - wall_start;
+    reader.join();
+    for (int i = 0; i < 100 && zc.in_flight > 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        reap_zerocopy(zc, sender);
+    }
+
+    const double gigabytes = (double)packets * packet_size / 1e9;
+    std::printf("%-9s %.3f s CPU/GB, %.2f GB/s, %d corrupt, %llu completions copied, %d still in flight\n",
+                zerocopy ? "zerocopy" : "copy", cpu / gigabytes, gigabytes / wall, corrupt.load(),
+                (unsigned long long)zc.copied, zc.in_flight);
+
+    destroy_zerocopy(zc);
+    close_socket(sender);
+    close_socket(receiver);
+    return corrupt == 0;
+}
+
+int main(int argc, char** argv) {
+    const int packet_size = (argc > 1 ? std::atoi(argv[1]) : 1024) * 1024;
+    const int packets = argc > 2 ? std::atoi(argv[2]) : 2000;
+    if (packet_size <= 0 || packets <= 0) {
+        std::fprintf(stderr, "usage: zerocopy_bench [packet KiB] [packets]\n");
+        return 1;
+    }
+    std::printf("%d packets of %d KiB\n", packets, packet_size / 1024);
+    const bool copy_ok = run(false, packet_size, packets);
+    const bool zerocopy_ok = run(true, packet_size, packets);
+    return copy_ok && zerocopy_ok ? 0 : 1;
+}
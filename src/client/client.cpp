@@ -1,197 +1,807 @@
-#include <iostream>
-#include <thread>
-#include <vector>
-#include <atomic>
-#include <chrono>
-
-#ifdef _WIN32
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#include <d3d11.h>
-#include <dxgi1_2.h>
-#include <wrl/client.h>
-using Microsoft::WRL::ComPtr;
-#pragma comment(lib, "ws2_32.lib")
-#pragma comment(lib, "d3d11.lib")
-#pragma comment(lib, "dxgi.lib")
-#else
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <unistd.h>
-#endif
-
-extern "C" {
-#include <libavcodec/avcodec.h>
-#include <libavformat/avformat.h>
-#include <libswscale/swscale.h>
-#include <libavutil/imgutils.h>
-#include <libavutil/opt.h>
-}
-
-#include <SDL3/SDL.h>
-
-
-int recvall(int sock, char* buf, int len) {
-    int total = 0;
-    while (total < len) {
-        int r = recv(sock, buf + total, len - total, 0);
-        if (r <= 0) return r;
-        total += r;
-    }
-    return total;
-}
-
-void start_client(const char* ip_addr,int port, bool& running) {
-    #ifdef _WIN32
-        WSADATA wsa;
-        WSAStartup(MAKEWORD(2, 2), &wsa);
-    #endif
-
-    #ifdef _WIN32
-        SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
-        char flag = 1;
-        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
-    #else
-        int sock = socket(AF_INET, SOCK_STREAM, 0);
-        int flag = 1;
-        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
-    #endif
-
-    sockaddr_in server_addr{};
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-    inet_pton(AF_INET, ip_addr, &server_addr.sin_addr);
-
-    if (connect(sock, (sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        std::cerr << "[Client] Connection failed\n";
-        #ifdef _WIN32
-            WSACleanup();
-        #endif
-        return;
-    }
-    std::cout << "[Client] Connected to host.\n";
-
-    const AVCodec* codec = avcodec_find_decoder(AV_CODEC_ID_H264);
-    AVCodecContext* codec_ctx = avcodec_alloc_context3(codec);
-    if (!codec_ctx) {
-        std::cerr << "Failed to allocate codec context\n";
-        return;
-    }
-    avcodec_open2(codec_ctx, codec, nullptr);
-
-    AVFrame* frame = av_frame_alloc();
-    AVPacket* pkt = av_packet_alloc();
-
-    // === SDL3 initialization ===
-    if (!SDL_Init(SDL_INIT_VIDEO)) {
-        std::cerr << "SDL_Init Error: " << SDL_GetError() << std::endl;
-        return;
-    }
-
-    SDL_Window* win = SDL_CreateWindow("Remote Play",
-        1980, 1020, SDL_WINDOW_RESIZABLE);
-
-    if (!win) {
-        std::cerr << "SDL_CreateWindow failed: " << SDL_GetError() << "\n";
-        SDL_Quit();
-        return;
-    }
-
-    SDL_Renderer* renderer = SDL_CreateRenderer(win, nullptr);
-    if (!renderer) {
-        std::cerr << "SDL_CreateRenderer failed: " << SDL_GetError() << "\n";
-        SDL_DestroyWindow(win);
-        SDL_Quit();
-        return;
-    }
-
-    SDL_Texture* texture = SDL_CreateTexture(renderer,
-        SDL_PIXELFORMAT_YV12,
-        SDL_TEXTUREACCESS_STREAMING,
-        1980, 1020);
-
-    if (!texture) {
-        std::cerr << "SDL_CreateTexture failed: " << SDL_GetError() << "\n";
-        SDL_DestroyRenderer(renderer);
-        SDL_DestroyWindow(win);
-        SDL_Quit();
-        return;
-    }
-
-    while (running) {
-        int net_size = 0;
-        int received = recvall(sock, (char*)&net_size, sizeof(net_size));
-        if (received <= 0) {
-            std::cout << "[Client] Connection closed or error on size recv\n";
-            break;
-        }
-        net_size = ntohl(net_size);
-        //std::cout << "[Client] recv size returned: " << received << ", size: " << net_size << std::endl;
-        if (received <= 0) {
-            std::cout << "[Client] Connection closed or error on size recv\n";
-            break;
-        }
-
-        std::vector<uint8_t> buffer(net_size);
-        received = recvall(sock, (char*)buffer.data(), net_size);
-        if (received <= 0) {
-            std::cout << "[Client] Connection closed or error on frame data recv\n";
-            running = false;
-            break;
-        }
-
-        //av_packet_unref(pkt);
-        av_new_packet(pkt, net_size);
-        memcpy(pkt->data, buffer.data(), net_size);
-
-        int ret = avcodec_send_packet(codec_ctx, pkt);
-        if (ret < 0) {
-            std::cerr << "Error sending packet to decoder: " << ret << "\n";
-            break;
-        }
-
-        while (ret >= 0) {
-            ret = avcodec_receive_frame(codec_ctx, frame);
-            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) break;
-            else if (ret < 0) {
-                std::cerr << "Error receiving frame from decoder: " << ret << "\n";
-                break;
-            }
-
-            SDL_UpdateYUVTexture(texture, nullptr,
-                frame->data[0], frame->linesize[0],
-                frame->data[1], frame->linesize[1],
-                frame->data[2], frame->linesize[2]);
-
-            SDL_RenderClear(renderer);
-            SDL_RenderTexture(renderer, texture, nullptr, nullptr);
-            SDL_RenderPresent(renderer);
-        }
-
-        // Poll SDL events to allow window closing
-        SDL_Event event;
-        while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_EVENT_QUIT) {
-                running = false;
-            }
-        }
-    }
-
-    // Cleanup
-    SDL_DestroyTexture(texture);
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(win);
-    SDL_Quit();
-
-    av_frame_free(&frame);
-    av_packet_free(&pkt);
-    avcodec_free_context(&codec_ctx);
-
-#ifdef _WIN32
-    closesocket(sock);
-    WSACleanup();
-#else
-    close(sock);
-#endif
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+
+#ifdef _WIN32
+#include <d3d11.h>
+#include <dxgi1_2.h>
+#include <wrl/client.h>
+using Microsoft::WRL::ComPtr;
+#pragma comment(lib, "d3d11.lib")
+#pragma comment(lib, "dxgi.lib")
+#endif
+
+#include "shared/link_emulator.h"
+#include "shared/poller.h"
+#include "shared/protocol.h"
+#include "shared/rtp.h"
+#include "shared/socket.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
+}
+
+#include <SDL3/SDL.h>
+
+#include "client.h"
+#include "decoder/stripe_decoder.h"
+#include "shared/delta_codec.h"
+
+// A received datagram held back until the emulated link would deliver it
+struct DelayedDatagram {
+    uint64_t arrival_us = 0;
+    std::vector<uint8_t> data;
+};
+
+// The client's side of the connection, only the main thread sends
+struct HostConnection {
+    Transport transport;
+    uint32_t next_sequence = 0;
+    // UDP video: frames come from the reassembler, control stays on TCP
+    bool udp = false;
+    socket_t udp_sock = (socket_t)-1;
+    Poller poller;
+    std::vector<PollEvent> events;
+    RtpReassembler rtp;
+    DatagramReceiver receiver;
+    uint64_t busy_poll_us = 0;              // Spin on the video socket before sleeping, 0 = off
+    LinkEmulator link;
+    std::deque<DelayedDatagram> delayed;    // In arrival order, when the link is shaped
+    // Retransmission: skipped sequence numbers go to the host as NACKs
+    bool nack = false;
+    uint64_t retransmit_us = 0;             // The host resends nothing captured longer ago
+    std::vector<uint16_t> nacks;
+    std::vector<be16> nack_payload;
+    uint64_t packets_nacked = 0;
+    // Congestion control: video arrival times go to the host
+    bool feedback = false;
+    std::vector<RtpArrival> arrivals;
+    std::vector<FeedbackArrival> feedback_payload;
+};
+
+// Where UDP video frames spent their time between the network and the
+// screen, summed until the next log line. With kernel receive timestamps the
+// time a frame sat in the socket buffer is told apart from the path's.
+struct FrameLatency {
+    uint64_t frames = 0;
+    uint64_t spread_us = 0;         // First to last packet arriving: pacing and the path's rate
+    uint64_t socket_us = 0;         // Last packet arriving to being read
+    uint64_t reassembly_us = 0;     // ... to the frame being handed out, waiting for its turn or retransmissions
+    uint64_t decode_us = 0;         // ... to its picture being presented
+    uint64_t total_max_us = 0;      // Last packet arriving to presented, the longest
+};
+
+// Receive buffer of the RTP socket, holds a few key frames
+static const int UDP_RECV_BUFFER = 4 * 1024 * 1024;
+// Longest wait for UDP video before the window gets serviced again
+static const int UDP_WAIT_MS = 10;
+// How often the host hears about UDP packet loss, which sizes its FEC
+static const Uint64 RECEIVER_REPORT_INTERVAL_MS = 500;
+// Round trip assumed until the first PONG, and the slack on top of one and a
+// half round trips that a frame waits for its retransmissions
+static const uint32_t DEFAULT_RTT_US = 20000;
+static const uint32_t RETRANSMIT_SLACK_US = 5000;
+// How often the host hears when its video arrived, the pace of its rate control
+static const Uint64 FEEDBACK_INTERVAL_MS = 50;
+// How often the frame latency breakdown is logged
+static const Uint64 LATENCY_LOG_INTERVAL_MS = 5000;
+// Longest an emulated bottleneck queues a datagram before dropping it
+static const double EMULATED_QUEUE_MS = 300;
+
+// Opens the socket RTP video arrives on, returning its port or 0
+static uint16_t open_video_socket(HostConnection& conn) {
+    conn.udp_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    socklen_t len = sizeof(addr);
+    int buffer_size = UDP_RECV_BUFFER;
+    setsockopt(conn.udp_sock, SOL_SOCKET, SO_RCVBUF, (const char*)&buffer_size, sizeof(buffer_size));
+    if (bind(conn.udp_sock, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+        getsockname(conn.udp_sock, (sockaddr*)&addr, &len) != 0 ||
+        !set_nonblocking(conn.udp_sock)) {
+        close_socket(conn.udp_sock);
+        conn.udp_sock = (socket_t)-1;
+        return 0;
+    }
+    return ntohs(addr.sin_port);
+}
+
+// Starts waiting on both sockets once the host agreed to UDP video
+static bool start_udp_video(HostConnection& conn, const ClientOptions& options) {
+    if (!init_poller(conn.poller)) return false;
+    if (!poller_add(conn.poller, conn.transport.sock, false) || !poller_add(conn.poller, conn.udp_sock, false)) {
+        destroy_poller(conn.poller);
+        return false;
+    }
+    init_datagram_receiver(conn.receiver, conn.udp_sock, RTP_DATAGRAM_SIZE * 2, options.udp_gro,
+                           options.udp_timestamps);
+    if (options.busy_poll_us > 0) {
+        conn.busy_poll_us = (uint64_t)options.busy_poll_us;
+        if (enable_busy_poll(conn.udp_sock, options.busy_poll_us)) {
+            std::cout << "[Client] Busy polling the video socket for " << options.busy_poll_us << " us\n";
+        } else {
+            std::cout << "[Client] SO_BUSY_POLL refused, spinning on the video socket for "
+                      << options.busy_poll_us << " us without it\n";
+        }
+    }
+    conn.udp = true;
+    return true;
+}
+
+// Hands the datagrams the emulated link has delivered by `now_us` to the
+// reassembler, with their emulated arrival times
+static void release_delayed(HostConnection& conn, uint64_t now_us) {
+    while (!conn.delayed.empty() && conn.delayed.front().arrival_us <= now_us) {
+        const DelayedDatagram& datagram = conn.delayed.front();
+        rtp_receive(conn.rtp, datagram.data.data(), datagram.data.size(), datagram.arrival_us);
+        conn.delayed.pop_front();
+    }
+}
+
+// Passes one received datagram through the emulated link
+static void receive_datagram(HostConnection& conn, const ReceivedDatagram& received) {
+    if (!link_shaped(conn.link)) {
+        if (!link_drops(conn.link)) rtp_receive(conn.rtp, received.data, received.size, received.arrival_us);
+        return;
+    }
+    DelayedDatagram datagram;
+    const uint64_t arrival_us = received.arrival_us != 0 ? received.arrival_us : protocol_timestamp_us();
+    if (!link_transmit(conn.link, arrival_us, received.size, datagram.arrival_us)) return;
+    datagram.data.assign(received.data, received.data + received.size);
+    conn.delayed.push_back(std::move(datagram));
+}
+
+// Reads what the video socket holds, returning how many datagrams
+static size_t drain_video_socket(HostConnection& conn) {
+    size_t count = 0;
+    while (recv_datagrams(conn.receiver, conn.udp_sock) && !conn.receiver.datagrams.empty()) {
+        for (const ReceivedDatagram& datagram : conn.receiver.datagrams) receive_datagram(conn, datagram);
+        count += conn.receiver.datagrams.size();
+    }
+    return count;
+}
+
+// Busy polling: reads the video socket in a loop until a frame is whole or
+// busy_poll_us pass without a datagram, at most UDP_WAIT_MS. With
+// SO_BUSY_POLL each empty read also polls the device, so a frame is taken in
+// without waiting for an interrupt and a wake-up.
+static bool spin_for_frame(HostConnection& conn, MessageHeader& header, std::vector<uint8_t>& payload) {
+    uint64_t now_us = protocol_timestamp_us();
+    const uint64_t end_us = now_us + UDP_WAIT_MS * 1000;
+    uint64_t idle_until_us = now_us + conn.busy_poll_us;
+    while (now_us < idle_until_us && now_us < end_us) {
+        const bool received = drain_video_socket(conn) > 0;
+        now_us = protocol_timestamp_us();
+        release_delayed(conn, now_us);
+        if (rtp_next_frame(conn.rtp, header, payload)) return true;
+        if (received) idle_until_us = now_us + conn.busy_poll_us;
+    }
+    return false;
+}
+
+// Next message from the host. With UDP video the wait ends after
+// UDP_WAIT_MS, leaving header.type 0 when nothing arrived, so the window
+// keeps responding. Returns false when the TCP connection is gone.
+static bool next_host_message(HostConnection& conn, MessageHeader& header, std::vector<uint8_t>& payload) {
+    if (!conn.udp) return recv_protocol_message(conn.transport, header, payload);
+
+    header = MessageHeader();
+    header.type = 0;
+    release_delayed(conn, protocol_timestamp_us());
+    if (rtp_next_frame(conn.rtp, header, payload)) return true;
+    if (conn.busy_poll_us > 0 && spin_for_frame(conn, header, payload)) return true;
+
+    // Wakes up for the next datagram the emulated link delivers
+    int wait_ms = UDP_WAIT_MS;
+    if (!conn.delayed.empty()) {
+        const uint64_t now_us = protocol_timestamp_us();
+        const uint64_t due_us = conn.delayed.front().arrival_us;
+        wait_ms = due_us > now_us ? std::min(wait_ms, (int)((due_us - now_us + 999) / 1000)) : 0;
+    }
+    bool control = false;
+    poller_wait(conn.poller, conn.events, wait_ms);
+    for (const PollEvent& event : conn.events) {
+        if (event.sock != conn.udp_sock) {
+            if (event.closed) return false;
+            control = control || event.readable;
+            continue;
+        }
+        drain_video_socket(conn);
+    }
+    release_delayed(conn, protocol_timestamp_us());
+    if (control) return recv_protocol_message(conn.transport, header, payload);
+    rtp_next_frame(conn.rtp, header, payload);
+    return true;
+}
+
+// Sends a message whose head (header plus fixed info, if any) the caller
+// filled in place, stamping the sequence number
+static bool send_to_host(HostConnection& conn, MessageHeader& header, size_t head_size,
+    const uint8_t* payload = nullptr, size_t payload_size = 0) {
+    header.sequence = conn.next_sequence++;
+    return send_protocol_message(conn.transport, header, head_size, payload, payload_size);
+}
+
+// How long a frame with missing packets waits for their retransmission: a
+// NACK and the resent packet take a round trip. A frame arrives about half a
+// round trip after capture, and the host resends nothing past its deadline.
+static void set_retransmit_wait(HostConnection& conn, uint32_t rtt_us) {
+    const uint64_t wait = rtt_us + rtt_us / 2 + RETRANSMIT_SLACK_US;
+    const uint64_t left = conn.retransmit_us > rtt_us / 2 ? conn.retransmit_us - rtt_us / 2 : 0;
+    // Too far for any retransmission to make it, the host answers NACKs with an IDR
+    conn.rtp.retransmit_wait_us = rtt_us + RETRANSMIT_SLACK_US <= left ? std::min(wait, left) : 0;
+}
+
+// Asks the host to resend the video packets skipped since the last call
+static bool send_nacks(HostConnection& conn, uint32_t rtt_us) {
+    rtp_take_nacks(conn.rtp, conn.nacks);
+    if (conn.nacks.empty()) return true;
+    conn.nack_payload.assign(conn.nacks.begin(), conn.nacks.end());
+    conn.packets_nacked += conn.nacks.size();
+    MessageHead<NackInfo> head;
+    head.header.type = MSG_NACK;
+    head.info.rtt_us = rtt_us;
+    head.info.count = (uint16_t)conn.nacks.size();
+    return send_to_host(conn, head.header, sizeof(head), (const uint8_t*)conn.nack_payload.data(),
+        conn.nack_payload.size() * sizeof(be16));
+}
+
+// Tells the host when the video packets recorded since the last call arrived
+static bool send_feedback(HostConnection& conn, uint32_t rtt_us) {
+    rtp_take_arrivals(conn.rtp, conn.arrivals);
+    if (conn.arrivals.empty()) return true;
+    uint64_t base_us = conn.arrivals.front().arrival_us;
+    for (const RtpArrival& arrival : conn.arrivals) base_us = std::min(base_us, arrival.arrival_us);
+    conn.feedback_payload.resize(conn.arrivals.size());
+    for (size_t i = 0; i < conn.arrivals.size(); ++i) {
+        FeedbackArrival& entry = conn.feedback_payload[i];
+        entry.sequence = conn.arrivals[i].sequence;
+        entry.reserved = 0;
+        entry.arrival_delta_us = (uint32_t)(conn.arrivals[i].arrival_us - base_us);
+    }
+    MessageHead<TransportFeedback> head;
+    head.header.type = MSG_TRANSPORT_FEEDBACK;
+    head.info.base_arrival_us = base_us;
+    head.info.rtt_us = rtt_us;
+    head.info.count = (uint16_t)conn.arrivals.size();
+    return send_to_host(conn, head.header, sizeof(head), (const uint8_t*)conn.feedback_payload.data(),
+        conn.feedback_payload.size() * sizeof(FeedbackArrival));
+}
+
+static bool send_rendition(HostConnection& conn, uint8_t type, int rendition) {
+    MessageHead<RenditionInfo> head;
+    head.header.type = type;
+    head.info.rendition = (uint32_t)rendition;
+    return send_to_host(conn, head.header, sizeof(head));
+}
+
+// Times the host's PROBE burst and tells it the rate that arrived. The first
+// message only marks the start, the closing one the end.
+static bool answer_probe(HostConnection& conn) {
+    MessageHeader header;
+    std::vector<uint8_t> payload;
+    uint64_t first_us = 0;
+    uint64_t bytes = 0;
+    while (recv_protocol_message(conn.transport, header, payload)) {
+        const ProbeInfo* info = message_view<ProbeInfo>(payload);
+        if (header.type != MSG_PROBE || !info) continue;
+        const uint64_t now_us = protocol_timestamp_us();
+        if (first_us == 0) {
+            first_us = now_us;
+        } else {
+            bytes += sizeof(MessageHeader) + payload.size();
+        }
+        if (!info->last) continue;
+
+        const double seconds = (now_us - first_us) / 1e6;
+        const double bitrate = seconds > 0 ? bytes * 8 / seconds : 0;
+        MessageHead<ProbeResult> result;
+        result.header.type = MSG_PROBE_RESULT;
+        result.info.bitrate = (uint32_t)std::min(bitrate, (double)UINT32_MAX);
+        std::cout << "[Client] Probe arrived at " << (int)(bitrate / 1000) << " kbps over "
+                  << (int)(seconds * 1000) << " ms (sent at " << (uint32_t)info->bitrate / 1000 << ")\n";
+        return send_to_host(conn, result.header, sizeof(result));
+    }
+    return false;
+}
+
+// Sends STREAM_INIT and waits for the host's reply, which carries the stream
+// description and the rendition's SPS/PPS. A nonzero `udp_port` asks for
+// video over UDP, the reply says whether the host agreed. When the host
+// probes the path first, the probe is answered before returning.
+static bool subscribe(HostConnection& conn, int rendition, uint16_t udp_port, StreamInfo& stream,
+    std::vector<uint8_t>& parameter_sets) {
+    MessageHead<SubscribeInfo> request;
+    request.header.type = MSG_STREAM_INIT;
+    request.info.rendition = (uint32_t)rendition;
+    request.info.udp_port = udp_port;
+    request.info.probe = 1;
+    if (!send_to_host(conn, request.header, sizeof(request))) return false;
+
+    MessageHeader header;
+    std::vector<uint8_t> payload;
+    while (recv_protocol_message(conn.transport, header, payload)) {
+        if (header.type != MSG_STREAM_INIT) continue;
+        const StreamInfo* info = message_view<StreamInfo>(payload);
+        if (!info || info->stripe_count == 0) return false;
+        stream = *info;
+        parameter_sets.assign(payload.begin() + sizeof(StreamInfo), payload.end());
+        return !(header.flags & MSG_FLAG_PROBE) || answer_probe(conn);
+    }
+    return false;
+}
+
+// Delay between the last resize event and the report, so dragging a window
+// edge does not make the host reopen its encoder for every pixel
+static const Uint64 VIEWPORT_REPORT_DELAY_MS = 200;
+
+// Tells the host the window's drawable size and the display's refresh rate
+static bool report_viewport(HostConnection& conn, SDL_Window* win) {
+    int width = 0, height = 0;
+    SDL_GetWindowSizeInPixels(win, &width, &height);
+    if (width <= 0 || height <= 0) return true;
+    const SDL_DisplayMode* mode = SDL_GetCurrentDisplayMode(SDL_GetDisplayForWindow(win));
+
+    MessageHead<ViewportInfo> head;
+    head.header.type = MSG_VIEWPORT;
+    head.info.width = (uint32_t)width;
+    head.info.height = (uint32_t)height;
+    head.info.refresh_mhz = mode ? (uint32_t)(mode->refresh_rate * 1000.0f) : 0;
+    return send_to_host(conn, head.header, sizeof(head));
+}
+
+// Logs the time from subscribing to the first picture on screen
+static void log_first_frame(bool& first_frame, std::chrono::steady_clock::time_point subscribed_at) {
+    if (!first_frame) return;
+    first_frame = false;
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - subscribed_at;
+    std::cout << "[Client] First frame " << elapsed.count() << " ms after subscribing\n";
+}
+
+// Handles window, quit and rendition keys. Number keys ask the host for
+// another simulcast rendition, applied at its next keyframe.
+static void poll_events(HostConnection& conn, SDL_Window* win, bool& running, Uint64& viewport_due) {
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        if (event.type == SDL_EVENT_QUIT) {
+            running = false;
+        } else if (event.type == SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED ||
+                   event.type == SDL_EVENT_WINDOW_DISPLAY_CHANGED) {
+            viewport_due = SDL_GetTicks() + VIEWPORT_REPORT_DELAY_MS;
+        } else if (event.type == SDL_EVENT_KEY_DOWN && !event.key.repeat &&
+                   event.key.key >= SDLK_1 && event.key.key <= SDLK_9) {
+            send_rendition(conn, MSG_RENDITION_REQUEST, (int)(event.key.key - SDLK_1));
+        }
+    }
+
+    if (viewport_due != 0 && SDL_GetTicks() >= viewport_due) {
+        viewport_due = 0;
+        report_viewport(conn, win);
+    }
+}
+
+// Streaming texture the decoded pictures are uploaded to
+struct VideoOutput {
+    SDL_Renderer* renderer = nullptr;
+    SDL_Texture* texture = nullptr;
+    int tex_w = 0;
+    int tex_h = 0;
+};
+
+// Recreates the texture when the incoming picture size changes
+static bool ensure_texture(VideoOutput& out, int width, int height) {
+    if (out.texture && out.tex_w == width && out.tex_h == height) return true;
+    SDL_Texture* created = SDL_CreateTexture(out.renderer, SDL_PIXELFORMAT_YV12,
+        SDL_TEXTUREACCESS_STREAMING, width, height);
+    if (!created) {
+        std::cerr << "SDL_CreateTexture failed: " << SDL_GetError() << "\n";
+        return false;
+    }
+    if (out.texture) SDL_DestroyTexture(out.texture);
+    out.texture = created;
+    out.tex_w = width;
+    out.tex_h = height;
+    return true;
+}
+
+static void present(VideoOutput& out) {
+    SDL_RenderClear(out.renderer);
+    SDL_RenderTexture(out.renderer, out.texture, nullptr, nullptr);
+    SDL_RenderPresent(out.renderer);
+}
+
+// Decodes one H.264 access unit. Returns false on a fatal error, `shown` is
+// set when a picture was uploaded.
+static bool show_h264_frame(AVCodecContext* codec_ctx, AVPacket* pkt, AVFrame* frame,
+    const uint8_t* data, size_t size, VideoOutput& out, bool& shown) {
+    if (av_new_packet(pkt, (int)size) < 0) return false;
+    memcpy(pkt->data, data, size);
+
+    int ret = avcodec_send_packet(codec_ctx, pkt);
+    av_packet_unref(pkt);
+    if (ret < 0) {
+        std::cerr << "Error sending packet to decoder: " << ret << "\n";
+        return false;
+    }
+
+    while (ret >= 0) {
+        ret = avcodec_receive_frame(codec_ctx, frame);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) break;
+        else if (ret < 0) {
+            std::cerr << "Error receiving frame from decoder: " << ret << "\n";
+            break;
+        }
+
+        // Switching renditions changes the picture size mid-stream
+        if (!ensure_texture(out, frame->width, frame->height)) return false;
+
+        SDL_UpdateYUVTexture(out.texture, nullptr,
+            frame->data[0], frame->linesize[0],
+            frame->data[1], frame->linesize[1],
+            frame->data[2], frame->linesize[2]);
+        shown = true;
+    }
+    return true;
+}
+
+// Decodes the collected stripes and uploads each one to its rows
+static bool show_stripes(StripeDecoderContext& stripe_dec, VideoOutput& out, bool& shown) {
+    decode_stripes(stripe_dec);
+
+    // Stripes stack top to bottom, their decoded heights give the layout
+    int frame_w = 0, frame_h = 0;
+    for (AVFrame* f : stripe_dec.frames) {
+        frame_w = f->width;
+        frame_h += f->height;
+    }
+    if (frame_w <= 0) return true;
+    if (!ensure_texture(out, frame_w, frame_h)) return false;
+
+    int y = 0;
+    for (size_t i = 0; i < stripe_dec.frames.size(); ++i) {
+        AVFrame* f = stripe_dec.frames[i];
+        if (stripe_dec.has_frame[i]) {
+            SDL_Rect rect = { 0, y, f->width, f->height };
+            SDL_UpdateYUVTexture(out.texture, &rect,
+                f->data[0], f->linesize[0],
+                f->data[1], f->linesize[1],
+                f->data[2], f->linesize[2]);
+            shown = true;
+        }
+        y += f->height;
+    }
+    return true;
+}
+
+// Applies one raw delta message and uploads only the tiles that changed
+static bool show_delta_frame(DeltaDecoder& delta_dec, const uint8_t* data, size_t size, VideoOutput& out, bool& shown) {
+    if (!decode_delta(delta_dec, data, size)) {
+        std::cerr << "[Client] Dropping undecodable delta frame\n";
+        return true;
+    }
+
+    DeltaPlanes& planes = delta_dec.frame;
+    if (!ensure_texture(out, planes.width, planes.height)) return false;
+    if (delta_dec.dirty_w > 0 && delta_dec.dirty_h > 0) {
+        const int x = delta_dec.dirty_x, y = delta_dec.dirty_y;
+        SDL_Rect rect = { x, y, delta_dec.dirty_w, delta_dec.dirty_h };
+        SDL_UpdateYUVTexture(out.texture, &rect,
+            planes.plane(0) + y * planes.stride(0) + x, planes.stride(0),
+            planes.plane(1) + (y / 2) * planes.stride(1) + x / 2, planes.stride(1),
+            planes.plane(2) + (y / 2) * planes.stride(2) + x / 2, planes.stride(2));
+    }
+    shown = true;
+    return true;
+}
+
+static uint64_t elapsed_us(uint64_t from_us, uint64_t to_us) {
+    return to_us > from_us ? to_us - from_us : 0;
+}
+
+// Adds a presented frame that was handed out at `handed_out_us`
+static void record_frame_latency(FrameLatency& latency, const RtpFrameTiming& timing, uint64_t handed_out_us,
+    uint64_t presented_us) {
+    ++latency.frames;
+    latency.spread_us += elapsed_us(timing.first_arrival_us, timing.last_arrival_us);
+    latency.socket_us += elapsed_us(timing.last_arrival_us, timing.last_received_us);
+    latency.reassembly_us += elapsed_us(timing.last_received_us, handed_out_us);
+    latency.decode_us += elapsed_us(handed_out_us, presented_us);
+    latency.total_max_us = std::max(latency.total_max_us, elapsed_us(timing.last_arrival_us, presented_us));
+}
+
+// Logs and resets the averages. The network's share is taken as half the
+// round trip, the client's own from its receive timestamps.
+static void log_frame_latency(FrameLatency& latency, uint32_t rtt_us, bool kernel_timestamps) {
+    if (latency.frames == 0) return;
+    const double frames = (double)latency.frames * 1000;
+    std::cout << std::fixed << std::setprecision(2)
+              << "[Client] Frame latency: network ~" << rtt_us / 2000.0 << " ms (half the RTT), arrival spread "
+              << latency.spread_us / frames << " ms";
+    if (kernel_timestamps) std::cout << ", socket buffer " << latency.socket_us / frames << " ms";
+    std::cout << ", reassembly " << latency.reassembly_us / frames << " ms, decode and present "
+              << latency.decode_us / frames << " ms, arrival to screen max " << latency.total_max_us / 1000.0
+              << " ms (" << latency.frames << " frames)\n";
+    std::cout.unsetf(std::ios::floatfield);
+    latency = FrameLatency();
+}
+
+// Keep-alive and round-trip measurement
+static const Uint64 PING_INTERVAL_MS = 1000;
+static const int PINGS_PER_RTT_LOG = 5;
+// Repeat of an unanswered keyframe request
+static const Uint64 KEYFRAME_REQUEST_INTERVAL_MS = 500;
+
+void start_client(const char* ip_addr,int port, const ClientOptions& options, bool& running) {
+    #ifdef _WIN32
+        WSADATA wsa;
+        WSAStartup(MAKEWORD(2, 2), &wsa);
+    #endif
+
+    #ifdef _WIN32
+        SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+        char flag = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    #else
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        int flag = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    #endif
+
+    sockaddr_in server_addr{};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    inet_pton(AF_INET, ip_addr, &server_addr.sin_addr);
+
+    if (connect(sock, (sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        std::cerr << "[Client] Connection failed\n";
+        #ifdef _WIN32
+            WSACleanup();
+        #endif
+        return;
+    }
+    std::cout << "[Client] Connected to host.\n";
+    HostConnection conn;
+    init_transport(conn.transport, sock);
+
+    const AVCodec* codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+    AVCodecContext* codec_ctx = avcodec_alloc_context3(codec);
+    if (!codec_ctx) {
+        std::cerr << "Failed to allocate codec context\n";
+        return;
+    }
+    avcodec_open2(codec_ctx, codec, nullptr);
+
+    AVFrame* frame = av_frame_alloc();
+    AVPacket* pkt = av_packet_alloc();
+
+    // === SDL3 initialization ===
+    if (!SDL_Init(SDL_INIT_VIDEO)) {
+        std::cerr << "SDL_Init Error: " << SDL_GetError() << std::endl;
+        return;
+    }
+
+    SDL_Window* win = SDL_CreateWindow("Remote Play",
+        1980, 1020, SDL_WINDOW_RESIZABLE);
+
+    if (!win) {
+        std::cerr << "SDL_CreateWindow failed: " << SDL_GetError() << "\n";
+        SDL_Quit();
+        return;
+    }
+
+    VideoOutput out;
+    out.renderer = SDL_CreateRenderer(win, nullptr);
+    if (!out.renderer) {
+        std::cerr << "SDL_CreateRenderer failed: " << SDL_GetError() << "\n";
+        SDL_DestroyWindow(win);
+        SDL_Quit();
+        return;
+    }
+
+    if (!ensure_texture(out, 1980, 1020)) {
+        SDL_DestroyRenderer(out.renderer);
+        SDL_DestroyWindow(win);
+        SDL_Quit();
+        return;
+    }
+
+    // Subscribing makes the host force an IDR, so the window and decoder are
+    // set up first. The host's STREAM_INIT reply says which codec and how many
+    // stripes to expect, plus the rendition's parameter sets.
+    const auto subscribed_at = std::chrono::steady_clock::now();
+    bool first_frame = true;
+    StreamInfo stream;
+    std::vector<uint8_t> parameter_sets;
+    uint16_t udp_port = 0;
+    init_link_emulator(conn.link, options.emulate_loss_percent, options.emulate_burst);
+    shape_link_emulator(conn.link, options.emulate_rate_kbps, options.emulate_delay_ms, EMULATED_QUEUE_MS);
+    if (options.udp && (udp_port = open_video_socket(conn)) == 0) {
+        std::cerr << "[Client] Could not open a UDP port, video stays on TCP\n";
+    }
+    if (!subscribe(conn, options.rendition, udp_port, stream, parameter_sets)) {
+        std::cerr << "[Client] Failed to subscribe\n";
+        running = false;
+    } else {
+        const bool udp = stream.video_transport == VIDEO_OVER_UDP;
+        if (udp && !start_udp_video(conn, options)) {
+            std::cerr << "[Client] Failed to wait on the UDP video socket\n";
+            running = false;
+        } else if (udp_port != 0 && !udp) {
+            std::cerr << "[Client] Host sends video over TCP\n";
+        }
+        conn.nack = udp && (uint16_t)stream.retransmit_ms > 0;
+        conn.retransmit_us = (uint16_t)stream.retransmit_ms * 1000ull;
+        conn.feedback = udp && stream.feedback;
+        conn.rtp.feedback = conn.feedback;
+        std::cout << "[Client] Stream: " << (stream.codec == CODEC_RAW_DELTA ? "raw delta" : "H.264")
+                  << ", " << (int)stream.stripe_count << " stripe(s), "
+                  << (int)stream.rendition_count << " rendition(s)"
+                  << (udp ? ", over UDP" : "") << "\n";
+        if (!parameter_sets.empty() && stream.codec == CODEC_H264 && stream.stripe_count == 1) {
+            bool shown = false;
+            show_h264_frame(codec_ctx, pkt, frame, parameter_sets.data(), parameter_sets.size(), out, shown);
+        }
+    }
+
+    StripeDecoderContext stripe_dec;
+    if (running && stream.stripe_count > 1 && !init_stripe_decoder(stream.stripe_count, stripe_dec)) {
+        std::cerr << "Failed to initialize stripe decoders\n";
+        running = false;
+    }
+    uint64_t stripe_timestamp = 0;
+
+    // The host encodes no larger than this window needs
+    Uint64 viewport_due = 0;
+    if (running && !report_viewport(conn, win)) {
+        std::cerr << "[Client] Failed to report window size\n";
+        running = false;
+    }
+
+    DeltaDecoder delta_dec;
+    MessageHeader header;
+    std::vector<uint8_t> payload;
+    Uint64 next_ping = 0;
+    // The host forces an IDR for the subscription anyway
+    Uint64 next_keyframe_request = SDL_GetTicks() + KEYFRAME_REQUEST_INTERVAL_MS;
+    Uint64 next_report = SDL_GetTicks() + RECEIVER_REPORT_INTERVAL_MS;
+    Uint64 next_feedback = SDL_GetTicks() + FEEDBACK_INTERVAL_MS;
+    Uint64 next_latency_log = SDL_GetTicks() + LATENCY_LOG_INTERVAL_MS;
+    FrameLatency latency;
+    int pongs = 0;
+    uint32_t rtt_us = DEFAULT_RTT_US;
+    if (conn.nack) set_retransmit_wait(conn, rtt_us);
+    while (running) {
+        if (!next_host_message(conn, header, payload)) {
+            std::cout << "[Client] Connection closed or error on recv\n";
+            running = false;
+            break;
+        }
+
+        if (header.type == MSG_PONG) {
+            const double rtt_ms = (protocol_timestamp_us() - header.timestamp_us) / 1000.0;
+            rtt_us = (uint32_t)(rtt_ms * 1000);
+            if (conn.nack) set_retransmit_wait(conn, rtt_us);
+            if (++pongs % PINGS_PER_RTT_LOG == 0) {
+                std::cout << "[Client] RTT " << rtt_ms << " ms\n";
+            }
+        } else if (header.type == MSG_VIDEO_FRAME) {
+            const uint64_t handed_out_us = protocol_timestamp_us();
+            const VideoFrameInfo* view = message_view<VideoFrameInfo>(payload);
+            if (!view || view->stripe_count == 0 || view->stripe_index >= view->stripe_count) {
+                std::cerr << "[Client] Malformed video frame\n";
+                continue;
+            }
+            const VideoFrameInfo& info = *view;
+            const uint8_t* data = payload.data() + sizeof(VideoFrameInfo);
+            const size_t size = payload.size() - sizeof(VideoFrameInfo);
+
+            bool ok = true;
+            bool shown = false;
+            if (info.codec == CODEC_RAW_DELTA) {
+                ok = show_delta_frame(delta_dec, data, size, out, shown);
+            } else if (info.stripe_count > 1 && info.stripe_count == stripe_dec.payloads.size()) {
+                // Stripes of one frame share its timestamp, a new timestamp
+                // drops whatever is left of an incomplete frame
+                if (header.timestamp_us != stripe_timestamp) {
+                    for (auto& stripe : stripe_dec.payloads) stripe.clear();
+                    stripe_timestamp = header.timestamp_us;
+                }
+                stripe_dec.payloads[info.stripe_index].assign(data, data + size);
+                if (info.stripe_index + 1 == info.stripe_count) {
+                    ok = show_stripes(stripe_dec, out, shown);
+                }
+            } else if (info.stripe_count == 1) {
+                ok = show_h264_frame(codec_ctx, pkt, frame, data, size, out, shown);
+            }
+            if (!ok) {
+                running = false;
+                break;
+            }
+            if (shown) {
+                present(out);
+                log_first_frame(first_frame, subscribed_at);
+                if (conn.udp) {
+                    record_frame_latency(latency, conn.rtp.delivered_timing, handed_out_us, protocol_timestamp_us());
+                }
+            }
+        }
+
+        // Poll SDL events to allow window closing
+        poll_events(conn, win, running, viewport_due);
+
+        // Frames after a lost one are skipped until a keyframe arrives
+        if (conn.udp && conn.rtp.need_keyframe && SDL_GetTicks() >= next_keyframe_request) {
+            next_keyframe_request = SDL_GetTicks() + KEYFRAME_REQUEST_INTERVAL_MS;
+            MessageHeader request;
+            request.type = MSG_KEYFRAME_REQUEST;
+            send_to_host(conn, request, sizeof(request));
+        }
+        if (conn.nack) send_nacks(conn, rtt_us);
+        if (conn.feedback && SDL_GetTicks() >= next_feedback) {
+            next_feedback = SDL_GetTicks() + FEEDBACK_INTERVAL_MS;
+            send_feedback(conn, rtt_us);
+        }
+        if (conn.udp && SDL_GetTicks() >= next_latency_log) {
+            next_latency_log = SDL_GetTicks() + LATENCY_LOG_INTERVAL_MS;
+            log_frame_latency(latency, rtt_us, conn.receiver.timestamps);
+        }
+        if (conn.udp && SDL_GetTicks() >= next_report) {
+            next_report = SDL_GetTicks() + RECEIVER_REPORT_INTERVAL_MS;
+            MessageHead<ReceiverReport> report;
+            report.header.type = MSG_RECEIVER_REPORT;
+            rtp_receiver_report(conn.rtp, report.info);
+            send_to_host(conn, report.header, sizeof(report));
+        }
+
+        if (SDL_GetTicks() >= next_ping) {
+            next_ping = SDL_GetTicks() + PING_INTERVAL_MS;
+            MessageHeader ping;
+            ping.type = MSG_PING;
+            ping.timestamp_us = protocol_timestamp_us();
+            send_to_host(conn, ping, sizeof(ping));
+        }
+    }
+
+    // Cleanup
+    if (stream.stripe_count > 1) destroy_stripe_decoder(stripe_dec);
+    SDL_DestroyTexture(out.texture);
+    SDL_DestroyRenderer(out.renderer);
+    SDL_DestroyWindow(win);
+    SDL_Quit();
+
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    avcodec_free_context(&codec_ctx);
+
+    if (conn.udp) {
+        std::cout << "[Client] UDP video: " << conn.rtp.frames_delivered << " frames decoded, "
+                  << conn.rtp.frames_lost << " lost, " << conn.rtp.frames_recovered << " repaired by FEC ("
+                  << conn.rtp.packets_recovered << " packets)\n";
+        if (conn.nack) std::cout << "[Client] NACKed " << conn.packets_nacked << " packets\n";
+        std::cout << "[Client] Received " << conn.receiver.received << " datagrams in " << conn.receiver.calls
+                  << " calls" << (conn.receiver.gro ? " with UDP_GRO" : "") << "\n";
+        if (conn.link.loss > 0) {
+            std::cout << "[Client] Emulated loss dropped " << conn.link.dropped << " datagrams\n";
+        }
+        if (link_shaped(conn.link)) {
+            std::cout << "[Client] Emulated bottleneck queue dropped " << conn.link.queue_dropped << " datagrams\n";
+        }
+        destroy_poller(conn.poller);
+    }
+    if (udp_port != 0) close_socket(conn.udp_sock);
+    close_socket(sock);
+#ifdef _WIN32
+    WSACleanup();
+#endif
 }
\ No newline at end of file
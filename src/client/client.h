@@ -1,3 +1,19 @@
-#pragma once
-
-void start_client(const char* ip_addr, int port, bool& running);
+#pragma once
+
+// Codec and stripe layout come from the host's STREAM_INIT
+struct ClientOptions {
+    int rendition = 0;  // Simulcast rendition to subscribe to
+    bool udp = false;   // Ask for video as RTP over UDP
+    bool udp_gro = true;    // Let the kernel coalesce video datagrams (UDP_GRO, Linux)
+    bool udp_timestamps = true;     // Kernel receive timestamps of video datagrams (SO_TIMESTAMPING, Linux)
+    int busy_poll_us = 0;   // Spin this long on the video socket before sleeping (SO_BUSY_POLL), 0 = off
+    // Drop this share of received video datagrams, in runs of `emulate_burst`
+    double emulate_loss_percent = 0;
+    double emulate_burst = 1;
+    // Pass received video through a bottleneck of this rate (0 = unlimited)
+    // and delay, to try congestion control
+    double emulate_rate_kbps = 0;
+    double emulate_delay_ms = 0;
+};
+
+void start_client(const char* ip_addr, int port, const ClientOptions& options, bool& running);
@@ -0,0 +1,72 @@
+#include "stripe_decoder.h"
+#include <cstring>
+#include <iostream>
+
+static void decode_stripe(StripeDecoderContext& ctx, int index) {
+    ctx.has_frame[index] = 0;
+    const std::vector<uint8_t>& payload = ctx.payloads[index];
+    if (payload.empty()) return;
+
+    AVPacket* pkt = ctx.packets[index];
+    if (av_new_packet(pkt, (int)payload.size()) < 0) return;
+    memcpy(pkt->data, payload.data(), payload.size());
+
+    int ret = avcodec_send_packet(ctx.decoders[index], pkt);
+    av_packet_unref(pkt);
+    if (ret < 0) {
+        std::cerr << "Error sending stripe " << index << " to decoder: " << ret << "\n";
+        return;
+    }
+
+    // Keep only the newest picture, stripes are presented together
+    while (avcodec_receive_frame(ctx.decoders[index], ctx.frames[index]) == 0) {
+        ctx.has_frame[index] = 1;
+    }
+}
+
+bool init_stripe_decoder(int stripe_count, StripeDecoderContext& ctx) {
+    const AVCodec* codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+    if (!codec) {
+        std::cerr << "Failed to find H.264 decoder\n";
+        return false;
+    }
+
+    for (int i = 0; i < stripe_count; ++i) {
+        AVCodecContext* codec_ctx = avcodec_alloc_context3(codec);
+        if (!codec_ctx) {
+            std::cerr << "Failed to allocate codec context\n";
+            destroy_stripe_decoder(ctx);
+            return false;
+        }
+        // One thread per stripe, frame threading would only add delay
+        codec_ctx->thread_count = 1;
+        codec_ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+        if (avcodec_open2(codec_ctx, codec, nullptr) < 0) {
+            avcodec_free_context(&codec_ctx);
+            destroy_stripe_decoder(ctx);
+            return false;
+        }
+        ctx.decoders.push_back(codec_ctx);
+        ctx.packets.push_back(av_packet_alloc());
+        ctx.frames.push_back(av_frame_alloc());
+    }
+    ctx.has_frame.assign(stripe_count, 0);
+    ctx.payloads.resize(stripe_count);
+
+    start_workers(ctx.workers, stripe_count, [&ctx](int index) { decode_stripe(ctx, index); });
+    return true;
+}
+
+void decode_stripes(StripeDecoderContext& ctx) {
+    run_workers(ctx.workers);
+}
+
+void destroy_stripe_decoder(StripeDecoderContext& ctx) {
+    stop_workers(ctx.workers);
+    for (auto& frame : ctx.frames) av_frame_free(&frame);
+    for (auto& pkt : ctx.packets) av_packet_free(&pkt);
+    for (auto& codec_ctx : ctx.decoders) avcodec_free_context(&codec_ctx);
+    ctx.frames.clear();
+    ctx.packets.clear();
+    ctx.decoders.clear();
+}
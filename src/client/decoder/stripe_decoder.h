@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include "shared/worker_group.h"
+
+// One H.264 decoder per stripe of a striped stream. Stripes of a frame are
+// decoded in parallel, each on its own thread.
+struct StripeDecoderContext {
+    std::vector<AVCodecContext*> decoders;
+    std::vector<AVPacket*> packets;
+    std::vector<AVFrame*> frames;
+    std::vector<uint8_t> has_frame;    // frames[i] holds a new picture
+    std::vector<std::vector<uint8_t>> payloads;
+    WorkerGroup workers;
+};
+
+bool init_stripe_decoder(int stripe_count, StripeDecoderContext& ctx);
+
+// Decodes ctx.payloads (one per stripe) in parallel into ctx.frames
+void decode_stripes(StripeDecoderContext& ctx);
+
+void destroy_stripe_decoder(StripeDecoderContext& ctx);
@@ -0,0 +1,82 @@
+#include "change_detector.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CHANGE_DETECTOR_SSE2 1
+#endif
+
+// SAD of one row span against the reference, storing the new bytes in place
+static uint32_t sad_and_store(const uint8_t* cur, uint8_t* ref, int len) {
+    uint32_t sad = 0;
+    int i = 0;
+#ifdef CHANGE_DETECTOR_SSE2
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(cur + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(ref + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(a, b));
+        _mm_storeu_si128((__m128i*)(ref + i), a);
+    }
+    sad = (uint32_t)(_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+#endif
+    for (; i < len; ++i) {
+        sad += (uint32_t)std::abs(cur[i] - ref[i]);
+        ref[i] = cur[i];
+    }
+    return sad;
+}
+
+void init_change_detector(ChangeDetector& detector, int width, int height, int tile_size) {
+    detector.width = width;
+    detector.height = height;
+    detector.tile_size = tile_size;
+    detector.tiles_x = (width + tile_size - 1) / tile_size;
+    detector.tiles_y = (height + tile_size - 1) / tile_size;
+    // An average difference of one level per byte, so capture noise is
+    // ignored but a blinking cursor is not
+    detector.tile_threshold = (uint32_t)(tile_size * tile_size * 4);
+    detector.previous.assign((size_t)width * height * 4, 0);
+    detector.tile_sad.assign((size_t)detector.tiles_x * detector.tiles_y, 0);
+    detector.has_previous = false;
+}
+
+int detect_changes(ChangeDetector& detector, const uint8_t* data, int linesize) {
+    const int row_bytes = detector.width * 4;
+
+    if (!detector.has_previous) {
+        for (int y = 0; y < detector.height; ++y) {
+            memcpy(&detector.previous[(size_t)y * row_bytes], data + (size_t)y * linesize, row_bytes);
+        }
+        detector.has_previous = true;
+        std::fill(detector.tile_sad.begin(), detector.tile_sad.end(), UINT32_MAX);
+        detector.total_sad = 0;
+        detector.changed_tiles = (int)detector.tile_sad.size();
+        return detector.changed_tiles;
+    }
+
+    std::fill(detector.tile_sad.begin(), detector.tile_sad.end(), 0);
+    for (int y = 0; y < detector.height; ++y) {
+        const uint8_t* cur = data + (size_t)y * linesize;
+        uint8_t* ref = &detector.previous[(size_t)y * row_bytes];
+        uint32_t* sads = &detector.tile_sad[(size_t)(y / detector.tile_size) * detector.tiles_x];
+
+        for (int tx = 0; tx < detector.tiles_x; ++tx) {
+            int x0 = tx * detector.tile_size * 4;
+            int len = std::min(detector.tile_size * 4, row_bytes - x0);
+            sads[tx] += sad_and_store(cur + x0, ref + x0, len);
+        }
+    }
+
+    int changed = 0;
+    uint64_t total = 0;
+    for (uint32_t sad : detector.tile_sad) {
+        if (sad > detector.tile_threshold) ++changed;
+        total += sad;
+    }
+    detector.total_sad = total;
+    detector.changed_tiles = changed;
+    return changed;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Tile-level change detection on captured BGRA frames. Each frame is compared
+// against the previous one with a sum of absolute differences per tile (SSE2
+// where available) and copied into the reference in the same pass.
+struct ChangeDetector {
+    int width = 0;
+    int height = 0;
+    int tile_size = 32;
+    int tiles_x = 0;
+    int tiles_y = 0;
+    uint32_t tile_threshold = 0;    // SAD above which a tile counts as changed
+    std::vector<uint8_t> previous;  // Last frame, tightly packed BGRA
+    std::vector<uint32_t> tile_sad; // Per-tile SAD of the last comparison
+    uint64_t total_sad = 0;         // Whole-frame SAD of the last comparison
+    int changed_tiles = 0;
+    bool has_previous = false;
+};
+
+void init_change_detector(ChangeDetector& detector, int width, int height, int tile_size = 32);
+
+// Compares `data` against the previous frame and keeps it as the new
+// reference. Returns the number of changed tiles (all of them on the first call).
+int detect_changes(ChangeDetector& detector, const uint8_t* data, int linesize);
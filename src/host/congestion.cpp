@@ -0,0 +1,351 @@
+#include "congestion.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Sent packets remembered until their feedback, about 1.5 s at 20 Mbit/s
+static const size_t SENT_HISTORY = 4096;
+// Packets sent within this long of a group's first one join the group
+static const uint64_t GROUP_SPAN_US = 5000;
+// Trendline (section 5.4 of the draft, as in WebRTC's estimator)
+static const size_t TREND_WINDOW = 20;
+static const double TREND_SMOOTHING = 0.9;
+static const double TREND_GAIN = 4.0;
+static const double OVERUSE_TIME_MS = 10.0;
+static const double THRESHOLD_UP = 0.0087;
+static const double THRESHOLD_DOWN = 0.039;
+static const double THRESHOLD_MIN_MS = 6.0;
+static const double THRESHOLD_MAX_MS = 600.0;
+// The lowest one-way delay of two epochs is the path's delay without a queue
+static const uint64_t BASE_DELAY_EPOCH_US = 5000000;
+static const uint64_t RECEIVE_WINDOW_US = 500000;
+// AIMD
+static const double DECREASE_FACTOR = 0.85;
+static const double INCREASE_PER_SECOND = 1.08;
+static const double MAX_RECEIVED_RATIO = 1.5;   // Climbs no further ahead of what gets through
+static const uint64_t MIN_DECREASE_INTERVAL_US = 100000;
+static const double HIGH_LOSS = 0.10;
+static const double LOW_LOSS = 0.02;
+static const double PACKET_BITS = 1200 * 8;
+// TCP: kernel counters are polled this often
+static const uint64_t TCP_POLL_INTERVAL_US = 100000;
+static const double TCP_DELIVERED_SMOOTHING = 0.7;
+static const double TCP_LOSS_SMOOTHING = 0.9;
+// Per poll; the kernel's rate samples swing widely, their recent maximum is
+// the path's rate
+static const double TCP_CAPACITY_DECAY = 0.95;
+static const double TCP_FAST_INCREASE_PER_SECOND = 1.15;
+static const double TCP_SLOW_INCREASE_PER_SECOND = 1.03;
+static const uint64_t TCP_MIN_DECREASE_INTERVAL_US = 300000;
+
+void init_congestion_controller(CongestionController& cc, int start_bitrate, int min_bitrate, int max_bitrate,
+    uint64_t queue_target_us) {
+    cc = CongestionController();
+    cc.min_bitrate = min_bitrate;
+    cc.max_bitrate = std::max(max_bitrate, min_bitrate);
+    cc.target = std::min(std::max(start_bitrate, cc.min_bitrate), cc.max_bitrate);
+    cc.queue_target_us = queue_target_us;
+    cc.sent.resize(SENT_HISTORY);
+}
+
+void congestion_packet_sent(CongestionController& cc, uint16_t sequence, size_t size, uint64_t send_us) {
+    if (cc.sent.empty()) return;
+    CongestionPacket& packet = cc.sent[sequence % cc.sent.size()];
+    packet.sequence = sequence;
+    packet.size = (uint16_t)std::min(size, (size_t)UINT16_MAX);
+    packet.send_us = send_us;
+}
+
+// Adapts the threshold to the trend's usual swing, so a path with jittery
+// delay does not look overused all the time and a calm one reacts early
+static void update_threshold(CongestionController& cc, double modified_trend, uint64_t now_us) {
+    if (cc.threshold_updated_us == 0) cc.threshold_updated_us = now_us;
+    const double magnitude = std::fabs(modified_trend);
+    // A spike far above the threshold is a delay jump, not noise to adapt to
+    if (magnitude > cc.threshold_ms + 15) {
+        cc.threshold_updated_us = now_us;
+        return;
+    }
+    const double k = magnitude < cc.threshold_ms ? THRESHOLD_DOWN : THRESHOLD_UP;
+    const double elapsed_ms = std::min((now_us - cc.threshold_updated_us) / 1000.0, 100.0);
+    cc.threshold_ms += k * (magnitude - cc.threshold_ms) * elapsed_ms;
+    cc.threshold_ms = std::min(std::max(cc.threshold_ms, THRESHOLD_MIN_MS), THRESHOLD_MAX_MS);
+    cc.threshold_updated_us = now_us;
+}
+
+// Overuse needs the trend above the threshold for a while and still rising
+static void detect_usage(CongestionController& cc, double send_delta_ms, uint64_t arrival_us) {
+    if (cc.deltas < 2) return;
+    const double modified = std::min(cc.deltas, 60) * cc.trend * TREND_GAIN;
+    if (modified > cc.threshold_ms) {
+        cc.overuse_ms = cc.overuse_ms < 0 ? send_delta_ms / 2 : cc.overuse_ms + send_delta_ms;
+        ++cc.overuse_count;
+        if (cc.overuse_ms > OVERUSE_TIME_MS && cc.overuse_count > 1 && cc.trend >= cc.previous_trend) {
+            cc.overuse_ms = 0;
+            cc.overuse_count = 0;
+            cc.usage = LinkUsage::OVERUSE;
+        }
+    } else {
+        cc.overuse_ms = -1;
+        cc.overuse_count = 0;
+        cc.usage = modified < -cc.threshold_ms ? LinkUsage::UNDERUSE : LinkUsage::NORMAL;
+    }
+    cc.previous_trend = cc.trend;
+    update_threshold(cc, modified, arrival_us);
+}
+
+// Least squares slope of smoothed accumulated delay over arrival time
+static void update_trend(CongestionController& cc, double delay_delta_ms, double send_delta_ms, uint64_t arrival_us) {
+    cc.deltas = std::min(cc.deltas + 1, 1000);
+    cc.accumulated_delay_ms += delay_delta_ms;
+    cc.smoothed_delay_ms = TREND_SMOOTHING * cc.smoothed_delay_ms + (1 - TREND_SMOOTHING) * cc.accumulated_delay_ms;
+    cc.trend_samples.emplace_back((arrival_us - cc.first_arrival_us) / 1000.0, cc.smoothed_delay_ms);
+    if (cc.trend_samples.size() > TREND_WINDOW) cc.trend_samples.pop_front();
+
+    if (cc.trend_samples.size() == TREND_WINDOW) {
+        double mean_x = 0, mean_y = 0;
+        for (const auto& sample : cc.trend_samples) {
+            mean_x += sample.first;
+            mean_y += sample.second;
+        }
+        mean_x /= TREND_WINDOW;
+        mean_y /= TREND_WINDOW;
+        double numerator = 0, denominator = 0;
+        for (const auto& sample : cc.trend_samples) {
+            numerator += (sample.first - mean_x) * (sample.second - mean_y);
+            denominator += (sample.first - mean_x) * (sample.first - mean_x);
+        }
+        if (denominator != 0) cc.trend = numerator / denominator;
+    }
+    detect_usage(cc, send_delta_ms, arrival_us);
+}
+
+// Adds a packet to the current group. A packet sent past the group's span
+// closes it, and the closed group's delay against the one before feeds the
+// trend.
+static void add_to_group(CongestionController& cc, uint64_t send_us, uint64_t arrival_us) {
+    CongestionGroup& group = cc.group;
+    if (group.valid && send_us < group.first_send_us) return;     // Reordered
+    if (group.valid && send_us - group.first_send_us <= GROUP_SPAN_US) {
+        group.last_send_us = std::max(group.last_send_us, send_us);
+        group.last_arrival_us = std::max(group.last_arrival_us, arrival_us);
+        return;
+    }
+
+    if (group.valid && cc.previous_group.valid) {
+        const CongestionGroup& previous = cc.previous_group;
+        const double send_delta_ms = ((int64_t)group.last_send_us - (int64_t)previous.last_send_us) / 1000.0;
+        const double arrival_delta_ms = ((int64_t)group.last_arrival_us - (int64_t)previous.last_arrival_us) / 1000.0;
+        if (cc.first_arrival_us == 0) cc.first_arrival_us = group.last_arrival_us;
+        update_trend(cc, arrival_delta_ms - send_delta_ms, send_delta_ms, group.last_arrival_us);
+    }
+    if (group.valid) cc.previous_group = group;
+    group.valid = true;
+    group.first_send_us = send_us;
+    group.last_send_us = send_us;
+    group.last_arrival_us = arrival_us;
+}
+
+// Tracks the lowest one-way delay of the current and previous epoch, the
+// clocks' offset included; it cancels out of the queueing delay
+static void update_queue_delay(CongestionController& cc, uint64_t send_us, uint64_t arrival_us) {
+    const int64_t one_way_us = (int64_t)(arrival_us - send_us);
+    if (cc.epoch_start_us == 0) cc.epoch_start_us = arrival_us;
+    if (arrival_us - cc.epoch_start_us > BASE_DELAY_EPOCH_US) {
+        cc.previous_epoch_min_us = cc.epoch_min_us;
+        cc.epoch_min_us = INT64_MAX;
+        cc.epoch_start_us = arrival_us;
+    }
+    cc.epoch_min_us = std::min(cc.epoch_min_us, one_way_us);
+    cc.base_delay_us = std::min(cc.epoch_min_us, cc.previous_epoch_min_us);
+    cc.feedback_min_queue_us = std::min(cc.feedback_min_queue_us, one_way_us - cc.base_delay_us);
+}
+
+static void update_received(CongestionController& cc, uint64_t arrival_us, uint32_t size) {
+    cc.received.emplace_back(arrival_us, size);
+    cc.received_bytes += size;
+    while (arrival_us - cc.received.front().first > RECEIVE_WINDOW_US) {
+        cc.received_bytes -= cc.received.front().second;
+        cc.received.pop_front();
+    }
+    const uint64_t span_us = arrival_us - cc.received.front().first;
+    if (span_us >= RECEIVE_WINDOW_US / 2) {
+        cc.received_bitrate = (cc.received_bytes - cc.received.front().second) * 8 * 1e6 / span_us;
+    }
+}
+
+void congestion_packet_arrived(CongestionController& cc, uint16_t sequence, uint64_t arrival_us) {
+    if (cc.sent.empty()) return;
+    CongestionPacket& packet = cc.sent[sequence % cc.sent.size()];
+    if (packet.send_us == 0 || packet.sequence != sequence) return;
+    const uint64_t send_us = packet.send_us;
+    packet.send_us = 0;
+    cc.feedback_sent_us = std::max(cc.feedback_sent_us, send_us);
+
+    update_received(cc, arrival_us, packet.size);
+    update_queue_delay(cc, send_us, arrival_us);
+    add_to_group(cc, send_us, arrival_us);
+}
+
+// Spread of the received rate at overuse, as WebRTC keeps it: a variance
+// normalized by the estimate in kbit/s
+static double capacity_deviation(const CongestionController& cc) {
+    return std::sqrt(cc.capacity_variance * cc.capacity / 1000) * 1000;
+}
+
+static int clamp_target(CongestionController& cc) {
+    cc.target = std::min(std::max(cc.target, (double)cc.min_bitrate), (double)cc.max_bitrate);
+    return (int)cc.target;
+}
+
+// Cuts to a share of the target, or of what got through when that is less.
+// Cutting every flow by the same share of its own rate is what lets flows
+// sharing a link converge to equal shares. Packets sent before the last cut
+// still show the old rate, so the next cut waits for feedback on later
+// ones, which takes a round trip plus whatever the queue holds.
+static void decrease_rate(CongestionController& cc, uint64_t now_us) {
+    if (cc.decreased_us != 0 && (cc.feedback_sent_us <= cc.decreased_us ||
+                                 now_us - cc.decreased_us < MIN_DECREASE_INTERVAL_US)) {
+        return;
+    }
+    const double through = cc.received_bitrate > 0 ? std::min(cc.received_bitrate, cc.target) : cc.target;
+    cc.target = DECREASE_FACTOR * through;
+    // The rate that overused is the best guess at the link's capacity. One
+    // well below the estimate means the link got slower.
+    if (cc.received_bitrate > 0) {
+        const double kbps = cc.received_bitrate / 1000;
+        if (cc.capacity > 0 && cc.received_bitrate < cc.capacity - 3 * capacity_deviation(cc)) cc.capacity = 0;
+        if (cc.capacity == 0) {
+            cc.capacity = cc.received_bitrate;
+        } else {
+            const double estimate = cc.capacity / 1000;
+            cc.capacity_variance = 0.95 * cc.capacity_variance + 0.05 * (kbps - estimate) * (kbps - estimate) / estimate;
+            cc.capacity_variance = std::min(std::max(cc.capacity_variance, 0.4), 2.5);
+            cc.capacity = 0.95 * cc.capacity + 0.05 * cc.received_bitrate;
+        }
+    }
+    cc.decreased_us = now_us;
+    cc.increasing = false;
+    ++cc.decreases;
+}
+
+// About a packet per response time once overuse showed where the capacity
+// is, multiplicative before that and once the rate passes it
+static void increase_rate(CongestionController& cc, uint64_t now_us) {
+    const double elapsed = std::min((now_us - cc.updated_us) / 1e6, 1.0);
+    if (cc.capacity > 0 && cc.target > cc.capacity + 3 * capacity_deviation(cc)) cc.capacity = 0;  // The link got faster
+
+    double increased;
+    if (cc.capacity > 0) {
+        const double response_s = (cc.rtt_us + 100000) / 1e6;
+        increased = cc.target + std::max(4000.0, PACKET_BITS / response_s) * elapsed;
+    } else {
+        increased = cc.target * std::pow(INCREASE_PER_SECOND, elapsed);
+    }
+    // Encoders undershoot on easy content; a target far above what actually
+    // goes out would overshoot the link once the content gets hard
+    if (cc.received_bitrate > 0) {
+        const double limit = MAX_RECEIVED_RATIO * cc.received_bitrate + 10000;
+        if (increased > limit) increased = std::max(cc.target, limit);
+    }
+    cc.target = increased;
+}
+
+int congestion_update(CongestionController& cc, uint64_t rtt_us, uint64_t now_us) {
+    cc.rtt_us = rtt_us;
+    if (cc.updated_us == 0) cc.updated_us = now_us;
+    // Even the least delayed packet waited past the target and the queue is
+    // not draining yet, e.g. from the last cut
+    bool standing_queue = false;
+    if (cc.feedback_min_queue_us != INT64_MAX) {
+        const uint64_t queue_us = (uint64_t)std::max(cc.feedback_min_queue_us, (int64_t)0);
+        standing_queue = queue_us > cc.queue_target_us && queue_us >= cc.queue_delay_us;
+        cc.queue_delay_us = queue_us;
+    }
+    cc.feedback_min_queue_us = INT64_MAX;
+
+    if (cc.usage == LinkUsage::OVERUSE || standing_queue) {
+        decrease_rate(cc, now_us);
+    } else if (cc.usage == LinkUsage::UNDERUSE) {
+        // The queue drains, the rate that emptied it is kept
+        cc.increasing = false;
+    } else if (!cc.increasing) {
+        cc.increasing = true;
+    } else if (cc.loss <= LOW_LOSS) {
+        increase_rate(cc, now_us);
+    }
+    cc.updated_us = now_us;
+    return clamp_target(cc);
+}
+
+int congestion_report_loss(CongestionController& cc, double loss, uint64_t now_us) {
+    cc.loss = loss;
+    if (loss > HIGH_LOSS) {
+        cc.target *= 1 - 0.5 * loss;
+        cc.decreased_us = now_us;
+        ++cc.decreases;
+    }
+    return clamp_target(cc);
+}
+
+void init_tcp_rate_controller(TcpRateController& rc, int start_bitrate, int min_bitrate, int max_bitrate,
+    uint64_t queue_target_us) {
+    rc = TcpRateController();
+    rc.min_bitrate = min_bitrate;
+    rc.max_bitrate = std::max(max_bitrate, min_bitrate);
+    rc.target = std::min(std::max(start_bitrate, rc.min_bitrate), rc.max_bitrate);
+    rc.queue_target_us = queue_target_us;
+}
+
+bool tcp_rate_due(const TcpRateController& rc, uint64_t now_us) {
+    return rc.polled_us == 0 || now_us - rc.polled_us >= TCP_POLL_INTERVAL_US;
+}
+
+int tcp_rate_update(TcpRateController& rc, const TcpPathInfo& info, uint64_t backlog_bytes, uint64_t now_us) {
+    if (rc.polled_us == 0 || info.bytes_acked < rc.bytes_acked) {
+        rc.polled_us = now_us;
+        rc.bytes_acked = info.bytes_acked;
+        rc.bytes_retransmitted = info.bytes_retransmitted;
+        return (int)rc.target;
+    }
+    const double elapsed = (now_us - rc.polled_us) / 1e6;
+    const uint64_t acked = info.bytes_acked - rc.bytes_acked;
+    const uint64_t retransmitted = info.bytes_retransmitted - std::min(rc.bytes_retransmitted, info.bytes_retransmitted);
+    const double delivered = acked * 8 / std::max(elapsed, 1e-3);
+    rc.delivered = rc.delivered > 0 ? TCP_DELIVERED_SMOOTHING * rc.delivered + (1 - TCP_DELIVERED_SMOOTHING) * delivered
+                                    : delivered;
+    const double loss = acked > 0 ? std::min((double)retransmitted / acked, 1.0) : 0;
+    rc.loss = TCP_LOSS_SMOOTHING * rc.loss + (1 - TCP_LOSS_SMOOTHING) * loss;
+    rc.polled_us = now_us;
+    rc.bytes_acked = info.bytes_acked;
+    rc.bytes_retransmitted = info.bytes_retransmitted;
+    // Only a sender that kept the path busy measures its rate
+    if (info.delivery_rate > 0 && !info.app_limited) {
+        rc.capacity = std::max((double)info.delivery_rate, TCP_CAPACITY_DECAY * rc.capacity);
+    }
+
+    // What waits to be sent drains at the rate acknowledgments come back
+    const uint64_t rtt_queue_us = info.min_rtt_us > 0 && info.rtt_us > info.min_rtt_us ? info.rtt_us - info.min_rtt_us : 0;
+    const uint64_t waiting = backlog_bytes + (uint64_t)std::max<int64_t>(info.unsent_bytes, 0);
+    const double drain_rate = std::max({ rc.delivered, rc.capacity, (double)rc.min_bitrate });
+    const uint64_t queue_delay_us = rtt_queue_us + (uint64_t)(waiting * 8 * 1e6 / drain_rate);
+    // The smoothed RTT lags, a queue already draining from the last cut
+    // needs no further one
+    const bool standing_queue = queue_delay_us > rc.queue_target_us && queue_delay_us >= rc.queue_delay_us;
+    rc.queue_delay_us = queue_delay_us;
+
+    if (standing_queue || rc.loss > LOW_LOSS) {
+        if (rc.decreased_us == 0 || now_us - rc.decreased_us >= TCP_MIN_DECREASE_INTERVAL_US) {
+            if (info.delivery_rate == 0) rc.capacity = rc.delivered;
+            rc.target = DECREASE_FACTOR * std::min(rc.target, rc.delivered);
+            rc.decreased_us = now_us;
+            ++rc.decreases;
+        }
+    } else if (queue_delay_us < rc.queue_target_us / 2) {
+        const bool below_capacity = rc.capacity == 0 || rc.target < DECREASE_FACTOR * rc.capacity;
+        rc.target *= std::pow(below_capacity ? TCP_FAST_INCREASE_PER_SECOND : TCP_SLOW_INCREASE_PER_SECOND,
+                              std::min(elapsed, 1.0));
+    }
+    rc.target = std::min(std::max(rc.target, (double)rc.min_bitrate), (double)rc.max_bitrate);
+    return (int)rc.target;
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+#include "shared/socket.h"
+
+// Sender-side bitrate control for one UDP viewer, after Google Congestion
+// Control (draft-ietf-rmcat-gcc-02). The client reports when each video
+// packet arrived. Packets sent within a few milliseconds of each other form
+// a group, and a trendline over how much later each group arrives than it
+// was sent tells whether the bottleneck queue is filling (overuse), draining
+// (underuse) or steady. The rate follows AIMD: a multiplicative climb until
+// overuse shows where the link's capacity is, an additive one from then on,
+// and a cut to 85% of the target (or of what got through, if less) on
+// overuse.
+//
+// The gradient only sees a queue grow. A queue standing more than
+// `queue_target_us` above the lowest one-way delay seen recently counts as
+// overuse too, which bounds the delay the controller can settle on. Loss
+// above 10% cuts the rate, loss above 2% stops it from climbing.
+
+// Queueing delay UDP viewers' controllers let stand at the bottleneck
+const uint64_t CONGESTION_QUEUE_TARGET_US = 25'000;
+
+// Bandwidth usage seen by the delay trend
+enum class LinkUsage : uint8_t { NORMAL, OVERUSE, UNDERUSE };
+
+// A sent video packet waiting for its feedback
+struct CongestionPacket {
+    uint16_t sequence = 0;
+    uint16_t size = 0;
+    uint64_t send_us = 0;           // 0 = free slot
+};
+
+// Packets sent close together, whose last arrival is compared with the
+// previous group's
+struct CongestionGroup {
+    bool valid = false;
+    uint64_t first_send_us = 0;
+    uint64_t last_send_us = 0;
+    uint64_t last_arrival_us = 0;
+};
+
+struct CongestionController {
+    int min_bitrate = 0;
+    int max_bitrate = 0;
+    double target = 0;                  // Send rate, bits per second
+    uint64_t queue_target_us = 0;
+    std::vector<CongestionPacket> sent; // Ring indexed by sequence number
+    // Delay gradient
+    CongestionGroup group;
+    CongestionGroup previous_group;
+    uint64_t first_arrival_us = 0;
+    double accumulated_delay_ms = 0;
+    double smoothed_delay_ms = 0;
+    std::deque<std::pair<double, double>> trend_samples;    // Arrival ms, smoothed delay ms
+    int deltas = 0;
+    double trend = 0;
+    double previous_trend = 0;
+    double threshold_ms = 12.5;         // Adapts to how noisy the path's delay is
+    double overuse_ms = -1;             // How long the trend has been above the threshold
+    int overuse_count = 0;
+    uint64_t threshold_updated_us = 0;
+    LinkUsage usage = LinkUsage::NORMAL;
+    // Queueing delay: one-way delay above the lowest of the last two epochs
+    int64_t base_delay_us = INT64_MAX;
+    int64_t epoch_min_us = INT64_MAX;
+    int64_t previous_epoch_min_us = INT64_MAX;
+    uint64_t epoch_start_us = 0;
+    int64_t feedback_min_queue_us = INT64_MAX;   // Lowest in the current feedback
+    uint64_t queue_delay_us = 0;        // ... of the last feedback
+    // Rate that got through, over the last RECEIVE_WINDOW
+    std::deque<std::pair<uint64_t, uint32_t>> received;     // Arrival, bytes
+    uint64_t received_bytes = 0;
+    double received_bitrate = 0;        // 0 until the window has filled
+    // AIMD
+    bool increasing = false;            // After a cut, holds until the trend is normal again
+    uint64_t updated_us = 0;
+    uint64_t decreased_us = 0;
+    uint64_t feedback_sent_us = 0;      // Latest send time any feedback covered
+    double capacity = 0;                // Received rate at recent overuse, 0 = unknown
+    double capacity_variance = 0.4;
+    double loss = 0;
+    uint64_t rtt_us = 0;
+    uint64_t decreases = 0;
+};
+
+// Starts at `start_bitrate` within [min_bitrate, max_bitrate]
+void init_congestion_controller(CongestionController& cc, int start_bitrate, int min_bitrate, int max_bitrate,
+    uint64_t queue_target_us);
+
+// Records a video packet as it leaves
+void congestion_packet_sent(CongestionController& cc, uint16_t sequence, size_t size, uint64_t send_us);
+
+// Feeds one packet's arrival time from a TRANSPORT_FEEDBACK. Call
+// congestion_update after the last one of a message.
+void congestion_packet_arrived(CongestionController& cc, uint16_t sequence, uint64_t arrival_us);
+
+// Moves the target after a feedback message. Returns the new target.
+int congestion_update(CongestionController& cc, uint64_t rtt_us, uint64_t now_us);
+
+// Folds the loss fraction of a receiver report in. Returns the new target.
+int congestion_report_loss(CongestionController& cc, double loss, uint64_t now_us);
+
+// Bitrate for a viewer whose video goes over TCP, from the kernel's view of
+// the connection (tcp_path_info) polled every 100 ms. The kernel's own
+// congestion control decides how fast bytes leave. The encoder only has to
+// stay below that, or frames pile up in the socket and in front of it. The
+// queue counts both: RTT above the minimum, plus the bytes not sent yet at
+// the rate acknowledgments come back. A queue above `queue_target_us` that is
+// not draining, or retransmissions above 2% of the acknowledged bytes, cut
+// the rate to 85% of what was delivered. Below half the target it climbs:
+// quickly up to 85% of the path's rate and slowly past it. The path's rate is
+// the recent peak of the kernel's delivery rate samples taken while the
+// sender kept it busy (Linux), elsewhere the rate at the last cut.
+struct TcpRateController {
+    int min_bitrate = 0;
+    int max_bitrate = 0;
+    double target = 0;                  // Bits per second
+    uint64_t queue_target_us = 0;
+    uint64_t polled_us = 0;
+    uint64_t bytes_acked = 0;           // At the last poll
+    uint64_t bytes_retransmitted = 0;
+    double delivered = 0;               // Smoothed acknowledged rate, bits per second
+    double capacity = 0;                // Path rate when the sender kept it busy, 0 = unknown
+    double loss = 0;                    // Smoothed share of bytes retransmitted
+    uint64_t queue_delay_us = 0;        // At the last poll
+    uint64_t decreased_us = 0;
+    uint64_t decreases = 0;
+};
+
+// Starts at `start_bitrate` within [min_bitrate, max_bitrate]
+void init_tcp_rate_controller(TcpRateController& rc, int start_bitrate, int min_bitrate, int max_bitrate,
+    uint64_t queue_target_us);
+
+// Whether the next poll is due at `now_us`
+bool tcp_rate_due(const TcpRateController& rc, uint64_t now_us);
+
+// Moves the target after a poll. `backlog_bytes` is what waits for the
+// socket in the sender's own queue. Returns the new target.
+int tcp_rate_update(TcpRateController& rc, const TcpPathInfo& info, uint64_t backlog_bytes, uint64_t now_us);
@@ -0,0 +1,79 @@
+#include "content_analyzer.h"
+
+// Frames a new class has to hold before the encoder is retuned
+static const int CLASS_HOLD_FRAMES = 30;
+
+const char* content_class_name(ContentClass cls) {
+    switch (cls) {
+        case ContentClass::STATIC_2D: return "static-2d";
+        case ContentClass::FMV: return "fmv";
+        case ContentClass::GAMEPLAY_3D: return "gameplay-3d";
+        default: return "unknown";
+    }
+}
+
+static ContentClass classify(const ContentStats& stats) {
+    // Menus and 2D screens only update parts of the image
+    if (stats.changed_fraction < 0.35f) return ContentClass::STATIC_2D;
+    // Full-frame change: decoded video moves smoothly between frames while
+    // 3D gameplay with camera motion differs a lot more per pixel
+    if (stats.mean_abs_diff < 8.0f) return ContentClass::FMV;
+    return ContentClass::GAMEPLAY_3D;
+}
+
+bool analyze_content(ContentAnalyzer& analyzer, const ChangeDetector& detector, ContentStats& stats) {
+    const size_t tiles = detector.tile_sad.size();
+    const double channels = (double)detector.width * detector.height * 3;
+
+    stats.changed_fraction = tiles ? (float)detector.changed_tiles / tiles : 0.0f;
+    stats.mean_abs_diff = channels > 0 ? (float)(detector.total_sad / channels) : 0.0f;
+
+    // A cut replaces almost every tile with a jump far above the recent motion
+    stats.scene_cut = analyzer.has_average && stats.changed_fraction > 0.9f &&
+        stats.mean_abs_diff > 20.0f && stats.mean_abs_diff > analyzer.average_diff * 3.0f;
+
+    analyzer.average_diff = analyzer.has_average ? analyzer.average_diff * 0.9f + stats.mean_abs_diff * 0.1f : stats.mean_abs_diff;
+    analyzer.has_average = true;
+
+    ContentClass cls = classify(stats);
+    if (cls == analyzer.current) {
+        analyzer.candidate_frames = 0;
+        return false;
+    }
+
+    if (cls != analyzer.candidate) {
+        analyzer.candidate = cls;
+        analyzer.candidate_frames = 0;
+    }
+    // The frame right after a cut is not representative yet, but the cut
+    // itself is the cheapest point to switch since it costs an IDR anyway
+    if (++analyzer.candidate_frames >= CLASS_HOLD_FRAMES || stats.scene_cut) {
+        analyzer.current = cls;
+        analyzer.candidate_frames = 0;
+        return true;
+    }
+    return false;
+}
+
+void apply_content_tuning(EncoderSettings& settings, ContentClass cls) {
+    switch (cls) {
+        case ContentClass::STATIC_2D:
+            // Sharp text and flat colors, worth low QPs since few blocks change
+            settings.x264_tune = "animation,zerolatency";
+            settings.qmin = 10;
+            settings.qmax = 36;
+            break;
+        case ContentClass::FMV:
+            // Already compressed video, extra bits mostly reproduce its artifacts
+            settings.x264_tune = "film,zerolatency";
+            settings.qmin = 18;
+            settings.qmax = 42;
+            break;
+        case ContentClass::GAMEPLAY_3D:
+        default:
+            settings.x264_tune = "zerolatency";
+            settings.qmin = 16;
+            settings.qmax = 45;
+            break;
+    }
+}
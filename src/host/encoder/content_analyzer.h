@@ -0,0 +1,38 @@
+#pragma once
+
+#include "encoder.h"
+#include "host/capture/change_detector.h"
+
+// Rough content classes of PS2 output, each with its own encoder tuning
+enum class ContentClass {
+    STATIC_2D,      // Menus, 2D screens, HUD-only updates
+    FMV,            // Pre-rendered cutscenes: full-frame, smooth motion
+    GAMEPLAY_3D,    // Full-frame, fast motion
+};
+
+const char* content_class_name(ContentClass cls);
+
+// Per-frame statistics taken from the change detection pass that runs on the
+// captured image right before color conversion, so they cost no extra pass
+struct ContentStats {
+    float changed_fraction = 0.0f;  // Share of tiles that changed
+    float mean_abs_diff = 0.0f;     // Average per-channel difference
+    bool scene_cut = false;
+};
+
+struct ContentAnalyzer {
+    ContentClass current = ContentClass::GAMEPLAY_3D;
+    ContentClass candidate = ContentClass::GAMEPLAY_3D;
+    int candidate_frames = 0;
+    float average_diff = 0.0f;      // Running average of mean_abs_diff
+    bool has_average = false;
+};
+
+// Updates the classification with the detector's last comparison. Returns
+// true when the content class changed; scene cuts switch immediately, other
+// changes need the new class to hold for about a second.
+bool analyze_content(ContentAnalyzer& analyzer, const ChangeDetector& detector, ContentStats& stats);
+
+// Applies the tune/QP range of `cls` on top of the base settings. Only
+// libx264 uses them, the hardware encoders keep their rate control.
+void apply_content_tuning(EncoderSettings& settings, ContentClass cls);
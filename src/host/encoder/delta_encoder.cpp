@@ -0,0 +1,49 @@
+#include "delta_encoder.h"
+#include <iostream>
+
+bool init_delta_encoder(const EncoderSettings& settings, DeltaEncoderContext& ctx) {
+    ctx.sws_ctx = sws_getContext(settings.width, settings.height, settings.input_format,
+                                 settings.width, settings.height, AV_PIX_FMT_YUV420P,
+                                 SWS_POINT, nullptr, nullptr, nullptr);
+    if (!ctx.sws_ctx) {
+        std::cerr << "[Encoder] Failed to initialize sws context\n";
+        return false;
+    }
+
+    ctx.frame = av_frame_alloc();
+    if (!ctx.frame) {
+        destroy_delta_encoder(ctx);
+        return false;
+    }
+    ctx.frame->format = AV_PIX_FMT_YUV420P;
+    ctx.frame->width = settings.width;
+    ctx.frame->height = settings.height;
+    if (av_frame_get_buffer(ctx.frame, 32) < 0) {
+        std::cerr << "[Encoder] Failed to allocate frame buffer\n";
+        destroy_delta_encoder(ctx);
+        return false;
+    }
+
+    ctx.delta.force_keyframe = true;
+    std::cout << "[Encoder] Using raw delta mode (LZ4)\n";
+    return true;
+}
+
+bool encode_delta_frame(DeltaEncoderContext& ctx, const uint8_t* data, int linesize) {
+    const uint8_t* inData[1] = { data };
+    int inLinesize[1] = { linesize };
+    sws_scale(ctx.sws_ctx, inData, inLinesize, 0, ctx.frame->height, ctx.frame->data, ctx.frame->linesize);
+
+    const uint8_t* planes[3] = { ctx.frame->data[0], ctx.frame->data[1], ctx.frame->data[2] };
+    return encode_delta(ctx.delta, ctx.frame->width, ctx.frame->height, planes, ctx.frame->linesize, ctx.output);
+}
+
+void destroy_delta_encoder(DeltaEncoderContext& ctx) {
+    if (ctx.frame) {
+        av_frame_free(&ctx.frame);
+    }
+    if (ctx.sws_ctx) {
+        sws_freeContext(ctx.sws_ctx);
+        ctx.sws_ctx = nullptr;
+    }
+}
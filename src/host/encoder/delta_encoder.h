@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "encoder.h"
+#include "shared/delta_codec.h"
+
+// LAN "raw delta" mode: the captured frame is converted to YUV420P as for
+// H.264, then sent as LZ4-compressed tile XOR deltas (see shared/delta_codec.h)
+// instead of going through an encoder.
+struct DeltaEncoderContext {
+    SwsContext* sws_ctx = nullptr;
+    AVFrame* frame = nullptr;
+    DeltaEncoder delta;
+    std::vector<uint8_t> output;    // Message for the last frame
+};
+
+bool init_delta_encoder(const EncoderSettings& settings, DeltaEncoderContext& ctx);
+
+bool encode_delta_frame(DeltaEncoderContext& ctx, const uint8_t* data, int linesize);
+
+void destroy_delta_encoder(DeltaEncoderContext& ctx);
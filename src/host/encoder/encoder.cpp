@@ -1,188 +1,270 @@
-#include "encoder.h"
-#include <iostream>
-
-extern "C" {
-#include <libavutil/opt.h>
-#include <libavutil/imgutils.h>
-}
-
-static const char* encoder_name(EncoderType type) {
-    switch (type) {
-        case EncoderType::NVENC: return "h264_nvenc";
-        case EncoderType::QSV:   return "h264_qsv";
-        case EncoderType::AMF:   return "h264_amf";
-        case EncoderType::SOFTWARE: return "libx264";
-        default: return nullptr;
-    }
-}
-
-static bool try_encoder(EncoderType type, const EncoderSettings& settings, EncoderContext& ctx) {
-    const char* name = encoder_name(type);
-    if (!name) return false;
-
-    ctx.codec = avcodec_find_encoder_by_name(name);
-    if (!ctx.codec) return false;
-
-    ctx.codec_ctx = avcodec_alloc_context3(ctx.codec);
-    if (!ctx.codec_ctx) return false;
-
-    ctx.codec_ctx->width = settings.width;
-    ctx.codec_ctx->height = settings.height;
-    ctx.codec_ctx->time_base = {1, settings.fps};
-    ctx.codec_ctx->framerate = {settings.fps, 1};
-    ctx.codec_ctx->bit_rate = settings.bitrate;
-    ctx.codec_ctx->gop_size = 10;
-    ctx.codec_ctx->max_b_frames = 1;
-    ctx.codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
-
-    // Encoder-specific tuning
-    if (type == EncoderType::SOFTWARE) {
-        av_opt_set(ctx.codec_ctx->priv_data, "preset", "ultrafast", 0);
-        av_opt_set(ctx.codec_ctx->priv_data, "tune", "zerolatency", 0);
-    } else if (type == EncoderType::NVENC) {
-        av_opt_set(ctx.codec_ctx->priv_data, "preset", "llhp", 0);  // low-latency high performance
-    }
-
-    if (avcodec_open2(ctx.codec_ctx, ctx.codec, nullptr) < 0) {
-        avcodec_free_context(&ctx.codec_ctx);
-        return false;
-    }
-
-    ctx.sws_ctx = sws_getContext(settings.width, settings.height, settings.input_format,
-                                 settings.width, settings.height, AV_PIX_FMT_YUV420P,
-                                 SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
-    if (!ctx.sws_ctx) {
-        avcodec_free_context(&ctx.codec_ctx);
-        return false;
-    }
-
-    ctx.frame = av_frame_alloc();
-    ctx.frame->format = AV_PIX_FMT_YUV420P;
-    ctx.frame->width = settings.width;
-    ctx.frame->height = settings.height;
-    av_frame_get_buffer(ctx.frame, 32);
-
-    ctx.pkt = av_packet_alloc();
-    ctx.input_format = settings.input_format;
-
-    return true;
-}
-
-void print_available_encoders() {
-    void* iter = nullptr;
-    std::cout << "Available encoders at runtime:\n";
-    while (const AVCodec* codec = av_codec_iterate(&iter)) {
-        if (av_codec_is_encoder(codec)) {
-            std::cout << " - " << codec->name << "\n";
-        }
-    }
-}
-
-bool init_encoder(const EncoderSettings& settings, EncoderContext& ctx) {
-    // Find codec by preferred encoder type
-    const char* codec_name = nullptr;
-    switch (settings.preferred) {
-        case EncoderType::NVENC: codec_name = "h264_nvenc"; break;
-        case EncoderType::QSV: codec_name = "h264_qsv"; break;
-        case EncoderType::AMF: codec_name = "h264_amf"; break;
-        default: codec_name = nullptr; break;
-    }
-
-    if (codec_name)
-        ctx.codec = avcodec_find_encoder_by_name(codec_name);
-    else
-        ctx.codec = avcodec_find_encoder(AV_CODEC_ID_H264);
-    std::cout << "[Encoder] Using encoder: " << ctx.codec->name << "\n";
-
-    if (!ctx.codec) {
-        std::cerr << "[Encoder] Failed to find encoder\n";
-        return false;
-    }
-
-    ctx.codec_ctx = avcodec_alloc_context3(ctx.codec);
-    if (!ctx.codec_ctx) {
-        std::cerr << "[Encoder] Failed to allocate codec context\n";
-        return false;
-    }
-
-    ctx.codec_ctx->width = settings.width;
-    ctx.codec_ctx->height = settings.height;
-    ctx.codec_ctx->time_base = AVRational{1, settings.fps};
-    ctx.codec_ctx->framerate = AVRational{settings.fps, 1};
-    ctx.codec_ctx->bit_rate = settings.bitrate;
-    ctx.codec_ctx->gop_size = 10;
-    ctx.codec_ctx->max_b_frames = 1;
-    ctx.codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
-
-    if (codec_name == "h264_nvenc") {
-        av_opt_set(ctx.codec_ctx->priv_data, "preset", "p7", 0);            // slowest (best quality)
-        av_opt_set(ctx.codec_ctx->priv_data, "tune", "lossless", 0);        // Lossless
-        av_opt_set(ctx.codec_ctx->priv_data, "delay", "0", 0);              // Delay frame output by the given amount of frames (from 0 to INT_MAX)
-        av_opt_set(ctx.codec_ctx->priv_data, "rc", "cbr", 0);               // Constant bitrate mode
-        av_opt_set(ctx.codec_ctx->priv_data, "zerolatency", "1", 0);        // Set 1 to indicate zero latency operation (no reordering delay)
-        av_opt_set(ctx.codec_ctx->priv_data, "gpu", "0", 0);                // first GPU (optional)
-        av_opt_set(ctx.codec_ctx->priv_data, "rc-lookahead", "0", 0);       // reduce latency by disabling lookahead
-        av_opt_set(ctx.codec_ctx->priv_data, "bufsize", "24000000", 0);     // buffer size matching bitrate (optional)
-    }
-    else if (codec_name == "h264_qsv") {
-        av_opt_set(ctx.codec_ctx->priv_data, "preset", "fast", 0);
-        av_opt_set(ctx.codec_ctx->priv_data, "async_depth", "1", 0);
-    }
-    else if (codec_name == "h264_amf") {
-        av_opt_set(ctx.codec_ctx->priv_data, "usage", "realtime", 0);
-        av_opt_set(ctx.codec_ctx->priv_data, "profile", "main", 0);
-    }
-    else if (codec_name == "libx264") {
-        av_opt_set(ctx.codec_ctx->priv_data, "preset", "ultrafast", 0);
-        av_opt_set(ctx.codec_ctx->priv_data, "tune", "zerolatency", 0);
-    }
-
-    if (avcodec_open2(ctx.codec_ctx, ctx.codec, nullptr) < 0) {
-        std::cerr << "[Encoder] Failed to open codec\n";
-        avcodec_free_context(&ctx.codec_ctx);
-        return false;
-    }
-
-    // Initialize sws context here with input pixel format from settings
-    ctx.input_format = settings.input_format;
-    ctx.sws_ctx = sws_getContext(settings.width, settings.height, ctx.input_format,
-                                 settings.width, settings.height, AV_PIX_FMT_YUV420P,
-                                 SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
-    if (!ctx.sws_ctx) {
-        std::cerr << "[Encoder] Failed to initialize sws context\n";
-        avcodec_free_context(&ctx.codec_ctx);
-        return false;
-    }
-
-    ctx.frame = av_frame_alloc();
-    ctx.pkt = av_packet_alloc();
-    if (!ctx.frame || !ctx.pkt) {
-        std::cerr << "[Encoder] Failed to allocate frame or packet\n";
-        destroy_encoder(ctx);
-        return false;
-    }
-
-    ctx.frame->format = AV_PIX_FMT_YUV420P;
-    ctx.frame->width = settings.width;
-    ctx.frame->height = settings.height;
-    if (av_frame_get_buffer(ctx.frame, 32) < 0) {
-        std::cerr << "[Encoder] Failed to allocate frame buffer\n";
-        destroy_encoder(ctx);
-        return false;
-    }
-
-    return true;
-}
-
-void destroy_encoder(EncoderContext& ctx) {
-    if (ctx.frame) {
-        av_frame_free(&ctx.frame);
-    }
-    if (ctx.pkt) {
-        av_packet_free(&ctx.pkt);
-    }
-    if (ctx.codec_ctx) {
-        avcodec_free_context(&ctx.codec_ctx);
-    }
-    ctx.codec = nullptr;
-}
+#include "encoder.h"
+#include <iostream>
+#include <string>
+
+#include "temporal_layers.h"
+
+extern "C" {
+#include <libavutil/opt.h>
+#include <libavutil/imgutils.h>
+}
+
+static const char* encoder_name(EncoderType type) {
+    switch (type) {
+        case EncoderType::NVENC: return "h264_nvenc";
+        case EncoderType::QSV:   return "h264_qsv";
+        case EncoderType::AMF:   return "h264_amf";
+        case EncoderType::SOFTWARE: return "libx264";
+        default: return nullptr;
+    }
+}
+
+static bool try_encoder(EncoderType type, const EncoderSettings& settings, EncoderContext& ctx) {
+    const char* name = encoder_name(type);
+    if (!name) return false;
+
+    ctx.codec = avcodec_find_encoder_by_name(name);
+    if (!ctx.codec) return false;
+
+    ctx.codec_ctx = avcodec_alloc_context3(ctx.codec);
+    if (!ctx.codec_ctx) return false;
+
+    ctx.codec_ctx->width = settings.width;
+    ctx.codec_ctx->height = settings.height;
+    ctx.codec_ctx->time_base = {1, settings.fps};
+    ctx.codec_ctx->framerate = {settings.fps, 1};
+    ctx.codec_ctx->bit_rate = settings.bitrate;
+    ctx.codec_ctx->gop_size = 10;
+    ctx.codec_ctx->max_b_frames = 1;
+    ctx.codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+
+    // Encoder-specific tuning
+    if (type == EncoderType::SOFTWARE) {
+        av_opt_set(ctx.codec_ctx->priv_data, "preset", "ultrafast", 0);
+        av_opt_set(ctx.codec_ctx->priv_data, "tune", "zerolatency", 0);
+    } else if (type == EncoderType::NVENC) {
+        av_opt_set(ctx.codec_ctx->priv_data, "preset", "llhp", 0);  // low-latency high performance
+    }
+
+    if (avcodec_open2(ctx.codec_ctx, ctx.codec, nullptr) < 0) {
+        avcodec_free_context(&ctx.codec_ctx);
+        return false;
+    }
+
+    ctx.sws_ctx = sws_getContext(settings.width, settings.height, settings.input_format,
+                                 settings.width, settings.height, AV_PIX_FMT_YUV420P,
+                                 SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+    if (!ctx.sws_ctx) {
+        avcodec_free_context(&ctx.codec_ctx);
+        return false;
+    }
+
+    ctx.frame = av_frame_alloc();
+    ctx.frame->format = AV_PIX_FMT_YUV420P;
+    ctx.frame->width = settings.width;
+    ctx.frame->height = settings.height;
+    av_frame_get_buffer(ctx.frame, 32);
+
+    ctx.pkt = av_packet_alloc();
+    ctx.input_format = settings.input_format;
+
+    return true;
+}
+
+void print_available_encoders() {
+    void* iter = nullptr;
+    std::cout << "Available encoders at runtime:\n";
+    while (const AVCodec* codec = av_codec_iterate(&iter)) {
+        if (av_codec_is_encoder(codec)) {
+            std::cout << " - " << codec->name << "\n";
+        }
+    }
+}
+
+bool init_encoder(const EncoderSettings& settings, EncoderContext& ctx) {
+    // Find codec by preferred encoder type
+    const char* codec_name = nullptr;
+    switch (settings.preferred) {
+        case EncoderType::NVENC: codec_name = "h264_nvenc"; break;
+        case EncoderType::QSV: codec_name = "h264_qsv"; break;
+        case EncoderType::AMF: codec_name = "h264_amf"; break;
+        default: codec_name = nullptr; break;
+    }
+
+    if (codec_name)
+        ctx.codec = avcodec_find_encoder_by_name(codec_name);
+    else
+        ctx.codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+    std::cout << "[Encoder] Using encoder: " << ctx.codec->name << "\n";
+
+    if (!ctx.codec) {
+        std::cerr << "[Encoder] Failed to find encoder\n";
+        return false;
+    }
+
+    ctx.codec_ctx = avcodec_alloc_context3(ctx.codec);
+    if (!ctx.codec_ctx) {
+        std::cerr << "[Encoder] Failed to allocate codec context\n";
+        return false;
+    }
+
+    ctx.codec_ctx->width = settings.width;
+    ctx.codec_ctx->height = settings.height;
+    ctx.codec_ctx->time_base = AVRational{1, settings.fps};
+    ctx.codec_ctx->framerate = AVRational{settings.fps, 1};
+    ctx.codec_ctx->bit_rate = settings.bitrate;
+    ctx.codec_ctx->gop_size = settings.gop_size;
+    ctx.codec_ctx->max_b_frames = settings.max_b_frames;
+    ctx.codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    ctx.codec_ctx->thread_count = settings.thread_count;
+
+    // Compare against the codec actually found, libx264 is picked through the
+    // generic H.264 lookup so codec_name is null for it
+    const std::string name = ctx.codec->name;
+    // Keyframe requests must produce IDRs so new viewers can start decoding
+    if (name == "libx264" || name == "h264_nvenc") {
+        av_opt_set(ctx.codec_ctx->priv_data, "forced-idr", "1", 0);
+    }
+
+    if (name == "h264_nvenc") {
+        av_opt_set(ctx.codec_ctx->priv_data, "preset", "p7", 0);            // slowest (best quality)
+        av_opt_set(ctx.codec_ctx->priv_data, "tune", "lossless", 0);        // Lossless
+        av_opt_set(ctx.codec_ctx->priv_data, "delay", "0", 0);              // Delay frame output by the given amount of frames (from 0 to INT_MAX)
+        av_opt_set(ctx.codec_ctx->priv_data, "rc", "cbr", 0);               // Constant bitrate mode
+        av_opt_set(ctx.codec_ctx->priv_data, "zerolatency", "1", 0);        // Set 1 to indicate zero latency operation (no reordering delay)
+        av_opt_set(ctx.codec_ctx->priv_data, "gpu", "0", 0);                // first GPU (optional)
+        av_opt_set(ctx.codec_ctx->priv_data, "rc-lookahead", "0", 0);       // reduce latency by disabling lookahead
+        av_opt_set(ctx.codec_ctx->priv_data, "bufsize", "24000000", 0);     // buffer size matching bitrate (optional)
+    }
+    else if (name == "h264_qsv") {
+        av_opt_set(ctx.codec_ctx->priv_data, "preset", "fast", 0);
+        av_opt_set(ctx.codec_ctx->priv_data, "async_depth", "1", 0);
+    }
+    else if (name == "h264_amf") {
+        av_opt_set(ctx.codec_ctx->priv_data, "usage", "realtime", 0);
+        av_opt_set(ctx.codec_ctx->priv_data, "profile", "main", 0);
+    }
+    else if (name == "libx264") {
+        av_opt_set(ctx.codec_ctx->priv_data, "preset", "ultrafast", 0);
+        av_opt_set(ctx.codec_ctx->priv_data, "tune", settings.x264_tune, 0);
+        // The hardware encoders run CBR, a QP range there would override
+        // their rate control rather than steer it
+        if (settings.qmin >= 0) ctx.codec_ctx->qmin = settings.qmin;
+        if (settings.qmax >= 0) ctx.codec_ctx->qmax = settings.qmax;
+    }
+
+    // Temporal layers map onto a fixed B-frame pattern with non-reference
+    // frames in the top layer, see temporal_layers.h
+    if (settings.temporal_layers > 1) {
+        const int layers = settings.temporal_layers < MAX_TEMPORAL_LAYERS ? settings.temporal_layers : MAX_TEMPORAL_LAYERS;
+        ctx.codec_ctx->max_b_frames = (1 << (layers - 1)) - 1;
+        if (name == "libx264") {
+            av_opt_set(ctx.codec_ctx->priv_data, "b-pyramid", layers > 2 ? "strict" : "none", 0);
+            av_opt_set(ctx.codec_ctx->priv_data, "x264-params", "b-adapt=0", 0);   // fixed pattern
+        } else if (name == "h264_nvenc") {
+            av_opt_set(ctx.codec_ctx->priv_data, "b_ref_mode", layers > 2 ? "middle" : "disabled", 0);
+        } else {
+            std::cerr << "[Encoder] " << name << " has no fixed B-frame pattern, temporal layers may not be decodable on their own\n";
+        }
+    }
+
+    if (avcodec_open2(ctx.codec_ctx, ctx.codec, nullptr) < 0) {
+        std::cerr << "[Encoder] Failed to open codec\n";
+        avcodec_free_context(&ctx.codec_ctx);
+        return false;
+    }
+
+    // Initialize sws context here with input pixel format from settings
+    ctx.input_format = settings.input_format;
+    const int src_width = settings.src_width > 0 ? settings.src_width : settings.width;
+    const int src_height = settings.src_height > 0 ? settings.src_height : settings.height;
+    ctx.sws_ctx = sws_getContext(src_width, src_height, ctx.input_format,
+                                 settings.width, settings.height, AV_PIX_FMT_YUV420P,
+                                 SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+    if (!ctx.sws_ctx) {
+        std::cerr << "[Encoder] Failed to initialize sws context\n";
+        avcodec_free_context(&ctx.codec_ctx);
+        return false;
+    }
+
+    ctx.frame = av_frame_alloc();
+    ctx.pkt = av_packet_alloc();
+    if (!ctx.frame || !ctx.pkt) {
+        std::cerr << "[Encoder] Failed to allocate frame or packet\n";
+        destroy_encoder(ctx);
+        return false;
+    }
+
+    ctx.frame->format = AV_PIX_FMT_YUV420P;
+    ctx.frame->width = settings.width;
+    ctx.frame->height = settings.height;
+    if (av_frame_get_buffer(ctx.frame, 32) < 0) {
+        std::cerr << "[Encoder] Failed to allocate frame buffer\n";
+        destroy_encoder(ctx);
+        return false;
+    }
+
+    return true;
+}
+
+bool reopen_encoder(EncoderContext& ctx, const EncoderSettings& settings) {
+    destroy_encoder(ctx);
+    ctx = EncoderContext();
+    return init_encoder(settings, ctx);
+}
+
+bool takes_content_tuning(const EncoderContext& ctx) {
+    return ctx.codec && std::string(ctx.codec->name) == "libx264";
+}
+
+void request_keyframe(EncoderContext& ctx) {
+    ctx.force_keyframe = true;
+}
+
+void set_encoder_bitrate(EncoderContext& ctx, int bitrate) {
+    if (!ctx.codec_ctx) return;
+    // The wrappers compare these with what the encoder was configured with
+    // before every frame and reconfigure it in place when they differ
+    ctx.codec_ctx->bit_rate = bitrate;
+    if (ctx.codec_ctx->rc_max_rate > 0) ctx.codec_ctx->rc_max_rate = bitrate;
+}
+
+int encoder_bitrate(const EncoderContext& ctx) {
+    return ctx.codec_ctx ? (int)ctx.codec_ctx->bit_rate : 0;
+}
+
+int send_encoder_frame(EncoderContext& ctx, AVFrame* frame) {
+    if (!ctx.force_keyframe) {
+        return avcodec_send_frame(ctx.codec_ctx, frame);
+    }
+
+    if (!ctx.keyframe_ref) ctx.keyframe_ref = av_frame_alloc();
+    if (!ctx.keyframe_ref || av_frame_ref(ctx.keyframe_ref, frame) < 0) {
+        return avcodec_send_frame(ctx.codec_ctx, frame);
+    }
+    ctx.keyframe_ref->pict_type = AV_PICTURE_TYPE_I;
+    int ret = avcodec_send_frame(ctx.codec_ctx, ctx.keyframe_ref);
+    av_frame_unref(ctx.keyframe_ref);
+    if (ret >= 0) ctx.force_keyframe = false;
+    return ret;
+}
+
+void destroy_encoder(EncoderContext& ctx) {
+    if (ctx.keyframe_ref) {
+        av_frame_free(&ctx.keyframe_ref);
+    }
+    if (ctx.frame) {
+        av_frame_free(&ctx.frame);
+    }
+    if (ctx.pkt) {
+        av_packet_free(&ctx.pkt);
+    }
+    if (ctx.codec_ctx) {
+        avcodec_free_context(&ctx.codec_ctx);
+    }
+    if (ctx.sws_ctx) {
+        sws_freeContext(ctx.sws_ctx);
+        ctx.sws_ctx = nullptr;
+    }
+    ctx.codec = nullptr;
+}
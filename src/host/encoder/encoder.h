@@ -1,39 +1,75 @@
-#pragma once
-
-extern "C" {
-#include <libavcodec/avcodec.h>
-#include <libswscale/swscale.h>
-}
-
-// Encoder backend types
-enum class EncoderType {
-    NVENC,
-    QSV,
-    AMF,
-    SOFTWARE
-};
-
-struct EncoderSettings {
-    int width = 1280;
-    int height = 720;
-    int fps = 30;
-    int bitrate = 400000;
-    EncoderType preferred = EncoderType::NVENC;
-    AVPixelFormat input_format = AV_PIX_FMT_BGRA;
-};
-
-struct EncoderContext {
-    const AVCodec* codec = nullptr;
-    AVCodecContext* codec_ctx = nullptr;
-    SwsContext* sws_ctx = nullptr;
-    AVFrame* frame = nullptr;
-    AVPacket* pkt = nullptr;
-    AVPixelFormat input_format = AV_PIX_FMT_BGRA;
-    int frame_index = 0;
-};
-
-// Initializes and returns an encoder context
-bool init_encoder(const EncoderSettings& settings, EncoderContext& ctx);
-
-// Frees encoder context
-void destroy_encoder(EncoderContext& ctx);
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+// Encoder backend types
+enum class EncoderType {
+    NVENC,
+    QSV,
+    AMF,
+    SOFTWARE
+};
+
+struct EncoderSettings {
+    int width = 1280;
+    int height = 720;
+    int fps = 30;
+    int bitrate = 400000;
+    EncoderType preferred = EncoderType::NVENC;
+    AVPixelFormat input_format = AV_PIX_FMT_BGRA;
+    int gop_size = 10;
+    int max_b_frames = 1;
+    int thread_count = 0;   // 0 lets the encoder pick
+    int temporal_layers = 1;    // 1-3, see temporal_layers.h
+    int src_width = 0;      // Size of the scaler input, 0 = same as the output
+    int src_height = 0;
+    // Content tuning, only libx264 takes it (see takes_content_tuning)
+    const char* x264_tune = "zerolatency";
+    int qmin = -1;          // QP range, -1 keeps the encoder default
+    int qmax = -1;
+};
+
+struct EncoderContext {
+    const AVCodec* codec = nullptr;
+    AVCodecContext* codec_ctx = nullptr;
+    SwsContext* sws_ctx = nullptr;
+    AVFrame* frame = nullptr;
+    AVPacket* pkt = nullptr;
+    AVPixelFormat input_format = AV_PIX_FMT_BGRA;
+    int frame_index = 0;
+    bool force_keyframe = false;        // Next frame is encoded as an IDR
+    AVFrame* keyframe_ref = nullptr;    // Scratch reference used to tag that frame
+};
+
+// Initializes and returns an encoder context
+bool init_encoder(const EncoderSettings& settings, EncoderContext& ctx);
+
+// Closes and reopens the encoder with new settings, the first frame after
+// this is an IDR
+bool reopen_encoder(EncoderContext& ctx, const EncoderSettings& settings);
+
+// Whether x264_tune and the QP range change anything for this encoder. The
+// tune is a libx264 option and FFmpeg applies neither live, so a new tuning
+// needs a reopen.
+bool takes_content_tuning(const EncoderContext& ctx);
+
+// Asks for the next encoded frame to be an IDR
+void request_keyframe(EncoderContext& ctx);
+
+// Retargets a running encoder without reopening it. libx264, NVENC and QSV
+// pick the new rate up at the next frame; other encoders keep encoding at
+// the old one until they are reopened.
+void set_encoder_bitrate(EncoderContext& ctx, int bitrate);
+
+// Rate the encoder currently aims for
+int encoder_bitrate(const EncoderContext& ctx);
+
+// Sends `frame` to the encoder, as an IDR if one was requested. The frame
+// itself is left untouched so it can be shared between encoders.
+int send_encoder_frame(EncoderContext& ctx, AVFrame* frame);
+
+// Frees encoder context
+void destroy_encoder(EncoderContext& ctx);
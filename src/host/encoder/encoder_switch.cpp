@@ -0,0 +1,35 @@
+#include "encoder_switch.h"
+#include <iostream>
+
+void start_encoder_switch(EncoderSwitch& sw, const EncoderSettings& settings) {
+    sw.ready = false;
+    sw.ok = false;
+    sw.settings = settings;
+    sw.encoder = EncoderContext();
+    sw.thread = std::thread([&sw]() {
+        sw.ok = init_encoder(sw.settings, sw.encoder);
+        sw.ready = true;
+    });
+}
+
+bool encoder_switch_in_progress(const EncoderSwitch& sw) {
+    return sw.thread.joinable();
+}
+
+bool finish_encoder_switch(EncoderSwitch& sw) {
+    if (!sw.thread.joinable() || !sw.ready) return false;
+    sw.thread.join();
+    if (!sw.ok) {
+        std::cerr << "[Encoder] Failed to open " << sw.settings.width << "x" << sw.settings.height
+                  << "@" << sw.settings.fps << "\n";
+        destroy_encoder(sw.encoder);
+        return false;
+    }
+    return true;
+}
+
+void cancel_encoder_switch(EncoderSwitch& sw) {
+    if (!sw.thread.joinable()) return;
+    sw.thread.join();
+    destroy_encoder(sw.encoder);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#include "encoder.h"
+
+// Opens an encoder with new settings on its own thread so the running one
+// keeps encoding meanwhile. Once it is ready, switching is a swap plus the new
+// encoder's first IDR, however long the open itself took.
+struct EncoderSwitch {
+    std::thread thread;
+    std::atomic<bool> ready{ false };
+    bool ok = false;
+    EncoderSettings settings;
+    EncoderContext encoder;
+};
+
+void start_encoder_switch(EncoderSwitch& sw, const EncoderSettings& settings);
+
+bool encoder_switch_in_progress(const EncoderSwitch& sw);
+
+// Joins a finished switch. Returns false while it is still opening or when
+// it failed; on success sw.encoder holds the new encoder.
+bool finish_encoder_switch(EncoderSwitch& sw);
+
+// Waits for an outstanding switch and frees whatever it opened
+void cancel_encoder_switch(EncoderSwitch& sw);
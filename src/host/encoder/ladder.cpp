@@ -0,0 +1,76 @@
+#include "ladder.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// Frames in a row that have to miss or beat the budget before the step moves
+static const int SLOW_FRAMES_TO_STEP_DOWN = 10;
+static const int FAST_FRAMES_TO_STEP_UP = 300;
+
+static double pixel_rate(const LadderStep& step) {
+    return (double)step.width * step.height * step.fps;
+}
+
+void init_ladder(RenditionLadder& ladder, const std::vector<LadderStep>& steps,
+    int capture_width, int capture_height, int bitrate) {
+    ladder.steps.clear();
+    ladder.bitrate = bitrate;
+    for (LadderStep step : steps) {
+        step.width = std::min(step.width, capture_width) & ~1;
+        step.height = std::min(step.height, capture_height) & ~1;
+        if (step.width <= 0 || step.height <= 0 || step.fps <= 0) continue;
+        ladder.steps.push_back(step);
+    }
+    ladder.current = 0;
+    ladder.slow_frames = 0;
+    ladder.fast_frames = 0;
+
+    for (const LadderStep& step : ladder.steps) {
+        std::cout << "[Host] Ladder step: " << step.width << "x" << step.height << "@" << step.fps << "\n";
+    }
+}
+
+int update_ladder(RenditionLadder& ladder, double busy_seconds) {
+    if (ladder.steps.size() < 2) return -1;
+
+    const LadderStep& current = ladder.steps[ladder.current];
+    const double interval = 1.0 / current.fps;
+
+    if (busy_seconds > interval * 0.9) {
+        ladder.fast_frames = 0;
+        if (++ladder.slow_frames >= SLOW_FRAMES_TO_STEP_DOWN && ladder.current + 1 < (int)ladder.steps.size()) {
+            ladder.slow_frames = 0;
+            return ladder.current + 1;
+        }
+        return -1;
+    }
+    ladder.slow_frames = 0;
+
+    if (ladder.current == 0) return -1;
+
+    // Work grows roughly with the pixel rate, so predict the cost of the step above
+    const LadderStep& up = ladder.steps[ladder.current - 1];
+    const double predicted = busy_seconds * pixel_rate(up) / pixel_rate(current);
+    if (predicted < (1.0 / up.fps) * 0.6) {
+        if (++ladder.fast_frames >= FAST_FRAMES_TO_STEP_UP) {
+            ladder.fast_frames = 0;
+            return ladder.current - 1;
+        }
+    } else {
+        ladder.fast_frames = 0;
+    }
+    return -1;
+}
+
+EncoderSettings ladder_step_settings(const RenditionLadder& ladder, int step, const EncoderSettings& base) {
+    const LadderStep& top = ladder.steps[0];
+    const LadderStep& target = ladder.steps[step];
+
+    EncoderSettings settings = base;
+    settings.width = target.width;
+    settings.height = target.height;
+    settings.fps = target.fps;
+    // Smaller pictures need more bits per pixel, so scale by the square root
+    settings.bitrate = (int)(ladder.bitrate * std::sqrt(pixel_rate(target) / pixel_rate(top)));
+    return settings;
+}
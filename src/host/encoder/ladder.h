@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+
+#include "encoder.h"
+
+// Resolution / frame-rate ladder for the primary stream, e.g.
+// 1080p60 -> 720p60 -> 720p30 -> 540p30. The host steps down while encoding
+// and sending a frame does not fit the frame interval and steps back up once
+// the higher step is predicted to fit comfortably.
+struct LadderStep {
+    int width = 0;
+    int height = 0;
+    int fps = 30;
+};
+
+struct RenditionLadder {
+    std::vector<LadderStep> steps;  // Best first
+    int bitrate = 0;                // Of the first step
+    int current = 0;
+    int slow_frames = 0;
+    int fast_frames = 0;
+};
+
+// Clamps `steps` to the capture size (keeping even dimensions) and starts on the first one
+void init_ladder(RenditionLadder& ladder, const std::vector<LadderStep>& steps,
+    int capture_width, int capture_height, int bitrate);
+
+// Feeds the time the last frame spent encoding and sending. Returns the step
+// to switch to, or -1 to stay.
+int update_ladder(RenditionLadder& ladder, double busy_seconds);
+
+// `base` retargeted to `step`, the first step's bitrate scaled with the pixel rate
+EncoderSettings ladder_step_settings(const RenditionLadder& ladder, int step, const EncoderSettings& base);
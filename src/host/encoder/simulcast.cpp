@@ -0,0 +1,117 @@
+#include "simulcast.h"
+#include <iostream>
+#include <utility>
+
+static void receive_packets(EncoderContext& enc, std::vector<AVPacket*>& packets) {
+    while (avcodec_receive_packet(enc.codec_ctx, enc.pkt) == 0) {
+        AVPacket* out = av_packet_alloc();
+        av_packet_move_ref(out, enc.pkt);
+        packets.push_back(out);
+    }
+}
+
+static void encode_rendition(SimulcastContext& ctx, int index) {
+    EncoderContext& enc = ctx.encoders[index];
+    AVFrame* primary = ctx.encoders[0].frame;
+    AVFrame* frame = enc.frame;
+
+    if (ctx.shares_primary[index]) {
+        frame = primary;
+    } else if (index > 0) {
+        if (av_frame_make_writable(frame) < 0) return;
+        sws_scale(enc.sws_ctx, primary->data, primary->linesize, 0, primary->height, frame->data, frame->linesize);
+        frame->pts = primary->pts;
+    }
+
+    if (send_encoder_frame(enc, frame) < 0) return;
+    receive_packets(enc, ctx.packets[index]);
+}
+
+bool init_simulcast(const std::vector<EncoderSettings>& renditions, SimulcastContext& ctx) {
+    if (renditions.empty()) return false;
+
+    const EncoderSettings& primary = renditions[0];
+    ctx.settings = renditions;
+    ctx.encoders.resize(renditions.size());
+    ctx.shares_primary.assign(renditions.size(), false);
+    ctx.packets.resize(renditions.size());
+
+    for (size_t i = 0; i < renditions.size(); ++i) {
+        EncoderSettings& settings = ctx.settings[i];
+        if (i > 0) {
+            // Secondary renditions scale from the primary YUV frame
+            settings.input_format = AV_PIX_FMT_YUV420P;
+            settings.src_width = primary.width;
+            settings.src_height = primary.height;
+            ctx.shares_primary[i] = settings.width == primary.width && settings.height == primary.height;
+        }
+
+        if (!init_encoder(settings, ctx.encoders[i])) {
+            std::cerr << "[Encoder] Failed to initialize rendition " << i << "\n";
+            destroy_simulcast(ctx);
+            return false;
+        }
+        std::cout << "[Encoder] Rendition " << i << ": " << settings.width << "x" << settings.height
+                  << " @ " << settings.bitrate / 1000 << " kbps\n";
+    }
+
+    if (renditions.size() > 1) {
+        start_workers(ctx.workers, (int)renditions.size(), [&ctx](int index) { encode_rendition(ctx, index); });
+    }
+    return true;
+}
+
+void encode_simulcast(SimulcastContext& ctx, const uint8_t* data, int linesize, int64_t pts) {
+    EncoderContext& primary = ctx.encoders[0];
+    if (av_frame_make_writable(primary.frame) < 0) return;
+
+    const uint8_t* inData[1] = { data };
+    int inLinesize[1] = { linesize };
+    sws_scale(primary.sws_ctx, inData, inLinesize, 0, primary.codec_ctx->height, primary.frame->data, primary.frame->linesize);
+    primary.frame->pts = pts;
+
+    if (ctx.encoders.size() > 1) {
+        run_workers(ctx.workers);
+    } else {
+        encode_rendition(ctx, 0);
+    }
+}
+
+void swap_primary_encoder(SimulcastContext& ctx, EncoderContext& encoder, EncoderSettings& settings) {
+    // Frames the old encoder still holds back for B-frames or lookahead
+    EncoderContext& old = ctx.encoders[0];
+    if (avcodec_send_frame(old.codec_ctx, nullptr) == 0) receive_packets(old, ctx.packets[0]);
+    std::swap(ctx.encoders[0], encoder);
+    std::swap(ctx.settings[0], settings);
+}
+
+void release_simulcast_packets(SimulcastContext& ctx) {
+    for (auto& packets : ctx.packets) {
+        for (auto& pkt : packets) av_packet_free(&pkt);
+        packets.clear();
+    }
+}
+
+void request_simulcast_keyframe(SimulcastContext& ctx, int rendition) {
+    for (size_t i = 0; i < ctx.encoders.size(); ++i) {
+        if (rendition < 0 || (int)i == rendition) request_keyframe(ctx.encoders[i]);
+    }
+}
+
+bool simulcast_keyframe_pending(const SimulcastContext& ctx) {
+    for (const auto& enc : ctx.encoders) {
+        if (enc.force_keyframe) return true;
+    }
+    return false;
+}
+
+void destroy_simulcast(SimulcastContext& ctx) {
+    stop_workers(ctx.workers);
+    release_simulcast_packets(ctx);
+    for (auto& enc : ctx.encoders) {
+        destroy_encoder(enc);
+    }
+    ctx.encoders.clear();
+    ctx.settings.clear();
+    ctx.packets.clear();
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "encoder.h"
+#include "shared/worker_group.h"
+
+// Encodes one captured frame into several renditions (resolution/bitrate
+// pairs). Rendition 0 is the primary one and the only one converted from the
+// captured BGRA image; the others reuse its YUV frame directly when the size
+// matches or downscale from it, which is much cheaper than a second
+// BGRA -> YUV conversion. A single rendition is plain single-stream encoding.
+struct SimulcastContext {
+    std::vector<EncoderSettings> settings;    // As opened, secondary ones read the primary frame
+    std::vector<EncoderContext> encoders;
+    std::vector<bool> shares_primary;     // Encodes rendition 0's frame as is
+    std::vector<std::vector<AVPacket*>> packets;    // Output of the last frame, per rendition
+    WorkerGroup workers;
+};
+
+// `renditions[0]` must describe the captured size, the others are scaled from it
+bool init_simulcast(const std::vector<EncoderSettings>& renditions, SimulcastContext& ctx);
+
+// Converts one captured frame and encodes it on every rendition in parallel,
+// output packets are left in ctx.packets until release_simulcast_packets
+void encode_simulcast(SimulcastContext& ctx, const uint8_t* data, int linesize, int64_t pts);
+
+// Exchanges the primary encoder for one opened elsewhere (single rendition
+// only); `encoder` and `settings` receive the old ones. The old encoder is
+// drained first, its last packets lead ctx.packets[0] ahead of the new
+// encoder's output.
+void swap_primary_encoder(SimulcastContext& ctx, EncoderContext& encoder, EncoderSettings& settings);
+
+void release_simulcast_packets(SimulcastContext& ctx);
+
+// Requests an IDR on one rendition, or on all of them with -1
+void request_simulcast_keyframe(SimulcastContext& ctx, int rendition = -1);
+
+bool simulcast_keyframe_pending(const SimulcastContext& ctx);
+
+void destroy_simulcast(SimulcastContext& ctx);
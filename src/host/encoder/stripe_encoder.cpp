@@ -0,0 +1,107 @@
+#include "stripe_encoder.h"
+#include <iostream>
+
+// H.264 macroblocks are 16 rows high, keeping stripe borders on macroblock rows
+// avoids padding inside the frame
+static const int STRIPE_ALIGN = 16;
+
+std::vector<int> stripe_heights(int height, int count) {
+    int base = (height / count) / STRIPE_ALIGN * STRIPE_ALIGN;
+    if (base < STRIPE_ALIGN) base = STRIPE_ALIGN;
+
+    std::vector<int> heights;
+    int remaining = height;
+    while (remaining > 0 && (int)heights.size() < count - 1 && remaining > base) {
+        heights.push_back(base);
+        remaining -= base;
+    }
+    if (remaining > 0) heights.push_back(remaining);
+    return heights;
+}
+
+static void encode_stripe(StripeEncoderContext& ctx, int index) {
+    EncoderContext& enc = ctx.encoders[index];
+    EncodedStripe& out = ctx.stripes[index];
+    out.data.clear();
+
+    if (av_frame_make_writable(enc.frame) < 0) return;
+
+    const uint8_t* inData[1] = { ctx.input + (size_t)out.y * ctx.input_linesize };
+    int inLinesize[1] = { ctx.input_linesize };
+    sws_scale(enc.sws_ctx, inData, inLinesize, 0, out.height, enc.frame->data, enc.frame->linesize);
+
+    enc.frame->pts = ctx.pts;
+    if (send_encoder_frame(enc, enc.frame) < 0) return;
+
+    while (avcodec_receive_packet(enc.codec_ctx, enc.pkt) == 0) {
+        out.data.insert(out.data.end(), enc.pkt->data, enc.pkt->data + enc.pkt->size);
+        av_packet_unref(enc.pkt);
+    }
+}
+
+bool init_stripe_encoder(const EncoderSettings& settings, int stripe_count, StripeEncoderContext& ctx) {
+    std::vector<int> heights = stripe_heights(settings.height, stripe_count);
+    if ((int)heights.size() < stripe_count) {
+        std::cerr << "[Encoder] " << stripe_count << " stripes requested, a frame " << settings.height
+                  << " rows high only splits into " << heights.size() << "\n";
+    }
+
+    ctx.settings.resize(heights.size());
+    ctx.encoders.resize(heights.size());
+    ctx.stripes.resize(heights.size());
+
+    int y = 0;
+    for (size_t i = 0; i < heights.size(); ++i) {
+        EncoderSettings stripe_settings = settings;
+        stripe_settings.height = heights[i];
+        // Parallelism comes from the stripes, each encoder stays on one thread
+        // and must emit one packet per frame so stripes stay in lockstep
+        stripe_settings.thread_count = 1;
+        stripe_settings.max_b_frames = 0;
+        stripe_settings.bitrate = (int)((int64_t)settings.bitrate * heights[i] / settings.height);
+
+        ctx.settings[i] = stripe_settings;
+        if (!init_encoder(stripe_settings, ctx.encoders[i])) {
+            std::cerr << "[Encoder] Failed to initialize stripe " << i << "\n";
+            destroy_stripe_encoder(ctx);
+            return false;
+        }
+        ctx.stripes[i].y = y;
+        ctx.stripes[i].height = heights[i];
+        y += heights[i];
+    }
+
+    start_workers(ctx.workers, (int)heights.size(), [&ctx](int index) { encode_stripe(ctx, index); });
+    std::cout << "[Encoder] Encoding " << heights.size() << " stripes in parallel\n";
+    return true;
+}
+
+void encode_stripes(StripeEncoderContext& ctx, const uint8_t* data, int linesize, int64_t pts) {
+    ctx.input = data;
+    ctx.input_linesize = linesize;
+    ctx.pts = pts;
+    run_workers(ctx.workers);
+}
+
+void request_stripe_keyframe(StripeEncoderContext& ctx) {
+    for (auto& enc : ctx.encoders) {
+        request_keyframe(enc);
+    }
+}
+
+bool stripe_keyframe_pending(const StripeEncoderContext& ctx) {
+    for (const auto& enc : ctx.encoders) {
+        if (enc.force_keyframe) return true;
+    }
+    return false;
+}
+
+void destroy_stripe_encoder(StripeEncoderContext& ctx) {
+    stop_workers(ctx.workers);
+    for (auto& enc : ctx.encoders) {
+        destroy_encoder(enc);
+    }
+    ctx.encoders.clear();
+    ctx.settings.clear();
+    ctx.stripes.clear();
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "encoder.h"
+#include "shared/worker_group.h"
+
+// Encoded output of one horizontal stripe for the current frame. Holds every
+// packet the stripe's encoder produced (one with the zero-latency settings used
+// here, zero while the encoder is still priming).
+struct EncodedStripe {
+    int y = 0;
+    int height = 0;
+    std::vector<uint8_t> data;
+};
+
+// Splits each frame into horizontal stripes and runs one encoder per stripe on
+// its own thread. Every stripe is an independent H.264 stream.
+struct StripeEncoderContext {
+    std::vector<EncoderSettings> settings;
+    std::vector<EncoderContext> encoders;
+    std::vector<EncodedStripe> stripes;
+    WorkerGroup workers;
+
+    // Input of the frame currently being encoded
+    const uint8_t* input = nullptr;
+    int input_linesize = 0;
+    int64_t pts = 0;
+};
+
+// Splits `height` into `count` stripes aligned to whole macroblock rows.
+// Frames shorter than `count` macroblock rows get fewer stripes.
+std::vector<int> stripe_heights(int height, int count);
+
+// Initializes one encoder per stripe, `settings` describes the full frame
+bool init_stripe_encoder(const EncoderSettings& settings, int stripe_count, StripeEncoderContext& ctx);
+
+// Converts and encodes all stripes of one captured frame in parallel.
+// Results are left in ctx.stripes.
+void encode_stripes(StripeEncoderContext& ctx, const uint8_t* data, int linesize, int64_t pts);
+
+// Requests an IDR on every stripe, stripes keep a shared GOP cadence
+void request_stripe_keyframe(StripeEncoderContext& ctx);
+
+bool stripe_keyframe_pending(const StripeEncoderContext& ctx);
+
+// Stops the worker threads and frees every stripe encoder
+void destroy_stripe_encoder(StripeEncoderContext& ctx);
@@ -0,0 +1,53 @@
+#include "temporal_layers.h"
+#include <iostream>
+
+#include "shared/h264.h"
+
+// Frames in a row that have to miss or meet the budget before the cut-off moves
+static const int SLOW_FRAMES_TO_DROP = 3;
+static const int FAST_FRAMES_TO_RESTORE = 60;
+
+int packet_temporal_layer(const uint8_t* data, size_t size, int temporal_layers) {
+    if (temporal_layers <= 1) return 0;
+
+    for (const NalUnit& nal : find_nal_units(data, size)) {
+        if (nal.type == H264_NAL_IDR) return 0;
+        if (nal.type != H264_NAL_SLICE) continue;
+
+        if (nal.ref_idc == 0) return temporal_layers - 1;
+        // Reference B frames only exist in the middle of a 3 layer pyramid
+        return h264_slice_type(data + nal.offset, nal.size) == 1 ? 1 : 0;
+    }
+    return 0;
+}
+
+void init_layer_filter(TemporalLayerFilter& filter, int layers) {
+    filter.layers = layers < 1 ? 1 : layers;
+    filter.max_layer = filter.layers - 1;
+    filter.slow_frames = 0;
+    filter.fast_frames = 0;
+}
+
+bool layer_filter_accepts(const TemporalLayerFilter& filter, int layer) {
+    return layer <= filter.max_layer;
+}
+
+void update_layer_filter(TemporalLayerFilter& filter, double send_seconds, double frame_interval) {
+    if (filter.layers <= 1) return;
+
+    if (send_seconds > frame_interval * 0.5) {
+        filter.fast_frames = 0;
+        if (++filter.slow_frames >= SLOW_FRAMES_TO_DROP && filter.max_layer > 0) {
+            --filter.max_layer;
+            filter.slow_frames = 0;
+            std::cout << "[Host] Receiver falling behind, sending temporal layers <= " << filter.max_layer << "\n";
+        }
+    } else if (send_seconds < frame_interval * 0.25) {
+        filter.slow_frames = 0;
+        if (++filter.fast_frames >= FAST_FRAMES_TO_RESTORE && filter.max_layer < filter.layers - 1) {
+            ++filter.max_layer;
+            filter.fast_frames = 0;
+            std::cout << "[Host] Receiver caught up, sending temporal layers <= " << filter.max_layer << "\n";
+        }
+    }
+}
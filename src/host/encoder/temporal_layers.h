@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Temporal scalability on top of plain H.264 B-frame patterns.
+//
+//   2 layers: P b P b ...       non-reference b frames form layer 1
+//   3 layers: P b B b P ...     the reference B is layer 1, the b frames layer 2
+//
+// Frames of the top layer are never referenced, so dropping them (or layers
+// above a cut-off) keeps the stream decodable at 1/2 or 1/4 of the frame rate.
+// The reordering costs 2^(layers-1) - 1 frames of encoder delay.
+static const int MAX_TEMPORAL_LAYERS = 3;
+
+// Temporal layer of an encoded access unit, derived from its first slice
+int packet_temporal_layer(const uint8_t* data, size_t size, int temporal_layers);
+
+// Sender-side layer cut-off for one receiver. Drops enhancement layers while
+// sending falls behind the frame interval and adds them back once the link
+// has been keeping up for a while.
+struct TemporalLayerFilter {
+    int layers = 1;
+    int max_layer = 0;
+    int slow_frames = 0;
+    int fast_frames = 0;
+};
+
+void init_layer_filter(TemporalLayerFilter& filter, int layers);
+
+bool layer_filter_accepts(const TemporalLayerFilter& filter, int layer);
+
+// Feeds the time the last frame took to send
+void update_layer_filter(TemporalLayerFilter& filter, double send_seconds, double frame_interval);
@@ -1,210 +1,791 @@
-#include "host.h"
-#include <iostream>
-#include <thread>
-
-#ifdef _WIN32
-#include <d3d11.h>
-#include <dxgi1_2.h>
-#include <wrl/client.h>
-using Microsoft::WRL::ComPtr;
-#else
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <unistd.h>
-#endif
-
-#include "encoder/encoder.h"
-
-extern "C" {
-#include <libavcodec/avcodec.h>
-#include <libswscale/swscale.h>
-#include <libavutil/opt.h>
-}
-
-bool init_dxgi_capture(ComPtr<ID3D11Device>& device, ComPtr<ID3D11DeviceContext>& context,
-    ComPtr<IDXGIOutputDuplication>& duplication, int& width, int& height) {
-    HRESULT hr;
-    ComPtr<IDXGIFactory1> dxgiFactory;
-    hr = CreateDXGIFactory1(__uuidof(IDXGIFactory1), (void**)&dxgiFactory);
-    if (FAILED(hr)) return false;
-
-    ComPtr<IDXGIAdapter1> adapter;
-    hr = dxgiFactory->EnumAdapters1(0, &adapter);
-    if (FAILED(hr)) return false;
-
-    ComPtr<IDXGIOutput> output;
-    hr = adapter->EnumOutputs(0, &output);
-    if (FAILED(hr)) return false;
-
-    DXGI_OUTPUT_DESC desc;
-    output->GetDesc(&desc);
-
-    ComPtr<IDXGIOutput1> output1;
-    hr = output.As(&output1);
-    if (FAILED(hr)) return false;
-
-    D3D_FEATURE_LEVEL level;
-    hr = D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr, 0,
-        nullptr, 0, D3D11_SDK_VERSION, &device, &level, &context);
-    if (FAILED(hr)) return false;
-
-    ComPtr<IDXGIDevice> dxgiDevice;
-    device.As(&dxgiDevice);
-
-    ComPtr<IDXGIAdapter> dxgiAdapter;
-    dxgiDevice->GetAdapter(&dxgiAdapter);
-
-    hr = output1->DuplicateOutput(device.Get(), &duplication);
-    if (FAILED(hr)) return false;
-
-    width = desc.DesktopCoordinates.right - desc.DesktopCoordinates.left;
-    height = desc.DesktopCoordinates.bottom - desc.DesktopCoordinates.top;
-    return true;
-}
-
-int send_all(int sock, const char* data, int len) {
-    int total_sent = 0;
-    while (total_sent < len) {
-        int sent = send(sock, data + total_sent, len - total_sent, 0);
-        if (sent <= 0) return sent;
-        total_sent += sent;
-    }
-    return total_sent;
-}
-
-void start_host_server(int port, bool& running) {
-    #ifdef _WIN32
-        WSADATA wsa;
-        WSAStartup(MAKEWORD(2, 2), &wsa);
-    #endif
-
-
-    #ifdef _WIN32
-        SOCKET server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    #else
-        int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    #endif
-    sockaddr_in server_addr{};
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-
-    bind(server_fd, (sockaddr*)&server_addr, sizeof(server_addr));
-    listen(server_fd, 1);
-    std::cout << "[Host] Waiting for client...\n";
-
-    #ifdef _WIN32
-        SOCKET client_fd = accept(server_fd, nullptr, nullptr);
-    #else
-        int client_fd = accept(server_fd, nullptr, nullptr);
-        if (client_fd < 0) {
-            std::cerr << "Failed to accept client\n";
-            return;
-        }
-    #endif
-    std::cout << "[Host] Client connected!\n";
-
-    ComPtr<ID3D11Device> device;
-    ComPtr<ID3D11DeviceContext> context;
-    ComPtr<IDXGIOutputDuplication> duplication;
-    int width = 0, height = 0;
-
-    if (!init_dxgi_capture(device, context, duplication, width, height)) {
-        std::cerr << "[Host] DXGI initialization failed\n";
-        return;
-    }
-
-    ComPtr<ID3D11Texture2D> stagingTex;
-    D3D11_TEXTURE2D_DESC desc = {};
-    desc.Width = width;
-    desc.Height = height;
-    desc.MipLevels = 1;
-    desc.ArraySize = 1;
-    desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
-    desc.SampleDesc.Count = 1;
-    desc.Usage = D3D11_USAGE_STAGING;
-    desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-    desc.BindFlags = 0;
-    desc.MiscFlags = 0;
-    device->CreateTexture2D(&desc, nullptr, &stagingTex);
-
-    EncoderSettings settings = {
-        width,              // int
-        height,             // int
-        30,                 // fps
-        5'000'000,          // bitrate
-        EncoderType::NVENC, // preferred encoder
-        AV_PIX_FMT_BGRA     // input pixel format
-    };
-
-    EncoderContext enc;
-    if (!init_encoder(settings, enc)) {
-        std::cerr << "Failed to initialize encoder\n";
-        return;
-    }
-
-    SwsContext* sws_ctx = sws_getContext(width, height, AV_PIX_FMT_BGRA,
-        width, height, AV_PIX_FMT_YUV420P, 0, 0, 0, 0);
-
-    AVFrame* frame = av_frame_alloc();
-    frame->format = AV_PIX_FMT_YUV420P;
-    frame->width = width;
-    frame->height = height;
-    av_frame_get_buffer(frame, 32);
-
-    AVPacket* pkt = av_packet_alloc();
-    
-    int64_t frame_index = 0;
-
-    while (running) {
-        DXGI_OUTDUPL_FRAME_INFO frameInfo;
-        ComPtr<IDXGIResource> desktopResource;
-        HRESULT hr = duplication->AcquireNextFrame(100, &frameInfo, &desktopResource);
-        if (FAILED(hr)) continue;
-
-        ComPtr<ID3D11Texture2D> tex;
-        desktopResource.As(&tex);
-
-        context->CopyResource(stagingTex.Get(), tex.Get());
-
-        D3D11_MAPPED_SUBRESOURCE mapped;
-        context->Map(stagingTex.Get(), 0, D3D11_MAP_READ, 0, &mapped);
-
-        uint8_t* inData[1] = { (uint8_t*)mapped.pData };
-        int inLinesize[1] = { (int)mapped.RowPitch };
-
-        sws_scale(enc.sws_ctx, inData, inLinesize, 0, enc.codec_ctx->height, enc.frame->data, enc.frame->linesize);
-        enc.frame->pts = frame_index++;
-        avcodec_send_frame(enc.codec_ctx, enc.frame);
-        
-        while (avcodec_receive_packet(enc.codec_ctx, enc.pkt) == 0) {
-            int net_size = enc.pkt->size;
-            int net_size_be = htonl(net_size);
-            if (send_all(client_fd, (char*)&net_size_be, sizeof(net_size_be)) != sizeof(net_size_be)) {
-                std::cerr << "[Host] Failed to send packet size\n";
-                break;
-            }
-            if (send_all(client_fd, (char*)enc.pkt->data, net_size) != net_size) {
-                std::cerr << "[Host] Failed to send packet data\n";
-                break;
-            }
-            av_packet_unref(enc.pkt);
-        }
-
-        context->Unmap(stagingTex.Get(), 0);
-        duplication->ReleaseFrame();
-        std::this_thread::sleep_for(std::chrono::milliseconds(33));
-    }
-
-    destroy_encoder(enc);
-
-#ifdef _WIN32
-    closesocket(client_fd);
-    closesocket(server_fd);
-    WSACleanup();
-#else
-    close(client_fd);
-    close(server_fd);
-#endif
-}
+#include "host.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#include <d3d11.h>
+#include <dxgi1_2.h>
+#include <wrl/client.h>
+using Microsoft::WRL::ComPtr;
+#endif
+
+#include "capture/change_detector.h"
+#include "encoder/content_analyzer.h"
+#include "encoder/delta_encoder.h"
+#include "encoder/encoder.h"
+#include "encoder/encoder_switch.h"
+#include "encoder/ladder.h"
+#include "encoder/simulcast.h"
+#include "encoder/stripe_encoder.h"
+#include "encoder/temporal_layers.h"
+#include "shared/h264.h"
+#include "shared/protocol.h"
+#include "shared/socket.h"
+#include "idle_controller.h"
+#include "stats.h"
+#include "viewers.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+#include <libavutil/opt.h>
+}
+
+bool init_dxgi_capture(ComPtr<ID3D11Device>& device, ComPtr<ID3D11DeviceContext>& context,
+    ComPtr<IDXGIOutputDuplication>& duplication, int& width, int& height) {
+    HRESULT hr;
+    ComPtr<IDXGIFactory1> dxgiFactory;
+    hr = CreateDXGIFactory1(__uuidof(IDXGIFactory1), (void**)&dxgiFactory);
+    if (FAILED(hr)) return false;
+
+    ComPtr<IDXGIAdapter1> adapter;
+    hr = dxgiFactory->EnumAdapters1(0, &adapter);
+    if (FAILED(hr)) return false;
+
+    ComPtr<IDXGIOutput> output;
+    hr = adapter->EnumOutputs(0, &output);
+    if (FAILED(hr)) return false;
+
+    DXGI_OUTPUT_DESC desc;
+    output->GetDesc(&desc);
+
+    ComPtr<IDXGIOutput1> output1;
+    hr = output.As(&output1);
+    if (FAILED(hr)) return false;
+
+    D3D_FEATURE_LEVEL level;
+    hr = D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr, 0,
+        nullptr, 0, D3D11_SDK_VERSION, &device, &level, &context);
+    if (FAILED(hr)) return false;
+
+    ComPtr<IDXGIDevice> dxgiDevice;
+    device.As(&dxgiDevice);
+
+    ComPtr<IDXGIAdapter> dxgiAdapter;
+    dxgiDevice->GetAdapter(&dxgiAdapter);
+
+    hr = output1->DuplicateOutput(device.Get(), &duplication);
+    if (FAILED(hr)) return false;
+
+    width = desc.DesktopCoordinates.right - desc.DesktopCoordinates.left;
+    height = desc.DesktopCoordinates.bottom - desc.DesktopCoordinates.top;
+    return true;
+}
+
+// Frames whose capture time is remembered for their delayed packets
+static const int CAPTURE_TIME_SLOTS = 64;
+
+// Send buffer of the RTP socket. Key frames are bursts of a few hundred
+// datagrams that the default buffer would partly drop.
+static const int UDP_SEND_BUFFER = 4 * 1024 * 1024;
+
+// VIDEO_FRAME head shared by every viewer of a frame, only the sequence
+// number differs per connection
+static VideoFrameHead video_frame_head(bool keyframe, uint64_t timestamp_us) {
+    VideoFrameHead head;
+    head.header.type = MSG_VIDEO_FRAME;
+    head.header.flags = keyframe ? MSG_FLAG_KEYFRAME : 0;
+    head.header.timestamp_us = timestamp_us;
+    return head;
+}
+
+// Payload of one VIDEO_FRAME in every form a send path takes: the bytes, the
+// packet for zero-copy sends, and a shared reference for the event loop's
+// queues, made only in event loop mode
+struct FramePayload {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    const AVPacket* pkt = nullptr;
+    std::shared_ptr<const uint8_t> shared;
+};
+
+static std::shared_ptr<const uint8_t> share_bytes(const uint8_t* data, size_t size) {
+    auto copy = std::make_shared<std::vector<uint8_t>>(data, data + size);
+    return std::shared_ptr<const uint8_t>(copy, copy->data());
+}
+
+// Reference on the packet's buffer, copies only if the packet has none
+static std::shared_ptr<const uint8_t> share_packet(const AVPacket* pkt) {
+    AVPacket* ref = av_packet_clone(pkt);
+    if (!ref) return share_bytes(pkt->data, pkt->size);
+    return std::shared_ptr<const uint8_t>(ref->data, [ref](const uint8_t*) {
+        AVPacket* owned = ref;
+        av_packet_free(&owned);
+    });
+}
+
+// Sends one VIDEO_FRAME to `viewer` and accounts the time it took. Queued
+// viewers only get it queued, the event loop writes it. UDP viewers get it
+// as datagrams right away, or queued with the pacer.
+static void send_video(ViewerList& viewers, Viewer& viewer, VideoFrameHead& head, const FramePayload& payload) {
+    if (viewer.udp) {
+        send_udp_video(viewers, viewer, head, payload.data, payload.size);
+        return;
+    }
+    if (viewer.queued) {
+        queue_to_viewer(viewer, head.header, sizeof(head), payload.shared, payload.size);
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    const bool ok = payload.pkt ? send_packet_to_viewer(viewer, head.header, sizeof(head), payload.pkt)
+                                : send_to_viewer(viewer, head.header, sizeof(head), payload.data, payload.size);
+    if (!ok) {
+        std::cerr << "[Host] Failed to send frame\n";
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    viewer.send_seconds += elapsed.count();
+}
+
+// Sends one encoded access unit of `rendition` to every viewer that wants it
+static void send_packet(ViewerList& viewers, int rendition, const AVPacket* pkt, uint64_t timestamp_us) {
+    const bool keyframe = pkt->flags & AV_PKT_FLAG_KEY;
+    const int layer = packet_temporal_layer(pkt->data, pkt->size, viewers.temporal_layers);
+    if (keyframe) {
+        update_parameter_sets(viewers, rendition, pkt->data, pkt->size);
+    }
+
+    VideoFrameHead head = video_frame_head(keyframe, timestamp_us);
+    head.info.rendition = (uint8_t)rendition;
+    head.info.temporal_layer = (uint8_t)layer;
+    FramePayload payload;
+    payload.data = pkt->data;
+    payload.size = pkt->size;
+    payload.pkt = pkt;
+    if (viewers.event_loop) payload.shared = share_packet(pkt);
+
+    for (auto& viewer : viewers.viewers) {
+        if (!viewer_wants(*viewer, rendition, keyframe)) continue;
+        if (!layer_filter_accepts(viewer->layer_filter, layer)) continue;
+        send_video(viewers, *viewer, head, payload);
+    }
+}
+
+// Every stripe goes out as its own VIDEO_FRAME carrying its index, the client
+// decodes once the last one of a timestamp arrives. Stripe encoders share one
+// GOP cadence, so a keyframe in the first stripe starts a decodable frame for
+// new viewers and all stripes of a frame are in the same temporal layer.
+static void send_stripes(ViewerList& viewers, const StripeEncoderContext& stripe_enc, uint64_t timestamp_us) {
+    const auto& first = stripe_enc.stripes[0].data;
+    const bool keyframe = h264_contains_idr(first.data(), first.size());
+    const int layer = packet_temporal_layer(first.data(), first.size(), viewers.temporal_layers);
+
+    // All stripes of a frame go out in one batch. The stripe buffers are
+    // reused by the next frame, so queues get one shared copy of each.
+    std::vector<VideoFrameHead> heads(stripe_enc.stripes.size(), video_frame_head(keyframe, timestamp_us));
+    std::vector<std::shared_ptr<const uint8_t>> shared;
+    MessageBatch batch;
+    for (size_t i = 0; i < heads.size(); ++i) {
+        const auto& data = stripe_enc.stripes[i].data;
+        heads[i].info.temporal_layer = (uint8_t)layer;
+        heads[i].info.stripe_index = (uint8_t)i;
+        heads[i].info.stripe_count = (uint8_t)heads.size();
+        add_protocol_message(batch, heads[i].header, sizeof(VideoFrameHead), data.data(), data.size());
+        if (viewers.event_loop) shared.push_back(share_bytes(data.data(), data.size()));
+    }
+
+    for (auto& viewer : viewers.viewers) {
+        if (!viewer_wants(*viewer, 0, keyframe)) continue;
+        if (!layer_filter_accepts(viewer->layer_filter, layer)) continue;
+        if (viewer->udp) {
+            for (size_t i = 0; i < heads.size(); ++i) {
+                const auto& data = stripe_enc.stripes[i].data;
+                send_udp_video(viewers, *viewer, heads[i], data.data(), data.size());
+            }
+            continue;
+        }
+        if (viewer->queued) {
+            for (size_t i = 0; i < heads.size(); ++i) {
+                queue_to_viewer(*viewer, heads[i].header, sizeof(VideoFrameHead), shared[i],
+                                stripe_enc.stripes[i].data.size());
+            }
+            continue;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        if (!send_batch_to_viewer(*viewer, batch)) {
+            std::cerr << "[Host] Failed to send frame\n";
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        viewer->send_seconds += elapsed.count();
+    }
+}
+
+// Raw delta messages are lossless and self-describing, one per frame
+static void send_delta(ViewerList& viewers, const DeltaEncoderContext& delta_enc, uint64_t timestamp_us) {
+    const bool keyframe = delta_enc.delta.last_keyframe;
+    VideoFrameHead head = video_frame_head(keyframe, timestamp_us);
+    head.info.codec = CODEC_RAW_DELTA;
+    FramePayload payload;
+    payload.data = delta_enc.output.data();
+    payload.size = delta_enc.output.size();
+    if (viewers.event_loop) payload.shared = share_bytes(payload.data, payload.size);
+
+    for (auto& viewer : viewers.viewers) {
+        if (!viewer_wants(*viewer, 0, keyframe)) continue;
+        send_video(viewers, *viewer, head, payload);
+    }
+}
+
+// Shrinks `settings` to the smallest size with the capture's aspect ratio that
+// still covers a viewport_w x viewport_h window, and caps the frame rate at the
+// display's refresh rate. Never grows either; pixels the client would only
+// downscale are not worth encoding.
+static void fit_viewport(EncoderSettings& settings, int capture_w, int capture_h,
+    int viewport_w, int viewport_h, int refresh_mhz) {
+    const double scale = std::max((double)viewport_w / capture_w, (double)viewport_h / capture_h);
+    const int w = ((int)std::ceil(capture_w * scale) + 1) & ~1;
+    const int h = ((int)std::ceil(capture_h * scale) + 1) & ~1;
+    if (w < settings.width && h < settings.height) {
+        settings.bitrate = (int)(settings.bitrate * std::sqrt((double)w * h / ((double)settings.width * settings.height)));
+        settings.width = w;
+        settings.height = h;
+    }
+
+    const int refresh_fps = (refresh_mhz + 999) / 1000;
+    if (refresh_fps > 0 && refresh_fps < settings.fps) {
+        settings.fps = refresh_fps;
+    }
+}
+
+enum class EncodeMode { SIMULCAST, STRIPES, RAW_DELTA };
+
+// The host runs the stripe encoders, the simulcast renditions or the raw delta coder
+struct HostEncoders {
+    EncodeMode mode = EncodeMode::SIMULCAST;
+    StripeEncoderContext stripes;
+    SimulcastContext simulcast;
+    DeltaEncoderContext delta;
+    std::vector<bool> stale_tuning;     // Still open with the previous content class's tuning
+};
+
+static void request_keyframes(HostEncoders& encoders) {
+    switch (encoders.mode) {
+    case EncodeMode::STRIPES: request_stripe_keyframe(encoders.stripes); break;
+    case EncodeMode::SIMULCAST: request_simulcast_keyframe(encoders.simulcast); break;
+    case EncodeMode::RAW_DELTA: encoders.delta.delta.force_keyframe = true; break;
+    }
+}
+
+static void request_rendition_keyframe(HostEncoders& encoders, int rendition) {
+    switch (encoders.mode) {
+    case EncodeMode::STRIPES: request_stripe_keyframe(encoders.stripes); break;
+    case EncodeMode::SIMULCAST: request_simulcast_keyframe(encoders.simulcast, rendition); break;
+    case EncodeMode::RAW_DELTA: encoders.delta.delta.force_keyframe = true; break;
+    }
+}
+
+static bool keyframe_pending(const HostEncoders& encoders) {
+    switch (encoders.mode) {
+    case EncodeMode::STRIPES: return stripe_keyframe_pending(encoders.stripes);
+    case EncodeMode::SIMULCAST: return simulcast_keyframe_pending(encoders.simulcast);
+    case EncodeMode::RAW_DELTA: return encoders.delta.delta.force_keyframe;
+    }
+    return false;
+}
+
+// Switches the settings to the tuning of `cls`. Encoders that take it are
+// only marked, apply_pending_tuning reopens them once an IDR is due anyway.
+// Raw delta is lossless and has nothing to tune.
+static void retune_encoders(HostEncoders& encoders, ContentClass cls) {
+    if (encoders.mode == EncodeMode::RAW_DELTA) return;
+
+    const bool striped = encoders.mode == EncodeMode::STRIPES;
+    std::vector<EncoderSettings>& all = striped ? encoders.stripes.settings : encoders.simulcast.settings;
+    std::vector<EncoderContext>& open = striped ? encoders.stripes.encoders : encoders.simulcast.encoders;
+    encoders.stale_tuning.resize(open.size());
+    for (size_t i = 0; i < all.size(); ++i) {
+        apply_content_tuning(all[i], cls);
+        encoders.stale_tuning[i] = takes_content_tuning(open[i]);
+    }
+}
+
+// Reopens the encoders left on an old tuning that are about to send an IDR,
+// the reopen then costs nothing extra. The request is kept so the frame is
+// still accounted for as the IDR it was asked for.
+static bool apply_pending_tuning(HostEncoders& encoders) {
+    if (encoders.mode == EncodeMode::RAW_DELTA) return true;
+
+    const bool striped = encoders.mode == EncodeMode::STRIPES;
+    std::vector<EncoderSettings>& all = striped ? encoders.stripes.settings : encoders.simulcast.settings;
+    std::vector<EncoderContext>& open = striped ? encoders.stripes.encoders : encoders.simulcast.encoders;
+    for (size_t i = 0; i < encoders.stale_tuning.size() && i < open.size(); ++i) {
+        if (!encoders.stale_tuning[i] || !open[i].force_keyframe) continue;
+        if (!reopen_encoder(open[i], all[i])) {
+            std::cerr << "[Encoder] Failed to reopen " << (striped ? "stripe " : "rendition ") << i << "\n";
+            return false;
+        }
+        request_keyframe(open[i]);
+        encoders.stale_tuning[i] = false;
+    }
+    return true;
+}
+
+// Sets `encoder` to `bitrate` unless it is within 5% already, each change
+// costs the rate control a few frames to settle
+static void limit_encoder_bitrate(EncoderContext& encoder, int bitrate) {
+    const int current = encoder_bitrate(encoder);
+    if (std::abs(bitrate - current) * 20 <= current) return;
+    set_encoder_bitrate(encoder, bitrate);
+}
+
+// Holds every rendition at or below the limit its viewers' congestion
+// controllers set (see viewer_bitrate_limits), at the configured rate where
+// there is none. Stripes split the limit in proportion to their share.
+// Reopened and switched encoders start at the configured rate again and
+// are pulled back on the next frame.
+static void apply_bitrate_limits(HostEncoders& encoders, const std::vector<int>& limits) {
+    switch (encoders.mode) {
+    case EncodeMode::STRIPES: {
+        const int limit = limits.empty() ? 0 : limits[0];
+        int64_t total = 0;
+        for (const auto& settings : encoders.stripes.settings) total += settings.bitrate;
+        for (size_t i = 0; i < encoders.stripes.encoders.size(); ++i) {
+            const int configured = encoders.stripes.settings[i].bitrate;
+            const int share = total > 0 ? (int)(limit * (int64_t)configured / total) : configured;
+            limit_encoder_bitrate(encoders.stripes.encoders[i], limit > 0 ? std::min(configured, share) : configured);
+        }
+        break;
+    }
+    case EncodeMode::SIMULCAST:
+        for (size_t r = 0; r < encoders.simulcast.encoders.size(); ++r) {
+            const int configured = encoders.simulcast.settings[r].bitrate;
+            const int limit = r < limits.size() ? limits[r] : 0;
+            limit_encoder_bitrate(encoders.simulcast.encoders[r], limit > 0 ? std::min(configured, limit) : configured);
+        }
+        break;
+    case EncodeMode::RAW_DELTA:
+        break;
+    }
+}
+
+static int primary_bitrate(const HostEncoders& encoders) {
+    switch (encoders.mode) {
+    case EncodeMode::STRIPES: {
+        int total = 0;
+        for (const auto& encoder : encoders.stripes.encoders) total += encoder_bitrate(encoder);
+        return total;
+    }
+    case EncodeMode::SIMULCAST: return encoder_bitrate(encoders.simulcast.encoders[0]);
+    case EncodeMode::RAW_DELTA: return 0;
+    }
+    return 0;
+}
+
+static void destroy_host_encoders(HostEncoders& encoders) {
+    switch (encoders.mode) {
+    case EncodeMode::STRIPES: destroy_stripe_encoder(encoders.stripes); break;
+    case EncodeMode::SIMULCAST: destroy_simulcast(encoders.simulcast); break;
+    case EncodeMode::RAW_DELTA: destroy_delta_encoder(encoders.delta); break;
+    }
+}
+
+void start_host_server(int port, const HostOptions& options, bool& running) {
+    #ifdef _WIN32
+        WSADATA wsa;
+        WSAStartup(MAKEWORD(2, 2), &wsa);
+    #endif
+
+
+    socket_t server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in server_addr{};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+
+    bind(server_fd, (sockaddr*)&server_addr, sizeof(server_addr));
+    listen(server_fd, 8);
+    std::cout << "[Host] Listening on port " << port << "\n";
+
+    // Capture and the encoders start right away, so a viewer joining later
+    // only waits for one forced IDR
+    ViewerList viewers;
+    if (options.udp) {
+        // RTP video leaves from the same port number
+        viewers.udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+        int buffer_size = UDP_SEND_BUFFER;
+        setsockopt(viewers.udp_fd, SOL_SOCKET, SO_SNDBUF, (const char*)&buffer_size, sizeof(buffer_size));
+        if (bind(viewers.udp_fd, (sockaddr*)&server_addr, sizeof(server_addr)) == 0) {
+            viewers.udp = true;
+            viewers.udp_gso = options.udp_gso && udp_segmentation_supported(viewers.udp_fd);
+            if (viewers.udp_gso) std::cout << "[Host] UDP video leaves as segmented sends\n";
+            if (options.udp_timestamps && enable_tx_timestamps(viewers.tx_stamps, viewers.udp_fd)) {
+                std::cout << "[Host] UDP video sends are timestamped by the kernel\n";
+            }
+        } else {
+            std::cerr << "[Host] UDP port " << port << " unavailable, video stays on TCP\n";
+            close_socket(viewers.udp_fd);
+        }
+    }
+    if (viewers.udp && options.pacing_share > 0) {
+        if (viewers.tx_stamps.enabled) viewers.pacer.stamps = &viewers.tx_stamps;
+        viewers.pacing = start_pacer(viewers.pacer, options.pacing_share,
+                                     std::max(options.keyframe_pacing_share, options.pacing_share), viewers.udp_gso);
+    }
+    viewers.temporal_layers = options.temporal_layers;
+
+    ComPtr<ID3D11Device> device;
+    ComPtr<ID3D11DeviceContext> context;
+    ComPtr<IDXGIOutputDuplication> duplication;
+    int width = 0, height = 0;
+
+    if (!init_dxgi_capture(device, context, duplication, width, height)) {
+        std::cerr << "[Host] DXGI initialization failed\n";
+        close_viewers(viewers, server_fd);
+        return;
+    }
+
+    ComPtr<ID3D11Texture2D> stagingTex;
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = width;
+    desc.Height = height;
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    desc.SampleDesc.Count = 1;
+    desc.Usage = D3D11_USAGE_STAGING;
+    desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+    desc.BindFlags = 0;
+    desc.MiscFlags = 0;
+    device->CreateTexture2D(&desc, nullptr, &stagingTex);
+
+    EncoderSettings settings = {
+        width,              // int
+        height,             // int
+        30,                 // fps
+        options.bitrate_kbps * 1000,    // bitrate
+        EncoderType::NVENC, // preferred encoder
+        AV_PIX_FMT_BGRA     // input pixel format
+    };
+    settings.temporal_layers = options.temporal_layers;
+
+    ContentAnalyzer analyzer;
+    if (options.adaptive_tuning) {
+        apply_content_tuning(settings, analyzer.current);
+    }
+
+    // The ladder and the viewers' windows drive the primary stream's size
+    // and rate, it starts on the best ladder step. Only the single H.264
+    // stream is resized.
+    const bool resizable = !options.raw_delta && options.stripes <= 1 && options.simulcast.empty();
+    if (resizable) {
+        settings.src_width = width;
+        settings.src_height = height;
+    }
+    RenditionLadder ladder;
+    if (!options.ladder.empty()) {
+        init_ladder(ladder, options.ladder, width, height, settings.bitrate);
+        if (!ladder.steps.empty()) {
+            settings = ladder_step_settings(ladder, 0, settings);
+        }
+    }
+    const EncoderSettings top_settings = settings;
+    EncoderSwitch encoder_switch;
+    double frame_interval = 1.0 / settings.fps;
+
+    // Rendition 0 is the full capture, simulcast renditions are scaled from it
+    std::vector<EncoderSettings> renditions = { settings };
+    for (const RenditionOption& option : options.simulcast) {
+        EncoderSettings rendition = settings;
+        rendition.width = std::min(option.width, width) & ~1;
+        rendition.height = std::min(option.height, height) & ~1;
+        rendition.bitrate = option.bitrate;
+        renditions.push_back(rendition);
+    }
+
+    HostEncoders encoders;
+    if (options.raw_delta) {
+        encoders.mode = EncodeMode::RAW_DELTA;
+        if (!init_delta_encoder(settings, encoders.delta)) {
+            std::cerr << "Failed to initialize raw delta encoder\n";
+            close_viewers(viewers, server_fd);
+            return;
+        }
+    } else if (options.stripes > 1) {
+        encoders.mode = EncodeMode::STRIPES;
+        if (!init_stripe_encoder(settings, options.stripes, encoders.stripes)) {
+            std::cerr << "Failed to initialize stripe encoders\n";
+            close_viewers(viewers, server_fd);
+            return;
+        }
+    } else if (!init_simulcast(renditions, encoders.simulcast)) {
+        std::cerr << "Failed to initialize encoder\n";
+        close_viewers(viewers, server_fd);
+        return;
+    }
+
+    // The STREAM_INIT reply describes what the encoders actually produce
+    viewers.codec = encoders.mode == EncodeMode::RAW_DELTA ? CODEC_RAW_DELTA : CODEC_H264;
+    viewers.stripe_count = encoders.mode == EncodeMode::STRIPES ? (int)encoders.stripes.stripes.size() : 1;
+    // Stripes and raw delta only ever send rendition 0
+    viewers.rendition_count = encoders.mode == EncodeMode::SIMULCAST ? (int)encoders.simulcast.encoders.size() : 1;
+    viewers.zerocopy = options.zerocopy;
+    viewers.transport = options.transport;
+    viewers.event_loop = options.event_loop;
+    viewers.latency_budget = std::chrono::milliseconds(options.latency_budget_ms);
+    viewers.fec = options.fec;
+    viewers.fec_ratio = options.fec_percent / 100.0;
+    viewers.retransmits = options.retransmits;
+    viewers.congestion_control = options.congestion_control && encoders.mode != EncodeMode::RAW_DELTA;
+    for (const EncoderSettings& rendition : renditions) viewers.bitrates.push_back(rendition.bitrate);
+    viewers.probe_duration = std::chrono::milliseconds(options.probe_ms);
+    start_accepting_viewers(viewers, server_fd);
+
+    // Change detection feeds both the idle controller and the content analyzer
+    ChangeDetector change_detector;
+    IdleController idle;
+    const bool detect_idle = options.idle_fps >= 0;
+    const bool detect_changes_enabled = detect_idle || options.adaptive_tuning;
+    if (detect_changes_enabled) {
+        init_change_detector(change_detector, width, height);
+    }
+    if (detect_idle) {
+        init_idle_controller(idle, options.idle_fps, options.idle_after_ms);
+    }
+
+    HostStats stats;
+    std::vector<TxStamp> tx_stamps;
+    stats.content_class = options.adaptive_tuning ? content_class_name(analyzer.current) : "n/a";
+    int64_t frame_index = 0;
+    // Capture timestamps by pts, B-frame reordering hands packets back late
+    std::vector<uint64_t> capture_times(CAPTURE_TIME_SLOTS, 0);
+    auto next_frame = std::chrono::steady_clock::now();
+    bool staged = false;    // stagingTex holds the last captured image
+    // Renditions whose requested IDR has not left the encoder yet. With
+    // B-frames or lookahead it waits there for the frames after it, which a
+    // static desktop never presents.
+    std::vector<bool> idr_held(renditions.size(), false);
+
+    while (running) {
+        const bool draining = std::find(idr_held.begin(), idr_held.end(), true) != idr_held.end();
+        DXGI_OUTDUPL_FRAME_INFO frameInfo;
+        ComPtr<IDXGIResource> desktopResource;
+        HRESULT hr = duplication->AcquireNextFrame(draining ? (UINT)(frame_interval * 1000) : 100, &frameInfo,
+                                                   &desktopResource);
+        // A static desktop presents nothing and times out. The last image is
+        // encoded again while a joining viewer or the idle refinement wants a
+        // keyframe of it, and until that keyframe is out of the encoder.
+        const bool repeat = hr == DXGI_ERROR_WAIT_TIMEOUT;
+        if (FAILED(hr) && !(repeat && staged)) continue;
+
+        if (!repeat) {
+            ComPtr<ID3D11Texture2D> tex;
+            desktopResource.As(&tex);
+            context->CopyResource(stagingTex.Get(), tex.Get());
+            staged = true;
+        }
+
+        D3D11_MAPPED_SUBRESOURCE mapped;
+        context->Map(stagingTex.Get(), 0, D3D11_MAP_READ, 0, &mapped);
+
+        uint8_t* inData[1] = { (uint8_t*)mapped.pData };
+        int inLinesize[1] = { (int)mapped.RowPitch };
+
+        const int64_t pts = frame_index++;
+        capture_times[pts % CAPTURE_TIME_SLOTS] = protocol_timestamp_us();
+        if (!repeat) ++stats.frames_captured;
+
+        bool changed = !repeat;
+        if (detect_changes_enabled && !repeat) {
+            changed = detect_changes(change_detector, inData[0], inLinesize[0]) > 0;
+        }
+
+        if (options.adaptive_tuning && !repeat) {
+            ContentStats content;
+            if (analyze_content(analyzer, change_detector, content)) {
+                std::cout << "[Host] Content class: " << content_class_name(analyzer.current) << "\n";
+                stats.content_class = content_class_name(analyzer.current);
+                retune_encoders(encoders, analyzer.current);
+            }
+            if (content.scene_cut) {
+                request_keyframes(encoders);
+                ++stats.scene_cuts;
+            }
+        }
+
+        // Joining and switching viewers get an IDR on the next frame instead
+        // of waiting out the GOP
+        bool has_viewers = false;
+        std::vector<int> bitrate_limits;
+        {
+            std::lock_guard<std::mutex> lock(viewers.mutex);
+            for (int rendition : collect_keyframe_requests(viewers)) {
+                request_rendition_keyframe(encoders, rendition);
+            }
+            has_viewers = !viewers.viewers.empty();
+            if (viewers.congestion_control) {
+                update_tcp_rates(viewers);
+                bitrate_limits = viewer_bitrate_limits(viewers);
+            }
+        }
+        if (viewers.congestion_control) {
+            apply_bitrate_limits(encoders, bitrate_limits);
+            stats.target_kbps = primary_bitrate(encoders) / 1000;
+        }
+
+        // Static scenes are encoded at the idle rate or not at all, keyframe
+        // requests still go through so nobody waits on a paused stream
+        bool encode = true;
+        if (detect_idle) {
+            encode = idle_should_encode(idle, changed);
+            if (idle.refine) {
+                request_keyframes(encoders);
+            }
+            encode = encode || keyframe_pending(encoders) || draining;
+        }
+        if (repeat) {
+            encode = keyframe_pending(encoders) || draining;
+        }
+        // Without viewers only the first frame is encoded, which fills the
+        // parameter set cache for the handshake
+        if (!has_viewers && stats.frames_encoded > 0) {
+            encode = false;
+            idr_held.assign(idr_held.size(), false);
+        }
+
+        if (encode && !apply_pending_tuning(encoders)) {
+            std::cerr << "[Host] Failed to retune encoders\n";
+            running = false;
+        }
+
+        if (encode && running) {
+            // A prepared resize takes over before this frame, which then goes
+            // out as its first IDR at the new size, right after the frames the
+            // old encoder still held
+            bool switched = false;
+            if (finish_encoder_switch(encoder_switch)) {
+                swap_primary_encoder(encoders.simulcast, encoder_switch.encoder, encoder_switch.settings);
+                frame_interval = 1.0 / encoders.simulcast.settings[0].fps;
+                switched = true;
+                const EncoderSettings& now_settings = encoders.simulcast.settings[0];
+                std::cout << "[Host] Switched to " << now_settings.width << "x" << now_settings.height
+                          << "@" << now_settings.fps << "\n";
+                // Prepared before the last content class change, it picks
+                // the new tuning up at its next IDR like the others
+                if (options.adaptive_tuning) {
+                    EncoderSettings& primary = encoders.simulcast.settings[0];
+                    const int opened_qmin = primary.qmin;
+                    apply_content_tuning(primary, analyzer.current);
+                    if (primary.qmin != opened_qmin) {
+                        encoders.stale_tuning.resize(encoders.simulcast.encoders.size());
+                        encoders.stale_tuning[0] = takes_content_tuning(encoders.simulcast.encoders[0]);
+                    }
+                }
+            }
+
+            auto work_start = std::chrono::steady_clock::now();
+            bool encoded = true;
+            bool have_viewport = false;
+            int viewport_w = 0, viewport_h = 0, refresh_mhz = 0;
+            switch (encoders.mode) {
+            case EncodeMode::STRIPES:
+                encode_stripes(encoders.stripes, inData[0], inLinesize[0], pts);
+                break;
+            case EncodeMode::SIMULCAST:
+                for (size_t r = 0; r < idr_held.size(); ++r) {
+                    if (encoders.simulcast.encoders[r].force_keyframe) idr_held[r] = true;
+                }
+                encode_simulcast(encoders.simulcast, inData[0], inLinesize[0], pts);
+                break;
+            case EncodeMode::RAW_DELTA:
+                encoded = encode_delta_frame(encoders.delta, inData[0], inLinesize[0]);
+                break;
+            }
+            if (encoded) ++stats.frames_encoded;
+
+            if (encoded) {
+                std::lock_guard<std::mutex> lock(viewers.mutex);
+                viewers.frame_interval = frame_interval;
+                if (encoders.mode == EncodeMode::RAW_DELTA) {
+                    stats.bytes_encoded += encoders.delta.output.size();
+                    send_delta(viewers, encoders.delta, capture_times[pts % CAPTURE_TIME_SLOTS]);
+                } else if (encoders.mode == EncodeMode::STRIPES) {
+                    for (const auto& stripe : encoders.stripes.stripes) stats.bytes_encoded += stripe.data.size();
+                    send_stripes(viewers, encoders.stripes, capture_times[pts % CAPTURE_TIME_SLOTS]);
+                } else {
+                    for (size_t r = 0; r < encoders.simulcast.packets.size(); ++r) {
+                        for (AVPacket* pkt : encoders.simulcast.packets[r]) {
+                            if (pkt->flags & AV_PKT_FLAG_KEY) idr_held[r] = false;
+                            stats.bytes_encoded += pkt->size;
+                            const int64_t pkt_pts = pkt->pts == AV_NOPTS_VALUE ? pts : pkt->pts;
+                            send_packet(viewers, (int)r, pkt, capture_times[pkt_pts % CAPTURE_TIME_SLOTS]);
+                        }
+                    }
+                }
+                flush_viewers(viewers);
+                finish_viewer_frame(viewers, frame_interval);
+                have_viewport = options.fit_viewport && viewers_viewport(viewers, viewport_w, viewport_h, refresh_mhz);
+            }
+            if (encoders.mode == EncodeMode::SIMULCAST) release_simulcast_packets(encoders.simulcast);
+
+            std::chrono::duration<double> busy = std::chrono::steady_clock::now() - work_start;
+            if (switched) {
+                // The old encoder is freed once its last frames and the new IDR are out
+                destroy_encoder(encoder_switch.encoder);
+            } else if (resizable && !encoder_switch_in_progress(encoder_switch)) {
+                if (!ladder.steps.empty()) {
+                    int step = update_ladder(ladder, busy.count());
+                    if (step >= 0) ladder.current = step;
+                }
+
+                const EncoderSettings& current = encoders.simulcast.settings[0];
+                EncoderSettings target = current;
+                if (!ladder.steps.empty()) {
+                    target = ladder_step_settings(ladder, ladder.current, current);
+                } else {
+                    target.width = top_settings.width;
+                    target.height = top_settings.height;
+                    target.fps = top_settings.fps;
+                    target.bitrate = top_settings.bitrate;
+                }
+                if (have_viewport) {
+                    fit_viewport(target, width, height, viewport_w, viewport_h, refresh_mhz);
+                }
+                if (target.width != current.width || target.height != current.height || target.fps != current.fps) {
+                    start_encoder_switch(encoder_switch, target);
+                }
+            }
+        }
+        if (viewers.pacing) {
+            uint64_t paced = 0, delay_us = 0, max_delay_us = 0;
+            pacer_take_delay(viewers.pacer, paced, delay_us, max_delay_us);
+            stats.datagrams_paced += paced;
+            stats.pacing_delay_us += delay_us;
+            stats.pacing_max_delay_us = std::max(stats.pacing_max_delay_us, max_delay_us);
+        }
+        if (viewers.tx_stamps.enabled) {
+            read_tx_timestamps(viewers.tx_stamps, viewers.udp_fd, tx_stamps);
+            for (const TxStamp& stamp : tx_stamps) {
+                if (stamp.sent_us < stamp.send_us || stamp.send_us < stamp.tag) continue;
+                ++stats.frames_stamped;
+                stats.kernel_send_us += stamp.sent_us - stamp.send_us;
+                stats.capture_to_wire_us += stamp.sent_us - stamp.tag;
+                stats.capture_to_wire_max_us = std::max(stats.capture_to_wire_max_us, stamp.sent_us - stamp.tag);
+            }
+        }
+        report_host_stats(stats);
+
+        context->Unmap(stagingTex.Get(), 0);
+        if (!repeat) duplication->ReleaseFrame();
+
+        // Paced to the current step's frame rate, a late frame starts the next one right away
+        next_frame += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(frame_interval));
+        auto now = std::chrono::steady_clock::now();
+        if (next_frame < now) next_frame = now;
+        std::this_thread::sleep_until(next_frame);
+    }
+
+    cancel_encoder_switch(encoder_switch);
+
+    destroy_host_encoders(encoders);
+
+    close_viewers(viewers, server_fd);
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
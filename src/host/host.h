@@ -1,13 +1,52 @@
-#pragma once
-
-#ifdef _WIN32
-#include <d3d11.h>
-#include <dxgi1_2.h>
-#include <wrl/client.h>
-using Microsoft::WRL::ComPtr;
-#pragma comment(lib, "d3d11.lib")
-#pragma comment(lib, "dxgi.lib")
-#endif
-
-void start_host_server(int port, bool& running);
-
+#pragma once
+
+#ifdef _WIN32
+#include <d3d11.h>
+#include <dxgi1_2.h>
+#include <wrl/client.h>
+using Microsoft::WRL::ComPtr;
+#pragma comment(lib, "d3d11.lib")
+#pragma comment(lib, "dxgi.lib")
+#endif
+
+#include <vector>
+
+#include "encoder/ladder.h"
+#include "shared/fec.h"
+#include "shared/transport.h"
+
+// Extra simulcast rendition next to the full-size stream
+struct RenditionOption {
+    int width = 0;
+    int height = 0;
+    int bitrate = 0;
+};
+
+struct HostOptions {
+    int stripes = 1;    // >1 encodes horizontal stripes with one encoder each
+    int temporal_layers = 1;    // >1 lets the sender drop enhancement layers
+    std::vector<RenditionOption> simulcast;
+    std::vector<LadderStep> ladder;     // Steps to switch between under load, empty = fixed size
+    int idle_fps = 2;           // Encode rate for static scenes, 0 stops, <0 disables detection
+    int idle_after_ms = 500;
+    bool adaptive_tuning = true;    // Retune the encoder per detected content class
+    bool fit_viewport = true;       // Encode no larger than the viewers' windows need
+    bool raw_delta = false;         // LAN mode: lossless LZ4 tile deltas instead of H.264
+    bool zerocopy = false;          // MSG_ZEROCOPY for large packets (Linux)
+    TransportType transport = TransportType::POLL;    // Of the event loop
+    bool event_loop = false;        // One epoll/WSAPoll thread with per-viewer send queues
+    int latency_budget_ms = 150;    // Queued video older than this is dropped, NACKs for it get an IDR; 0 keeps it
+    bool udp = false;               // Offer RTP video over UDP to clients that ask for it
+    bool udp_gso = true;            // Send runs of datagrams in one syscall where the kernel segments them
+    bool udp_timestamps = true;     // Kernel send timestamps of each frame's last datagram (SO_TIMESTAMPING, Linux)
+    FecScheme fec = FecScheme::NONE;    // Repair packets for UDP video
+    int fec_percent = 10;           // ... per 100 video packets without loss, raised with reported loss
+    bool retransmits = true;        // Resend NACKed UDP video that can still make the latency budget
+    int bitrate_kbps = 5000;        // Full-size stream, the most congestion control goes to
+    bool congestion_control = true; // Lower renditions to what their viewers' paths take
+    int probe_ms = 200;             // Bandwidth probe picking a joining viewer's rendition and start rate, 0 = none
+    double pacing_share = 0.5;      // Of the frame interval UDP video frames are spread over, 0 sends them in one burst
+    double keyframe_pacing_share = 1.0; // ... keyframes, at least pacing_share
+};
+
+void start_host_server(int port, const HostOptions& options, bool& running);
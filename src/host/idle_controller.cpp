@@ -0,0 +1,45 @@
+#include "idle_controller.h"
+#include <iostream>
+
+void init_idle_controller(IdleController& idle, int idle_fps, int idle_after_ms) {
+    idle.idle_fps = idle_fps;
+    idle.idle_after_ms = idle_after_ms;
+    idle.idle = false;
+    idle.refine = false;
+    idle.last_change = std::chrono::steady_clock::now();
+    idle.last_encode = idle.last_change;
+}
+
+bool idle_should_encode(IdleController& idle, bool changed) {
+    auto now = std::chrono::steady_clock::now();
+    idle.refine = false;
+
+    if (changed) {
+        if (idle.idle) {
+            std::cout << "[Host] Motion resumed\n";
+        }
+        idle.idle = false;
+        idle.last_change = now;
+        idle.last_encode = now;
+        return true;
+    }
+
+    if (!idle.idle) {
+        if (now - idle.last_change < std::chrono::milliseconds(idle.idle_after_ms)) {
+            idle.last_encode = now;
+            return true;
+        }
+        // The encoder spent its bits on motion so far, one keyframe of the
+        // settled image brings it to full quality before encoding slows down
+        std::cout << "[Host] Static scene, encoding at " << idle.idle_fps << " fps\n";
+        idle.idle = true;
+        idle.refine = true;
+        idle.last_encode = now;
+        return true;
+    }
+
+    if (idle.idle_fps <= 0) return false;
+    if (now - idle.last_encode < std::chrono::milliseconds(1000 / idle.idle_fps)) return false;
+    idle.last_encode = now;
+    return true;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <chrono>
+
+// Lowers the encode rate while the captured image is static (paused game,
+// loading screen, menus) and resumes on the first changed frame.
+struct IdleController {
+    int idle_fps = 2;               // Encode rate while idle, 0 stops encoding
+    int idle_after_ms = 500;        // Static time before going idle
+    bool idle = false;
+    bool refine = false;            // Next encoded frame is the refinement frame
+    std::chrono::steady_clock::time_point last_change;
+    std::chrono::steady_clock::time_point last_encode;
+};
+
+void init_idle_controller(IdleController& idle, int idle_fps, int idle_after_ms);
+
+// Whether the current capture should be encoded. On entering idle one more
+// frame is encoded with refine set, so the static image is sent as a keyframe.
+bool idle_should_encode(IdleController& idle, bool changed);
@@ -0,0 +1,257 @@
+#include "pacer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <iostream>
+
+#include "shared/protocol.h"
+#include "shared/rtp.h"
+
+#ifdef _WIN32
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#else
+#include <time.h>
+#endif
+
+// Sleeps `us` microseconds on the most precise timer the platform has: a
+// high-resolution waitable timer on Windows 10 1803 and later (ordinary
+// timers tick every 15.6 ms), clock_nanosleep with an absolute deadline on
+// Linux, whose hrtimers wake within tens of microseconds.
+static void precise_sleep(Pacer& pacer, uint64_t us) {
+#ifdef _WIN32
+    LARGE_INTEGER due;
+    due.QuadPart = -(LONGLONG)(us * 10);    // Relative, in 100 ns units
+    if (pacer.timer && SetWaitableTimer(pacer.timer, &due, 0, nullptr, nullptr, FALSE)) {
+        WaitForSingleObject(pacer.timer, INFINITE);
+    } else {
+        Sleep((DWORD)((us + 999) / 1000));
+    }
+#elif defined(__linux__)
+    (void)pacer;
+    timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += (long)(us % 1000000) * 1000;
+    deadline.tv_sec += (time_t)(us / 1000000) + deadline.tv_nsec / 1000000000;
+    deadline.tv_nsec %= 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR) {
+    }
+#else
+    (void)pacer;
+    timespec duration;
+    duration.tv_sec = (time_t)(us / 1000000);
+    duration.tv_nsec = (long)(us % 1000000) * 1000;
+    nanosleep(&duration, nullptr);
+#endif
+}
+
+static bool has_backlog(const Pacer& pacer) {
+    for (const auto& flow : pacer.flows) {
+        if (!flow->queue.empty()) return true;
+    }
+    return false;
+}
+
+// Datagrams taken off one flow's queue, sent outside the lock
+struct PacerBatch {
+    std::shared_ptr<PacerFlow> flow;
+    std::vector<PacedDatagram> datagrams;
+};
+
+// Takes what the flow's bucket allows at `now_us` into `batch` and returns
+// when its next datagram is due, 0 when it has none left
+static uint64_t take_due(PacerFlow& flow, uint64_t now_us, PacerBatch& batch) {
+    flow.tokens = std::min(flow.bucket, flow.tokens + flow.rate * (double)(now_us - flow.refilled_us));
+    flow.refilled_us = now_us;
+    // The rate follows the deadline, so a late wake-up is made up for
+    // instead of pushing the frame past it
+    const bool overdue = now_us >= flow.deadline_us;
+    flow.rate = overdue ? 0 : flow.queued_bytes / (double)(flow.deadline_us - now_us);
+    while (!flow.queue.empty()) {
+        const double size = (double)flow.queue.front().data.size();
+        if (!overdue && flow.tokens < size && flow.tokens < flow.bucket) break;
+        flow.tokens = std::max(flow.tokens - size, 0.0);
+        flow.queued_bytes -= flow.queue.front().data.size();
+        batch.datagrams.push_back(std::move(flow.queue.front()));
+        flow.queue.pop_front();
+    }
+    if (flow.queue.empty()) return 0;
+    const double missing = std::min((double)flow.queue.front().data.size(), flow.bucket) - flow.tokens;
+    return now_us + (uint64_t)std::ceil(missing / flow.rate);
+}
+
+static void run_pacer(Pacer& pacer) {
+    std::vector<PacerBatch> batches;
+    std::vector<SendBuffer> buffers;
+    std::unique_lock<std::mutex> lock(pacer.mutex);
+    while (!pacer.stopping) {
+        if (!has_backlog(pacer)) {
+            pacer.wake.wait(lock, [&] { return pacer.stopping || has_backlog(pacer); });
+            continue;
+        }
+
+        uint64_t now_us = protocol_timestamp_us();
+        uint64_t next_us = now_us + PACER_MAX_SLEEP_US;
+        batches.clear();
+        for (const auto& flow : pacer.flows) {
+            if (flow->queue.empty()) continue;
+            PacerBatch batch;
+            batch.flow = flow;
+            const uint64_t due_us = take_due(*flow, now_us, batch);
+            if (due_us != 0) next_us = std::min(next_us, due_us);
+            if (!batch.datagrams.empty()) batches.push_back(std::move(batch));
+        }
+
+        // A full socket buffer is loss like any other. A device that refuses
+        // segmented sends is asked once.
+        lock.unlock();
+        bool refused = false;
+        for (const PacerBatch& batch : batches) {
+            buffers.clear();
+            for (const PacedDatagram& datagram : batch.datagrams) {
+                buffers.push_back({ datagram.data.data(), datagram.data.size() });
+                if (datagram.capture_us == 0 || !pacer.stamps) continue;
+                // Each frame's end leaves in a stamped send of its own
+                send_stamped_datagrams(*pacer.stamps, batch.flow->fd, batch.flow->addr, buffers.data(),
+                                       buffers.size(), pacer.segment && !refused, datagram.capture_us, &refused);
+                buffers.clear();
+            }
+            send_datagrams(batch.flow->fd, batch.flow->addr, buffers.data(), buffers.size(), pacer.segment && !refused,
+                           &refused);
+        }
+        if (refused && pacer.segment) {
+            pacer.segment = false;
+            std::cerr << "[Host] Device refuses segmented sends, pacing datagram by datagram\n";
+        }
+        const uint64_t sent_us = protocol_timestamp_us();
+        lock.lock();
+
+        for (PacerBatch& batch : batches) {
+            PacerFlow& flow = *batch.flow;
+            for (PacedDatagram& datagram : batch.datagrams) {
+                const uint64_t delay_us = sent_us - datagram.queued_us;
+                pacer.delay_total_us += delay_us;
+                pacer.delay_max_us = std::max(pacer.delay_max_us, delay_us);
+                ++pacer.delayed;
+                if (flow.closed) continue;
+                // Repair packets have their own sequence numbers and get no feedback
+                const RtpHeader& rtp = *(const RtpHeader*)datagram.data.data();
+                if ((rtp.marker_type & 0x7F) == RTP_PAYLOAD_TYPE) {
+                    flow.sent.push_back({ rtp.sequence, (uint16_t)datagram.data.size(), sent_us });
+                }
+                if (flow.spare.size() < PACER_SPARE_BUFFERS) flow.spare.push_back(std::move(datagram.data));
+            }
+        }
+
+        now_us = protocol_timestamp_us();
+        if (next_us > now_us) {
+            lock.unlock();
+            precise_sleep(pacer, next_us - now_us);
+            lock.lock();
+        }
+    }
+}
+
+bool start_pacer(Pacer& pacer, double share, double keyframe_share, bool segment) {
+    pacer.share = share;
+    pacer.keyframe_share = keyframe_share;
+    pacer.segment = segment;
+#ifdef _WIN32
+    pacer.timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!pacer.timer) pacer.timer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+#endif
+    pacer.stopping = false;
+    pacer.thread = std::thread(run_pacer, std::ref(pacer));
+    return true;
+}
+
+std::shared_ptr<PacerFlow> pacer_add_flow(Pacer& pacer, socket_t fd, const sockaddr_in& addr) {
+    auto flow = std::make_shared<PacerFlow>();
+    flow->fd = fd;
+    flow->addr = addr;
+    std::lock_guard<std::mutex> lock(pacer.mutex);
+    pacer.flows.push_back(flow);
+    return flow;
+}
+
+void pace_datagrams(Pacer& pacer, PacerFlow& flow, const SendBuffer* datagrams, size_t count,
+    bool keyframe, double frame_interval, uint64_t capture_us) {
+    if (count == 0) return;
+    const uint64_t now_us = protocol_timestamp_us();
+    const double share = keyframe ? pacer.keyframe_share : pacer.share;
+    const uint64_t window_us = std::max((uint64_t)(share * frame_interval * 1e6), PACER_MIN_WINDOW_US);
+    size_t largest = 0;
+    for (size_t i = 0; i < count; ++i) largest = std::max(largest, datagrams[i].size);
+
+    std::lock_guard<std::mutex> lock(pacer.mutex);
+    if (flow.closed) return;
+    const bool idle = flow.queue.empty();
+    for (size_t i = 0; i < count; ++i) {
+        PacedDatagram datagram;
+        if (!flow.spare.empty()) {
+            datagram.data = std::move(flow.spare.back());
+            flow.spare.pop_back();
+        }
+        const uint8_t* bytes = (const uint8_t*)datagrams[i].data;
+        datagram.data.assign(bytes, bytes + datagrams[i].size);
+        datagram.queued_us = now_us;
+        if (i + 1 == count) datagram.capture_us = capture_us;
+        flow.queue.push_back(std::move(datagram));
+        flow.queued_bytes += datagrams[i].size;
+    }
+    // A frame behind a queued one waits for it, however short its own share,
+    // and leaves no larger bursts than the queued one allowed
+    flow.deadline_us = idle ? now_us + window_us : std::max(flow.deadline_us, now_us + window_us);
+    const double bucket = (double)(keyframe ? largest : largest * PACER_BUCKET_DATAGRAMS);
+    flow.bucket = idle ? bucket : std::min(flow.bucket, bucket);
+    if (idle) {
+        // Saved up while the queue was empty
+        flow.tokens = flow.bucket;
+        flow.refilled_us = now_us;
+        flow.rate = 0;
+        pacer.wake.notify_one();
+    }
+}
+
+void pacer_take_sent(Pacer& pacer, PacerFlow& flow, std::vector<PacedSend>& sends) {
+    std::lock_guard<std::mutex> lock(pacer.mutex);
+    sends.swap(flow.sent);
+    flow.sent.clear();
+}
+
+void pacer_close_flow(Pacer& pacer, PacerFlow& flow) {
+    std::lock_guard<std::mutex> lock(pacer.mutex);
+    flow.closed = true;
+    flow.queue.clear();
+    flow.queued_bytes = 0;
+    flow.sent.clear();
+    flow.spare.clear();
+    pacer.flows.erase(std::remove_if(pacer.flows.begin(), pacer.flows.end(),
+                                     [&](const std::shared_ptr<PacerFlow>& f) { return f.get() == &flow; }),
+                      pacer.flows.end());
+}
+
+void pacer_take_delay(Pacer& pacer, uint64_t& count, uint64_t& total_us, uint64_t& max_us) {
+    std::lock_guard<std::mutex> lock(pacer.mutex);
+    count = pacer.delayed;
+    total_us = pacer.delay_total_us;
+    max_us = pacer.delay_max_us;
+    pacer.delayed = pacer.delay_total_us = pacer.delay_max_us = 0;
+}
+
+void stop_pacer(Pacer& pacer) {
+    if (!pacer.thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(pacer.mutex);
+        pacer.stopping = true;
+        pacer.flows.clear();
+    }
+    pacer.wake.notify_one();
+    pacer.thread.join();
+#ifdef _WIN32
+    if (pacer.timer) CloseHandle(pacer.timer);
+    pacer.timer = nullptr;
+#endif
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "shared/socket.h"
+
+// Token-bucket pacing of UDP video. Instead of leaving in one burst that
+// overflows switch and access point buffers, each frame's datagrams drain
+// from a per-viewer queue at the rate that empties it within a share of the
+// frame interval. A keyframe gets a longer share and a bucket of a single
+// datagram, so its burst is spread the most. One thread sends for every
+// viewer and sleeps on a high-resolution timer between datagrams.
+
+// Burst a P-frame may send at once after an idle queue, in datagrams
+const size_t PACER_BUCKET_DATAGRAMS = 4;
+// Shortest window a frame is spread over, shorter ones are sent as they come
+const uint64_t PACER_MIN_WINDOW_US = 1000;
+// Longest the thread sleeps while datagrams wait, so new frames start soon
+const uint64_t PACER_MAX_SLEEP_US = 1000;
+// Sent datagram buffers a flow keeps for its next frames, a keyframe's worth
+const size_t PACER_SPARE_BUFFERS = 256;
+
+struct PacedDatagram {
+    std::vector<uint8_t> data;
+    uint64_t queued_us = 0;
+    uint64_t capture_us = 0;        // On a frame's last datagram, whose send gets stamped
+};
+
+// A paced RTP video packet, for the congestion controller's send times
+struct PacedSend {
+    uint16_t sequence = 0;
+    uint16_t size = 0;
+    uint64_t send_us = 0;
+};
+
+// One viewer's queue. Everything but fd and addr is guarded by Pacer::mutex.
+struct PacerFlow {
+    socket_t fd;
+    sockaddr_in addr{};
+    std::deque<PacedDatagram> queue;
+    size_t queued_bytes = 0;
+    double rate = 0;                // Bytes per microsecond
+    double tokens = 0;              // Bytes that may leave now
+    double bucket = 0;              // Most tokens saved up while idle, kept while frames wait
+    uint64_t refilled_us = 0;
+    uint64_t deadline_us = 0;       // When the queue is due to be empty
+    std::vector<PacedSend> sent;    // RTP video sent since the last pacer_take_sent
+    std::vector<std::vector<uint8_t>> spare;    // Sent datagrams' buffers, queued again instead of allocating
+    bool closed = false;
+};
+
+struct Pacer {
+    double share = 0;               // Of the frame interval a P-frame is spread over
+    double keyframe_share = 0;
+    bool segment = false;           // Due datagrams leave as segmented sends until the device refuses one
+    TxTimestamps* stamps = nullptr; // Kernel transmit timestamps of frame ends, if any
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread thread;
+    bool stopping = false;
+    std::vector<std::shared_ptr<PacerFlow>> flows;
+    // Queueing delay of the datagrams sent since the last pacer_take_delay
+    uint64_t delay_total_us = 0;
+    uint64_t delay_max_us = 0;
+    uint64_t delayed = 0;
+#ifdef _WIN32
+    HANDLE timer = nullptr;         // High-resolution waitable timer
+#endif
+};
+
+// Starts the sending thread. `share` and `keyframe_share` are fractions of
+// the frame interval, above 0.
+bool start_pacer(Pacer& pacer, double share, double keyframe_share, bool segment);
+
+// A queue for datagrams to `addr` over `fd`, until pacer_close_flow
+std::shared_ptr<PacerFlow> pacer_add_flow(Pacer& pacer, socket_t fd, const sockaddr_in& addr);
+
+// Queues copies of one frame's datagrams, due out within the frame's share
+// of `frame_interval` seconds or with what is still queued, whichever ends
+// later. With Pacer::stamps the last one's send is stamped, tagged with
+// `capture_us`. While earlier frames are queued the burst stays at the
+// smaller of theirs and this frame's, so a P-frame behind a keyframe does
+// not widen it.
+void pace_datagrams(Pacer& pacer, PacerFlow& flow, const SendBuffer* datagrams, size_t count,
+    bool keyframe, double frame_interval, uint64_t capture_us);
+
+// Moves the flow's sent RTP video packets into `sends`
+void pacer_take_sent(Pacer& pacer, PacerFlow& flow, std::vector<PacedSend>& sends);
+
+// Drops what the flow still has queued and stops sending to it
+void pacer_close_flow(Pacer& pacer, PacerFlow& flow);
+
+// Queueing delay since the last call: datagrams sent, their total and
+// their longest delay
+void pacer_take_delay(Pacer& pacer, uint64_t& count, uint64_t& total_us, uint64_t& max_us);
+
+// Drops every queue and joins the thread
+void stop_pacer(Pacer& pacer);
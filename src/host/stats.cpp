@@ -0,0 +1,36 @@
+#include "stats.h"
+#include <iomanip>
+#include <iostream>
+
+void report_host_stats(HostStats& stats, std::chrono::seconds interval) {
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = now - stats.window_start;
+    if (elapsed < interval) return;
+
+    const double seconds = elapsed.count();
+    std::cout << std::fixed << std::setprecision(1)
+              << "[Host] capture " << stats.frames_captured / seconds << " fps"
+              << ", encode " << stats.frames_encoded / seconds << " fps"
+              << ", " << stats.bytes_encoded * 8 / seconds / 1000 << " kbps";
+    if (stats.target_kbps > 0) std::cout << " (target " << stats.target_kbps << ")";
+    std::cout << ", content " << stats.content_class
+              << ", scene cuts " << stats.scene_cuts;
+    if (stats.datagrams_paced > 0) {
+        std::cout << ", pacing delay " << stats.pacing_delay_us / 1000.0 / stats.datagrams_paced
+                  << " ms (max " << stats.pacing_max_delay_us / 1000.0 << ")";
+    }
+    if (stats.frames_stamped > 0) {
+        std::cout << ", capture to wire " << stats.capture_to_wire_us / 1000.0 / stats.frames_stamped
+                  << " ms (max " << stats.capture_to_wire_max_us / 1000.0 << ", in the kernel "
+                  << stats.kernel_send_us / stats.frames_stamped << " us)";
+    }
+    std::cout << "\n";
+    std::cout.unsetf(std::ios::floatfield);
+
+    const char* content_class = stats.content_class;
+    const int target_kbps = stats.target_kbps;
+    stats = HostStats();
+    stats.content_class = content_class;
+    stats.target_kbps = target_kbps;
+    stats.window_start = now;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// Host-side counters, printed periodically by the capture loop
+struct HostStats {
+    uint64_t frames_captured = 0;
+    uint64_t frames_encoded = 0;
+    uint64_t bytes_encoded = 0;
+    uint64_t scene_cuts = 0;
+    const char* content_class = "n/a";
+    int target_kbps = 0;        // Full-size stream's encoder target, 0 = not H.264
+    // Time UDP video waited in the pacer
+    uint64_t datagrams_paced = 0;
+    uint64_t pacing_delay_us = 0;
+    uint64_t pacing_max_delay_us = 0;
+    // Kernel send timestamps of UDP video frames' last datagrams: time spent
+    // in the kernel after the send call, and from capture until it left
+    uint64_t frames_stamped = 0;
+    uint64_t kernel_send_us = 0;
+    uint64_t capture_to_wire_us = 0;
+    uint64_t capture_to_wire_max_us = 0;
+    std::chrono::steady_clock::time_point window_start = std::chrono::steady_clock::now();
+};
+
+// Prints and resets the counters once `interval` has passed
+void report_host_stats(HostStats& stats, std::chrono::seconds interval = std::chrono::seconds(5));
@@ -0,0 +1,1157 @@
+#include "viewers.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <utility>
+
+#include "shared/h264.h"
+
+static void shutdown_socket(socket_t fd) {
+#ifdef _WIN32
+    shutdown(fd, SD_BOTH);
+#else
+    shutdown(fd, SHUT_RDWR);
+#endif
+}
+
+// Wakes the viewer's reader thread, which closes the socket. Nothing is left
+// to wake once it has, and the number may belong to another connection.
+static void shutdown_viewer(Viewer& viewer) {
+    std::lock_guard<std::mutex> lock(viewer.send_mutex);
+    if (viewer.fd != (socket_t)-1) shutdown_socket(viewer.fd);
+}
+
+// Event loop tick, bounds how late silent peers are noticed
+static const int EVENT_LOOP_TICK_MS = 250;
+// Clients ping every second, a viewer silent for this long is gone
+static const auto VIEWER_TIMEOUT = std::chrono::seconds(5);
+// Unsent bytes after which a viewer is dropped as hopelessly behind
+static const size_t VIEWER_QUEUE_LIMIT = 64 * 1024 * 1024;
+static const size_t RECV_CHUNK = 64 * 1024;
+// io_uring event loop: viewers beyond RING_SLOTS are served through the
+// poller. Each slot pins RING_RECV_SIZE bytes, clients only send control
+// messages.
+static const unsigned RING_SLOTS = 64;
+static const size_t RING_RECV_SIZE = 16 * 1024;
+// How long the event loop waits on its way out for the ring's operations to
+// come back after shutting their sockets down
+static const int RING_DRAIN_MS = 1000;
+// Unsent bytes a viewer socket holds before it stops reporting writable. Past
+// that the backlog stays in the send queue, where stale frames can be dropped.
+static const int VIEWER_UNSENT_LIMIT = 16 * 1024;
+// Congestion control never asks the encoder for less than this
+static const int CONGESTION_MIN_BITRATE = 300'000;
+// Queueing delay congestion control lets stand over TCP, above UDP's
+// CONGESTION_QUEUE_TARGET_US: RTT samples are coarser and the socket buffer
+// counts
+static const uint64_t TCP_QUEUE_TARGET_US = 40'000;
+// Bandwidth probe: padding goes out every PROBE_INTERVAL_US at this many
+// times the rendition's bitrate, so a path that takes the full rate shows
+// it. The client's result may take PROBE_RESULT_TIMEOUT_US after the burst.
+static const double PROBE_HEADROOM = 1.5;
+static const uint64_t PROBE_INTERVAL_US = 2'000;
+static const size_t PROBE_MAX_PADDING = 64 * 1024;
+static const uint64_t PROBE_RESULT_TIMEOUT_US = 500'000;
+// Queueing delay at which the probe stops adding padding: the path has shown
+// it is slower, and what is queued delays the first frame
+static const double PROBE_QUEUE_LIMIT_US = 15'000;
+// Share of the probed rate the encoder starts at
+static const double PROBE_USABLE_SHARE = 0.85;
+
+static const MessageHeader& queued_header(const QueuedMessage& message) {
+    return *(const MessageHeader*)message.head;
+}
+
+static bool queued_keyframe(const QueuedMessage& message) {
+    const MessageHeader& header = queued_header(message);
+    return header.type == MSG_VIDEO_FRAME && (header.flags & MSG_FLAG_KEYFRAME);
+}
+
+static int queued_temporal_layer(const QueuedMessage& message) {
+    if (message.head_size < sizeof(VideoFrameHead)) return 0;
+    return ((const VideoFrameHead*)message.head)->info.temporal_layer;
+}
+
+// Appends a message to the send queue. While resyncing, video up to the next
+// keyframe is discarded. Call with the send lock held.
+static void push_queued(Viewer& viewer, MessageHeader& header, size_t head_size,
+    std::shared_ptr<const uint8_t> payload, size_t payload_size) {
+    if (viewer.resyncing && header.type == MSG_VIDEO_FRAME) {
+        if (!(header.flags & MSG_FLAG_KEYFRAME)) return;
+        viewer.resyncing = false;
+    }
+    header.sequence = viewer.next_sequence++;
+    header.payload_size = (uint32_t)(head_size - sizeof(MessageHeader) + payload_size);
+    QueuedMessage message;
+    memcpy(message.head, &header, head_size);
+    message.head_size = head_size;
+    message.payload = std::move(payload);
+    message.payload_size = payload_size;
+    message.queued_at = std::chrono::steady_clock::now();
+    viewer.queued_bytes += head_size + payload_size;
+    viewer.send_queue.push_back(std::move(message));
+}
+
+// Shared copy of bytes the caller only lends for the duration of a call
+static std::shared_ptr<const uint8_t> share_copy(const void* data, size_t size) {
+    auto copy = std::make_shared<std::vector<uint8_t>>((const uint8_t*)data, (const uint8_t*)data + size);
+    return std::shared_ptr<const uint8_t>(copy, copy->data());
+}
+
+void queue_to_viewer(Viewer& viewer, MessageHeader& header, size_t head_size,
+    std::shared_ptr<const uint8_t> payload, size_t payload_size) {
+    std::lock_guard<std::mutex> lock(viewer.send_mutex);
+    push_queued(viewer, header, head_size, std::move(payload), payload_size);
+}
+
+bool send_to_viewer(Viewer& viewer, MessageHeader& header, size_t head_size,
+    const uint8_t* payload, size_t payload_size) {
+    std::lock_guard<std::mutex> lock(viewer.send_mutex);
+    if (viewer.queued) {
+        push_queued(viewer, header, head_size, share_copy(payload, payload_size), payload_size);
+        return viewer.connected;
+    }
+    if (!viewer.connected) return false;
+    header.sequence = viewer.next_sequence++;
+    if (!send_protocol_message(viewer.transport, header, head_size, payload, payload_size)) {
+        viewer.connected = false;
+        return false;
+    }
+    return true;
+}
+
+bool send_batch_to_viewer(Viewer& viewer, const MessageBatch& batch) {
+    std::lock_guard<std::mutex> lock(viewer.send_mutex);
+    if (viewer.queued) {
+        for (size_t i = 0; i < batch.headers.size(); ++i) {
+            const SendBuffer& head = batch.buffers[2 * i];
+            const SendBuffer& payload = batch.buffers[2 * i + 1];
+            push_queued(viewer, *batch.headers[i], head.size, share_copy(payload.data, payload.size), payload.size);
+        }
+        return viewer.connected;
+    }
+    if (!viewer.connected) return false;
+    for (MessageHeader* header : batch.headers) {
+        header->sequence = viewer.next_sequence++;
+    }
+    if (!send_protocol_batch(viewer.transport, batch)) {
+        viewer.connected = false;
+        return false;
+    }
+    return true;
+}
+
+// Stops segmented sends once the device has refused one, rather than paying a
+// failed syscall for every frame
+static void note_segmentation(ViewerList& list, bool refused) {
+    if (refused && list.udp_gso.exchange(false)) {
+        std::cerr << "[Host] Device refuses segmented sends, sending datagram by datagram\n";
+    }
+}
+
+// Hands the send times of paced video to the congestion controller. Call
+// with the send lock held.
+static void record_paced_sends(ViewerList& list, Viewer& viewer) {
+    static thread_local std::vector<PacedSend> sends;
+    pacer_take_sent(list.pacer, *viewer.pacing, sends);
+    if (!viewer.congestion_control) return;
+    for (const PacedSend& send : sends) {
+        congestion_packet_sent(viewer.congestion, send.sequence, send.size, send.send_us);
+    }
+}
+
+bool send_udp_video(ViewerList& list, Viewer& viewer, const VideoFrameHead& head, const uint8_t* data, size_t size) {
+    std::lock_guard<std::mutex> lock(viewer.send_mutex);
+    rtp_packetize(viewer.rtp, head, data, size);
+    if (viewer.pacing) {
+        const bool keyframe = head.header.flags & MSG_FLAG_KEYFRAME;
+        pace_datagrams(list.pacer, *viewer.pacing, viewer.rtp.datagrams.data(), viewer.rtp.datagrams.size(),
+                       keyframe, list.frame_interval, head.header.timestamp_us);
+        record_paced_sends(list, viewer);
+        return true;
+    }
+    // A full socket buffer is loss like any other, only TCP tells of a
+    // viewer going away
+    bool refused = false;
+    const bool sent = send_stamped_datagrams(list.tx_stamps, viewer.udp_fd, viewer.udp_addr, viewer.rtp.datagrams.data(),
+                                             viewer.rtp.datagrams.size(), list.udp_gso, head.header.timestamp_us, &refused);
+    note_segmentation(list, refused);
+    if (viewer.congestion_control) {
+        // Repair packets have their own sequence numbers and get no feedback
+        const uint64_t now_us = protocol_timestamp_us();
+        for (const SendBuffer& datagram : viewer.rtp.datagrams) {
+            const RtpHeader& rtp = *(const RtpHeader*)datagram.data;
+            if ((rtp.marker_type & 0x7F) != RTP_PAYLOAD_TYPE) continue;
+            congestion_packet_sent(viewer.congestion, rtp.sequence, datagram.size, now_us);
+        }
+    }
+    return sent;
+}
+
+bool send_packet_to_viewer(Viewer& viewer, MessageHeader& header, size_t head_size, const AVPacket* pkt) {
+    std::lock_guard<std::mutex> lock(viewer.send_mutex);
+    if (!viewer.connected) return false;
+    header.sequence = viewer.next_sequence++;
+    if (!send_zerocopy(viewer.zerocopy, viewer.transport, header, head_size, pkt)) {
+        viewer.connected = false;
+        return false;
+    }
+    return true;
+}
+
+// Frees the viewer's send state and closes its socket. Call with the send
+// lock held once the viewer may be shared: the sends check `connected` and
+// the shutdowns check `fd` under it, so none of them reaches a number the
+// next connection may have been given.
+static void release_viewer(Viewer& viewer) {
+    viewer.connected = false;
+    destroy_zerocopy(viewer.zerocopy);
+    close_socket(viewer.fd);
+    viewer.fd = (socket_t)-1;
+}
+
+// Starts the congestion controller of the viewer's transport at
+// `start_bitrate`, never above `max_bitrate`. Call with the send lock held or
+// before the viewer is shared.
+static void start_congestion_control(Viewer& viewer, int start_bitrate, int max_bitrate) {
+    const int min_bitrate = std::min(CONGESTION_MIN_BITRATE, max_bitrate);
+    start_bitrate = std::min(std::max(start_bitrate, min_bitrate), max_bitrate);
+    if (viewer.udp) {
+        init_congestion_controller(viewer.congestion, start_bitrate, min_bitrate, max_bitrate, CONGESTION_QUEUE_TARGET_US);
+    } else {
+        init_tcp_rate_controller(viewer.tcp_rate, start_bitrate, min_bitrate, max_bitrate, TCP_QUEUE_TARGET_US);
+    }
+    viewer.congestion_control = true;
+}
+
+// Moves a probed viewer to the richest rendition, no richer than the one it
+// asked for, that the rate the probe arrived at covers (the leanest when none
+// does) and starts its congestion controller there
+static void finish_probe(ViewerList& list, Viewer& viewer, uint32_t probed) {
+    std::lock_guard<std::mutex> list_lock(list.mutex);
+    if (!viewer.probing) return;
+    const int requested = viewer.rendition;
+    const int budget = probed > 0 ? (int)std::min(PROBE_USABLE_SHARE * probed, (double)INT32_MAX)
+                                  : list.bitrates[requested];
+    int chosen = requested;
+    for (int i = 0; i < (int)list.bitrates.size(); ++i) {
+        const int rate = list.bitrates[i], best = list.bitrates[chosen];
+        if (rate > list.bitrates[requested]) continue;
+        if (best > budget ? rate < best : rate <= budget && rate > best) chosen = i;
+    }
+    viewer.rendition = chosen;
+    if (list.congestion_control) {
+        std::lock_guard<std::mutex> lock(viewer.send_mutex);
+        start_congestion_control(viewer, budget, list.bitrates[chosen]);
+        viewer.target_bitrate = viewer.udp ? (int)viewer.congestion.target : (int)viewer.tcp_rate.target;
+    }
+    viewer.probing = false;
+    std::cout << "[Host] Probe arrived at " << probed / 1000 << " kbps, starting rendition " << chosen;
+    if (list.congestion_control) std::cout << " at " << viewer.target_bitrate / 1000 << " kbps";
+    std::cout << "\n";
+}
+
+// Applies one control message from a subscribed viewer
+static void handle_viewer_message(ViewerList& list, Viewer& viewer, const MessageHeader& header,
+    const std::vector<uint8_t>& payload) {
+    switch (header.type) {
+    case MSG_RENDITION_REQUEST:
+        if (const RenditionInfo* request = message_view<RenditionInfo>(payload)) {
+            viewer.pending_rendition = (int)request->rendition;
+        }
+        break;
+    case MSG_VIEWPORT:
+        if (const ViewportInfo* viewport = message_view<ViewportInfo>(payload)) {
+            const int width = (int)viewport->width, height = (int)viewport->height;
+            const int refresh_mhz = (int)viewport->refresh_mhz;
+            std::cout << "[Host] Viewer window " << width << "x" << height
+                      << " @ " << refresh_mhz / 1000.0 << " Hz\n";
+            viewer.refresh_mhz = refresh_mhz;
+            viewer.viewport_height = height;
+            viewer.viewport_width = width;
+        }
+        break;
+    case MSG_KEYFRAME_REQUEST:
+        viewer.wants_keyframe = true;
+        break;
+    case MSG_RECEIVER_REPORT:
+        if (const ReceiverReport* report = message_view<ReceiverReport>(payload)) {
+            const uint32_t expected = report->packets_expected;
+            if (!viewer.udp || expected == 0) break;
+            const double loss = (double)(uint32_t)report->packets_lost / expected;
+            std::lock_guard<std::mutex> lock(viewer.send_mutex);
+            rtp_report_loss(viewer.rtp, loss);
+            if (viewer.congestion_control) {
+                viewer.target_bitrate = congestion_report_loss(viewer.congestion, loss, protocol_timestamp_us());
+            }
+        }
+        break;
+    case MSG_NACK:
+        if (const NackInfo* nack = message_view<NackInfo>(payload)) {
+            const be16* listed = (const be16*)(payload.data() + sizeof(NackInfo));
+            const size_t count = std::min({ (size_t)(uint16_t)nack->count, RTP_MAX_NACKS,
+                                            (payload.size() - sizeof(NackInfo)) / sizeof(be16) });
+            if (!viewer.udp || count == 0) break;
+            uint16_t sequences[RTP_MAX_NACKS];
+            for (size_t i = 0; i < count; ++i) sequences[i] = listed[i];
+
+            std::lock_guard<std::mutex> lock(viewer.send_mutex);
+            const size_t expired = rtp_retransmit(viewer.rtp, sequences, count, (uint32_t)nack->rtt_us / 2);
+            if (!viewer.rtp.retransmits.empty()) {
+                bool refused = false;
+                send_datagrams(viewer.udp_fd, viewer.udp_addr, viewer.rtp.retransmits.data(), viewer.rtp.retransmits.size(),
+                               list.udp_gso, &refused);
+                note_segmentation(list, refused);
+            }
+            // The frame misses its deadline anyway, an IDR ends the wait sooner
+            if (expired > 0) viewer.wants_keyframe = true;
+        }
+        break;
+    case MSG_TRANSPORT_FEEDBACK:
+        if (const TransportFeedback* feedback = message_view<TransportFeedback>(payload)) {
+            const FeedbackArrival* arrivals = (const FeedbackArrival*)(payload.data() + sizeof(TransportFeedback));
+            const size_t count = std::min((size_t)(uint16_t)feedback->count,
+                                          (payload.size() - sizeof(TransportFeedback)) / sizeof(FeedbackArrival));
+            if (!viewer.udp || !viewer.congestion_control || count == 0) break;
+            const uint64_t base_us = feedback->base_arrival_us;
+
+            std::lock_guard<std::mutex> lock(viewer.send_mutex);
+            if (viewer.pacing) record_paced_sends(list, viewer);
+            for (size_t i = 0; i < count; ++i) {
+                congestion_packet_arrived(viewer.congestion, arrivals[i].sequence,
+                                          base_us + (uint32_t)arrivals[i].arrival_delta_us);
+            }
+            viewer.target_bitrate = congestion_update(viewer.congestion, (uint32_t)feedback->rtt_us, protocol_timestamp_us());
+        }
+        break;
+    case MSG_PROBE_RESULT:
+        if (const ProbeResult* result = message_view<ProbeResult>(payload)) {
+            finish_probe(list, viewer, result->bitrate);
+        }
+        break;
+    case MSG_PING: {
+        MessageHeader pong;
+        pong.type = MSG_PONG;
+        pong.timestamp_us = header.timestamp_us;
+        send_to_viewer(viewer, pong, sizeof(pong), nullptr, 0);
+        break;
+    }
+    default:
+        // Input injection does not exist yet, other types are host-to-client
+        break;
+    }
+}
+
+// Answers the client's STREAM_INIT and adds the viewer to the list
+static bool subscribe_viewer(ViewerList& list, const std::shared_ptr<Viewer>& viewer,
+    const std::vector<uint8_t>& payload) {
+    const RenditionInfo* request = message_view<RenditionInfo>(payload);
+    if (!request) return false;
+    const int rendition = (int)request->rendition;
+    const SubscribeInfo* subscribe = message_view<SubscribeInfo>(payload);
+    const uint16_t udp_port = subscribe ? (uint16_t)subscribe->udp_port : 0;
+
+    viewer->subscribed_at = std::chrono::steady_clock::now();
+    viewer->rendition = rendition >= 0 && rendition < list.rendition_count ? rendition : 0;
+    init_layer_filter(viewer->layer_filter, list.temporal_layers);
+    if (list.zerocopy && !init_zerocopy(viewer->zerocopy, viewer->fd)) {
+        std::cerr << "[Host] Zero-copy send unavailable, copying\n";
+    }
+
+    // The client can set up its decoder while the forced IDR is encoded. The
+    // viewer is not in the list yet, so nothing else sends on the socket.
+    StreamInitHead reply;
+    reply.header.type = MSG_STREAM_INIT;
+    reply.header.timestamp_us = protocol_timestamp_us();
+    reply.info.codec = list.codec;
+    reply.info.stripe_count = (uint8_t)list.stripe_count;
+    reply.info.rendition_count = (uint8_t)list.rendition_count;
+    reply.info.temporal_layers = (uint8_t)list.temporal_layers;
+
+    // Congestion control starts at the configured rate, or what the probe
+    // found, and never goes above the configured one
+    const int bitrate = viewer->rendition < (int)list.bitrates.size() ? list.bitrates[viewer->rendition] : 0;
+    const bool congestion_control = list.congestion_control && bitrate > 0 && list.codec == CODEC_H264;
+
+    // RTP video goes to the client's port at the address the TCP connection
+    // comes from
+    socklen_t addr_len = sizeof(viewer->udp_addr);
+    if (list.udp && udp_port != 0 && list.codec == CODEC_H264 &&
+        getpeername(viewer->fd, (sockaddr*)&viewer->udp_addr, &addr_len) == 0 &&
+        viewer->udp_addr.sin_family == AF_INET) {
+        viewer->udp_addr.sin_port = htons(udp_port);
+        viewer->udp_fd = list.udp_fd;
+        viewer->udp = true;
+        init_rtp_packetizer(viewer->rtp, list.fec, list.fec_ratio);
+        if (list.retransmits) {
+            // Without a budget anything still in the history is worth sending
+            const int budget_ms = (int)list.latency_budget.count();
+            const uint16_t deadline_ms = (uint16_t)(budget_ms > 0 ? std::min(budget_ms, (int)UINT16_MAX) : UINT16_MAX);
+            init_rtp_history(viewer->rtp, deadline_ms * 1000ull);
+            reply.info.retransmit_ms = deadline_ms;
+        }
+        reply.info.feedback = congestion_control;
+        reply.info.video_transport = VIDEO_OVER_UDP;
+    }
+    if (congestion_control) start_congestion_control(*viewer, bitrate, bitrate);
+    // The probe measures the TCP connection, which shares the path with UDP video
+    const bool probe = list.probe_duration.count() > 0 && subscribe && subscribe->probe &&
+                       bitrate > 0 && list.codec == CODEC_H264;
+    if (probe) reply.header.flags = MSG_FLAG_PROBE;
+
+    std::vector<uint8_t> parameter_sets;
+    {
+        std::lock_guard<std::mutex> lock(list.mutex);
+        if (viewer->rendition < (int)list.parameter_sets.size()) {
+            parameter_sets = list.parameter_sets[viewer->rendition];
+        }
+    }
+    if (!send_to_viewer(*viewer, reply.header, sizeof(reply), parameter_sets.data(), parameter_sets.size())) {
+        std::cerr << "[Host] Failed to send handshake\n";
+        return false;
+    }
+
+    if (probe) {
+        viewer->probe_bitrate = (int)(PROBE_HEADROOM * bitrate);
+        viewer->probe_start_us = protocol_timestamp_us();
+        viewer->probe_next_us = viewer->probe_start_us;
+        viewer->probe_deadline_us = viewer->probe_start_us + list.probe_duration.count() * 1000 + PROBE_RESULT_TIMEOUT_US;
+        viewer->probing = true;
+    }
+
+    viewer->subscribed = true;
+    std::lock_guard<std::mutex> lock(list.mutex);
+    if (viewer->udp && list.pacing) viewer->pacing = pacer_add_flow(list.pacer, list.udp_fd, viewer->udp_addr);
+    list.viewers.push_back(viewer);
+    std::cout << "[Host] Viewer subscribed to rendition " << viewer->rendition;
+    if (viewer->udp) std::cout << ", video over UDP";
+    if (viewer->udp && list.fec != FecScheme::NONE) std::cout << " with " << fec_scheme_name(list.fec) << " FEC";
+    if (viewer->pacing) std::cout << ", paced";
+    if (viewer->congestion_control) std::cout << ", congestion controlled";
+    if (probe) std::cout << ", probing at " << viewer->probe_bitrate / 1000 << " kbps";
+    std::cout << "\n";
+    return true;
+}
+
+// Whether `size` more bytes of padding would only queue: more than that still
+// waits to leave the host, or what is in flight takes PROBE_QUEUE_LIMIT_US
+// more than a round trip at the rate acknowledgments have come back since
+// the probe started
+static bool probe_backed_up(Viewer& viewer, size_t size, uint64_t elapsed_us) {
+    std::lock_guard<std::mutex> lock(viewer.send_mutex);
+    if (!viewer.connected) return true;
+    const size_t queued = viewer.queued ? viewer.queued_bytes : 0;
+    if (queued + (size_t)std::max(socket_unsent_bytes(viewer.fd), 0) > size) return true;
+    TcpPathInfo info;
+    if (!tcp_path_info(viewer.fd, info) || info.min_rtt_us == 0 || elapsed_us <= info.min_rtt_us) return false;
+    const double acked_per_us = info.bytes_acked / (double)(elapsed_us - info.min_rtt_us);
+    return info.bytes_in_flight > acked_per_us * (info.min_rtt_us + PROBE_QUEUE_LIMIT_US);
+}
+
+// Sends the probe padding due at `now_us`, or the closing PROBE once the
+// burst is over. Padding is skipped while the path is slower than the probe.
+// Returns when to call again, 0 after the closing PROBE.
+static uint64_t send_probe(const ViewerList& list, Viewer& viewer, uint64_t now_us) {
+    static const uint8_t padding[PROBE_MAX_PADDING] = {};
+    MessageHead<ProbeInfo> head;
+    head.header.type = MSG_PROBE;
+    head.header.timestamp_us = now_us;
+    head.info.bitrate = (uint32_t)viewer.probe_bitrate;
+    head.info.duration_ms = (uint16_t)std::min<long long>(list.probe_duration.count(), UINT16_MAX);
+    const uint64_t end_us = viewer.probe_start_us + list.probe_duration.count() * 1000;
+    if (now_us >= end_us) {
+        head.info.last = 1;
+        send_to_viewer(viewer, head.header, sizeof(head), nullptr, 0);
+        return 0;
+    }
+
+    const uint64_t elapsed_us = now_us - viewer.probe_start_us;
+    const uint64_t due = (uint64_t)(viewer.probe_bitrate / 8.0 * elapsed_us / 1e6);
+    const size_t size = (size_t)std::min<uint64_t>(due - std::min(viewer.probe_bytes, due), PROBE_MAX_PADDING);
+    viewer.probe_bytes = due;
+    if (size > 0 && !probe_backed_up(viewer, size, elapsed_us)) {
+        send_to_viewer(viewer, head.header, sizeof(head), padding, size);
+    }
+    return std::min(now_us + PROBE_INTERVAL_US, end_us);
+}
+
+// Runs one connection from its STREAM_INIT until it goes away, on its own
+// thread so a slow or silent client holds up nobody else. The thread owns
+// the socket and closes it on exit.
+static void serve_viewer(ViewerList& list, std::shared_ptr<Viewer> viewer) {
+    MessageHeader header;
+    std::vector<uint8_t> payload;
+    if (!recv_protocol_message(viewer->transport, header, payload) || header.type != MSG_STREAM_INIT) {
+        std::cerr << "[Host] Client disconnected before subscribing\n";
+    } else if (subscribe_viewer(list, viewer, payload)) {
+        // The client answers the probe once it is over, the loop below takes that
+        while (viewer->probe_next_us != 0 && viewer->connected) {
+            const uint64_t now_us = protocol_timestamp_us();
+            if (now_us < viewer->probe_next_us) {
+                std::this_thread::sleep_for(std::chrono::microseconds(viewer->probe_next_us - now_us));
+                continue;
+            }
+            viewer->probe_next_us = send_probe(list, *viewer, now_us);
+        }
+        while (recv_protocol_message(viewer->transport, header, payload)) {
+            handle_viewer_message(list, *viewer, header, payload);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(viewer->send_mutex);
+        release_viewer(*viewer);
+    }
+    viewer->finished = true;
+}
+
+// Joins the threads of connections that are over. Call with the list locked.
+static void join_finished_threads(ViewerList& list) {
+    for (auto it = list.threads.begin(); it != list.threads.end();) {
+        if (!it->viewer->finished) {
+            ++it;
+            continue;
+        }
+        it->thread.join();
+        it = list.threads.erase(it);
+    }
+}
+
+void add_viewer(ViewerList& list, socket_t fd) {
+    auto viewer = std::make_shared<Viewer>();
+    viewer->fd = fd;
+    init_transport(viewer->transport, fd);
+
+    std::lock_guard<std::mutex> lock(list.mutex);
+    join_finished_threads(list);
+    list.threads.push_back({ viewer, std::thread(serve_viewer, std::ref(list), viewer) });
+}
+
+// Removes the VIDEO_FRAME messages in [first, last) of the send queue, only
+// enhancement layers unless `all_layers`. Returns the number of frames.
+static size_t drop_queued_video(Viewer& viewer, size_t first, size_t last, bool all_layers) {
+    std::deque<QueuedMessage>& queue = viewer.send_queue;
+    size_t frames = 0;
+    uint64_t frame_timestamp = 0;
+    size_t out = first;
+    for (size_t i = first; i < queue.size(); ++i) {
+        QueuedMessage& message = queue[i];
+        const MessageHeader& header = queued_header(message);
+        if (i < last && header.type == MSG_VIDEO_FRAME && (all_layers || queued_temporal_layer(message) > 0)) {
+            // Stripes of one frame share its timestamp
+            const uint64_t timestamp = header.timestamp_us;
+            if (frames == 0 || timestamp != frame_timestamp) ++frames;
+            frame_timestamp = timestamp;
+            viewer.queued_bytes -= message.head_size + message.payload_size;
+            continue;
+        }
+        if (out != i) queue[out] = std::move(message);
+        ++out;
+    }
+    queue.erase(queue.begin() + out, queue.end());
+    return frames;
+}
+
+// Drops queued video that waited past the latency budget instead of sending
+// it late. Enhancement layers go first, nothing references them. If the
+// backlog is still stale, all video before the newest queued keyframe goes,
+// unless that keyframe is stale as well; then everything goes and the viewer
+// skips ahead to an IDR. A frame already partly written is kept whole, and
+// so are the messages an io_uring send still reads. Call with the send lock
+// held.
+static void drop_stale_frames(Viewer& viewer, std::chrono::milliseconds budget) {
+    std::deque<QueuedMessage>& queue = viewer.send_queue;
+    if (budget.count() <= 0 || queue.empty()) return;
+    const auto now = std::chrono::steady_clock::now();
+
+    size_t keep = std::max<size_t>(viewer.ring_sending, viewer.send_offset > 0 ? 1 : 0);
+    if (keep > 0) {
+        const uint64_t timestamp = queued_header(queue[keep - 1]).timestamp_us;
+        while (keep < queue.size() && queued_header(queue[keep]).type == MSG_VIDEO_FRAME &&
+               queued_header(queue[keep]).timestamp_us == timestamp) {
+            ++keep;
+        }
+    }
+    if (keep == queue.size() || now - queue[keep].queued_at <= budget) return;
+    std::chrono::duration<double, std::milli> age = now - queue[keep].queued_at;
+    const size_t backlog = viewer.queued_bytes;
+
+    size_t frames = drop_queued_video(viewer, keep, queue.size(), false);
+    bool resync = false;
+    if (keep < queue.size() && now - queue[keep].queued_at > budget) {
+        size_t newest_keyframe = queue.size();
+        uint64_t keyframe_timestamp = 0;
+        for (size_t i = keep; i < queue.size(); ++i) {
+            if (!queued_keyframe(queue[i])) continue;
+            const uint64_t timestamp = queued_header(queue[i]).timestamp_us;
+            if (newest_keyframe == queue.size() || timestamp != keyframe_timestamp) newest_keyframe = i;
+            keyframe_timestamp = timestamp;
+        }
+        // A keyframe that went stale itself would only restart the backlog
+        if (newest_keyframe < queue.size() && now - queue[newest_keyframe].queued_at > budget) {
+            newest_keyframe = queue.size();
+        }
+        const bool keyframe_queued = newest_keyframe < queue.size();
+        const size_t dropped = drop_queued_video(viewer, keep, newest_keyframe, true);
+        frames += dropped;
+        if (dropped > 0 && !keyframe_queued) {
+            resync = true;
+            viewer.resyncing = true;
+            viewer.wants_keyframe = true;
+        }
+    }
+    if (frames == 0) return;
+
+    viewer.dropped_frames += frames;
+    const int unsent = socket_unsent_bytes(viewer.fd);
+    std::cerr << "[Host] Viewer backlog " << (int)age.count() << " ms (" << backlog / 1024 << " KiB queued";
+    if (unsent >= 0) std::cerr << ", " << unsent / 1024 << " KiB unsent in the socket";
+    std::cerr << "), dropped " << frames << " frames" << (resync ? ", waiting for an IDR" : "") << "\n";
+}
+
+// Fills `buffers` with the unsent part of the viewer's queue, at most
+// MAX_GATHER pieces reaching into the first `messages` queued messages.
+// Call with the send lock held.
+static size_t gather_queued(const Viewer& viewer, SendBuffer* buffers, size_t& messages) {
+    size_t count = 0;
+    size_t skip = viewer.send_offset;
+    messages = 0;
+    for (const QueuedMessage& message : viewer.send_queue) {
+        if (count + 2 > MAX_GATHER) break;
+        const SendBuffer parts[] = {{message.head, message.head_size}, {message.payload.get(), message.payload_size}};
+        for (const SendBuffer& part : parts) {
+            if (skip >= part.size) {
+                skip -= part.size;
+                continue;
+            }
+            buffers[count++] = { (const uint8_t*)part.data + skip, part.size - skip };
+            skip = 0;
+        }
+        ++messages;
+    }
+    return count;
+}
+
+// Pops the messages `sent` more bytes completed. Call with the send lock held.
+static void consume_queued(Viewer& viewer, size_t sent) {
+    viewer.queued_bytes -= sent;
+    size_t done = viewer.send_offset + sent;
+    while (!viewer.send_queue.empty()) {
+        const QueuedMessage& front = viewer.send_queue.front();
+        const size_t size = front.head_size + front.payload_size;
+        if (done < size) break;
+        done -= size;
+        viewer.send_queue.pop_front();
+    }
+    viewer.send_offset = done;
+}
+
+static bool queue_overflowed(const Viewer& viewer) {
+    if (viewer.queued_bytes <= VIEWER_QUEUE_LIMIT) return false;
+    std::cerr << "[Host] Viewer fell too far behind\n";
+    return true;
+}
+
+// Writes as much of the viewer's queue as the socket takes, dropping what
+// went stale first. `blocked` is set when the socket filled up first. Returns false on error or when the
+// viewer fell hopelessly behind.
+static bool flush_viewer(Viewer& viewer, std::chrono::milliseconds budget, bool& blocked) {
+    std::lock_guard<std::mutex> lock(viewer.send_mutex);
+    blocked = false;
+    drop_stale_frames(viewer, budget);
+    while (!viewer.send_queue.empty()) {
+        SendBuffer buffers[MAX_GATHER];
+        size_t messages = 0;
+        const size_t count = gather_queued(viewer, buffers, messages);
+
+        size_t sent = 0;
+        if (!try_send_buffers(viewer.fd, buffers, count, sent)) return false;
+        if (sent == 0) {
+            blocked = true;
+            break;
+        }
+        consume_queued(viewer, sent);
+    }
+    return !queue_overflowed(viewer);
+}
+
+// flush_viewer for a ring viewer: queues one gathered send of its queue
+// unless the last one is still in flight, and keeps a receive queued. The
+// completions pop what went out and handle what came in.
+static bool queue_ring_viewer(ViewerList& list, Viewer& viewer) {
+    const unsigned slot = (unsigned)viewer.ring_slot;
+    if (!viewer.ring_receiving) viewer.ring_receiving = queue_ring_recv(list.ring, slot);
+
+    std::lock_guard<std::mutex> lock(viewer.send_mutex);
+    drop_stale_frames(viewer, list.latency_budget);
+    if (viewer.ring_sending == 0 && !viewer.send_queue.empty()) {
+        SendBuffer buffers[MAX_GATHER];
+        size_t messages = 0;
+        const size_t count = gather_queued(viewer, buffers, messages);
+        // A full submission queue leaves it for the next pass
+        if (queue_ring_send(list.ring, slot, buffers, count)) viewer.ring_sending = messages;
+    }
+    return !queue_overflowed(viewer);
+}
+
+// Handles every complete message in the viewer's receive buffer. Returns
+// false when the peer sent garbage or did not subscribe properly.
+static bool handle_received_messages(ViewerList& list, const std::shared_ptr<Viewer>& viewer) {
+    std::vector<uint8_t>& buffer = viewer->recv_buffer;
+    size_t pos = 0;
+    std::vector<uint8_t> payload;
+    while (buffer.size() - pos >= sizeof(MessageHeader)) {
+        MessageHeader header;
+        memcpy(&header, buffer.data() + pos, sizeof(header));
+        if (!valid_message_header(header)) return false;
+        const size_t size = sizeof(header) + header.payload_size;
+        if (buffer.size() - pos < size) break;
+
+        payload.assign(buffer.begin() + pos + sizeof(header), buffer.begin() + pos + size);
+        pos += size;
+        viewer->last_heard = std::chrono::steady_clock::now();
+        if (viewer->subscribed) {
+            handle_viewer_message(list, *viewer, header, payload);
+        } else if (header.type != MSG_STREAM_INIT || !subscribe_viewer(list, viewer, payload)) {
+            return false;
+        }
+    }
+    buffer.erase(buffer.begin(), buffer.begin() + pos);
+    return true;
+}
+
+// Reads whatever arrived and handles every complete message. Returns false
+// when the peer closed, errored or sent garbage.
+static bool read_queued_viewer(ViewerList& list, const std::shared_ptr<Viewer>& viewer) {
+    std::vector<uint8_t>& buffer = viewer->recv_buffer;
+    while (true) {
+        const size_t old_size = buffer.size();
+        buffer.resize(old_size + RECV_CHUNK);
+        size_t received = 0;
+        const bool ok = try_recv(viewer->fd, buffer.data() + old_size, RECV_CHUNK, received);
+        buffer.resize(old_size + received);
+        if (!ok) return false;
+        if (received == 0) break;
+    }
+    return handle_received_messages(list, viewer);
+}
+
+// Applies a finished ring operation of `viewer`. Returns false when the
+// connection is over.
+static bool complete_ring_operation(ViewerList& list, const std::shared_ptr<Viewer>& viewer,
+    const RingCompletion& completion) {
+    // The kernel waits for sockets itself, these only come from a signal
+    const bool retry = completion.result == -EAGAIN || completion.result == -EINTR;
+    if (completion.op == RingOp::SEND) {
+        std::lock_guard<std::mutex> lock(viewer->send_mutex);
+        viewer->ring_sending = 0;
+        if (completion.result > 0 && viewer->connected) consume_queued(*viewer, (size_t)completion.result);
+        return completion.result >= 0 || retry;
+    }
+    viewer->ring_receiving = false;
+    if (completion.result <= 0) return retry;
+    if (!viewer->connected) return true;
+    const uint8_t* data = ring_buffer(list.ring, completion.slot);
+    viewer->recv_buffer.insert(viewer->recv_buffer.end(), data, data + completion.result);
+    return handle_received_messages(list, viewer);
+}
+
+// Frees a closed viewer's send state, socket and ring slot. Call with the
+// send lock held, for a ring viewer once its operations are back.
+static void release_queued_viewer(ViewerList& list, Viewer& viewer) {
+    if (viewer.ring_slot >= 0) {
+        set_ring_file(list.ring, (unsigned)viewer.ring_slot, (socket_t)-1);
+        viewer.ring_slot = -1;
+    }
+    release_viewer(viewer);
+    viewer.send_queue.clear();
+    viewer.queued_bytes = 0;
+}
+
+// Takes a connection out of the loop. The capture loop drops it from the
+// list on its next frame. A ring viewer's socket is only shut down, which
+// ends its operations; the loop releases it once they are back.
+static void close_queued_viewer(ViewerList& list, Viewer& viewer) {
+    if (!viewer.subscribed) std::cerr << "[Host] Client disconnected before subscribing\n";
+    viewer.connected = false;
+    std::lock_guard<std::mutex> lock(viewer.send_mutex);
+    if (viewer.ring_slot >= 0) {
+        shutdown_socket(viewer.fd);
+        return;
+    }
+    poller_remove(list.poller, viewer.fd);
+    release_queued_viewer(list, viewer);
+}
+
+// Collects the ring's completions and applies them to their viewers
+static void reap_ring_viewers(ViewerList& list, const std::vector<std::shared_ptr<Viewer>>& ring_viewers,
+    std::vector<RingCompletion>& completions) {
+    completions.clear();
+    reap_ring(list.ring, completions);
+    for (const RingCompletion& completion : completions) {
+        const std::shared_ptr<Viewer>& viewer = ring_viewers[completion.slot];
+        if (!viewer) continue;
+        if (!complete_ring_operation(list, viewer, completion) && viewer->connected) {
+            close_queued_viewer(list, *viewer);
+        }
+    }
+}
+
+static void accept_queued_viewers(ViewerList& list, socket_t server_fd,
+    std::map<socket_t, std::shared_ptr<Viewer>>& connections, std::vector<std::shared_ptr<Viewer>>& ring_viewers) {
+    while (true) {
+        socket_t fd = accept(server_fd, nullptr, nullptr);
+#ifdef _WIN32
+        if (fd == INVALID_SOCKET) return;
+#else
+        if (fd < 0) return;
+#endif
+        int flag = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&flag, sizeof(flag));
+        set_unsent_limit(fd, VIEWER_UNSENT_LIMIT);
+        auto viewer = std::make_shared<Viewer>();
+        viewer->fd = fd;
+        viewer->queued = true;
+        viewer->last_heard = std::chrono::steady_clock::now();
+        // A free ring slot, or else the poller, serves the connection
+        auto slot = std::find(ring_viewers.begin(), ring_viewers.end(), nullptr);
+        if (slot != ring_viewers.end() && set_ring_file(list.ring, (unsigned)(slot - ring_viewers.begin()), fd)) {
+            viewer->ring_slot = (int)(slot - ring_viewers.begin());
+            *slot = viewer;
+        } else if (!set_nonblocking(fd) || !poller_add(list.poller, fd, false)) {
+            close_socket(fd);
+            continue;
+        }
+        connections[fd] = viewer;
+        std::cout << "[Host] Client connected!\n";
+    }
+}
+
+// Accepts, reads and writes every viewer from one thread. The capture loop
+// only queues; flush_viewers wakes the loop to write. With io_uring each pass
+// queues a send and a receive per ring viewer and submits them all in one
+// call; the ring's descriptor in the poller wakes the loop for their
+// completions.
+static void run_event_loop(ViewerList& list, socket_t server_fd) {
+    std::map<socket_t, std::shared_ptr<Viewer>> connections;
+    std::vector<PollEvent> events;
+    const bool ring = list.transport == TransportType::IO_URING;
+    std::vector<std::shared_ptr<Viewer>> ring_viewers(ring ? list.ring.slots : 0);
+    std::vector<RingCompletion> completions;
+    int wait_ms = EVENT_LOOP_TICK_MS;
+    while (!list.stopping) {
+        poller_wait(list.poller, events, wait_ms);
+
+        for (const PollEvent& event : events) {
+            if (event.sock == server_fd) {
+                accept_queued_viewers(list, server_fd, connections, ring_viewers);
+                continue;
+            }
+            auto it = connections.find(event.sock);
+            if (it == connections.end()) continue;
+            if (event.closed || (event.readable && !read_queued_viewer(list, it->second))) {
+                close_queued_viewer(list, *it->second);
+                connections.erase(it);
+            }
+        }
+        if (ring) reap_ring_viewers(list, ring_viewers, completions);
+
+        // Pace probes, write queues, follow socket buffer space and drop
+        // silent or hopelessly slow peers
+        const auto now = std::chrono::steady_clock::now();
+        const uint64_t now_us = protocol_timestamp_us();
+        wait_ms = EVENT_LOOP_TICK_MS;
+        for (auto it = connections.begin(); it != connections.end();) {
+            Viewer& viewer = *it->second;
+            // Closed ring viewers wait here for their operations
+            if (!viewer.connected) {
+                if (viewer.ring_receiving || viewer.ring_sending > 0) {
+                    ++it;
+                    continue;
+                }
+                ring_viewers[(size_t)viewer.ring_slot].reset();
+                std::lock_guard<std::mutex> lock(viewer.send_mutex);
+                release_queued_viewer(list, viewer);
+                it = connections.erase(it);
+                continue;
+            }
+            if (viewer.probe_next_us != 0 && now_us >= viewer.probe_next_us) {
+                viewer.probe_next_us = send_probe(list, viewer, now_us);
+            }
+            if (viewer.probe_next_us != 0) {
+                const uint64_t wait_us = viewer.probe_next_us > now_us ? viewer.probe_next_us - now_us : 0;
+                wait_ms = std::min(wait_ms, (int)((wait_us + 999) / 1000));
+            }
+            bool blocked = false;
+            bool ok = viewer.ring_slot >= 0 ? queue_ring_viewer(list, viewer)
+                                            : flush_viewer(viewer, list.latency_budget, blocked);
+            if (ok && now - viewer.last_heard > VIEWER_TIMEOUT) {
+                std::cerr << "[Host] Viewer timed out\n";
+                ok = false;
+            }
+            if (!ok) {
+                close_queued_viewer(list, viewer);
+                if (viewer.ring_slot < 0) {
+                    it = connections.erase(it);
+                    continue;
+                }
+            } else if (viewer.ring_slot < 0 && blocked != viewer.want_write &&
+                       poller_modify(list.poller, viewer.fd, blocked)) {
+                viewer.want_write = blocked;
+            }
+            ++it;
+        }
+        // Everything this pass queued goes to the kernel in one call
+        if (ring) submit_ring(list.ring);
+    }
+
+    for (auto& connection : connections) {
+        if (connection.second->connected) close_queued_viewer(list, *connection.second);
+    }
+    if (!ring) return;
+
+    // The kernel writes into the viewers' receive buffers and reads their
+    // queues until the operations come back
+    submit_ring(list.ring);
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(RING_DRAIN_MS);
+    auto busy = [&] {
+        for (const auto& viewer : ring_viewers) {
+            if (viewer && (viewer->ring_receiving || viewer->ring_sending > 0)) return true;
+        }
+        return false;
+    };
+    while (busy() && std::chrono::steady_clock::now() < deadline) {
+        wait_ring(list.ring, EVENT_LOOP_TICK_MS);
+        reap_ring_viewers(list, ring_viewers, completions);
+    }
+    for (auto& viewer : ring_viewers) {
+        if (!viewer) continue;
+        std::lock_guard<std::mutex> lock(viewer->send_mutex);
+        release_queued_viewer(list, *viewer);
+    }
+    std::cout << "[Host] io_uring: " << list.ring.operations << " operations in " << list.ring.submit_calls
+              << " submissions\n";
+}
+
+void flush_viewers(ViewerList& list) {
+    if (list.event_loop) wake_poller(list.poller);
+}
+
+// Sets up list.ring and has the poller wake the event loop for its completions
+static bool init_viewer_ring(ViewerList& list) {
+    if (init_io_ring(list.ring, RING_SLOTS, RING_RECV_SIZE) && poller_add(list.poller, io_ring_fd(list.ring), false)) {
+        return true;
+    }
+    destroy_io_ring(list.ring);
+    return false;
+}
+
+void start_accepting_viewers(ViewerList& list, socket_t server_fd) {
+    if (list.event_loop) {
+        if (init_poller(list.poller) && set_nonblocking(server_fd) && poller_add(list.poller, server_fd, false)) {
+            if (list.transport == TransportType::IO_URING && !init_viewer_ring(list)) {
+                std::cerr << "[Host] io_uring unavailable, the event loop polls its sockets\n";
+                list.transport = TransportType::POLL;
+            }
+            list.accept_thread = std::thread(run_event_loop, std::ref(list), server_fd);
+            return;
+        }
+        std::cerr << "[Host] Event loop unavailable, using a thread per viewer\n";
+        destroy_poller(list.poller);
+        list.event_loop = false;
+    }
+
+    list.accept_thread = std::thread([&list, server_fd] {
+        while (true) {
+            socket_t fd = accept(server_fd, nullptr, nullptr);
+#ifdef _WIN32
+            if (fd == INVALID_SOCKET) return;
+#else
+            if (fd < 0) return;
+#endif
+            // Every message leaves in one gathered send, so there is
+            // nothing for Nagle to coalesce
+            int flag = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&flag, sizeof(flag));
+            // Keeps the kernel from hiding seconds of video from the send
+            // time measurements
+            set_unsent_limit(fd, VIEWER_UNSENT_LIMIT);
+            std::cout << "[Host] Client connected!\n";
+            add_viewer(list, fd);
+        }
+    });
+}
+
+void update_parameter_sets(ViewerList& list, int rendition, const uint8_t* data, size_t size) {
+    if (rendition >= (int)list.parameter_sets.size()) list.parameter_sets.resize(rendition + 1);
+    std::vector<uint8_t> parameter_sets;
+    if (h264_extract_parameter_sets(data, size, parameter_sets)) {
+        list.parameter_sets[rendition] = std::move(parameter_sets);
+    }
+}
+
+std::vector<int> collect_keyframe_requests(ViewerList& list) {
+    std::vector<int> renditions;
+    const uint64_t now_us = protocol_timestamp_us();
+    for (auto& viewer : list.viewers) {
+        // The probe result picks the rendition to start on
+        if (viewer->probing) {
+            if (now_us < viewer->probe_deadline_us) continue;
+            std::cerr << "[Host] No probe result, starting rendition " << viewer->rendition << " as asked\n";
+            viewer->probing = false;
+        }
+        if (viewer->wants_keyframe.exchange(false)) {
+            viewer->awaiting_keyframe = true;
+            viewer->keyframe_requested = -1;
+        }
+        int pending = viewer->pending_rendition;
+        int needed = pending >= 0 && pending < list.rendition_count ? pending
+                   : viewer->awaiting_keyframe ? viewer->rendition : -1;
+        if (needed < 0 || needed == viewer->keyframe_requested) continue;
+
+        viewer->keyframe_requested = needed;
+        if (std::find(renditions.begin(), renditions.end(), needed) == renditions.end()) {
+            renditions.push_back(needed);
+        }
+    }
+    return renditions;
+}
+
+// Marks the keyframe that starts or switches the viewer's stream
+static void start_viewer_stream(Viewer& viewer) {
+    viewer.awaiting_keyframe = false;
+    viewer.keyframe_requested = -1;
+    if (!viewer.first_frame_sent) {
+        viewer.first_frame_sent = true;
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - viewer.subscribed_at;
+        std::cout << "[Host] First frame to viewer " << elapsed.count() << " ms after subscribing\n";
+    }
+}
+
+bool viewer_wants(Viewer& viewer, int rendition, bool keyframe) {
+    if (!viewer.connected || viewer.probing) return false;
+
+    int pending = viewer.pending_rendition;
+    if (pending >= 0 && pending == rendition && keyframe) {
+        viewer.pending_rendition = -1;
+        if (pending != viewer.rendition) {
+            std::cout << "[Host] Viewer switched to rendition " << pending << "\n";
+        }
+        viewer.rendition = pending;
+        start_viewer_stream(viewer);
+        return true;
+    }
+    if (viewer.rendition != rendition) return false;
+
+    if (viewer.awaiting_keyframe) {
+        if (!keyframe) return false;
+        start_viewer_stream(viewer);
+    }
+    return true;
+}
+
+void finish_viewer_frame(ViewerList& list, double frame_interval) {
+    const auto now = std::chrono::steady_clock::now();
+    for (auto it = list.viewers.begin(); it != list.viewers.end();) {
+        Viewer& viewer = **it;
+        if (!viewer.connected) {
+            // The event loop closes queued viewers itself
+            if (!viewer.queued) shutdown_viewer(viewer);
+            std::cout << "[Host] Viewer disconnected\n";
+            if (viewer.udp && !viewer.rtp.history.empty()) {
+                std::lock_guard<std::mutex> lock(viewer.send_mutex);
+                std::cout << "[Host] Retransmitted " << viewer.rtp.packets_retransmitted << " packets, "
+                          << viewer.rtp.packets_expired << " NACKed too late\n";
+            }
+            if (viewer.congestion_control) {
+                std::lock_guard<std::mutex> lock(viewer.send_mutex);
+                const uint64_t decreases = viewer.udp ? viewer.congestion.decreases : viewer.tcp_rate.decreases;
+                const double target = viewer.udp ? viewer.congestion.target : viewer.tcp_rate.target;
+                std::cout << "[Host] Congestion control cut the bitrate " << decreases
+                          << " times, last at " << (int)(target / 1000) << " kbps\n";
+            }
+            if (viewer.pacing) pacer_close_flow(list.pacer, *viewer.pacing);
+            it = list.viewers.erase(it);
+            continue;
+        }
+        if (viewer.queued) {
+            std::lock_guard<std::mutex> lock(viewer.send_mutex);
+            std::chrono::duration<double> age{ 0.0 };
+            if (!viewer.send_queue.empty()) age = now - viewer.send_queue.front().queued_at;
+            viewer.send_seconds = age.count();
+        }
+        update_layer_filter(viewer.layer_filter, viewer.send_seconds, frame_interval);
+        viewer.send_seconds = 0.0;
+        ++it;
+    }
+    join_finished_threads(list);
+}
+
+void update_tcp_rates(ViewerList& list) {
+    const uint64_t now_us = protocol_timestamp_us();
+    for (auto& viewer : list.viewers) {
+        if (viewer->udp || !viewer->congestion_control || viewer->probing) continue;
+        // The socket is closed under the send lock once the viewer disconnects
+        std::lock_guard<std::mutex> lock(viewer->send_mutex);
+        if (!viewer->connected || !tcp_rate_due(viewer->tcp_rate, now_us)) continue;
+        TcpPathInfo info;
+        if (!tcp_path_info(viewer->fd, info)) continue;
+        viewer->target_bitrate = tcp_rate_update(viewer->tcp_rate, info, viewer->queued_bytes, now_us);
+    }
+}
+
+std::vector<int> viewer_bitrate_limits(const ViewerList& list) {
+    std::vector<int> limits(list.rendition_count, 0);
+    for (const auto& viewer : list.viewers) {
+        const int target = viewer->target_bitrate;
+        if (!viewer->connected || target <= 0 || viewer->rendition >= list.rendition_count) continue;
+        int& limit = limits[viewer->rendition];
+        limit = limit > 0 ? std::min(limit, target) : target;
+    }
+    return limits;
+}
+
+bool viewers_viewport(const ViewerList& list, int& width, int& height, int& refresh_mhz) {
+    width = height = refresh_mhz = 0;
+    for (const auto& viewer : list.viewers) {
+        if (!viewer->connected) continue;
+        if (viewer->viewport_width <= 0 || viewer->viewport_height <= 0) return false;
+        width = std::max(width, viewer->viewport_width.load());
+        height = std::max(height, viewer->viewport_height.load());
+        refresh_mhz = std::max(refresh_mhz, viewer->refresh_mhz.load());
+    }
+    return width > 0 && height > 0;
+}
+
+void close_viewers(ViewerList& list, socket_t server_fd) {
+    // Stop accepting first so no viewer shows up after the list is cleared.
+    // The event loop closes its connections on the way out.
+    if (list.event_loop) {
+        list.stopping = true;
+        if (list.accept_thread.joinable()) {
+            wake_poller(list.poller);
+            list.accept_thread.join();
+            destroy_poller(list.poller);
+            destroy_io_ring(list.ring);
+        }
+        close_socket(server_fd);
+    } else {
+        shutdown_socket(server_fd);
+        close_socket(server_fd);
+        if (list.accept_thread.joinable()) list.accept_thread.join();
+    }
+
+    // Connections still subscribing or probing are not in the list yet
+    std::vector<ViewerThread> threads;
+    {
+        std::lock_guard<std::mutex> lock(list.mutex);
+        for (ViewerThread& t : list.threads) shutdown_viewer(*t.viewer);
+        list.viewers.clear();
+        threads.swap(list.threads);
+    }
+
+    for (ViewerThread& t : threads) t.thread.join();
+    stop_pacer(list.pacer);
+    if (list.udp) close_socket(list.udp_fd);
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "congestion.h"
+#include "encoder/temporal_layers.h"
+#include "pacer.h"
+#include "shared/io_ring.h"
+#include "shared/poller.h"
+#include "shared/protocol.h"
+#include "shared/rtp.h"
+#include "shared/socket.h"
+#include "zerocopy.h"
+
+// A message waiting in an event loop send queue. The payload is shared
+// between every viewer the message goes to.
+struct QueuedMessage {
+    uint8_t head[MAX_HEAD_SIZE];
+    size_t head_size = 0;
+    std::shared_ptr<const uint8_t> payload;
+    size_t payload_size = 0;
+    std::chrono::steady_clock::time_point queued_at;
+};
+
+// One connected client. The capture loop only touches it under
+// ViewerList::mutex, the connection's thread or event loop only through the
+// atomics and under send_mutex.
+struct Viewer {
+    socket_t fd;
+    Transport transport;            // Sends under send_mutex, receives on the reader thread
+    std::mutex send_mutex;          // Capture loop and PONG replies share the socket
+    uint32_t next_sequence = 0;
+    // Event loop mode: sends are queued and written by the loop
+    bool queued = false;
+    std::deque<QueuedMessage> send_queue;   // Guarded by send_mutex
+    size_t send_offset = 0;         // Bytes of the front message already written
+    size_t queued_bytes = 0;
+    bool resyncing = false;         // Stale video was dropped, nothing but a keyframe is queued next
+    uint64_t dropped_frames = 0;
+    std::atomic<bool> wants_keyframe{ false };  // After dropping stale frames or a KEYFRAME_REQUEST
+    // Event loop only
+    std::vector<uint8_t> recv_buffer;
+    bool subscribed = false;
+    bool want_write = false;
+    // io_uring event loop: the viewer's slot on ViewerList::ring, -1 when the
+    // poller serves it. Queued messages a send in flight reads are not dropped.
+    int ring_slot = -1;
+    bool ring_receiving = false;
+    size_t ring_sending = 0;
+    std::chrono::steady_clock::time_point last_heard;
+    int rendition = 0;
+    bool awaiting_keyframe = true;  // Nothing is sent before the first keyframe
+    int keyframe_requested = -1;    // Rendition an IDR was last requested on for this viewer
+    bool first_frame_sent = false;
+    std::chrono::steady_clock::time_point subscribed_at;
+    std::atomic<int> pending_rendition{ -1 };
+    std::atomic<bool> connected{ true };
+    std::atomic<bool> finished{ false };    // The connection's thread is done with it and can be joined
+    // Last reported window, 0 until the client sends one
+    std::atomic<int> viewport_width{ 0 };
+    std::atomic<int> viewport_height{ 0 };
+    std::atomic<int> refresh_mhz{ 0 };
+    TemporalLayerFilter layer_filter;
+    double send_seconds = 0.0;      // Time spent sending the current frame
+    ZeroCopySender zerocopy;        // Guarded by send_mutex
+    // UDP video: VIDEO_FRAMEs go to udp_addr as RTP over the list's UDP
+    // socket, everything else stays on TCP
+    bool udp = false;
+    socket_t udp_fd;
+    sockaddr_in udp_addr{};
+    RtpPacketizer rtp;              // Guarded by send_mutex
+    std::shared_ptr<PacerFlow> pacing;  // Queue of paced video, null when frames leave in one burst
+    // Congestion control, on TRANSPORT_FEEDBACK over UDP and on the kernel's
+    // TCP statistics over TCP
+    bool congestion_control = false;
+    CongestionController congestion;    // Guarded by send_mutex
+    TcpRateController tcp_rate;         // Guarded by send_mutex
+    std::atomic<int> target_bitrate{ 0 };   // Video bitrate the path takes, 0 = no estimate
+    // Bandwidth probe: padding paced at probe_bitrate after the STREAM_INIT
+    // reply. The viewer gets no video until the client's PROBE_RESULT or
+    // probe_deadline_us, probing is cleared under ViewerList::mutex.
+    std::atomic<bool> probing{ false };
+    int probe_bitrate = 0;
+    uint64_t probe_start_us = 0;
+    // Only the thread that subscribed the viewer sends the probe
+    uint64_t probe_next_us = 0;     // Next padding due, 0 after the closing PROBE
+    uint64_t probe_bytes = 0;       // Padding due by the last send
+    uint64_t probe_deadline_us = 0;
+};
+
+// Thread that subscribes one connection and then reads from it
+struct ViewerThread {
+    std::shared_ptr<Viewer> viewer;
+    std::thread thread;
+};
+
+struct ViewerList {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Viewer>> viewers;
+    std::thread accept_thread;          // Accepts, or runs the event loop
+    std::vector<ViewerThread> threads;  // Per connection, joined once finished
+    uint8_t codec = CODEC_H264;
+    int stripe_count = 1;
+    int rendition_count = 1;
+    int temporal_layers = 1;
+    bool zerocopy = false;          // Send large packets with MSG_ZEROCOPY
+    bool event_loop = false;        // One poller thread instead of per-viewer threads
+    TransportType transport = TransportType::POLL;  // How the event loop moves bytes
+    // Age after which queued video is dropped instead of sent late, 0 keeps it
+    std::chrono::milliseconds latency_budget{ 0 };
+    bool udp = false;               // Offer RTP video to clients that ask for it
+    socket_t udp_fd;                // Bound to the TCP port, shared by all UDP viewers
+    std::atomic<bool> udp_gso{ false };  // Hand frames to the kernel as segmented sends, cleared once the device refuses
+    TxTimestamps tx_stamps;         // Kernel send times of each frame's last datagram, when enabled
+    FecScheme fec = FecScheme::NONE;
+    double fec_ratio = 0;           // Repair packets per video packet without loss
+    bool retransmits = false;       // Keep UDP video for NACKs, until latency_budget after capture
+    bool pacing = false;            // Spread UDP video frames over part of the frame interval
+    Pacer pacer;
+    double frame_interval = 0;      // Of the full-size stream, set by the capture loop
+    bool congestion_control = false;    // Hold renditions to the rate their viewers' paths take
+    std::vector<int> bitrates;      // Configured per rendition, the most congestion control goes to
+    std::chrono::milliseconds probe_duration{ 0 };  // Bandwidth probe before a viewer's first frame, 0 = none
+    Poller poller;
+    IoRing ring;                    // With TransportType::IO_URING
+    std::atomic<bool> stopping{ false };
+    std::vector<std::vector<uint8_t>> parameter_sets;   // Latest SPS/PPS per rendition
+};
+
+// Starts a thread for a new connection, which reads the client's
+// STREAM_INIT, answers with the host's STREAM_INIT (stream description and
+// the rendition's cached SPS/PPS), sends the bandwidth probe and then reads
+// the client's control messages. Threads that have finished are joined.
+void add_viewer(ViewerList& list, socket_t fd);
+
+// Sends one message (see send_protocol_message) under the viewer's send
+// lock, stamping the sequence number. Marks the viewer disconnected on failure.
+// Queued viewers get a copy of the payload queued instead.
+bool send_to_viewer(Viewer& viewer, MessageHeader& header, size_t head_size,
+    const uint8_t* payload, size_t payload_size);
+
+// Queues a message for a queued viewer without copying the payload
+void queue_to_viewer(Viewer& viewer, MessageHeader& header, size_t head_size,
+    std::shared_ptr<const uint8_t> payload, size_t payload_size);
+
+// Has the event loop write what was queued since the last call
+void flush_viewers(ViewerList& list);
+
+// Same for a batch, whose messages get consecutive sequence numbers
+bool send_batch_to_viewer(Viewer& viewer, const MessageBatch& batch);
+
+// Same with an encoded packet as payload. Large packets go out zero-copy
+// when the viewer has it enabled. Not for queued viewers.
+bool send_packet_to_viewer(Viewer& viewer, MessageHeader& header, size_t head_size, const AVPacket* pkt);
+
+// Sends one H.264 VIDEO_FRAME to a UDP viewer as RTP datagrams, or queues
+// them with the list's pacer. Call with the list locked.
+bool send_udp_video(ViewerList& list, Viewer& viewer, const VideoFrameHead& head, const uint8_t* data, size_t size);
+
+// Caches the parameter sets of a keyframe of `rendition` for later
+// handshakes. Call with the list locked.
+void update_parameter_sets(ViewerList& list, int rendition, const uint8_t* data, size_t size);
+
+// Renditions that joining, switching or resyncing viewers need an IDR on and
+// that have not been requested yet. Call with the list locked, once per frame.
+std::vector<int> collect_keyframe_requests(ViewerList& list);
+
+// Polls the kernel's statistics of congestion-controlled TCP viewers whose
+// next poll is due. Call with the list locked, once per frame.
+void update_tcp_rates(ViewerList& list);
+
+// Per rendition, the lowest bitrate the congestion controllers of its
+// viewers allow, 0 where none has an estimate. Call with the list locked.
+std::vector<int> viewer_bitrate_limits(const ViewerList& list);
+
+// Accepts further viewers until the server socket is closed. With
+// list.event_loop a single thread accepts, reads and writes every viewer.
+void start_accepting_viewers(ViewerList& list, socket_t server_fd);
+
+// Whether `viewer` gets the next access unit of `rendition`. A pending
+// rendition switch takes effect once the new rendition reaches a keyframe.
+bool viewer_wants(Viewer& viewer, int rendition, bool keyframe);
+
+// Feeds per-viewer send times (for queued viewers the age of the oldest
+// unsent message) to the temporal layer filters, drops viewers that
+// disconnected and joins their finished threads. Call with the list locked,
+// once per frame.
+void finish_viewer_frame(ViewerList& list, double frame_interval);
+
+// Smallest window size that covers every viewer's window and the highest
+// refresh rate among them. Returns false when some viewer has not reported
+// its window, in which case the full capture size is needed. Call with the
+// list locked.
+bool viewers_viewport(const ViewerList& list, int& width, int& height, int& refresh_mhz);
+
+// Disconnects every viewer, joins all threads and closes the server sockets
+void close_viewers(ViewerList& list, socket_t server_fd);
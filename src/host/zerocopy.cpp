@@ -0,0 +1,119 @@
+#include "zerocopy.h"
+
+#include <cstring>
+#include <iostream>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#if defined(__linux__)
+#include <errno.h>
+#include <linux/errqueue.h>
+#endif
+
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define HAVE_ZEROCOPY 1
+#endif
+
+bool init_zerocopy(ZeroCopySender& zc, socket_t sock) {
+#ifdef HAVE_ZEROCOPY
+    int one = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) != 0) return false;
+    for (ZeroCopySlot& slot : zc.slots) {
+        slot.packet = av_packet_alloc();
+        if (!slot.packet) {
+            destroy_zerocopy(zc);
+            return false;
+        }
+    }
+    zc.enabled = true;
+    return true;
+#else
+    (void)zc;
+    (void)sock;
+    return false;
+#endif
+}
+
+// Whether id `a` comes at or before `b`, ids wrap at 2^32
+static bool id_reached(uint32_t a, uint32_t b) {
+    return (int32_t)(b - a) >= 0;
+}
+
+void reap_zerocopy(ZeroCopySender& zc, socket_t sock) {
+#ifdef HAVE_ZEROCOPY
+    while (zc.in_flight > 0) {
+        char control[128];
+        msghdr msg{};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) return;
+
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            const bool recverr = (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                                 (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+            if (!recverr) continue;
+            sock_extended_err err;
+            memcpy(&err, CMSG_DATA(cm), sizeof(err));
+            if (err.ee_origin != SO_EE_ORIGIN_ZEROCOPY || err.ee_errno != 0) continue;
+
+            // ee_info..ee_data is the range of completed call ids
+            if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                if (zc.copied++ == 0) {
+                    std::cout << "[Host] Kernel copies zero-copy sends on this route (e.g. loopback)\n";
+                }
+            }
+            while (zc.in_flight > 0 && id_reached(zc.slots[zc.first].last_id, err.ee_data)) {
+                av_packet_unref(zc.slots[zc.first].packet);
+                zc.first = (zc.first + 1) % ZEROCOPY_SLOTS;
+                --zc.in_flight;
+            }
+        }
+    }
+#else
+    (void)zc;
+    (void)sock;
+#endif
+}
+
+bool send_zerocopy(ZeroCopySender& zc, Transport& transport, MessageHeader& header, size_t head_size,
+    const AVPacket* pkt) {
+    const socket_t sock = transport.sock;
+    if (zc.enabled) reap_zerocopy(zc, sock);
+    if (!zc.enabled || pkt->size < ZEROCOPY_MIN_SIZE || zc.in_flight == ZEROCOPY_SLOTS ||
+        head_size > MAX_HEAD_SIZE) {
+        return send_protocol_message(transport, header, head_size, pkt->data, pkt->size);
+    }
+#ifdef HAVE_ZEROCOPY
+    ZeroCopySlot& slot = zc.slots[(zc.first + zc.in_flight) % ZEROCOPY_SLOTS];
+    if (av_packet_ref(slot.packet, pkt) < 0) {
+        return send_protocol_message(transport, header, head_size, pkt->data, pkt->size);
+    }
+    header.payload_size = (uint32_t)(head_size - sizeof(MessageHeader) + pkt->size);
+    memcpy(slot.head, &header, head_size);
+
+    const SendBuffer buffers[] = {{slot.head, head_size}, {slot.packet->data, (size_t)slot.packet->size}};
+    uint32_t calls = 0;
+    const bool ok = send_buffers(sock, buffers, 2, MSG_ZEROCOPY, &calls);
+    if (calls == 0) {
+        av_packet_unref(slot.packet);
+        return ok;
+    }
+    zc.next_id += calls;
+    slot.last_id = zc.next_id - 1;
+    ++zc.in_flight;
+    return ok;
+#else
+    return false;
+#endif
+}
+
+void destroy_zerocopy(ZeroCopySender& zc) {
+    for (ZeroCopySlot& slot : zc.slots) {
+        av_packet_free(&slot.packet);
+    }
+    zc.enabled = false;
+    zc.first = 0;
+    zc.in_flight = 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "shared/protocol.h"
+#include "shared/socket.h"
+
+struct AVPacket;
+
+// Payloads below this are cheaper to copy than to pin and track
+const int ZEROCOPY_MIN_SIZE = 64 * 1024;
+// Zero-copy sends in flight per socket, further ones are copied
+const int ZEROCOPY_SLOTS = 16;
+
+// A send the kernel may still read from: a reference on the packet's buffer
+// and the message head, which the kernel reads in place as well
+struct ZeroCopySlot {
+    AVPacket* packet = nullptr;
+    uint8_t head[MAX_HEAD_SIZE];
+    uint32_t last_id = 0;   // Id of the last sendmsg call of this message
+};
+
+// MSG_ZEROCOPY state of one socket (Linux only). Slots form a ring in send
+// order, which is the order TCP completes them in.
+struct ZeroCopySender {
+    bool enabled = false;
+    uint32_t next_id = 0;   // Kernel numbers successful MSG_ZEROCOPY calls from 0
+    ZeroCopySlot slots[ZEROCOPY_SLOTS];
+    int first = 0;
+    int in_flight = 0;
+    uint64_t copied = 0;    // Completions where the kernel fell back to copying
+};
+
+// Enables SO_ZEROCOPY on `sock`. Returns false where unsupported, the sender
+// then stays disabled and callers copy as usual.
+bool init_zerocopy(ZeroCopySender& zc, socket_t sock);
+
+// Sends head and packet payload with MSG_ZEROCOPY, keeping a reference on the
+// packet until the kernel reports completion. Copies through `transport`
+// instead when the sender is disabled, the packet is small or every slot is
+// busy.
+// header.payload_size is filled in.
+bool send_zerocopy(ZeroCopySender& zc, Transport& transport, MessageHeader& header, size_t head_size,
+    const AVPacket* pkt);
+
+// Releases the packets of completed sends without blocking
+void reap_zerocopy(ZeroCopySender& zc, socket_t sock);
+
+// Drops every reference, the kernel keeps its own page references
+void destroy_zerocopy(ZeroCopySender& zc);
@@ -4,6 +4,8 @@
 #include <vector>
 #include <atomic>
 #include <chrono>
+#include <cstdio>
+#include <string>
 
 #include "CLI11.hpp"
 
@@ -35,17 +37,219 @@ int main(int argc, char* argv[]) {
     app.add_option("-p,--port", port, "Port to connect/listen on")
        ->default_val("51234");
 
+    int stripes = 1;
+    app.add_option("-s,--stripes", stripes, "Host: encode the frame as N horizontal stripes in parallel, the client follows")
+       ->default_val("1")
+       ->check(CLI::Range(1, 64));
+
+    int temporal_layers = 1;
+    app.add_option("--temporal-layers", temporal_layers, "Host: encode 1-3 temporal layers so slow links can drop frames without re-encoding")
+       ->default_val("1")
+       ->check(CLI::Range(1, 3));
+
+    std::vector<std::string> simulcast;
+    app.add_option("--simulcast", simulcast, "Host: extra renditions encoded from the same capture, as WxH@kbps (e.g. 960x540@1500)");
+
+    int idle_fps = 2;
+    app.add_option("--idle-fps", idle_fps, "Host: encode rate while the image is static, 0 stops encoding, -1 disables detection")
+       ->default_val("2");
+
+    bool adaptive_tuning = true;
+    app.add_flag("--adaptive-tuning,!--no-adaptive-tuning", adaptive_tuning, "Host: retune libx264 for menus, FMV and 3D gameplay and force IDRs on scene cuts");
+
+    std::string codec = "h264";
+    app.add_option("--codec", codec, "Host: h264, or delta for lossless LZ4 tile deltas on a fast LAN")
+       ->default_val("h264")
+       ->check(CLI::IsMember({"h264", "delta"}));
+
+    int rendition = 0;
+    app.add_option("-r,--rendition", rendition, "Client: simulcast rendition to subscribe to (0 = full size)")
+       ->default_val("0");
+
+    bool fit_viewport = true;
+    app.add_flag("--fit-viewport,!--no-fit-viewport", fit_viewport, "Host: encode at the smallest size that covers the viewers' windows");
+
+    bool zerocopy = false;
+    app.add_flag("--zerocopy", zerocopy, "Host: send large encoded frames with MSG_ZEROCOPY (Linux)");
+
+    std::string transport = "poll";
+    app.add_option("--transport", transport, "Host (--event-loop): viewer socket I/O, poll or io_uring (Linux)")
+       ->default_val("poll")
+       ->check(CLI::IsMember({"poll", "io_uring"}));
+
+    bool event_loop = false;
+    app.add_flag("--event-loop", event_loop, "Host: serve all viewers from one epoll/WSAPoll thread with per-viewer send queues");
+
+    bool udp = false;
+    app.add_flag("--udp", udp, "Host: offer video as RTP over UDP on the same port; client: ask for it");
+
+    bool gso = true;
+    app.add_flag("--gso,!--no-gso", gso, "Host (--udp): let the kernel cut each frame into datagrams (UDP_SEGMENT on Linux, USO on Windows 11); client: take coalesced datagrams with UDP_GRO");
+
+    bool timestamps = true;
+    app.add_flag("--timestamps,!--no-timestamps", timestamps, "Host and client (--udp): kernel send and receive timestamps of video datagrams (SO_TIMESTAMPING, Linux) for the latency figures");
+
+    int busy_poll_us = 0;
+    app.add_option("--busy-poll-us", busy_poll_us, "Client (--udp): spin on the video socket this long before sleeping, polling the device with SO_BUSY_POLL where permitted (Linux), 0 = off")
+       ->default_val("0")
+       ->check(CLI::Range(0, 10000));
+
+    std::string fec = "none";
+    app.add_option("--fec", fec, "Host (--udp): repair packets for lost video datagrams, none, xor parity or rs (Reed-Solomon, recovers bursts)")
+       ->default_val("none")
+       ->check(CLI::IsMember({"none", "xor", "rs"}));
+
+    int fec_percent = 10;
+    app.add_option("--fec-percent", fec_percent, "Host (--udp): repair packets per 100 video packets on a clean link, raised with the loss clients report")
+       ->default_val("10")
+       ->check(CLI::Range(0, 50));
+
+    bool nack = true;
+    app.add_flag("--nack,!--no-nack", nack, "Host (--udp): resend video packets clients report missing while they can still make --latency-budget-ms");
+
+    int bitrate_kbps = 5000;
+    app.add_option("--bitrate-kbps", bitrate_kbps, "Host: full-size stream bitrate, the most congestion control raises it to")
+       ->default_val("5000")
+       ->check(CLI::Range(100, 1000000));
+
+    bool congestion_control = true;
+    app.add_flag("--congestion-control,!--no-congestion-control", congestion_control, "Host: lower each rendition's bitrate to what its viewers' paths take, from packet arrival times over UDP and the kernel's TCP statistics over TCP");
+
+    int probe_ms = 200;
+    app.add_option("--probe-ms", probe_ms, "Host: measure each joining viewer's path with this long a paced burst and start it on the rendition and bitrate it takes, 0 starts at --bitrate-kbps")
+       ->default_val("200")
+       ->check(CLI::Range(0, 1000));
+
+    double pacing_share = 0.5;
+    app.add_option("--pacing-share", pacing_share, "Host (--udp): spread each frame's datagrams over this share of the frame interval, 0 sends them in one burst")
+       ->default_val("0.5")
+       ->check(CLI::Range(0.0, 1.0));
+
+    double keyframe_pacing_share = 1.0;
+    app.add_option("--keyframe-pacing-share", keyframe_pacing_share, "Host (--udp): the same for keyframes, which may spill into the next frame's interval")
+       ->default_val("1.0")
+       ->check(CLI::Range(0.0, 4.0));
+
+    double emulate_loss = 0;
+    app.add_option("--emulate-loss", emulate_loss, "Client (--udp): drop this percentage of received video datagrams, to try FEC and resync")
+       ->default_val("0")
+       ->check(CLI::Range(0.0, 99.0));
+
+    double emulate_burst = 1;
+    app.add_option("--emulate-burst", emulate_burst, "Client (--udp): mean run length of emulated losses, 1 drops independently")
+       ->default_val("1")
+       ->check(CLI::Range(1.0, 1000.0));
+
+    double emulate_rate_kbps = 0;
+    app.add_option("--emulate-rate-kbps", emulate_rate_kbps, "Client (--udp): pass received video through a bottleneck this fast with a 300 ms drop-tail queue, 0 = unlimited")
+       ->default_val("0")
+       ->check(CLI::NonNegativeNumber);
+
+    double emulate_delay_ms = 0;
+    app.add_option("--emulate-delay-ms", emulate_delay_ms, "Client (--udp): one-way delay added to received video")
+       ->default_val("0")
+       ->check(CLI::Range(0.0, 10000.0));
+
+    int latency_budget_ms = 150;
+    app.add_option("--latency-budget-ms", latency_budget_ms, "Host: with --event-loop drop queued video older than this and resync the viewer with an IDR, with --udp stop resending video this old; 0 never gives up")
+       ->default_val("150")
+       ->check(CLI::NonNegativeNumber);
+
+    std::vector<std::string> ladder;
+    app.add_option("--ladder", ladder, "Host: resolution/frame-rate steps to switch between under load, best first, as WxH@fps (e.g. 1920x1080@60 1280x720@60 1280x720@30 960x540@30)");
+
     CLI11_PARSE(app, argc, argv);
     bool running = true;
 
+    TransportType transport_type = TransportType::POLL;
+    parse_transport_type(transport.c_str(), transport_type);
+
+    const bool raw_delta = codec == "delta";
+    if (raw_delta && (stripes > 1 || !simulcast.empty())) {
+        std::cerr << "--codec delta cannot be combined with --stripes or --simulcast\n";
+        return 1;
+    }
+    if (stripes > 1 && !simulcast.empty()) {
+        std::cerr << "--stripes cannot be combined with --simulcast\n";
+        return 1;
+    }
+    if (!ladder.empty() && (raw_delta || stripes > 1 || !simulcast.empty())) {
+        std::cerr << "--ladder only works with a single H.264 stream\n";
+        return 1;
+    }
+    if (mode == "host" && udp && raw_delta) {
+        std::cerr << "--udp only carries H.264, raw delta frames need TCP\n";
+        return 1;
+    }
+    if (mode == "host" && event_loop && zerocopy) {
+        std::cerr << "--event-loop writes non-blocking itself and cannot be combined with --zerocopy\n";
+        return 1;
+    }
+    if (mode == "host" && !event_loop && transport_type != TransportType::POLL) {
+        std::cerr << "--transport io_uring drives the event loop's sockets, add --event-loop\n";
+        return 1;
+    }
+
     if (mode == "host") {
-        start_host_server(port, running);
+        HostOptions options;
+        options.stripes = stripes;
+        options.temporal_layers = temporal_layers;
+        options.idle_fps = idle_fps;
+        options.adaptive_tuning = adaptive_tuning;
+        options.fit_viewport = fit_viewport;
+        options.raw_delta = raw_delta;
+        options.zerocopy = zerocopy;
+        options.transport = transport_type;
+        options.event_loop = event_loop;
+        options.latency_budget_ms = latency_budget_ms;
+        options.udp = udp;
+        options.udp_gso = gso;
+        options.udp_timestamps = timestamps;
+        parse_fec_scheme(fec.c_str(), options.fec);
+        options.fec_percent = fec_percent;
+        options.retransmits = nack;
+        options.bitrate_kbps = bitrate_kbps;
+        options.congestion_control = congestion_control;
+        options.probe_ms = probe_ms;
+        options.pacing_share = pacing_share;
+        options.keyframe_pacing_share = keyframe_pacing_share;
+        for (const std::string& spec : simulcast) {
+            RenditionOption rendition_option;
+            int kbps = 0;
+            if (sscanf(spec.c_str(), "%dx%d@%d", &rendition_option.width, &rendition_option.height, &kbps) != 3 ||
+                rendition_option.width <= 0 || rendition_option.height <= 0 || kbps <= 0) {
+                std::cerr << "Invalid simulcast rendition '" << spec << "', expected WxH@kbps\n";
+                return 1;
+            }
+            rendition_option.bitrate = kbps * 1000;
+            options.simulcast.push_back(rendition_option);
+        }
+        for (const std::string& spec : ladder) {
+            LadderStep step;
+            if (sscanf(spec.c_str(), "%dx%d@%d", &step.width, &step.height, &step.fps) != 3 ||
+                step.width <= 0 || step.height <= 0 || step.fps <= 0) {
+                std::cerr << "Invalid ladder step '" << spec << "', expected WxH@fps\n";
+                return 1;
+            }
+            options.ladder.push_back(step);
+        }
+        start_host_server(port, options, running);
     } else if (mode == "client") {
         if (ip=="") {
             std::cerr << "If running client you need to specify IP address: -i x.x.x.x\n";
             return 1;
         }
-        start_client(ip.c_str(), port, running);
+        ClientOptions options;
+        options.rendition = rendition;
+        options.udp = udp;
+        options.udp_gro = gso;
+        options.udp_timestamps = timestamps;
+        options.busy_poll_us = busy_poll_us;
+        options.emulate_loss_percent = emulate_loss;
+        options.emulate_burst = emulate_burst;
+        options.emulate_rate_kbps = emulate_rate_kbps;
+        options.emulate_delay_ms = emulate_delay_ms;
+        start_client(ip.c_str(), port, options, running);
     } else {
         std::cerr << "Invalid mode: use 'host' or 'client'\n";
         return 1;
@@ -0,0 +1,188 @@
+#include "delta_codec.h"
+#include <algorithm>
+#include <cstring>
+
+#include <lz4.h>
+
+static const size_t HEADER_SIZE = 12;
+
+static void put_u16(uint8_t* p, uint16_t v) { p[0] = (uint8_t)(v >> 8); p[1] = (uint8_t)v; }
+static void put_u32(uint8_t* p, uint32_t v) { put_u16(p, (uint16_t)(v >> 16)); put_u16(p + 2, (uint16_t)v); }
+static uint16_t get_u16(const uint8_t* p) { return (uint16_t)((p[0] << 8) | p[1]); }
+static uint32_t get_u32(const uint8_t* p) { return ((uint32_t)get_u16(p) << 16) | get_u16(p + 2); }
+
+// Chroma planes round up for odd sizes, as FFmpeg sizes them
+static int chroma_size(int luma) { return (luma + 1) / 2; }
+
+uint8_t* DeltaPlanes::plane(int i) {
+    const size_t luma = (size_t)width * height;
+    const size_t chroma = (size_t)chroma_size(width) * chroma_size(height);
+    return data.data() + (i == 0 ? 0 : luma + (i - 1) * chroma);
+}
+
+int DeltaPlanes::stride(int i) const {
+    return i == 0 ? width : chroma_size(width);
+}
+
+void init_delta_planes(DeltaPlanes& planes, int width, int height) {
+    planes.width = width;
+    planes.height = height;
+    planes.data.assign((size_t)width * height + 2 * (size_t)chroma_size(width) * chroma_size(height), 0);
+}
+
+// Visits the three plane rectangles of tile (tx, ty) as (plane, x, y, w, h)
+template <typename F>
+static void for_each_tile_rect(int width, int height, int tx, int ty, F&& fn) {
+    for (int p = 0; p < 3; ++p) {
+        const int shift = p == 0 ? 0 : 1;
+        const int tile = DELTA_TILE_SIZE >> shift;
+        const int pw = p == 0 ? width : chroma_size(width);
+        const int ph = p == 0 ? height : chroma_size(height);
+        const int x = tx * tile;
+        const int y = ty * tile;
+        fn(p, x, y, std::min(tile, pw - x), std::min(tile, ph - y));
+    }
+}
+
+bool encode_delta(DeltaEncoder& enc, int width, int height,
+    const uint8_t* const planes[3], const int linesizes[3], std::vector<uint8_t>& out) {
+    bool keyframe = enc.force_keyframe;
+    if (enc.reference.width != width || enc.reference.height != height) {
+        init_delta_planes(enc.reference, width, height);
+        keyframe = true;
+    }
+    if (keyframe) {
+        std::fill(enc.reference.data.begin(), enc.reference.data.end(), 0);
+    }
+    enc.force_keyframe = false;
+    enc.last_keyframe = keyframe;
+
+    const int tiles_x = (width + DELTA_TILE_SIZE - 1) / DELTA_TILE_SIZE;
+    const int tiles_y = (height + DELTA_TILE_SIZE - 1) / DELTA_TILE_SIZE;
+    enc.bitmap.assign(((size_t)tiles_x * tiles_y + 7) / 8, 0);
+    enc.xor_data.clear();
+
+    for (int ty = 0; ty < tiles_y; ++ty) {
+        for (int tx = 0; tx < tiles_x; ++tx) {
+            bool changed = keyframe;
+            if (!changed) {
+                for_each_tile_rect(width, height, tx, ty, [&](int p, int x, int y, int w, int h) {
+                    for (int row = 0; row < h && !changed; ++row) {
+                        const uint8_t* cur = planes[p] + (size_t)(y + row) * linesizes[p] + x;
+                        const uint8_t* ref = enc.reference.plane(p) + (size_t)(y + row) * enc.reference.stride(p) + x;
+                        changed = memcmp(cur, ref, w) != 0;
+                    }
+                });
+            }
+            if (!changed) continue;
+
+            const int index = ty * tiles_x + tx;
+            enc.bitmap[index / 8] |= (uint8_t)(0x80 >> (index % 8));
+            for_each_tile_rect(width, height, tx, ty, [&](int p, int x, int y, int w, int h) {
+                for (int row = 0; row < h; ++row) {
+                    const uint8_t* cur = planes[p] + (size_t)(y + row) * linesizes[p] + x;
+                    uint8_t* ref = enc.reference.plane(p) + (size_t)(y + row) * enc.reference.stride(p) + x;
+                    size_t offset = enc.xor_data.size();
+                    enc.xor_data.resize(offset + w);
+                    uint8_t* dst = enc.xor_data.data() + offset;
+                    for (int i = 0; i < w; ++i) dst[i] = cur[i] ^ ref[i];
+                    memcpy(ref, cur, w);
+                }
+            });
+        }
+    }
+
+    const int bound = LZ4_compressBound((int)enc.xor_data.size());
+    out.resize(HEADER_SIZE + enc.bitmap.size() + (size_t)bound);
+    put_u16(&out[0], (uint16_t)width);
+    put_u16(&out[2], (uint16_t)height);
+    put_u16(&out[4], (uint16_t)DELTA_TILE_SIZE);
+    put_u16(&out[6], keyframe ? DELTA_FLAG_KEYFRAME : 0);
+    put_u32(&out[8], (uint32_t)enc.xor_data.size());
+    memcpy(&out[HEADER_SIZE], enc.bitmap.data(), enc.bitmap.size());
+
+    int compressed = 0;
+    if (!enc.xor_data.empty()) {
+        char* dst = (char*)&out[HEADER_SIZE + enc.bitmap.size()];
+        compressed = LZ4_compress_fast((const char*)enc.xor_data.data(), dst, (int)enc.xor_data.size(), bound, 1);
+        if (compressed <= 0) {
+            enc.force_keyframe = true;  // The reference already moved on
+            return false;
+        }
+    }
+    out.resize(HEADER_SIZE + enc.bitmap.size() + compressed);
+    return true;
+}
+
+bool decode_delta(DeltaDecoder& dec, const uint8_t* data, size_t size) {
+    if (size < HEADER_SIZE) return false;
+    const int width = get_u16(data);
+    const int height = get_u16(data + 2);
+    const int tile_size = get_u16(data + 4);
+    const bool keyframe = get_u16(data + 6) & DELTA_FLAG_KEYFRAME;
+    const uint32_t raw_size = get_u32(data + 8);
+    if (tile_size != DELTA_TILE_SIZE || width <= 0 || height <= 0) return false;
+
+    if (keyframe) {
+        if (dec.frame.width != width || dec.frame.height != height) {
+            init_delta_planes(dec.frame, width, height);
+        } else {
+            std::fill(dec.frame.data.begin(), dec.frame.data.end(), 0);
+        }
+    } else if (dec.frame.width != width || dec.frame.height != height) {
+        return false;
+    }
+
+    const int tiles_x = (width + DELTA_TILE_SIZE - 1) / DELTA_TILE_SIZE;
+    const int tiles_y = (height + DELTA_TILE_SIZE - 1) / DELTA_TILE_SIZE;
+    const size_t bitmap_size = ((size_t)tiles_x * tiles_y + 7) / 8;
+    if (size < HEADER_SIZE + bitmap_size || raw_size > dec.frame.data.size()) return false;
+    const uint8_t* bitmap = data + HEADER_SIZE;
+
+    dec.xor_data.resize(raw_size);
+    if (raw_size > 0) {
+        const char* src = (const char*)(bitmap + bitmap_size);
+        int src_size = (int)(size - HEADER_SIZE - bitmap_size);
+        if (LZ4_decompress_safe(src, (char*)dec.xor_data.data(), src_size, (int)raw_size) != (int)raw_size) {
+            return false;
+        }
+    }
+
+    int min_tx = tiles_x, min_ty = tiles_y, max_tx = -1, max_ty = -1;
+    size_t offset = 0;
+    bool ok = true;
+    for (int ty = 0; ty < tiles_y && ok; ++ty) {
+        for (int tx = 0; tx < tiles_x && ok; ++tx) {
+            const int index = ty * tiles_x + tx;
+            if (!(bitmap[index / 8] & (0x80 >> (index % 8)))) continue;
+
+            for_each_tile_rect(width, height, tx, ty, [&](int p, int x, int y, int w, int h) {
+                for (int row = 0; row < h && ok; ++row) {
+                    if (offset + w > raw_size) {
+                        ok = false;
+                        break;
+                    }
+                    uint8_t* dst = dec.frame.plane(p) + (size_t)(y + row) * dec.frame.stride(p) + x;
+                    const uint8_t* src = dec.xor_data.data() + offset;
+                    for (int i = 0; i < w; ++i) dst[i] ^= src[i];
+                    offset += w;
+                }
+            });
+            min_tx = std::min(min_tx, tx);
+            min_ty = std::min(min_ty, ty);
+            max_tx = std::max(max_tx, tx);
+            max_ty = std::max(max_ty, ty);
+        }
+    }
+    if (!ok) return false;
+
+    if (max_tx < 0) {
+        dec.dirty_x = dec.dirty_y = dec.dirty_w = dec.dirty_h = 0;
+    } else {
+        dec.dirty_x = min_tx * DELTA_TILE_SIZE;
+        dec.dirty_y = min_ty * DELTA_TILE_SIZE;
+        dec.dirty_w = std::min((max_tx + 1) * DELTA_TILE_SIZE, width) - dec.dirty_x;
+        dec.dirty_h = std::min((max_ty + 1) * DELTA_TILE_SIZE, height) - dec.dirty_y;
+    }
+    return true;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Lossless "raw delta" codec for wired LANs. A YUV420P frame is split into
+// tiles (DELTA_TILE_SIZE luma pixels square). Tiles that changed since the
+// previous frame are XORed against it and the XOR data of all changed tiles
+// is compressed with LZ4 in one block; unchanged tiles cost one bit.
+//
+// Message layout, all fields big-endian:
+//   u16 width, u16 height, u16 tile_size, u16 flags
+//   u32 raw_size (XOR bytes before compression)
+//   ceil(tiles / 8) bytes changed-tile bitmap, row-major
+//   LZ4 block
+static const int DELTA_TILE_SIZE = 64;
+static const uint16_t DELTA_FLAG_KEYFRAME = 1;  // Decoder resets its reference to zero first
+
+// One planar YUV420P image, tightly packed
+struct DeltaPlanes {
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> data;
+
+    uint8_t* plane(int i);
+    int stride(int i) const;
+};
+
+void init_delta_planes(DeltaPlanes& planes, int width, int height);
+
+struct DeltaEncoder {
+    DeltaPlanes reference;
+    std::vector<uint8_t> xor_data;
+    std::vector<uint8_t> bitmap;
+    bool force_keyframe = true;
+    bool last_keyframe = false;     // The last encoded message was a keyframe
+};
+
+// Encodes one frame given as three plane pointers with their line sizes.
+// Returns false only on compression failure.
+bool encode_delta(DeltaEncoder& enc, int width, int height,
+    const uint8_t* const planes[3], const int linesizes[3], std::vector<uint8_t>& out);
+
+struct DeltaDecoder {
+    DeltaPlanes frame;
+    std::vector<uint8_t> xor_data;
+    // Luma-pixel bounding box of the tiles touched by the last message
+    int dirty_x = 0, dirty_y = 0, dirty_w = 0, dirty_h = 0;
+};
+
+// Applies one message to decoder.frame. Returns false on malformed input or
+// when a delta arrives without the keyframe it builds on.
+bool decode_delta(DeltaDecoder& dec, const uint8_t* data, size_t size);
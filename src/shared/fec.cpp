@@ -0,0 +1,213 @@
+#include "fec.h"
+
+#include <cstring>
+#include <vector>
+
+// SSSE3 is picked at run time, the build targets plain x86-64
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <tmmintrin.h>
+#define FEC_SSSE3 __attribute__((target("ssse3")))
+static bool cpu_has_ssse3() { return __builtin_cpu_supports("ssse3"); }
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <tmmintrin.h>
+#define FEC_SSSE3
+static bool cpu_has_ssse3() {
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+}
+#endif
+
+// GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1. Full products for
+// the scalar path, and per factor the products of the low and high nibble
+// for 16-byte table lookups.
+struct GaloisTables {
+    uint8_t exp[512];
+    uint8_t log[256];
+    uint8_t mul[256][256];
+    alignas(16) uint8_t mul_low[256][16];
+    alignas(16) uint8_t mul_high[256][16];
+    bool ssse3 = false;
+
+    GaloisTables() {
+        int x = 1;
+        for (int i = 0; i < 255; ++i) {
+            exp[i] = exp[i + 255] = (uint8_t)x;
+            log[x] = (uint8_t)i;
+            x <<= 1;
+            if (x & 0x100) x ^= 0x11D;
+        }
+        exp[510] = exp[511] = exp[0];
+        log[0] = 0;
+        for (int a = 0; a < 256; ++a) {
+            for (int b = 0; b < 256; ++b) {
+                mul[a][b] = a && b ? exp[log[a] + log[b]] : 0;
+            }
+            for (int n = 0; n < 16; ++n) {
+                mul_low[a][n] = mul[a][n];
+                mul_high[a][n] = mul[a][n << 4];
+            }
+        }
+#ifdef FEC_SSSE3
+        ssse3 = cpu_has_ssse3();
+#endif
+    }
+};
+
+static const GaloisTables gf;
+static bool ssse3_enabled = true;
+
+static uint8_t gf_inverse(uint8_t a) {
+    return gf.exp[255 - gf.log[a]];
+}
+
+// Repair row j, source column i of the Cauchy matrix
+static uint8_t cauchy(int j, int i) {
+    return gf_inverse((uint8_t)(j ^ (FEC_MAX_REPAIRS + i)));
+}
+
+bool parse_fec_scheme(const char* name, FecScheme& scheme) {
+    if (strcmp(name, "none") == 0) {
+        scheme = FecScheme::NONE;
+    } else if (strcmp(name, "xor") == 0) {
+        scheme = FecScheme::XOR;
+    } else if (strcmp(name, "rs") == 0) {
+        scheme = FecScheme::REED_SOLOMON;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* fec_scheme_name(FecScheme scheme) {
+    switch (scheme) {
+    case FecScheme::XOR: return "xor";
+    case FecScheme::REED_SOLOMON: return "rs";
+    default: return "none";
+    }
+}
+
+static void xor_into(uint8_t* dst, const uint8_t* src, size_t size) {
+    for (size_t i = 0; i < size; ++i) dst[i] ^= src[i];
+}
+
+#ifdef FEC_SSSE3
+// Splits each byte into nibbles and looks both up in 16-entry product tables
+FEC_SSSE3 static size_t mul_add_ssse3(uint8_t* dst, const uint8_t* src, uint8_t c, size_t size) {
+    const __m128i low = _mm_load_si128((const __m128i*)gf.mul_low[c]);
+    const __m128i high = _mm_load_si128((const __m128i*)gf.mul_high[c]);
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+        const __m128i product = _mm_xor_si128(
+            _mm_shuffle_epi8(low, _mm_and_si128(x, mask)),
+            _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi64(x, 4), mask)));
+        const __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(d, product));
+    }
+    return i;
+}
+#endif
+
+void gf_mul_add(uint8_t* dst, const uint8_t* src, uint8_t c, size_t size) {
+    if (c == 0) return;
+    if (c == 1) {
+        xor_into(dst, src, size);
+        return;
+    }
+    size_t i = 0;
+#ifdef FEC_SSSE3
+    if (gf.ssse3 && ssse3_enabled) i = mul_add_ssse3(dst, src, c, size);
+#endif
+    const uint8_t* row = gf.mul[c];
+    for (; i < size; ++i) dst[i] ^= row[src[i]];
+}
+
+bool fec_use_ssse3(bool enabled) {
+    ssse3_enabled = enabled;
+    return gf.ssse3 && ssse3_enabled;
+}
+
+void fec_encode(FecScheme scheme, const uint8_t* const* sources, int source_count,
+    uint8_t* const* repairs, int repair_count, size_t size) {
+    if (scheme == FecScheme::XOR) repair_count = 1;
+    for (int j = 0; j < repair_count; ++j) {
+        memset(repairs[j], 0, size);
+        for (int i = 0; i < source_count; ++i) {
+            gf_mul_add(repairs[j], sources[i], scheme == FecScheme::XOR ? 1 : cauchy(j, i), size);
+        }
+    }
+}
+
+bool fec_decode(FecScheme scheme, uint8_t* const* sources, const bool* have, int source_count,
+    const uint8_t* const* repairs, const int* repair_indices, int repair_count, size_t size) {
+    std::vector<int> missing;
+    for (int i = 0; i < source_count; ++i) {
+        if (!have[i]) missing.push_back(i);
+    }
+    const int count = (int)missing.size();
+    if (count == 0) return true;
+    if (count > repair_count || (scheme == FecScheme::XOR && count > 1)) return false;
+
+    if (scheme == FecScheme::XOR) {
+        uint8_t* out = sources[missing[0]];
+        memcpy(out, repairs[0], size);
+        for (int i = 0; i < source_count; ++i) {
+            if (have[i]) xor_into(out, sources[i], size);
+        }
+        return true;
+    }
+
+    // Each repair minus its known sources leaves a combination of the
+    // missing ones: remainder_j = sum over m of cauchy(j, m) * source_m.
+    // Every square Cauchy submatrix is invertible, so Gauss-Jordan on it
+    // always succeeds.
+    std::vector<std::vector<uint8_t>> remainders(count);
+    std::vector<uint8_t> matrix((size_t)count * count);
+    for (int r = 0; r < count; ++r) {
+        const int j = repair_indices[r];
+        remainders[r].assign(repairs[r], repairs[r] + size);
+        for (int i = 0; i < source_count; ++i) {
+            if (have[i]) gf_mul_add(remainders[r].data(), sources[i], cauchy(j, i), size);
+        }
+        for (int m = 0; m < count; ++m) {
+            matrix[(size_t)r * count + m] = cauchy(j, missing[m]);
+        }
+    }
+
+    // Reduce the matrix to the identity, applying the same row operations
+    // to the remainders
+    for (int col = 0; col < count; ++col) {
+        int pivot = col;
+        while (matrix[(size_t)pivot * count + col] == 0) ++pivot;
+        if (pivot != col) {
+            for (int m = 0; m < count; ++m) {
+                std::swap(matrix[(size_t)pivot * count + m], matrix[(size_t)col * count + m]);
+            }
+            std::swap(remainders[pivot], remainders[col]);
+        }
+        const uint8_t scale = gf_inverse(matrix[(size_t)col * count + col]);
+        for (int m = 0; m < count; ++m) {
+            matrix[(size_t)col * count + m] = gf.mul[scale][matrix[(size_t)col * count + m]];
+        }
+        std::vector<uint8_t> scaled(size, 0);
+        gf_mul_add(scaled.data(), remainders[col].data(), scale, size);
+        remainders[col].swap(scaled);
+
+        for (int r = 0; r < count; ++r) {
+            const uint8_t factor = matrix[(size_t)r * count + col];
+            if (r == col || factor == 0) continue;
+            for (int m = 0; m < count; ++m) {
+                matrix[(size_t)r * count + m] ^= gf.mul[factor][matrix[(size_t)col * count + m]];
+            }
+            gf_mul_add(remainders[r].data(), remainders[col].data(), factor, size);
+        }
+    }
+
+    for (int m = 0; m < count; ++m) {
+        memcpy(sources[missing[m]], remainders[m].data(), size);
+    }
+    return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Forward error correction over a group of equally sized symbols: source
+// symbols go out unchanged, repair symbols are combinations of them. XOR
+// parity adds one repair symbol that recovers any one loss. Reed-Solomon
+// (a systematic Cauchy code over GF(2^8)) recovers as many losses, bursts
+// included, as there are repair symbols.
+enum class FecScheme : uint8_t {
+    NONE = 0,
+    XOR = 1,
+    REED_SOLOMON = 2,
+};
+
+// Cauchy rows and columns are drawn from disjoint halves of GF(2^8)
+const int FEC_MAX_SOURCES = 128;
+const int FEC_MAX_REPAIRS = 128;
+
+// Parses "none", "xor" or "rs"
+bool parse_fec_scheme(const char* name, FecScheme& scheme);
+const char* fec_scheme_name(FecScheme scheme);
+
+// dst ^= c * src over GF(2^8), 16 bytes per step with SSSE3 where the CPU
+// has it
+void gf_mul_add(uint8_t* dst, const uint8_t* src, uint8_t c, size_t size);
+
+// Lets gf_mul_add take the SSSE3 path where the CPU has it (the default), or
+// keeps it on the scalar one, such as to test both on the same machine.
+// Call before any coding starts. Returns whether SSSE3 is now used.
+bool fec_use_ssse3(bool enabled);
+
+// Fills `repair_count` repair symbols (1 for XOR) from `source_count`
+// sources, all `size` bytes
+void fec_encode(FecScheme scheme, const uint8_t* const* sources, int source_count,
+    uint8_t* const* repairs, int repair_count, size_t size);
+
+// Rebuilds the sources with `have[i]` false in place from the repair symbols
+// `repairs[n]` with indices `repair_indices[n]`. Returns false when fewer
+// repairs than missing sources are given.
+bool fec_decode(FecScheme scheme, uint8_t* const* sources, const bool* have, int source_count,
+    const uint8_t* const* repairs, const int* repair_indices, int repair_count, size_t size);
@@ -0,0 +1,110 @@
+#include "h264.h"
+
+std::vector<NalUnit> find_nal_units(const uint8_t* data, size_t size) {
+    std::vector<NalUnit> units;
+    size_t i = 0;
+    size_t start = 0;
+    bool in_nal = false;
+
+    while (i + 3 <= size) {
+        // Start codes are 00 00 01 or 00 00 00 01, the leading zero of the long
+        // form is trailing_zero_bits of the previous NAL and gets trimmed below
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            if (in_nal) {
+                size_t end = i;
+                while (end > start && data[end - 1] == 0) --end;
+                units.back().size = end - start;
+            }
+            start = i + 3;
+            if (start < size) {
+                NalUnit nal;
+                nal.offset = start;
+                nal.type = data[start] & 0x1F;
+                nal.ref_idc = (data[start] >> 5) & 0x03;
+                units.push_back(nal);
+                in_nal = true;
+            }
+            i = start;
+        } else {
+            ++i;
+        }
+    }
+    if (in_nal) {
+        units.back().size = size - start;
+    }
+    return units;
+}
+
+bool h264_contains_idr(const uint8_t* data, size_t size) {
+    for (const NalUnit& nal : find_nal_units(data, size)) {
+        if (nal.type == H264_NAL_IDR) return true;
+    }
+    return false;
+}
+
+bool h264_extract_parameter_sets(const uint8_t* data, size_t size, std::vector<uint8_t>& out) {
+    static const uint8_t start_code[4] = { 0, 0, 0, 1 };
+    out.clear();
+    for (const NalUnit& nal : find_nal_units(data, size)) {
+        if (nal.type != H264_NAL_SPS && nal.type != H264_NAL_PPS) continue;
+        out.insert(out.end(), start_code, start_code + 4);
+        out.insert(out.end(), data + nal.offset, data + nal.offset + nal.size);
+    }
+    return !out.empty();
+}
+
+// Minimal RBSP bit reader for the first slice header fields, skips emulation
+// prevention bytes on the fly
+struct BitReader {
+    const uint8_t* data;
+    size_t size;
+    size_t byte = 0;
+    int bit = 7;
+    int zeros = 0;
+
+    int read_bit() {
+        if (byte >= size) return -1;
+        int value = (data[byte] >> bit) & 1;
+        if (--bit < 0) {
+            zeros = data[byte] == 0 ? zeros + 1 : 0;
+            bit = 7;
+            ++byte;
+            if (zeros >= 2 && byte < size && data[byte] == 3) {
+                ++byte;
+                zeros = 0;
+            }
+        }
+        return value;
+    }
+
+    // Exp-Golomb ue(v)
+    int read_ue() {
+        int leading = 0;
+        int b;
+        while ((b = read_bit()) == 0) {
+            if (++leading > 31) return -1;
+        }
+        if (b < 0) return -1;
+        unsigned value = 0;
+        for (int i = 0; i < leading; ++i) {
+            b = read_bit();
+            if (b < 0) return -1;
+            value = (value << 1) | (unsigned)b;
+        }
+        return (int)((1u << leading) - 1 + value);
+    }
+};
+
+int h264_slice_type(const uint8_t* nal, size_t size) {
+    if (size < 2) return -1;
+    BitReader reader{ nal + 1, size - 1 };
+    if (reader.read_ue() < 0) return -1;    // first_mb_in_slice
+    int slice_type = reader.read_ue();
+    if (slice_type < 0) return -1;
+    switch (slice_type % 5) {
+        case 0: return 0;   // P
+        case 1: return 1;   // B
+        case 3: return 0;   // SP
+        default: return 2;  // I, SI
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// NAL unit types used by the streaming code
+enum H264NalType {
+    H264_NAL_SLICE = 1,
+    H264_NAL_IDR = 5,
+    H264_NAL_SEI = 6,
+    H264_NAL_SPS = 7,
+    H264_NAL_PPS = 8,
+    H264_NAL_AUD = 9,
+};
+
+// One NAL unit inside an Annex-B buffer. `offset` points at the NAL header
+// byte (past the start code), `size` runs up to the next start code.
+struct NalUnit {
+    size_t offset = 0;
+    size_t size = 0;
+    int type = 0;
+    int ref_idc = 0;
+};
+
+// Splits an Annex-B byte stream (as produced by the FFmpeg H.264 encoders)
+// into its NAL units
+std::vector<NalUnit> find_nal_units(const uint8_t* data, size_t size);
+
+// Whether the buffer holds an IDR slice
+bool h264_contains_idr(const uint8_t* data, size_t size);
+
+// Copies the SPS and PPS NAL units of `data` to `out` as Annex-B (4 byte
+// start codes). Returns false when there are none.
+bool h264_extract_parameter_sets(const uint8_t* data, size_t size, std::vector<uint8_t>& out);
+
+// Slice type of a VCL NAL unit: 0 = P, 1 = B, 2 = I (SP/SI folded in), -1 on error
+int h264_slice_type(const uint8_t* nal, size_t size);
@@ -0,0 +1,233 @@
+#include "io_ring.h"
+
+#include <algorithm>
+#include <cerrno>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#ifdef __linux__
+
+// The mappings shared with the kernel, plus the iovecs of each slot's send:
+// the kernel reads them when it starts the send, which may be after submit
+struct IoRingMaps {
+    int fd = -1;
+    void* ring = MAP_FAILED;
+    size_t ring_size = 0;
+    io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED;
+    size_t sqes_size = 0;
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_entries = 0;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    unsigned queued = 0;            // Entries written since the last submit
+    std::vector<msghdr> messages;   // Per slot
+    std::vector<iovec> vectors;     // MAX_GATHER per slot
+};
+
+// user_data of an operation
+static uint64_t operation_tag(unsigned slot, RingOp op) {
+    return (uint64_t)slot << 1 | (op == RingOp::RECV ? 1 : 0);
+}
+
+bool init_io_ring(IoRing& ring, unsigned slots, size_t buffer_size) {
+    // Two operations per slot fit the submission queue between submits, and
+    // the completion queue, twice its size, never overflows
+    io_uring_params params{};
+    IoRingMaps* maps = new IoRingMaps;
+    ring.maps = maps;
+    maps->fd = (int)syscall(__NR_io_uring_setup, 2 * slots, &params);
+    // Without FAST_POLL a socket operation that has to wait ties up a kernel
+    // worker thread
+    const unsigned needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_FAST_POLL;
+    if (maps->fd < 0 || (params.features & needed) != needed) {
+        destroy_io_ring(ring);
+        return false;
+    }
+
+    maps->ring_size = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                               params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    maps->ring = mmap(nullptr, maps->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      maps->fd, IORING_OFF_SQ_RING);
+    maps->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    maps->sqes = (io_uring_sqe*)mmap(nullptr, maps->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                     maps->fd, IORING_OFF_SQES);
+    if (maps->ring == MAP_FAILED || maps->sqes == MAP_FAILED) {
+        destroy_io_ring(ring);
+        return false;
+    }
+    uint8_t* base = (uint8_t*)maps->ring;
+    maps->sq_head = (unsigned*)(base + params.sq_off.head);
+    maps->sq_tail = (unsigned*)(base + params.sq_off.tail);
+    maps->sq_mask = (unsigned*)(base + params.sq_off.ring_mask);
+    maps->sq_array = (unsigned*)(base + params.sq_off.array);
+    maps->sq_entries = params.sq_entries;
+    maps->cq_head = (unsigned*)(base + params.cq_off.head);
+    maps->cq_tail = (unsigned*)(base + params.cq_off.tail);
+    maps->cq_mask = (unsigned*)(base + params.cq_off.ring_mask);
+    maps->cqes = (io_uring_cqe*)(base + params.cq_off.cqes);
+
+    // Empty fixed files are filled in as sockets take slots
+    std::vector<int> files(slots, -1);
+    ring.buffers.resize(slots * buffer_size);
+    std::vector<iovec> buffers(slots);
+    for (unsigned i = 0; i < slots; ++i) buffers[i] = { ring.buffers.data() + i * buffer_size, buffer_size };
+    if (syscall(__NR_io_uring_register, maps->fd, IORING_REGISTER_FILES, files.data(), slots) != 0 ||
+        syscall(__NR_io_uring_register, maps->fd, IORING_REGISTER_BUFFERS, buffers.data(), slots) != 0) {
+        destroy_io_ring(ring);
+        return false;
+    }
+    maps->messages.resize(slots);
+    maps->vectors.resize(slots * MAX_GATHER);
+    ring.slot_size = buffer_size;
+    ring.slots = slots;
+    return true;
+}
+
+socket_t io_ring_fd(const IoRing& ring) {
+    return ring.maps ? ring.maps->fd : -1;
+}
+
+bool set_ring_file(IoRing& ring, unsigned slot, socket_t sock) {
+    int fd = sock;
+    io_uring_files_update update{};
+    update.offset = slot;
+    update.fds = (uint64_t)(uintptr_t)&fd;
+    return syscall(__NR_io_uring_register, ring.maps->fd, IORING_REGISTER_FILES_UPDATE, &update, 1) == 1;
+}
+
+const uint8_t* ring_buffer(const IoRing& ring, unsigned slot) {
+    return ring.buffers.data() + slot * ring.slot_size;
+}
+
+// Next free submission entry, submitting what is queued when the queue is full
+static io_uring_sqe* next_sqe(IoRing& ring) {
+    IoRingMaps& maps = *ring.maps;
+    const unsigned tail = *maps.sq_tail;
+    if (tail - __atomic_load_n(maps.sq_head, __ATOMIC_ACQUIRE) >= maps.sq_entries) {
+        if (!submit_ring(ring) || tail - __atomic_load_n(maps.sq_head, __ATOMIC_ACQUIRE) >= maps.sq_entries) {
+            return nullptr;
+        }
+    }
+    const unsigned index = tail & *maps.sq_mask;
+    io_uring_sqe* sqe = &maps.sqes[index];
+    *sqe = io_uring_sqe{};
+    maps.sq_array[index] = index;
+    return sqe;
+}
+
+// Makes the entry from next_sqe visible to the kernel's next submit
+static void push_sqe(IoRing& ring) {
+    IoRingMaps& maps = *ring.maps;
+    __atomic_store_n(maps.sq_tail, *maps.sq_tail + 1, __ATOMIC_RELEASE);
+    ++maps.queued;
+}
+
+bool queue_ring_send(IoRing& ring, unsigned slot, const SendBuffer* buffers, size_t count) {
+    io_uring_sqe* sqe = next_sqe(ring);
+    if (!sqe) return false;
+    iovec* vec = &ring.maps->vectors[slot * MAX_GATHER];
+    count = std::min(count, MAX_GATHER);
+    for (size_t i = 0; i < count; ++i) vec[i] = { (void*)buffers[i].data, buffers[i].size };
+    msghdr& msg = ring.maps->messages[slot];
+    msg = msghdr{};
+    msg.msg_iov = vec;
+    msg.msg_iovlen = count;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = (int)slot;
+    sqe->addr = (uint64_t)(uintptr_t)&msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = operation_tag(slot, RingOp::SEND);
+    push_sqe(ring);
+    return true;
+}
+
+bool queue_ring_recv(IoRing& ring, unsigned slot) {
+    io_uring_sqe* sqe = next_sqe(ring);
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = (int)slot;
+    sqe->addr = (uint64_t)(uintptr_t)ring_buffer(ring, slot);
+    sqe->len = (uint32_t)ring.slot_size;
+    sqe->buf_index = (uint16_t)slot;
+    sqe->user_data = operation_tag(slot, RingOp::RECV);
+    push_sqe(ring);
+    return true;
+}
+
+bool submit_ring(IoRing& ring) {
+    IoRingMaps& maps = *ring.maps;
+    while (maps.queued > 0) {
+        const int submitted = (int)syscall(__NR_io_uring_enter, maps.fd, maps.queued, 0, 0, nullptr, 0);
+        if (submitted < 0) {
+            if (errno == EINTR) continue;
+            // EAGAIN/EBUSY: the kernel is short of memory or completion
+            // room, the entries stay queued for the next pass
+            return errno == EAGAIN || errno == EBUSY;
+        }
+        maps.queued -= std::min((unsigned)submitted, maps.queued);
+        ring.operations += submitted;
+        ++ring.submit_calls;
+    }
+    return true;
+}
+
+void reap_ring(IoRing& ring, std::vector<RingCompletion>& completions) {
+    IoRingMaps& maps = *ring.maps;
+    unsigned head = *maps.cq_head;
+    const unsigned tail = __atomic_load_n(maps.cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        const io_uring_cqe& cqe = maps.cqes[head & *maps.cq_mask];
+        const RingOp op = (cqe.user_data & 1) ? RingOp::RECV : RingOp::SEND;
+        completions.push_back({ (unsigned)(cqe.user_data >> 1), op, cqe.res });
+    }
+    __atomic_store_n(maps.cq_head, head, __ATOMIC_RELEASE);
+}
+
+void wait_ring(IoRing& ring, int timeout_ms) {
+    pollfd pfd{ ring.maps->fd, POLLIN, 0 };
+    poll(&pfd, 1, timeout_ms);
+}
+
+void destroy_io_ring(IoRing& ring) {
+    IoRingMaps* maps = ring.maps;
+    if (!maps) return;
+    if (maps->sqes != MAP_FAILED) munmap(maps->sqes, maps->sqes_size);
+    if (maps->ring != MAP_FAILED) munmap(maps->ring, maps->ring_size);
+    if (maps->fd >= 0) close(maps->fd);
+    delete maps;
+    ring.maps = nullptr;
+    ring.buffers.clear();
+    ring.buffers.shrink_to_fit();
+    ring.slots = 0;
+}
+
+#else
+
+struct IoRingMaps {};
+
+bool init_io_ring(IoRing&, unsigned, size_t) { return false; }
+socket_t io_ring_fd(const IoRing&) { return (socket_t)-1; }
+bool set_ring_file(IoRing&, unsigned, socket_t) { return false; }
+const uint8_t* ring_buffer(const IoRing& ring, unsigned slot) { return ring.buffers.data() + slot * ring.slot_size; }
+bool queue_ring_send(IoRing&, unsigned, const SendBuffer*, size_t) { return false; }
+bool queue_ring_recv(IoRing&, unsigned) { return false; }
+bool submit_ring(IoRing&) { return false; }
+void reap_ring(IoRing&, std::vector<RingCompletion>&) {}
+void wait_ring(IoRing&, int) {}
+void destroy_io_ring(IoRing&) {}
+
+#endif
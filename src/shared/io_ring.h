@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "socket.h"
+
+enum class RingOp : uint8_t {
+    SEND,
+    RECV,
+};
+
+// One finished operation
+struct RingCompletion {
+    unsigned slot;
+    RingOp op;
+    int result;     // Bytes moved, 0 at end of stream, -errno on failure
+};
+
+struct IoRingMaps;
+
+// io_uring shared by many sockets on one thread (Linux 5.7+). Each socket
+// takes a slot: a fixed file and a registered receive buffer. Operations are
+// only queued until submit_ring, so one io_uring_enter carries every send
+// and receive a pass of the caller's loop prepared, and completions are
+// collected from the shared ring without a syscall. A slot has at most one
+// send and one receive in flight.
+struct IoRing {
+    IoRingMaps* maps = nullptr;
+    std::vector<uint8_t> buffers;   // Registered, slot_size bytes per slot
+    size_t slot_size = 0;
+    unsigned slots = 0;
+    uint64_t operations = 0;        // Submitted so far
+    uint64_t submit_calls = 0;      // io_uring_enter calls that carried them
+};
+
+// Sets up `slots` empty slots with `buffer_size` bytes of receive buffer
+// each. Returns false where io_uring is unavailable.
+bool init_io_ring(IoRing& ring, unsigned slots, size_t buffer_size);
+
+// Readable while completions wait, for a poller
+socket_t io_ring_fd(const IoRing& ring);
+
+// Points the slot's fixed file at `sock`, or empties it with (socket_t)-1.
+// The ring keeps its own reference until the slot's operations complete.
+bool set_ring_file(IoRing& ring, unsigned slot, socket_t sock);
+
+// Where the slot's receives land
+const uint8_t* ring_buffer(const IoRing& ring, unsigned slot);
+
+// Queues one gathered send on the slot's socket. The buffer list is copied,
+// the bytes are read when the kernel gets to them and must stay until the
+// completion.
+bool queue_ring_send(IoRing& ring, unsigned slot, const SendBuffer* buffers, size_t count);
+
+// Queues a receive of up to slot_size bytes into the slot's buffer
+bool queue_ring_recv(IoRing& ring, unsigned slot);
+
+// Hands everything queued to the kernel in one io_uring_enter
+bool submit_ring(IoRing& ring);
+
+// Appends the completions that arrived, without blocking
+void reap_ring(IoRing& ring, std::vector<RingCompletion>& completions);
+
+// Waits up to `timeout_ms` for a completion
+void wait_ring(IoRing& ring, int timeout_ms);
+
+// Closes the ring. Operations still in flight are cancelled, wait for their
+// completions first when their buffers matter.
+void destroy_io_ring(IoRing& ring);
@@ -0,0 +1,51 @@
+#include "link_emulator.h"
+
+#include <algorithm>
+
+void init_link_emulator(LinkEmulator& link, double loss_percent, double burst) {
+    link.loss = std::min(std::max(loss_percent / 100.0, 0.0), 0.99);
+    link.burst = std::max(burst, 1.0);
+    // Stationary loss p / (p + 1/burst) solved for the start probability p
+    link.start_probability = link.loss / (link.burst * (1 - link.loss));
+    link.dropping = false;
+    link.random.seed(std::random_device()());
+    link.dropped = 0;
+}
+
+void shape_link_emulator(LinkEmulator& link, double rate_kbps, double delay_ms, double queue_ms) {
+    link.rate_bps = std::max(rate_kbps, 0.0) * 1000;
+    link.delay_us = (uint64_t)(std::max(delay_ms, 0.0) * 1000);
+    link.queue_us = (uint64_t)(std::max(queue_ms, 0.0) * 1000);
+    link.busy_until_us = 0;
+    link.queue_dropped = 0;
+}
+
+bool link_shaped(const LinkEmulator& link) {
+    return link.rate_bps > 0 || link.delay_us > 0;
+}
+
+bool link_drops(LinkEmulator& link) {
+    if (link.loss <= 0) return false;
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    const double chance = link.burst <= 1 ? link.loss
+                        : link.dropping ? 1 - 1 / link.burst : link.start_probability;
+    link.dropping = uniform(link.random) < chance;
+    if (link.dropping) ++link.dropped;
+    return link.dropping;
+}
+
+bool link_transmit(LinkEmulator& link, uint64_t now_us, size_t size, uint64_t& arrival_us) {
+    if (link_drops(link)) return false;
+    uint64_t leaves_us = now_us;
+    if (link.rate_bps > 0) {
+        const uint64_t start_us = std::max(now_us, link.busy_until_us);
+        if (start_us - now_us > link.queue_us) {
+            ++link.queue_dropped;
+            return false;
+        }
+        link.busy_until_us = start_us + (uint64_t)(size * 8 * 1e6 / link.rate_bps);
+        leaves_us = link.busy_until_us;
+    }
+    arrival_us = leaves_us + link.delay_us;
+    return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+
+// Impairs received datagrams to try loss handling and rate control over a
+// clean link. With `burst` above 1 losses follow a two-state Gilbert-Elliott
+// model: once a drop starts, the next datagram is dropped too with
+// probability 1 - 1/burst, so runs of drops are `burst` long on average. At 1
+// every datagram is dropped independently.
+//
+// A shaped link also has a bottleneck: datagrams queue behind each other at
+// `rate_bps`, the queue drops what would wait longer than `queue_us`, and
+// everything arrives `delay_us` after leaving it. Times are whatever clock
+// the caller passes in, so the same link works in simulated time.
+struct LinkEmulator {
+    double loss = 0;            // Long-run fraction of datagrams dropped
+    double burst = 1;
+    double start_probability = 0;   // Of a drop after a delivered datagram
+    bool dropping = false;
+    std::mt19937 random;
+    uint64_t dropped = 0;
+    double rate_bps = 0;        // Bottleneck rate, 0 = unlimited
+    uint64_t delay_us = 0;      // Propagation delay
+    uint64_t queue_us = 0;      // Longest wait in the bottleneck queue
+    uint64_t busy_until_us = 0; // When the queue empties
+    uint64_t queue_dropped = 0; // Dropped by the full queue, not counted in `dropped`
+};
+
+// `loss_percent` of datagrams dropped in runs of `burst` on average
+void init_link_emulator(LinkEmulator& link, double loss_percent, double burst);
+
+// Caps the link at `rate_kbps` (0 = unlimited) behind a queue of `queue_ms`
+// and delays delivery by `delay_ms`
+void shape_link_emulator(LinkEmulator& link, double rate_kbps, double delay_ms, double queue_ms);
+
+// Whether a link shaped by shape_link_emulator delays or caps anything
+bool link_shaped(const LinkEmulator& link);
+
+// Whether the next datagram is lost
+bool link_drops(LinkEmulator& link);
+
+// Passes a datagram of `size` bytes sent at `now_us` through loss and the
+// bottleneck. Returns false when it is dropped, else sets its arrival time.
+bool link_transmit(LinkEmulator& link, uint64_t now_us, size_t size, uint64_t& arrival_us);
@@ -0,0 +1,163 @@
+#include "poller.h"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#elif !defined(_WIN32)
+#include <poll.h>
+#endif
+
+// Most events handled per wait
+static const int MAX_POLL_EVENTS = 64;
+
+#ifdef __linux__
+
+bool init_poller(Poller& poller) {
+    poller.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    poller.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (poller.epoll_fd < 0 || poller.wake_fd < 0) {
+        destroy_poller(poller);
+        return false;
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = poller.wake_fd;
+    return epoll_ctl(poller.epoll_fd, EPOLL_CTL_ADD, poller.wake_fd, &ev) == 0;
+}
+
+static uint32_t epoll_mask(bool want_write) {
+    return EPOLLIN | EPOLLRDHUP | (want_write ? (uint32_t)EPOLLOUT : 0u);
+}
+
+bool poller_add(Poller& poller, socket_t sock, bool want_write) {
+    epoll_event ev{};
+    ev.events = epoll_mask(want_write);
+    ev.data.fd = sock;
+    return epoll_ctl(poller.epoll_fd, EPOLL_CTL_ADD, sock, &ev) == 0;
+}
+
+bool poller_modify(Poller& poller, socket_t sock, bool want_write) {
+    epoll_event ev{};
+    ev.events = epoll_mask(want_write);
+    ev.data.fd = sock;
+    return epoll_ctl(poller.epoll_fd, EPOLL_CTL_MOD, sock, &ev) == 0;
+}
+
+void poller_remove(Poller& poller, socket_t sock) {
+    epoll_ctl(poller.epoll_fd, EPOLL_CTL_DEL, sock, nullptr);
+}
+
+void poller_wait(Poller& poller, std::vector<PollEvent>& events, int timeout_ms) {
+    events.clear();
+    epoll_event ready[MAX_POLL_EVENTS];
+    const int count = epoll_wait(poller.epoll_fd, ready, MAX_POLL_EVENTS, timeout_ms);
+    for (int i = 0; i < count; ++i) {
+        if (ready[i].data.fd == poller.wake_fd) {
+            uint64_t value;
+            while (read(poller.wake_fd, &value, sizeof(value)) > 0) {}
+            continue;
+        }
+        PollEvent event;
+        event.sock = ready[i].data.fd;
+        event.readable = ready[i].events & EPOLLIN;
+        event.writable = ready[i].events & EPOLLOUT;
+        event.closed = ready[i].events & (EPOLLHUP | EPOLLERR);
+        events.push_back(event);
+    }
+}
+
+void wake_poller(Poller& poller) {
+    const uint64_t one = 1;
+    if (write(poller.wake_fd, &one, sizeof(one)) < 0) {
+        // Counter saturated, a wake-up is pending anyway
+    }
+}
+
+void destroy_poller(Poller& poller) {
+    if (poller.epoll_fd >= 0) close(poller.epoll_fd);
+    if (poller.wake_fd >= 0) close(poller.wake_fd);
+    poller.epoll_fd = poller.wake_fd = -1;
+}
+
+#else
+
+#ifdef _WIN32
+#define poll WSAPoll
+#endif
+
+bool init_poller(Poller& poller) {
+    // A UDP socket that sends to itself, the portable stand-in for eventfd
+    poller.wake_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(poller.wake_sock, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+        getsockname(poller.wake_sock, (sockaddr*)&addr, &len) != 0 ||
+        connect(poller.wake_sock, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+        !set_nonblocking(poller.wake_sock)) {
+        close_socket(poller.wake_sock);
+        return false;
+    }
+    pollfd wake{};
+    wake.fd = poller.wake_sock;
+    wake.events = POLLIN;
+    poller.fds.assign(1, wake);
+    return true;
+}
+
+bool poller_add(Poller& poller, socket_t sock, bool want_write) {
+    pollfd entry{};
+    entry.fd = sock;
+    entry.events = POLLIN | (want_write ? POLLOUT : 0);
+    poller.fds.push_back(entry);
+    return true;
+}
+
+bool poller_modify(Poller& poller, socket_t sock, bool want_write) {
+    for (pollfd& entry : poller.fds) {
+        if (entry.fd != sock) continue;
+        entry.events = POLLIN | (want_write ? POLLOUT : 0);
+        return true;
+    }
+    return false;
+}
+
+void poller_remove(Poller& poller, socket_t sock) {
+    poller.fds.erase(std::remove_if(poller.fds.begin() + 1, poller.fds.end(),
+        [sock](const pollfd& entry) { return entry.fd == sock; }), poller.fds.end());
+}
+
+void poller_wait(Poller& poller, std::vector<PollEvent>& events, int timeout_ms) {
+    events.clear();
+    if (poll(poller.fds.data(), (unsigned long)poller.fds.size(), timeout_ms) <= 0) return;
+
+    if (poller.fds[0].revents) {
+        char drain[64];
+        while (recv(poller.wake_sock, drain, sizeof(drain), 0) > 0) {}
+    }
+    for (size_t i = 1; i < poller.fds.size() && (int)events.size() < MAX_POLL_EVENTS; ++i) {
+        const pollfd& entry = poller.fds[i];
+        if (!entry.revents) continue;
+        PollEvent event;
+        event.sock = entry.fd;
+        event.readable = entry.revents & POLLIN;
+        event.writable = entry.revents & POLLOUT;
+        event.closed = entry.revents & (POLLHUP | POLLERR | POLLNVAL);
+        events.push_back(event);
+    }
+}
+
+void wake_poller(Poller& poller) {
+    const char one = 1;
+    send(poller.wake_sock, &one, 1, 0);
+}
+
+void destroy_poller(Poller& poller) {
+    close_socket(poller.wake_sock);
+    poller.fds.clear();
+}
+
+#endif
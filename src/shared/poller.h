@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+
+#if !defined(__linux__) && !defined(_WIN32)
+#include <poll.h>
+#endif
+
+#include "socket.h"
+
+// Readiness of one socket
+struct PollEvent {
+    socket_t sock;
+    bool readable = false;
+    bool writable = false;
+    bool closed = false;    // Hang-up or error, the socket should be dropped
+};
+
+// Waits on many sockets from one thread: epoll on Linux, WSAPoll elsewhere.
+// Sockets are added, changed and removed by the waiting thread only; any
+// thread may wake it.
+struct Poller {
+#ifdef __linux__
+    int epoll_fd = -1;
+    int wake_fd = -1;       // eventfd
+#else
+    std::vector<pollfd> fds;
+    socket_t wake_sock = (socket_t)-1;  // UDP socket connected to itself
+#endif
+};
+
+bool init_poller(Poller& poller);
+
+// Watches `sock` for reads, and for writes when `want_write` is set
+bool poller_add(Poller& poller, socket_t sock, bool want_write);
+bool poller_modify(Poller& poller, socket_t sock, bool want_write);
+void poller_remove(Poller& poller, socket_t sock);
+
+// Waits up to `timeout_ms` for events. A wake-up returns early with no
+// events for it.
+void poller_wait(Poller& poller, std::vector<PollEvent>& events, int timeout_ms);
+
+// Makes a concurrent poller_wait return
+void wake_poller(Poller& poller);
+
+void destroy_poller(Poller& poller);
@@ -0,0 +1,40 @@
+#include "protocol.h"
+#include <chrono>
+
+bool valid_message_header(const MessageHeader& header) {
+    return header.version == PROTOCOL_VERSION && header.payload_size <= MAX_PAYLOAD_SIZE;
+}
+
+bool send_protocol_message(Transport& transport, MessageHeader& header, size_t head_size,
+    const uint8_t* payload, size_t payload_size) {
+    header.payload_size = (uint32_t)(head_size - sizeof(MessageHeader) + payload_size);
+
+    const SendBuffer buffers[] = {{&header, head_size}, {payload, payload_size}};
+    return transport_send(transport, buffers, payload_size ? 2 : 1);
+}
+
+void add_protocol_message(MessageBatch& batch, MessageHeader& header, size_t head_size,
+    const uint8_t* payload, size_t payload_size) {
+    header.payload_size = (uint32_t)(head_size - sizeof(MessageHeader) + payload_size);
+    batch.headers.push_back(&header);
+    batch.buffers.push_back({&header, head_size});
+    batch.buffers.push_back({payload, payload_size});
+}
+
+bool send_protocol_batch(Transport& transport, const MessageBatch& batch) {
+    return transport_send(transport, batch.buffers.data(), batch.buffers.size());
+}
+
+bool recv_protocol_message(Transport& transport, MessageHeader& header, std::vector<uint8_t>& payload) {
+    if (!transport_recv(transport, &header, sizeof(header))) return false;
+    if (!valid_message_header(header)) return false;
+
+    const uint32_t size = header.payload_size;
+    payload.resize(size);
+    return transport_recv(transport, payload.data(), size);
+}
+
+uint64_t protocol_timestamp_us() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
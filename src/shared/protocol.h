@@ -0,0 +1,255 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "transport.h"
+
+// Binary wire protocol shared by host and client (see DESIGN.md). Every
+// message is a fixed 24 byte header followed by `payload_size` bytes, all
+// integers big-endian:
+//
+//   0  u8  version         PROTOCOL_VERSION
+//   1  u8  type            MessageType
+//   2  u16 flags           MessageFlags
+//   4  u32 sequence        Per connection and direction, +1 per message
+//   8  u64 timestamp_us    Capture time on the sender's steady clock
+//   16 u32 payload_size
+//   20 u32 reserved        Zero, keeps the header a multiple of 8 bytes
+//
+// The structs below are the wire layout itself: they only hold bytes, so
+// they can be read as views straight over a receive buffer at any alignment
+// and built in place in front of a payload without a serialization step.
+static const uint8_t PROTOCOL_VERSION = 1;
+static const uint32_t MAX_PAYLOAD_SIZE = 64 * 1024 * 1024;
+
+enum MessageType : uint8_t {
+    MSG_STREAM_INIT = 1,        // Client: SubscribeInfo, host: StreamInfo + SPS/PPS
+    MSG_VIDEO_FRAME = 2,        // VideoFrameInfo + encoded data
+    MSG_AUDIO_FRAME = 3,
+    MSG_INPUT_EVENT = 4,
+    MSG_PING = 5,               // No payload, answered with a PONG
+    MSG_PONG = 6,               // Echoes the PING's timestamp
+    MSG_RENDITION_REQUEST = 7,  // RenditionInfo, applied at the rendition's next keyframe
+    MSG_VIEWPORT = 8,           // ViewportInfo
+    MSG_KEYFRAME_REQUEST = 9,   // No payload, the client lost its reference frames
+    MSG_RECEIVER_REPORT = 10,   // ReceiverReport, periodically while video arrives over UDP
+    MSG_NACK = 11,              // NackInfo + be16 RTP sequence numbers the client is missing
+    MSG_TRANSPORT_FEEDBACK = 12,    // TransportFeedback + FeedbackArrival per video packet received
+    MSG_PROBE = 13,             // ProbeInfo + padding, paced right after a STREAM_INIT with MSG_FLAG_PROBE
+    MSG_PROBE_RESULT = 14,      // ProbeResult, the client's answer to the closing PROBE
+};
+
+enum MessageFlags : uint16_t {
+    MSG_FLAG_KEYFRAME = 1,      // The frame can be decoded on its own
+    MSG_FLAG_PROBE = 2,         // STREAM_INIT: a PROBE burst follows, video waits for its result
+};
+
+enum VideoCodec : uint8_t {
+    CODEC_H264 = 1,
+    CODEC_RAW_DELTA = 2,        // shared/delta_codec.h
+};
+
+// How VIDEO_FRAMEs reach the client
+enum VideoTransport : uint8_t {
+    VIDEO_OVER_TCP = 0,
+    VIDEO_OVER_UDP = 1,         // RTP datagrams, see shared/rtp.h
+};
+
+// Big-endian integer stored as bytes; converts to and from T
+template <typename T>
+struct BigEndian {
+    uint8_t bytes[sizeof(T)];
+
+    BigEndian() = default;
+    BigEndian(T value) { *this = value; }
+
+    BigEndian& operator=(T value) {
+        for (size_t i = 0; i < sizeof(T); ++i) {
+            bytes[i] = (uint8_t)(value >> (8 * (sizeof(T) - 1 - i)));
+        }
+        return *this;
+    }
+
+    operator T() const {
+        T value = 0;
+        for (size_t i = 0; i < sizeof(T); ++i) {
+            value = (T)((value << 8) | bytes[i]);
+        }
+        return value;
+    }
+};
+
+using be16 = BigEndian<uint16_t>;
+using be32 = BigEndian<uint32_t>;
+using be64 = BigEndian<uint64_t>;
+
+static_assert(sizeof(be16) == 2 && alignof(be16) == 1, "be16 must be 2 unaligned bytes");
+static_assert(sizeof(be32) == 4 && alignof(be32) == 1, "be32 must be 4 unaligned bytes");
+static_assert(sizeof(be64) == 8 && alignof(be64) == 1, "be64 must be 8 unaligned bytes");
+
+struct MessageHeader {
+    uint8_t version = PROTOCOL_VERSION;
+    uint8_t type = 0;
+    be16 flags = 0;
+    be32 sequence = 0;
+    be64 timestamp_us = 0;
+    be32 payload_size = 0;
+    be32 reserved = 0;
+};
+
+// Fixed prefix of every VIDEO_FRAME payload
+struct VideoFrameInfo {
+    uint8_t codec = CODEC_H264;
+    uint8_t rendition = 0;
+    uint8_t temporal_layer = 0;
+    uint8_t stripe_index = 0;
+    uint8_t stripe_count = 1;
+    uint8_t reserved[3] = {};
+};
+
+// Host STREAM_INIT payload, followed by the subscribed rendition's SPS/PPS
+// (Annex-B, empty when not known yet or not H.264)
+struct StreamInfo {
+    uint8_t codec = CODEC_H264;
+    uint8_t stripe_count = 1;
+    uint8_t rendition_count = 1;
+    uint8_t temporal_layers = 1;
+    uint8_t video_transport = VIDEO_OVER_TCP;
+    uint8_t feedback = 0;       // UDP video: the host wants TRANSPORT_FEEDBACK to pace its bitrate
+    be16 retransmit_ms = 0;     // UDP video: NACKed packets are resent until this long after capture, 0 = never
+};
+
+// RENDITION_REQUEST payload
+struct RenditionInfo {
+    be32 rendition = 0;
+};
+
+// Client STREAM_INIT payload. It starts like RenditionInfo, which is all
+// older clients send.
+struct SubscribeInfo {
+    be32 rendition = 0;
+    be16 udp_port = 0;          // Where the client takes RTP video, 0 = over TCP
+    uint8_t probe = 0;          // The client measures a PROBE burst before video
+    uint8_t reserved = 0;
+};
+
+// RECEIVER_REPORT payload, counts since the previous report
+struct ReceiverReport {
+    be32 packets_expected = 0;  // Video packets sent, from the sequence numbers
+    be32 packets_lost = 0;      // ... that did not arrive, before FEC
+    be32 packets_recovered = 0; // ... that FEC rebuilt
+    be32 frames_lost = 0;       // Frames given up
+};
+
+// NACK payload, followed by `count` be16 sequence numbers
+struct NackInfo {
+    be32 rtt_us = 0;            // Client's latest round trip time, to judge what can still arrive
+    be16 count = 0;
+    be16 reserved = 0;
+};
+
+// TRANSPORT_FEEDBACK payload, followed by `count` FeedbackArrivals in the
+// order the packets arrived. Arrival times are on the client's clock, the
+// host only compares them with each other.
+struct TransportFeedback {
+    be64 base_arrival_us = 0;   // Arrival time the deltas count from
+    be32 rtt_us = 0;            // Client's latest round trip time
+    be16 count = 0;
+    be16 reserved = 0;
+};
+
+struct FeedbackArrival {
+    be16 sequence;              // RTP sequence number of a video packet
+    be16 reserved;
+    be32 arrival_delta_us;      // After base_arrival_us
+};
+
+// PROBE payload, followed by padding. The host paces the burst at `bitrate`
+// for `duration_ms` and closes it with a message that has `last` set.
+struct ProbeInfo {
+    be32 bitrate = 0;
+    be16 duration_ms = 0;
+    uint8_t last = 0;
+    uint8_t reserved = 0;
+};
+
+// PROBE_RESULT payload
+struct ProbeResult {
+    be32 bitrate = 0;           // Rate the burst arrived at after its first message, 0 = unknown
+};
+
+// VIEWPORT payload: drawable size in pixels, display refresh rate in mHz
+struct ViewportInfo {
+    be32 width = 0;
+    be32 height = 0;
+    be32 refresh_mhz = 0;
+};
+
+// Header and typed prefix laid out back to back, built in place on the send side
+template <typename Info>
+struct MessageHead {
+    MessageHeader header;
+    Info info;
+};
+
+using VideoFrameHead = MessageHead<VideoFrameInfo>;
+using StreamInitHead = MessageHead<StreamInfo>;
+
+// Room for any MessageHead where one is stored as bytes
+const size_t MAX_HEAD_SIZE = 64;
+
+static_assert(sizeof(MessageHeader) == 24 && alignof(MessageHeader) == 1, "header layout");
+static_assert(offsetof(MessageHeader, flags) == 2 && offsetof(MessageHeader, sequence) == 4 &&
+              offsetof(MessageHeader, timestamp_us) == 8 && offsetof(MessageHeader, payload_size) == 16,
+              "header field offsets");
+static_assert(sizeof(VideoFrameInfo) == 8, "VideoFrameInfo layout");
+static_assert(sizeof(MessageHead<ViewportInfo>) <= MAX_HEAD_SIZE, "largest head fits MAX_HEAD_SIZE");
+static_assert(sizeof(StreamInfo) == 8, "StreamInfo layout");
+static_assert(sizeof(RenditionInfo) == 4, "RenditionInfo layout");
+static_assert(sizeof(SubscribeInfo) == 8, "SubscribeInfo layout");
+static_assert(sizeof(ViewportInfo) == 12, "ViewportInfo layout");
+static_assert(sizeof(ReceiverReport) == 16, "ReceiverReport layout");
+static_assert(sizeof(NackInfo) == 8, "NackInfo layout");
+static_assert(sizeof(ProbeInfo) == 8 && sizeof(ProbeResult) == 4, "probe layouts");
+static_assert(sizeof(TransportFeedback) == 16 && sizeof(FeedbackArrival) == 8, "TransportFeedback layout");
+static_assert(sizeof(VideoFrameHead) == 32 && offsetof(VideoFrameHead, info) == 24, "VideoFrameHead layout");
+
+// Typed view over the start of a received payload, nullptr when it is too short
+template <typename T>
+const T* message_view(const std::vector<uint8_t>& payload) {
+    return payload.size() >= sizeof(T) ? reinterpret_cast<const T*>(payload.data()) : nullptr;
+}
+
+// Checks version and payload size of a received header
+bool valid_message_header(const MessageHeader& header);
+
+// Sends the first `head_size` bytes starting at `header` (the header alone or
+// a MessageHead) followed by `payload` in one gathered send;
+// header.payload_size is filled in. The caller serializes sends on the socket.
+bool send_protocol_message(Transport& transport, MessageHeader& header, size_t head_size,
+    const uint8_t* payload, size_t payload_size);
+
+// Several messages sent with as few syscalls as possible. Heads and payloads
+// are referenced, not copied, and must outlive the send.
+struct MessageBatch {
+    std::vector<MessageHeader*> headers;
+    std::vector<SendBuffer> buffers;    // Head and payload of each message
+};
+
+// Appends a message to `batch`, arguments as for send_protocol_message
+void add_protocol_message(MessageBatch& batch, MessageHeader& header, size_t head_size,
+    const uint8_t* payload, size_t payload_size);
+bool send_protocol_batch(Transport& transport, const MessageBatch& batch);
+
+template <typename Info>
+bool send_protocol_message(Transport& transport, MessageHead<Info>& head, const uint8_t* payload, size_t payload_size) {
+    return send_protocol_message(transport, head.header, sizeof(head), payload, payload_size);
+}
+
+// Receives one whole message. Returns false on disconnect or a bad header.
+bool recv_protocol_message(Transport& transport, MessageHeader& header, std::vector<uint8_t>& payload);
+
+// Microseconds on the steady clock, for header timestamps
+uint64_t protocol_timestamp_us();
@@ -0,0 +1,584 @@
+#include "rtp.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <random>
+
+#include "h264.h"
+
+static const uint8_t RTP_VERSION_EXTENSION = 0x80 | 0x10;
+static const uint16_t RTP_ONE_BYTE_PROFILE = 0xBEDE;
+static const uint8_t RTP_FRAME_ELEMENT = (1 << 4) | (sizeof(RtpFrameExtension) - 1);
+static const uint8_t RTP_MARKER = 0x80;
+
+static const uint8_t NAL_FU_A = 28;
+static const uint8_t FU_START = 0x80;
+static const uint8_t FU_END = 0x40;
+
+// Largest frame the reassembler collects, and how many it keeps open
+static const size_t MAX_FRAME_PACKETS = 16384;
+static const size_t MAX_PENDING_FRAMES = 64;
+static const size_t MAX_PENDING_FEC_GROUPS = 256;
+// Longest gap whose sequence numbers are remembered for NACKs
+static const uint64_t MAX_NACK_GAP = RTP_MAX_NACKS;
+
+// Video payloads leave room for the FEC header and symbol length, so repair
+// packets are no larger than video packets
+static const size_t MAX_PAYLOAD = RTP_DATAGRAM_SIZE - sizeof(RtpHeader) - sizeof(RtpFecHeader) - 2;
+
+// Weight of a new loss report, and repair packets sent per packet lost
+static const double LOSS_SMOOTHING = 0.3;
+static const double FEC_LOSS_FACTOR = 3.0;
+
+void init_rtp_packetizer(RtpPacketizer& packetizer, FecScheme scheme, double min_ratio) {
+    std::random_device random;
+    packetizer.ssrc = random();
+    packetizer.next_sequence = (uint16_t)random();
+    packetizer.next_fec_sequence = (uint16_t)random();
+    packetizer.fec = scheme;
+    packetizer.fec_min_ratio = std::min(min_ratio, RTP_FEC_MAX_RATIO);
+    packetizer.fec_ratio = packetizer.fec_min_ratio;
+    packetizer.loss = 0;
+}
+
+void rtp_report_loss(RtpPacketizer& packetizer, double loss) {
+    packetizer.loss += (loss - packetizer.loss) * LOSS_SMOOTHING;
+    packetizer.fec_ratio = std::min(std::max(packetizer.fec_min_ratio, packetizer.loss * FEC_LOSS_FACTOR),
+                                    RTP_FEC_MAX_RATIO);
+}
+
+void init_rtp_history(RtpPacketizer& packetizer, uint64_t deadline_us) {
+    packetizer.deadline_us = deadline_us;
+    packetizer.history.assign(RTP_HISTORY_SIZE, RtpHistoryEntry());
+    packetizer.history_bytes.assign(RTP_HISTORY_SIZE * RTP_DATAGRAM_SIZE, 0);
+    packetizer.retransmits.clear();
+    packetizer.retransmits.reserve(RTP_MAX_NACKS);
+}
+
+size_t rtp_retransmit(RtpPacketizer& packetizer, const uint16_t* sequences, size_t count, uint64_t one_way_us) {
+    packetizer.retransmits.clear();
+    if (packetizer.history.empty()) return count;
+    const uint64_t now = protocol_timestamp_us();
+    size_t expired = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const size_t slot = sequences[i] % RTP_HISTORY_SIZE;
+        const RtpHistoryEntry& entry = packetizer.history[slot];
+        if (!entry.valid || entry.sequence != sequences[i] ||
+            now + one_way_us > entry.timestamp_us + packetizer.deadline_us ||
+            packetizer.retransmits.size() == RTP_MAX_NACKS) {
+            ++expired;
+            continue;
+        }
+        packetizer.retransmits.push_back({ packetizer.history_bytes.data() + slot * RTP_DATAGRAM_SIZE, entry.size });
+    }
+    packetizer.packets_retransmitted += packetizer.retransmits.size();
+    packetizer.packets_expired += expired;
+    return expired;
+}
+
+// Copies the frame's video datagrams into the history ring
+static void remember_datagrams(RtpPacketizer& packetizer, uint64_t timestamp_us) {
+    for (const SendBuffer& datagram : packetizer.datagrams) {
+        const RtpHeader& rtp = *(const RtpHeader*)datagram.data;
+        const size_t slot = (uint16_t)rtp.sequence % RTP_HISTORY_SIZE;
+        RtpHistoryEntry& entry = packetizer.history[slot];
+        entry.valid = true;
+        entry.sequence = rtp.sequence;
+        entry.size = (uint16_t)datagram.size;
+        entry.timestamp_us = timestamp_us;
+        memcpy(packetizer.history_bytes.data() + slot * RTP_DATAGRAM_SIZE, datagram.data, datagram.size);
+    }
+}
+
+// Appends repair packets for the video datagrams of the frame in `rtp`.
+// XOR groups are sized for one parity packet at the current ratio,
+// Reed-Solomon groups take up to RTP_FEC_MAX_GROUP packets and as many
+// repair packets as the ratio asks for.
+static void add_repair_packets(RtpPacketizer& packetizer, RtpHeader rtp, uint8_t* out) {
+    const size_t count = packetizer.datagrams.size();
+    const double ratio = std::max(packetizer.fec_ratio, 1.0 / RTP_FEC_MAX_GROUP);
+    const size_t group_size = packetizer.fec == FecScheme::XOR
+        ? std::min(std::max((size_t)std::lround(1 / ratio), (size_t)2), RTP_FEC_MAX_GROUP)
+        : RTP_FEC_MAX_GROUP;
+    const size_t groups = (count + group_size - 1) / group_size;
+
+    rtp.marker_type = RTP_FEC_PAYLOAD_TYPE;
+    rtp.ssrc = packetizer.ssrc + 1;
+    RtpFecHeader fec;
+    fec.scheme = (uint8_t)packetizer.fec;
+    fec.reserved = 0;
+
+    const uint8_t* sources[RTP_FEC_MAX_GROUP];
+    uint8_t* repairs[RTP_FEC_MAX_GROUP];
+    size_t begin = 0;
+    for (size_t group = 0; group < groups; ++group) {
+        const size_t end = count * (group + 1) / groups;
+        const size_t source_count = end - begin;
+        const size_t repair_count = packetizer.fec == FecScheme::XOR ? 1
+            : std::min(std::max((size_t)std::ceil(source_count * packetizer.fec_ratio), (size_t)1), source_count);
+
+        size_t symbol_size = 0;
+        for (size_t i = begin; i < end; ++i) {
+            symbol_size = std::max(symbol_size, 2 + packetizer.datagrams[i].size - sizeof(RtpHeader));
+        }
+        packetizer.fec_symbols.assign(source_count * symbol_size, 0);
+        for (size_t i = 0; i < source_count; ++i) {
+            const SendBuffer& datagram = packetizer.datagrams[begin + i];
+            const size_t length = datagram.size - sizeof(RtpHeader);
+            uint8_t* symbol = packetizer.fec_symbols.data() + i * symbol_size;
+            symbol[0] = (uint8_t)(length >> 8);
+            symbol[1] = (uint8_t)length;
+            memcpy(symbol + 2, (const uint8_t*)datagram.data + sizeof(RtpHeader), length);
+            sources[i] = symbol;
+        }
+
+        fec.base_sequence = (uint16_t)(packetizer.next_sequence - count + begin);
+        fec.source_count = (uint8_t)source_count;
+        fec.repair_count = (uint8_t)repair_count;
+        fec.flags = end == count ? RTP_FEC_ENDS_FRAME : 0;
+        for (size_t j = 0; j < repair_count; ++j) {
+            rtp.sequence = packetizer.next_fec_sequence++;
+            fec.repair_index = (uint8_t)j;
+            memcpy(out, &rtp, sizeof(rtp));
+            memcpy(out + sizeof(rtp), &fec, sizeof(fec));
+            repairs[j] = out + sizeof(rtp) + sizeof(fec);
+            const size_t length = sizeof(rtp) + sizeof(fec) + symbol_size;
+            packetizer.datagrams.push_back({ out, length });
+            out += length;
+        }
+        fec_encode(packetizer.fec, sources, (int)source_count, repairs, (int)repair_count, symbol_size);
+        begin = end;
+    }
+}
+
+void rtp_packetize(RtpPacketizer& packetizer, const VideoFrameHead& head, const uint8_t* data, size_t size) {
+    const size_t max_payload = MAX_PAYLOAD;
+    const std::vector<NalUnit> units = find_nal_units(data, size);
+
+    // Sized for the worst case up front, so the datagrams can point into it.
+    // There are never more repair than video packets.
+    const size_t max_datagrams = (size / (max_payload - 2) + units.size() + 1) *
+                                 (packetizer.fec != FecScheme::NONE ? 2 : 1);
+    if (packetizer.bytes.size() < max_datagrams * RTP_DATAGRAM_SIZE) {
+        packetizer.bytes.resize(max_datagrams * RTP_DATAGRAM_SIZE);
+    }
+    packetizer.datagrams.clear();
+
+    RtpHeader rtp;
+    rtp.version_flags = RTP_VERSION_EXTENSION;
+    rtp.marker_type = RTP_PAYLOAD_TYPE;
+    rtp.timestamp = (uint32_t)((uint64_t)head.header.timestamp_us * 9 / 100);
+    rtp.ssrc = packetizer.ssrc;
+    rtp.extension_profile = RTP_ONE_BYTE_PROFILE;
+    rtp.extension_words = (uint16_t)((sizeof(RtpHeader) - 16) / 4);
+    rtp.element = RTP_FRAME_ELEMENT;
+    rtp.frame.timestamp_us = head.header.timestamp_us;
+    rtp.frame.first_sequence = packetizer.next_sequence;
+    rtp.frame.flags = (uint8_t)head.header.flags;
+    rtp.frame.codec = head.info.codec;
+    rtp.frame.rendition = head.info.rendition;
+    rtp.frame.temporal_layer = head.info.temporal_layer;
+    rtp.frame.stripe_index = head.info.stripe_index;
+    rtp.frame.stripe_count = head.info.stripe_count;
+    memset(rtp.padding, 0, sizeof(rtp.padding));
+
+    uint8_t* out = packetizer.bytes.data();
+    // Starts a datagram, the payload is written right after the header
+    auto begin_datagram = [&]() -> uint8_t* {
+        rtp.sequence = packetizer.next_sequence++;
+        memcpy(out, &rtp, sizeof(rtp));
+        return out + sizeof(rtp);
+    };
+    auto end_datagram = [&](uint8_t* end) {
+        packetizer.datagrams.push_back({ out, (size_t)(end - out) });
+        out = end;
+    };
+
+    for (const NalUnit& unit : units) {
+        const uint8_t* nal = data + unit.offset;
+        if (unit.size == 0) continue;
+        if (unit.size <= max_payload) {
+            uint8_t* payload = begin_datagram();
+            memcpy(payload, nal, unit.size);
+            end_datagram(payload + unit.size);
+            continue;
+        }
+
+        // FU-A: the NAL header moves into the FU indicator and header
+        const uint8_t indicator = (nal[0] & 0xE0) | NAL_FU_A;
+        size_t offset = 1;
+        while (offset < unit.size) {
+            const size_t chunk = std::min(max_payload - 2, unit.size - offset);
+            uint8_t* payload = begin_datagram();
+            payload[0] = indicator;
+            payload[1] = (uint8_t)((nal[0] & 0x1F) | (offset == 1 ? FU_START : 0) |
+                                   (offset + chunk == unit.size ? FU_END : 0));
+            memcpy(payload + 2, nal + offset, chunk);
+            end_datagram(payload + 2 + chunk);
+            offset += chunk;
+        }
+    }
+
+    if (packetizer.datagrams.empty()) return;
+    uint8_t* last = (uint8_t*)packetizer.datagrams.back().data;
+    last[1] |= RTP_MARKER;
+    if (!packetizer.history.empty()) remember_datagrams(packetizer, head.header.timestamp_us);
+    if (packetizer.fec != FecScheme::NONE) add_repair_packets(packetizer, rtp, out);
+}
+
+// Widens a 16 bit sequence number to the one closest to the highest seen
+static uint64_t extend_sequence(RtpReassembler& reassembler, uint16_t sequence) {
+    if (!reassembler.started) {
+        reassembler.started = true;
+        // Room below for packets that arrive out of order
+        reassembler.highest = (1ull << 32) + sequence;
+        reassembler.reported_highest = reassembler.highest - 1;
+        return reassembler.highest;
+    }
+    const int16_t delta = (int16_t)(uint16_t)(sequence - (uint16_t)reassembler.highest);
+    const uint64_t extended = reassembler.highest + delta;
+    if (delta > 0) reassembler.highest = extended;
+    return extended;
+}
+
+// Widens a 16 bit sequence number the same way without moving `highest`,
+// for numbers carried in payloads
+static uint64_t nearest_sequence(const RtpReassembler& reassembler, uint16_t sequence) {
+    const int16_t delta = (int16_t)(uint16_t)(sequence - (uint16_t)reassembler.highest);
+    return reassembler.highest + delta;
+}
+
+// Stores a video packet's payload in the frame starting at `first`
+static RtpPendingFrame& add_packet(RtpReassembler& reassembler, const RtpFrameExtension& info, uint64_t first,
+    uint64_t sequence, const uint8_t* payload, size_t size, bool marker) {
+    RtpPendingFrame& frame = reassembler.frames[first];
+    if (frame.packets.empty()) {
+        frame.info = info;
+        frame.first = first;
+        frame.wait_from_us = protocol_timestamp_us();
+    }
+    const size_t behind = (size_t)(sequence - first);
+    if (frame.packets.size() <= behind) frame.packets.resize(behind + 1);
+    if (frame.packets[behind].empty()) {
+        frame.packets[behind].assign(payload, payload + size);
+        ++frame.received;
+    }
+    if (marker) {
+        frame.last = sequence;
+        frame.has_last = true;
+    }
+    return frame;
+}
+
+// Rebuilds the group's missing video packets once enough repair packets are
+// in, then forgets the group
+static void recover_group(RtpReassembler& reassembler, std::map<uint64_t, RtpFecGroup>::iterator it) {
+    const uint64_t base = it->first;
+    RtpFecGroup& group = it->second;
+    const int count = group.source_count;
+    const size_t size = group.symbol_size;
+
+    auto frame = reassembler.frames.find(group.first);
+    const size_t offset = (size_t)(base - group.first);
+    bool have[FEC_MAX_SOURCES];
+    int missing = 0;
+    for (int i = 0; i < count; ++i) {
+        have[i] = frame != reassembler.frames.end() && offset + i < frame->second.packets.size() &&
+                  !frame->second.packets[offset + i].empty();
+        if (!have[i]) ++missing;
+    }
+    if (missing == 0) {
+        reassembler.fec_groups.erase(it);
+        return;
+    }
+    if ((size_t)missing > group.repairs_received || (group.scheme == FecScheme::XOR && missing > 1)) return;
+
+    reassembler.fec_symbols.assign((size_t)count * size, 0);
+    uint8_t* sources[FEC_MAX_SOURCES];
+    for (int i = 0; i < count; ++i) {
+        sources[i] = reassembler.fec_symbols.data() + (size_t)i * size;
+        if (!have[i]) continue;
+        const std::vector<uint8_t>& packet = frame->second.packets[offset + i];
+        if (packet.size() + 2 > size) {     // Not the packet the repair was made from
+            reassembler.fec_groups.erase(it);
+            return;
+        }
+        sources[i][0] = (uint8_t)(packet.size() >> 8);
+        sources[i][1] = (uint8_t)packet.size();
+        memcpy(sources[i] + 2, packet.data(), packet.size());
+    }
+    const uint8_t* repairs[FEC_MAX_REPAIRS];
+    int indices[FEC_MAX_REPAIRS];
+    int repair_count = 0;
+    for (size_t j = 0; j < group.repairs.size() && repair_count < missing; ++j) {
+        if (group.repairs[j].empty()) continue;
+        repairs[repair_count] = group.repairs[j].data();
+        indices[repair_count++] = (int)j;
+    }
+
+    if (fec_decode(group.scheme, sources, have, count, repairs, indices, repair_count, size)) {
+        for (int i = 0; i < count; ++i) {
+            if (have[i]) continue;
+            const size_t length = ((size_t)sources[i][0] << 8) | sources[i][1];
+            if (length == 0 || length + 2 > size) continue;
+            RtpPendingFrame& recovered = add_packet(reassembler, group.info, group.first, base + i,
+                sources[i] + 2, length, group.ends_frame && i == count - 1);
+            recovered.recovered = true;
+            ++reassembler.packets_recovered;
+        }
+    }
+    reassembler.fec_groups.erase(it);
+}
+
+// Files a repair packet under its group
+static void receive_repair(RtpReassembler& reassembler, const RtpHeader& rtp, const uint8_t* data, size_t size) {
+    if (size <= sizeof(RtpHeader) + sizeof(RtpFecHeader) + 2) return;
+    const RtpFecHeader& fec = *(const RtpFecHeader*)(data + sizeof(RtpHeader));
+    const FecScheme scheme = (FecScheme)fec.scheme;
+    if ((scheme != FecScheme::XOR && scheme != FecScheme::REED_SOLOMON) || fec.source_count == 0 ||
+        fec.source_count > FEC_MAX_SOURCES || fec.repair_index >= fec.repair_count) {
+        return;
+    }
+    const uint64_t first = nearest_sequence(reassembler, rtp.frame.first_sequence);
+    const uint64_t base = nearest_sequence(reassembler, fec.base_sequence);
+    if (base < first || base - first + fec.source_count > MAX_FRAME_PACKETS ||
+        (reassembler.delivered && first < reassembler.next_first)) {
+        return;
+    }
+
+    const size_t symbol_size = size - sizeof(RtpHeader) - sizeof(RtpFecHeader);
+    RtpFecGroup& group = reassembler.fec_groups[base];
+    if (group.repairs.empty()) {
+        group.info = rtp.frame;
+        group.first = first;
+        group.scheme = scheme;
+        group.source_count = fec.source_count;
+        group.ends_frame = fec.flags & RTP_FEC_ENDS_FRAME;
+        group.symbol_size = symbol_size;
+        group.repairs.resize(fec.repair_count);
+    }
+    if (group.symbol_size != symbol_size || fec.repair_index >= group.repairs.size() ||
+        !group.repairs[fec.repair_index].empty()) {
+        return;
+    }
+    const uint8_t* symbol = data + sizeof(RtpHeader) + sizeof(RtpFecHeader);
+    group.repairs[fec.repair_index].assign(symbol, symbol + symbol_size);
+    ++group.repairs_received;
+    recover_group(reassembler, reassembler.fec_groups.find(base));
+
+    while (reassembler.fec_groups.size() > MAX_PENDING_FEC_GROUPS) {
+        reassembler.fec_groups.erase(reassembler.fec_groups.begin());
+    }
+}
+
+bool rtp_receive(RtpReassembler& reassembler, const uint8_t* data, size_t size, uint64_t arrival_us) {
+    if (size <= sizeof(RtpHeader)) return false;
+    const RtpHeader& rtp = *(const RtpHeader*)data;
+    const uint8_t type = rtp.marker_type & 0x7F;
+    if (rtp.version_flags != RTP_VERSION_EXTENSION || (type != RTP_PAYLOAD_TYPE && type != RTP_FEC_PAYLOAD_TYPE) ||
+        rtp.extension_profile != RTP_ONE_BYTE_PROFILE || rtp.element != RTP_FRAME_ELEMENT) {
+        return false;
+    }
+    // Repair packets come on the next SSRC and only count once video did
+    if (type == RTP_FEC_PAYLOAD_TYPE) {
+        if (!reassembler.started || rtp.ssrc != reassembler.ssrc + 1) return false;
+        receive_repair(reassembler, rtp, data, size);
+        return true;
+    }
+    if (reassembler.started && rtp.ssrc != reassembler.ssrc) return false;
+    reassembler.ssrc = rtp.ssrc;
+
+    const uint64_t received_us = protocol_timestamp_us();
+    if (arrival_us == 0) arrival_us = received_us;
+    const bool started = reassembler.started;
+    const uint64_t highest = reassembler.highest;
+    const uint64_t sequence = extend_sequence(reassembler, rtp.sequence);
+    const uint16_t behind = (uint16_t)((uint16_t)rtp.sequence - (uint16_t)rtp.frame.first_sequence);
+    const uint64_t first = sequence - behind;
+    if (!started || sequence > highest) {
+        ++reassembler.packets_received;
+        if (reassembler.feedback && reassembler.arrivals.size() < RTP_MAX_ARRIVALS) {
+            RtpArrival arrival;
+            arrival.sequence = rtp.sequence;
+            arrival.arrival_us = arrival_us;
+            reassembler.arrivals.push_back(arrival);
+        }
+    }
+    if (started && sequence > highest + 1 && sequence - highest <= MAX_NACK_GAP) {
+        for (uint64_t skipped = highest + 1; skipped < sequence && reassembler.missing.size() < RTP_MAX_NACKS;
+             ++skipped) {
+            reassembler.missing.push_back(skipped);
+        }
+    }
+    if (behind >= MAX_FRAME_PACKETS || (reassembler.delivered && first < reassembler.next_first)) {
+        return true;    // Oversized, or the frame was handed out or given up already
+    }
+
+    RtpPendingFrame& frame = add_packet(reassembler, rtp.frame, first, sequence, data + sizeof(RtpHeader),
+        size - sizeof(RtpHeader), rtp.marker_type & RTP_MARKER);
+    if (frame.timing.first_arrival_us == 0) frame.timing.first_arrival_us = arrival_us;
+    frame.timing.last_arrival_us = std::max(frame.timing.last_arrival_us, arrival_us);
+    frame.timing.last_received_us = received_us;
+    // Skipped packets belong to this frame or, for a lost tail, the one
+    // before, which only now starts waiting for retransmissions
+    if (started && sequence > highest + 1) {
+        frame.wait_from_us = protocol_timestamp_us();
+        auto before = reassembler.frames.find(first);
+        if (before != reassembler.frames.begin()) std::prev(before)->second.wait_from_us = frame.wait_from_us;
+    }
+
+    // The packet may complete a group whose repair packets came first
+    auto group = reassembler.fec_groups.upper_bound(sequence);
+    if (group != reassembler.fec_groups.begin()) {
+        --group;
+        if (sequence < group->first + (uint64_t)group->second.source_count) recover_group(reassembler, group);
+    }
+
+    while (reassembler.frames.size() > MAX_PENDING_FRAMES) {
+        reassembler.frames.erase(reassembler.frames.begin());
+        ++reassembler.frames_lost;
+        reassembler.need_keyframe = true;
+    }
+    return true;
+}
+
+static bool frame_complete(const RtpPendingFrame& frame) {
+    if (!frame.has_last) return false;
+    const size_t count = (size_t)(frame.last - frame.first + 1);
+    return frame.packets.size() == count && frame.received == count;
+}
+
+// Rebuilds the Annex-B access unit behind `header`. False on a malformed packet.
+static bool depacketize(const RtpPendingFrame& frame, MessageHeader& header, std::vector<uint8_t>& payload) {
+    static const uint8_t start_code[4] = { 0, 0, 0, 1 };
+    VideoFrameInfo info;
+    info.codec = frame.info.codec;
+    info.rendition = frame.info.rendition;
+    info.temporal_layer = frame.info.temporal_layer;
+    info.stripe_index = frame.info.stripe_index;
+    info.stripe_count = frame.info.stripe_count;
+    payload.assign((const uint8_t*)&info, (const uint8_t*)&info + sizeof(info));
+
+    for (const std::vector<uint8_t>& packet : frame.packets) {
+        const uint8_t type = packet[0] & 0x1F;
+        if (type >= 1 && type <= 23) {
+            payload.insert(payload.end(), start_code, start_code + 4);
+            payload.insert(payload.end(), packet.begin(), packet.end());
+        } else if (type == NAL_FU_A && packet.size() > 2) {
+            if (packet[1] & FU_START) {
+                payload.insert(payload.end(), start_code, start_code + 4);
+                payload.push_back((uint8_t)((packet[0] & 0xE0) | (packet[1] & 0x1F)));
+            }
+            payload.insert(payload.end(), packet.begin() + 2, packet.end());
+        } else {
+            return false;
+        }
+    }
+
+    header = MessageHeader();
+    header.type = MSG_VIDEO_FRAME;
+    header.flags = frame.info.flags;
+    header.timestamp_us = frame.info.timestamp_us;
+    header.payload_size = (uint32_t)payload.size();
+    return true;
+}
+
+// Forgets repair packets of frames that were handed out or given up
+static void drop_old_groups(RtpReassembler& reassembler) {
+    auto& groups = reassembler.fec_groups;
+    while (!groups.empty() && reassembler.delivered && groups.begin()->second.first < reassembler.next_first) {
+        groups.erase(groups.begin());
+    }
+}
+
+bool rtp_next_frame(RtpReassembler& reassembler, MessageHeader& header, std::vector<uint8_t>& payload) {
+    drop_old_groups(reassembler);
+    const uint64_t now = protocol_timestamp_us();
+    auto& frames = reassembler.frames;
+    while (!frames.empty()) {
+        auto it = frames.begin();
+        RtpPendingFrame& frame = it->second;
+        const bool gap = reassembler.delivered && frame.first != reassembler.next_first;
+        // Retransmissions for it, or for the frames in the gap, may still come
+        const bool waiting = now < frame.wait_from_us + reassembler.retransmit_wait_us;
+
+        if (!frame_complete(frame)) {
+            bool later_complete = false;
+            for (auto later = std::next(it); later != frames.end() && !later_complete; ++later) {
+                later_complete = frame_complete(later->second);
+            }
+            if (!later_complete || waiting) return false;
+            // Nothing references an enhancement layer frame
+            if (gap || frame.info.temporal_layer == 0) reassembler.need_keyframe = true;
+            ++reassembler.frames_lost;
+            reassembler.next_first = frame.has_last ? frame.last + 1 : std::next(it)->first;
+            reassembler.delivered = true;
+            frames.erase(it);
+            continue;
+        }
+        if (frame.recovered) ++reassembler.frames_recovered;
+
+        // Whole frames missing in between, their layers are unknown
+        if (gap && waiting) return false;
+        if (gap) {
+            reassembler.need_keyframe = true;
+            ++reassembler.frames_lost;
+        }
+        reassembler.next_first = frame.last + 1;
+        reassembler.delivered = true;
+
+        const bool keyframe = frame.info.flags & MSG_FLAG_KEYFRAME;
+        if (reassembler.need_keyframe && !keyframe) {
+            frames.erase(it);
+            continue;
+        }
+        const bool ok = depacketize(frame, header, payload);
+        const RtpFrameTiming timing = frame.timing;
+        frames.erase(it);
+        if (!ok) {
+            reassembler.need_keyframe = true;
+            continue;
+        }
+        if (keyframe) reassembler.need_keyframe = false;
+        reassembler.delivered_timing = timing;
+        ++reassembler.frames_delivered;
+        return true;
+    }
+    return false;
+}
+
+void rtp_take_nacks(RtpReassembler& reassembler, std::vector<uint16_t>& sequences) {
+    sequences.clear();
+    for (uint64_t sequence : reassembler.missing) {
+        if (reassembler.delivered && sequence < reassembler.next_first) continue;
+        // Arrived late or rebuilt by FEC meanwhile
+        auto frame = reassembler.frames.upper_bound(sequence);
+        if (frame != reassembler.frames.begin()) {
+            const RtpPendingFrame& before = std::prev(frame)->second;
+            const uint64_t offset = sequence - before.first;
+            if (offset < before.packets.size() && !before.packets[offset].empty()) continue;
+        }
+        sequences.push_back((uint16_t)sequence);
+    }
+    reassembler.missing.clear();
+}
+
+void rtp_take_arrivals(RtpReassembler& reassembler, std::vector<RtpArrival>& arrivals) {
+    arrivals.clear();
+    arrivals.swap(reassembler.arrivals);
+}
+
+void rtp_receiver_report(RtpReassembler& reassembler, ReceiverReport& report) {
+    const uint64_t expected = reassembler.highest - reassembler.reported_highest;
+    const uint64_t received = reassembler.packets_received - reassembler.reported_received;
+    report.packets_expected = (uint32_t)expected;
+    report.packets_lost = (uint32_t)(expected > received ? expected - received : 0);
+    report.packets_recovered = (uint32_t)(reassembler.packets_recovered - reassembler.reported_recovered);
+    report.frames_lost = (uint32_t)(reassembler.frames_lost - reassembler.reported_frames_lost);
+    reassembler.reported_highest = reassembler.highest;
+    reassembler.reported_received = reassembler.packets_received;
+    reassembler.reported_recovered = reassembler.packets_recovered;
+    reassembler.reported_frames_lost = reassembler.frames_lost;
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "fec.h"
+#include "protocol.h"
+#include "socket.h"
+
+// RTP (RFC 3550) framing of VIDEO_FRAME messages for UDP video. H.264 is cut
+// as in RFC 6184 packetization-mode 1: NAL units that fit go out as single
+// NAL unit packets, larger ones as FU-A fragments. The marker bit ends each
+// frame (one stripe of one access unit) and a one-byte header extension
+// (RFC 8285) carries what VideoFrameInfo carries over TCP. Players ignore the
+// extension, so a one-stripe stream plays with a plain H.264 SDP:
+//
+//   m=video <port> RTP/AVP 96
+//   a=rtpmap:96 H264/90000
+//   a=fmtp:96 packetization-mode=1
+//
+// The SPS/PPS travel in the TCP STREAM_INIT and in every IDR access unit.
+//
+// With FEC on, each frame's datagrams are split into groups and every group
+// is followed by repair packets: payload type 97 on SSRC + 1 with their own
+// sequence numbers, so the video sequence stays gapless to other receivers.
+// A repair packet carries the frame's extension, an RtpFecHeader and one
+// repair symbol over the group's source symbols, each being a packet's
+// payload length (big-endian u16) and payload, zero padded to the longest.
+
+// Datagram size, below common path MTUs including tunnels
+const size_t RTP_DATAGRAM_SIZE = 1200;
+const uint8_t RTP_PAYLOAD_TYPE = 96;
+const uint8_t RTP_FEC_PAYLOAD_TYPE = 97;
+
+// Most source packets in one FEC group; larger frames are split evenly
+const size_t RTP_FEC_MAX_GROUP = 32;
+// Most repair packets per source packet the loss adaptation goes to
+const double RTP_FEC_MAX_RATIO = 0.5;
+
+// Video datagrams kept for retransmission, about a second at 10 Mbit/s
+const size_t RTP_HISTORY_SIZE = 1024;
+// Most sequence numbers in one NACK
+const size_t RTP_MAX_NACKS = 256;
+// Most arrivals kept for one TRANSPORT_FEEDBACK
+const size_t RTP_MAX_ARRIVALS = 1024;
+
+// Extension element with the frame's VideoFrameInfo fields
+struct RtpFrameExtension {
+    be64 timestamp_us;          // Capture time, as in MessageHeader
+    be16 first_sequence;        // Sequence number of the frame's first packet
+    uint8_t flags;              // MessageFlags
+    uint8_t codec;
+    uint8_t rendition;
+    uint8_t temporal_layer;
+    uint8_t stripe_index;
+    uint8_t stripe_count;
+};
+
+// Fixed RTP header plus the extension, in front of every payload
+struct RtpHeader {
+    uint8_t version_flags;      // V=2, X=1, no padding or CSRCs
+    uint8_t marker_type;        // Marker bit and payload type
+    be16 sequence;
+    be32 timestamp;             // 90 kHz
+    be32 ssrc;
+    be16 extension_profile;     // 0xBEDE, one-byte elements
+    be16 extension_words;
+    uint8_t element;            // ID 1, 16 bytes
+    RtpFrameExtension frame;
+    uint8_t padding[3];
+};
+
+// In front of the symbol in a repair packet's payload
+struct RtpFecHeader {
+    be16 base_sequence;         // Sequence number of the group's first source packet
+    uint8_t source_count;
+    uint8_t repair_count;
+    uint8_t repair_index;
+    uint8_t scheme;             // FecScheme
+    uint8_t flags;              // RTP_FEC_ENDS_FRAME
+    uint8_t reserved;
+};
+
+// The group's last source packet carries the frame's marker bit
+const uint8_t RTP_FEC_ENDS_FRAME = 1;
+
+static_assert(sizeof(RtpFrameExtension) == 16, "RtpFrameExtension layout");
+static_assert(sizeof(RtpHeader) == 36 && alignof(RtpHeader) == 1, "RtpHeader layout");
+static_assert(sizeof(RtpFecHeader) == 8, "RtpFecHeader layout");
+
+// A sent video datagram in the retransmission history
+struct RtpHistoryEntry {
+    bool valid = false;
+    uint16_t sequence = 0;
+    uint16_t size = 0;
+    uint64_t timestamp_us = 0;          // The frame's capture time
+};
+
+// Sender side of one viewer's RTP stream. The datagrams of the last frame
+// live in `bytes`, which keeps its capacity across frames. With
+// retransmission on, copies of the video datagrams also go into a ring
+// indexed by sequence number that is allocated once.
+struct RtpPacketizer {
+    uint32_t ssrc = 0;
+    uint16_t next_sequence = 0;
+    uint16_t next_fec_sequence = 0;
+    FecScheme fec = FecScheme::NONE;
+    double fec_min_ratio = 0;           // Repair packets per source packet without loss
+    double fec_ratio = 0;               // ... currently, raised with the reported loss
+    double loss = 0;                    // Smoothed fraction of packets lost
+    std::vector<uint8_t> bytes;
+    std::vector<SendBuffer> datagrams;
+    std::vector<uint8_t> fec_symbols;   // Source symbols of the group being protected
+    uint64_t deadline_us = 0;           // Retransmit only while capture + this is ahead, 0 = no history
+    std::vector<RtpHistoryEntry> history;
+    std::vector<uint8_t> history_bytes;
+    std::vector<SendBuffer> retransmits;    // Filled by rtp_retransmit, RTP_MAX_NACKS capacity
+    uint64_t packets_retransmitted = 0;
+    uint64_t packets_expired = 0;       // Requested too late or no longer in the history
+};
+
+// Random SSRC and starting sequence numbers, FEC with `scheme` at
+// `min_ratio` repair packets per source packet
+void init_rtp_packetizer(RtpPacketizer& packetizer, FecScheme scheme = FecScheme::NONE, double min_ratio = 0);
+
+// Folds a receiver's packet loss fraction (before FEC) into the FEC ratio
+void rtp_report_loss(RtpPacketizer& packetizer, double loss);
+
+// Keeps the last RTP_HISTORY_SIZE video datagrams for retransmission while
+// they can still be shown within `deadline_us` of capture
+void init_rtp_history(RtpPacketizer& packetizer, uint64_t deadline_us);
+
+// Points `packetizer.retransmits` at the requested datagrams that can still
+// make their deadline when sent now and taking `one_way_us` to arrive.
+// Returns how many requested datagrams could not, for which only a
+// keyframe helps.
+size_t rtp_retransmit(RtpPacketizer& packetizer, const uint16_t* sequences, size_t count, uint64_t one_way_us);
+
+// Cuts one H.264 VIDEO_FRAME (head plus Annex-B data) into datagrams,
+// replacing the previous frame's
+void rtp_packetize(RtpPacketizer& packetizer, const VideoFrameHead& head, const uint8_t* data, size_t size);
+
+// When a frame's video packets came in: the arrival rtp_receive was given
+// for its first and latest packet, and when the latest was taken in
+struct RtpFrameTiming {
+    uint64_t first_arrival_us = 0;
+    uint64_t last_arrival_us = 0;
+    uint64_t last_received_us = 0;
+};
+
+// A frame whose datagrams are arriving
+struct RtpPendingFrame {
+    RtpFrameExtension info;
+    RtpFrameTiming timing;
+    uint64_t first = 0;                     // Extended sequence number of the first packet
+    uint64_t last = 0;                      // ... and of the marker packet, once seen
+    uint64_t wait_from_us = 0;              // When its first packet came in, or a loss in it was seen
+    bool has_last = false;
+    bool recovered = false;                 // FEC rebuilt some of its packets
+    size_t received = 0;
+    std::vector<std::vector<uint8_t>> packets;  // Payloads by sequence offset, empty = missing
+};
+
+// Repair packets of one group, kept until its source packets are whole
+struct RtpFecGroup {
+    RtpFrameExtension info;
+    uint64_t first = 0;                     // Extended sequence number of the frame's first packet
+    FecScheme scheme = FecScheme::NONE;
+    int source_count = 0;
+    bool ends_frame = false;
+    size_t symbol_size = 0;
+    size_t repairs_received = 0;
+    std::vector<std::vector<uint8_t>> repairs;  // Symbols by repair index, empty = missing
+};
+
+// When a video packet came in, for transport feedback
+struct RtpArrival {
+    uint16_t sequence = 0;
+    uint64_t arrival_us = 0;
+};
+
+// Receiver side: puts frames back together and hands them out in order, as
+// the TCP path would deliver them. Frames behind a loss are skipped up to the
+// next keyframe, since they would only decode into garbage.
+struct RtpReassembler {
+    bool started = false;
+    uint32_t ssrc = 0;
+    uint64_t highest = 0;                   // Highest extended sequence number seen
+    uint64_t next_first = 0;                // First sequence number of the next frame to hand out
+    bool delivered = false;
+    bool need_keyframe = true;              // Reference chain broken, or nothing decoded yet
+    // How long an incomplete frame waits for retransmissions before it is
+    // given up for a later complete one, 0 without NACKs
+    uint64_t retransmit_wait_us = 0;
+    std::vector<uint64_t> missing;          // Skipped sequence numbers not NACKed yet
+    bool feedback = false;                  // Record arrivals for rtp_take_arrivals
+    std::vector<RtpArrival> arrivals;       // In-order video packets, at most RTP_MAX_ARRIVALS
+    std::map<uint64_t, RtpPendingFrame> frames;
+    std::map<uint64_t, RtpFecGroup> fec_groups;     // By extended sequence number of the first source
+    std::vector<uint8_t> fec_symbols;
+    RtpFrameTiming delivered_timing;        // Of the frame rtp_next_frame handed out last
+    uint64_t frames_delivered = 0;
+    uint64_t frames_lost = 0;
+    uint64_t frames_recovered = 0;          // Delivered or skipped whole thanks to FEC
+    uint64_t packets_received = 0;          // Video packets in order, not counting repair packets
+    uint64_t packets_recovered = 0;
+    // Counters at the last receiver report
+    uint64_t reported_highest = 0;
+    uint64_t reported_received = 0;
+    uint64_t reported_recovered = 0;
+    uint64_t reported_frames_lost = 0;
+};
+
+// Adds one datagram, video or repair, that arrived at `arrival_us` (0 = now),
+// such as its kernel receive timestamp. Returns false when it is not one of
+// the stream's.
+bool rtp_receive(RtpReassembler& reassembler, const uint8_t* data, size_t size, uint64_t arrival_us = 0);
+
+// Next frame for the decoder as a VIDEO_FRAME header and payload
+// (VideoFrameInfo and Annex-B data). An incomplete frame is given up once a
+// later one is complete and it waited retransmit_wait_us.
+bool rtp_next_frame(RtpReassembler& reassembler, MessageHeader& header, std::vector<uint8_t>& payload);
+
+// Moves the skipped sequence numbers that are still missing into
+// `sequences`, at most RTP_MAX_NACKS, for a NACK
+void rtp_take_nacks(RtpReassembler& reassembler, std::vector<uint16_t>& sequences);
+
+// Moves the arrivals recorded since the last call into `arrivals`, for a
+// TRANSPORT_FEEDBACK. Out of order packets and retransmissions are left
+// out, their arrival says nothing about the path's queue.
+void rtp_take_arrivals(RtpReassembler& reassembler, std::vector<RtpArrival>& arrivals);
+
+// Loss since the previous report, for MSG_RECEIVER_REPORT. Packets that
+// arrive late, retransmissions among them, count as lost.
+void rtp_receiver_report(RtpReassembler& reassembler, ReceiverReport& report);
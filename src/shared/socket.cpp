@@ -0,0 +1,716 @@
+#include "socket.h"
+
+#include <algorithm>
+#include <chrono>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#endif
+#ifdef __linux__
+#include <cstring>
+#include <ctime>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <netinet/udp.h>
+#endif
+#ifdef _WIN32
+#include <mstcpip.h>
+#endif
+
+#if defined(__linux__) && defined(UDP_SEGMENT)
+#define HAVE_UDP_GSO 1
+#endif
+#if defined(__linux__) && defined(UDP_GRO)
+#define HAVE_UDP_GRO 1
+#endif
+#if defined(_WIN32) && defined(UDP_SEND_MSG_SIZE)
+#define HAVE_UDP_USO 1
+#endif
+#if defined(__linux__) && defined(SO_TIMESTAMPING)
+#define HAVE_TIMESTAMPING 1
+#endif
+
+// A stream the peer closed fails the send instead of raising SIGPIPE
+#ifdef MSG_NOSIGNAL
+static const int NO_SIGPIPE = MSG_NOSIGNAL;
+#else
+static const int NO_SIGPIPE = 0;
+#endif
+
+void close_socket(socket_t sock) {
+#ifdef _WIN32
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+}
+
+bool set_nonblocking(socket_t sock) {
+#ifdef _WIN32
+    u_long mode = 1;
+    return ioctlsocket(sock, FIONBIO, &mode) == 0;
+#else
+    const int flags = fcntl(sock, F_GETFL, 0);
+    return flags >= 0 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+bool set_unsent_limit(socket_t sock, int bytes) {
+#ifdef TCP_NOTSENT_LOWAT
+    return setsockopt(sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (const char*)&bytes, sizeof(bytes)) == 0;
+#else
+    (void)sock;
+    (void)bytes;
+    return false;
+#endif
+}
+
+int socket_unsent_bytes(socket_t sock) {
+#ifdef SIOCOUTQNSD
+    int bytes = 0;
+    return ioctl(sock, SIOCOUTQNSD, &bytes) == 0 ? bytes : -1;
+#else
+    (void)sock;
+    return -1;
+#endif
+}
+
+#ifdef __linux__
+// The kernel's struct tcp_info up to tcpi_bytes_retrans. Fields are only ever
+// appended, but libc copies of the struct stop at older kernels' end.
+struct KernelTcpInfo {
+    uint8_t state, ca_state, retransmits, probes, backoff, options, wscale, app_limited;
+    uint32_t rto, ato, snd_mss, rcv_mss;
+    uint32_t unacked, sacked, lost, retrans, fackets;
+    uint32_t last_data_sent, last_ack_sent, last_data_recv, last_ack_recv;
+    uint32_t pmtu, rcv_ssthresh, rtt, rttvar, snd_ssthresh, snd_cwnd, advmss, reordering;
+    uint32_t rcv_rtt, rcv_space, total_retrans;
+    uint64_t pacing_rate, max_pacing_rate, bytes_acked, bytes_received;
+    uint32_t segs_out, segs_in, notsent_bytes, min_rtt, data_segs_in, data_segs_out;
+    uint64_t delivery_rate, busy_time, rwnd_limited, sndbuf_limited;
+    uint32_t delivered, delivered_ce;
+    uint64_t bytes_sent, bytes_retrans;
+};
+#endif
+
+bool tcp_path_info(socket_t sock, TcpPathInfo& info) {
+    info = TcpPathInfo();
+#if defined(__linux__)
+    KernelTcpInfo tcp{};
+    socklen_t len = sizeof(tcp);
+    if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &tcp, &len) != 0) return false;
+    // Kernels before 4.19 fill less, what they leave out stays unknown
+    auto has = [len](size_t end) { return len >= end; };
+    if (!has(offsetof(KernelTcpInfo, bytes_received))) return false;
+    info.bytes_acked = tcp.bytes_acked;
+    info.bytes_in_flight = (uint64_t)tcp.unacked * tcp.snd_mss;
+    info.bytes_retransmitted = has(offsetof(KernelTcpInfo, bytes_retrans) + sizeof(uint64_t))
+        ? tcp.bytes_retrans : (uint64_t)tcp.total_retrans * tcp.snd_mss;
+    info.rtt_us = tcp.rtt;
+    if (has(offsetof(KernelTcpInfo, data_segs_in))) {
+        info.unsent_bytes = tcp.notsent_bytes;
+        info.min_rtt_us = tcp.min_rtt;
+    }
+    if (has(offsetof(KernelTcpInfo, busy_time))) {
+        info.delivery_rate = tcp.delivery_rate * 8;
+        info.app_limited = tcp.app_limited & 1;
+    }
+    return true;
+#elif defined(_WIN32) && defined(SIO_TCP_INFO)
+    DWORD version = 0;
+    TCP_INFO_v0 tcp{};
+    DWORD returned = 0;
+    if (WSAIoctl(sock, SIO_TCP_INFO, &version, sizeof(version), &tcp, sizeof(tcp), &returned, nullptr, nullptr) != 0) {
+        return false;
+    }
+    // BytesOut counts retransmissions too
+    info.bytes_retransmitted = tcp.BytesRetrans;
+    info.bytes_in_flight = tcp.BytesInFlight;
+    const uint64_t sent = tcp.BytesOut > tcp.BytesRetrans ? tcp.BytesOut - tcp.BytesRetrans : 0;
+    info.bytes_acked = sent > tcp.BytesInFlight ? sent - tcp.BytesInFlight : 0;
+    info.rtt_us = tcp.RttUs;
+    info.min_rtt_us = tcp.MinRttUs;
+    return true;
+#else
+    (void)sock;
+    return false;
+#endif
+}
+
+// Whether the last socket call failed only because it would block
+static bool would_block() {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+int send_all(socket_t sock, const char* data, int len) {
+    int total_sent = 0;
+    while (total_sent < len) {
+        int sent = send(sock, data + total_sent, len - total_sent, NO_SIGPIPE);
+        if (sent <= 0) return sent;
+        total_sent += sent;
+    }
+    return total_sent;
+}
+
+int recv_all(socket_t sock, char* buf, int len) {
+    int total = 0;
+    while (total < len) {
+        int r = recv(sock, buf + total, len - total, 0);
+        if (r <= 0) return r;
+        total += r;
+    }
+    return total;
+}
+
+bool send_buffers(socket_t sock, const SendBuffer* buffers, size_t count, int flags, uint32_t* calls) {
+    if (calls) *calls = 0;
+    size_t index = 0;
+    size_t offset = 0;  // bytes of buffers[index] already sent
+    while (index < count) {
+        if (offset == buffers[index].size) {
+            ++index;
+            offset = 0;
+            continue;
+        }
+
+        const size_t batch = std::min(count - index, MAX_GATHER);
+        size_t sent = 0;
+#ifdef _WIN32
+        WSABUF vec[MAX_GATHER];
+        for (size_t i = 0; i < batch; ++i) {
+            const size_t skip = i == 0 ? offset : 0;
+            vec[i].buf = (char*)buffers[index + i].data + skip;
+            vec[i].len = (ULONG)(buffers[index + i].size - skip);
+        }
+        DWORD bytes = 0;
+        (void)flags;
+        if (WSASend(sock, vec, (DWORD)batch, &bytes, 0, nullptr, nullptr) != 0 || bytes == 0) return false;
+        sent = bytes;
+#else
+        iovec vec[MAX_GATHER];
+        for (size_t i = 0; i < batch; ++i) {
+            const size_t skip = i == 0 ? offset : 0;
+            vec[i].iov_base = (char*)buffers[index + i].data + skip;
+            vec[i].iov_len = buffers[index + i].size - skip;
+        }
+        msghdr msg{};
+        msg.msg_iov = vec;
+        msg.msg_iovlen = batch;
+        const ssize_t bytes = sendmsg(sock, &msg, flags | NO_SIGPIPE);
+        if (bytes <= 0) return false;
+        sent = (size_t)bytes;
+#endif
+        if (calls) ++*calls;
+        advance_send_buffers(buffers, index, offset, sent);
+    }
+    return true;
+}
+
+void advance_send_buffers(const SendBuffer* buffers, size_t& index, size_t& offset, size_t sent) {
+    while (sent > 0) {
+        const size_t left = buffers[index].size - offset;
+        if (sent < left) {
+            offset += sent;
+            return;
+        }
+        sent -= left;
+        ++index;
+        offset = 0;
+    }
+}
+
+bool try_send_buffers(socket_t sock, const SendBuffer* buffers, size_t count, size_t& sent) {
+    sent = 0;
+    const size_t batch = std::min(count, MAX_GATHER);
+#ifdef _WIN32
+    WSABUF vec[MAX_GATHER];
+    for (size_t i = 0; i < batch; ++i) {
+        vec[i].buf = (char*)buffers[i].data;
+        vec[i].len = (ULONG)buffers[i].size;
+    }
+    DWORD bytes = 0;
+    if (WSASend(sock, vec, (DWORD)batch, &bytes, 0, nullptr, nullptr) != 0) return would_block();
+#else
+    iovec vec[MAX_GATHER];
+    for (size_t i = 0; i < batch; ++i) {
+        vec[i].iov_base = (void*)buffers[i].data;
+        vec[i].iov_len = buffers[i].size;
+    }
+    msghdr msg{};
+    msg.msg_iov = vec;
+    msg.msg_iovlen = batch;
+    const ssize_t bytes = sendmsg(sock, &msg, MSG_DONTWAIT | NO_SIGPIPE);
+    if (bytes < 0) return would_block();
+#endif
+    sent = (size_t)bytes;
+    return true;
+}
+
+#ifdef HAVE_TIMESTAMPING
+// Payload of SCM_TIMESTAMPING: software, (deprecated) and hardware time
+struct KernelTimestamps {
+    timespec ts[3];
+};
+
+// Control space for UDP_SEGMENT or UDP_GRO next to SCM_TIMESTAMPING
+static const size_t CONTROL_SIZE = CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(KernelTimestamps));
+
+// Kernel timestamps are CLOCK_REALTIME. This offset, read once per batch,
+// takes them to the steady clock protocol_timestamp_us reads.
+static int64_t realtime_offset_us() {
+    timespec real;
+    clock_gettime(CLOCK_REALTIME, &real);
+    const int64_t steady_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    return (int64_t)real.tv_sec * 1000000 + real.tv_nsec / 1000 - steady_us;
+}
+
+static uint64_t steady_from_realtime(const timespec& ts, int64_t offset_us) {
+    if (ts.tv_sec == 0 && ts.tv_nsec == 0) return 0;
+    const int64_t steady_us = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 - offset_us;
+    return steady_us > 0 ? (uint64_t)steady_us : 0;
+}
+
+// Asks for a transmit timestamp of the message `msg` carries
+static void add_tx_stamp_request(msghdr& msg, cmsghdr* cmsg) {
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SO_TIMESTAMPING;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+    const uint32_t flags = SOF_TIMESTAMPING_TX_SOFTWARE;
+    memcpy(CMSG_DATA(cmsg), &flags, sizeof(flags));
+    msg.msg_controllen = (char*)cmsg - (char*)msg.msg_control + CMSG_SPACE(sizeof(uint32_t));
+}
+#elif defined(__linux__)
+static const size_t CONTROL_SIZE = CMSG_SPACE(sizeof(int));
+#endif
+
+bool udp_segmentation_supported(socket_t sock) {
+#if defined(HAVE_UDP_GSO)
+    int size = 0;
+    socklen_t len = sizeof(size);
+    return getsockopt(sock, SOL_UDP, UDP_SEGMENT, &size, &len) == 0;
+#elif defined(HAVE_UDP_USO)
+    DWORD size = 0;
+    int len = sizeof(size);
+    return getsockopt(sock, IPPROTO_UDP, UDP_SEND_MSG_SIZE, (char*)&size, &len) == 0;
+#else
+    (void)sock;
+    return false;
+#endif
+}
+
+// Length of the run of datagrams from `first` that one segmented send can
+// carry: all as long as the first except maybe the last, at most
+// MAX_UDP_SEGMENTS and MAX_UDP_PAYLOAD bytes
+static size_t segment_run(const SendBuffer* datagrams, size_t first, size_t count) {
+    const size_t segment = datagrams[first].size;
+    size_t run = 0, bytes = 0;
+    while (first + run < count && run < MAX_UDP_SEGMENTS) {
+        const size_t size = datagrams[first + run].size;
+        if (size > segment || bytes + size > MAX_UDP_PAYLOAD) break;
+        bytes += size;
+        ++run;
+        if (size < segment) break;
+    }
+    return std::max<size_t>(run, 1);
+}
+
+#if defined(HAVE_UDP_GSO) || defined(HAVE_UDP_USO)
+// Whether the last send failed because the device cannot segment: it has no
+// checksum offload or no USO
+static bool segmentation_refused_error() {
+#ifdef _WIN32
+    const int error = WSAGetLastError();
+    return error == WSAEINVAL || error == WSAEOPNOTSUPP;
+#else
+    return errno == EIO || errno == EINVAL || errno == EOPNOTSUPP;
+#endif
+}
+#endif
+
+#if defined(HAVE_UDP_GSO)
+// Iovecs of one sendmmsg call with segmented messages
+static const size_t MAX_SEGMENTED_IOVECS = 4 * MAX_UDP_SEGMENTS;
+
+// Sends runs of datagrams as one UDP_SEGMENT buffer each, several runs per
+// sendmmsg. Returns how many datagrams went out before an error. `keys`
+// counts the timestamp numbers the kernel gave out: the stamped message takes
+// one when it is sent, and also when the device refuses it, which happens
+// after the kernel has built the packet.
+static size_t send_segmented(socket_t sock, const sockaddr_in& addr, const SendBuffer* datagrams, size_t count,
+    bool stamp_last, uint32_t& keys) {
+    size_t done = 0;
+    while (done < count) {
+        mmsghdr messages[MAX_GATHER] = {};
+        iovec vec[MAX_SEGMENTED_IOVECS];
+        alignas(cmsghdr) char control[MAX_GATHER][CONTROL_SIZE] = {};
+        size_t batch = 0, iovecs = 0, next = done;
+        int stamped = -1;
+        while (next < count && batch < MAX_GATHER) {
+            const size_t run = segment_run(datagrams, next, count);
+            if (iovecs + run > MAX_SEGMENTED_IOVECS) break;
+            msghdr& msg = messages[batch].msg_hdr;
+            msg.msg_name = (void*)&addr;
+            msg.msg_namelen = sizeof(addr);
+            msg.msg_iov = &vec[iovecs];
+            msg.msg_iovlen = run;
+            for (size_t i = 0; i < run; ++i) {
+                vec[iovecs + i].iov_base = (void*)datagrams[next + i].data;
+                vec[iovecs + i].iov_len = datagrams[next + i].size;
+            }
+            msg.msg_control = control[batch];
+            cmsghdr* cmsg = (cmsghdr*)control[batch];
+            if (run > 1) {
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                const uint16_t segment = (uint16_t)datagrams[next].size;
+                memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+                msg.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+                cmsg = (cmsghdr*)(control[batch] + CMSG_SPACE(sizeof(uint16_t)));
+            }
+#ifdef HAVE_TIMESTAMPING
+            if (stamp_last && next + run == count) {
+                add_tx_stamp_request(msg, cmsg);
+                stamped = (int)batch;
+            }
+#endif
+            if (msg.msg_controllen == 0) msg.msg_control = nullptr;
+            iovecs += run;
+            next += run;
+            ++batch;
+        }
+        const int sent = sendmmsg(sock, messages, (unsigned)batch, 0);
+        if (sent <= 0) {
+            if (errno == EINTR) continue;
+            // The error is that of the first message
+            if (stamped == 0 && segmentation_refused_error()) ++keys;
+            return done;
+        }
+        if (stamped >= 0 && stamped < sent) ++keys;
+        for (int i = 0; i < sent; ++i) done += messages[i].msg_hdr.msg_iovlen;
+    }
+    return done;
+}
+#elif defined(HAVE_UDP_USO)
+// Sends runs of datagrams as one UDP_SEND_MSG_SIZE buffer each. Returns how
+// many datagrams went out before an error.
+static size_t send_segmented(socket_t sock, const sockaddr_in& addr, const SendBuffer* datagrams, size_t count,
+    bool stamp_last, uint32_t& keys) {
+    (void)stamp_last;
+    (void)keys;
+    size_t done = 0;
+    while (done < count) {
+        const size_t run = segment_run(datagrams, done, count);
+        WSABUF vec[MAX_UDP_SEGMENTS];
+        for (size_t i = 0; i < run; ++i) {
+            vec[i].buf = (char*)datagrams[done + i].data;
+            vec[i].len = (ULONG)datagrams[done + i].size;
+        }
+        char control[WSA_CMSG_SPACE(sizeof(DWORD))] = {};
+        WSAMSG msg{};
+        msg.name = (LPSOCKADDR)&addr;
+        msg.namelen = sizeof(addr);
+        msg.lpBuffers = vec;
+        msg.dwBufferCount = (DWORD)run;
+        if (run > 1) {
+            msg.Control.buf = control;
+            msg.Control.len = sizeof(control);
+            WSACMSGHDR* cmsg = WSA_CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = IPPROTO_UDP;
+            cmsg->cmsg_type = UDP_SEND_MSG_SIZE;
+            cmsg->cmsg_len = WSA_CMSG_LEN(sizeof(DWORD));
+            *(DWORD*)WSA_CMSG_DATA(cmsg) = (DWORD)datagrams[done].size;
+        }
+        DWORD bytes = 0;
+        if (WSASendMsg(sock, &msg, 0, &bytes, nullptr, nullptr) != 0) return done;
+        done += run;
+    }
+    return done;
+}
+#endif
+
+// send_datagrams, asking for a transmit timestamp of the last datagram with
+// `stamp_last` where the kernel has them. `keys` counts the numbers the
+// kernel gave the stamped sends, see send_segmented.
+static bool send_datagram_runs(socket_t sock, const sockaddr_in& addr, const SendBuffer* datagrams, size_t count,
+    bool segment, bool stamp_last, uint32_t& keys, bool* segmentation_refused) {
+    size_t done = 0;
+#if defined(HAVE_UDP_GSO) || defined(HAVE_UDP_USO)
+    if (segment) {
+        done = send_segmented(sock, addr, datagrams, count, stamp_last, keys);
+        if (done == count) return true;
+        // A full socket buffer is an error like any other
+        if (!segmentation_refused_error()) return false;
+        if (segmentation_refused) *segmentation_refused = true;
+    }
+#else
+    (void)segment;
+#endif
+#ifdef __linux__
+    while (done < count) {
+        const size_t batch = std::min(count - done, MAX_GATHER);
+        mmsghdr messages[MAX_GATHER] = {};
+        iovec vec[MAX_GATHER];
+        for (size_t i = 0; i < batch; ++i) {
+            vec[i].iov_base = (void*)datagrams[done + i].data;
+            vec[i].iov_len = datagrams[done + i].size;
+            messages[i].msg_hdr.msg_name = (void*)&addr;
+            messages[i].msg_hdr.msg_namelen = sizeof(addr);
+            messages[i].msg_hdr.msg_iov = &vec[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+#ifdef HAVE_TIMESTAMPING
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(uint32_t))] = {};
+        const bool stamped = stamp_last && done + batch == count;
+        if (stamped) {
+            msghdr& last = messages[batch - 1].msg_hdr;
+            last.msg_control = control;
+            add_tx_stamp_request(last, (cmsghdr*)control);
+        }
+#else
+        const bool stamped = false;
+#endif
+        const int sent = sendmmsg(sock, messages, (unsigned)batch, 0);
+        if (sent <= 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (stamped && (size_t)sent == batch) ++keys;
+        done += (size_t)sent;
+    }
+#else
+    (void)stamp_last;
+    for (size_t i = done; i < count; ++i) {
+        if (sendto(sock, (const char*)datagrams[i].data, (int)datagrams[i].size, 0,
+                   (const sockaddr*)&addr, sizeof(addr)) < 0) {
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+bool send_datagrams(socket_t sock, const sockaddr_in& addr, const SendBuffer* datagrams, size_t count,
+    bool segment, bool* segmentation_refused) {
+    uint32_t keys = 0;
+    return send_datagram_runs(sock, addr, datagrams, count, segment, false, keys, segmentation_refused);
+}
+
+bool enable_tx_timestamps(TxTimestamps& stamps, socket_t sock) {
+#ifdef HAVE_TIMESTAMPING
+    // Sends ask one by one, the socket only says how to report: numbered,
+    // without the packet looped back
+    const int flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    std::lock_guard<std::mutex> lock(stamps.mutex);
+    stamps.enabled = setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0;
+    stamps.next_key = 0;
+    stamps.pending.clear();
+#else
+    (void)sock;
+    stamps.enabled = false;
+#endif
+    return stamps.enabled;
+}
+
+bool send_stamped_datagrams(TxTimestamps& stamps, socket_t sock, const sockaddr_in& addr,
+    const SendBuffer* datagrams, size_t count, bool segment, uint64_t tag, bool* segmentation_refused) {
+    if (!stamps.enabled || count == 0) return send_datagrams(sock, addr, datagrams, count, segment, segmentation_refused);
+    std::lock_guard<std::mutex> lock(stamps.mutex);
+    PendingTxStamp stamp;
+    stamp.tag = tag;
+    stamp.send_us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    // A refused segmented send that goes again datagram by datagram takes two
+    // numbers. read_tx_timestamps renumbers from the kernel's reports should
+    // the count here still drift.
+    uint32_t keys = 0;
+    const bool sent = send_datagram_runs(sock, addr, datagrams, count, segment, true, keys, segmentation_refused);
+    stamps.next_key += keys;
+    if (!sent || keys == 0) return sent;
+    stamp.key = stamps.next_key - 1;
+    stamps.pending.push_back(stamp);
+    if (stamps.pending.size() > MAX_PENDING_TX_STAMPS) stamps.pending.pop_front();
+    return true;
+}
+
+void read_tx_timestamps(TxTimestamps& stamps, socket_t sock, std::vector<TxStamp>& sent) {
+    sent.clear();
+#ifdef HAVE_TIMESTAMPING
+    if (!stamps.enabled) return;
+    const int64_t offset_us = realtime_offset_us();
+    std::lock_guard<std::mutex> lock(stamps.mutex);
+    while (true) {
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(KernelTimestamps)) + CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in))];
+        msghdr msg{};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        uint64_t sent_us = 0;
+        const sock_extended_err* error = nullptr;
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                KernelTimestamps ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                sent_us = steady_from_realtime(ts.ts[0], offset_us);
+            } else if (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) {
+                error = (const sock_extended_err*)CMSG_DATA(cmsg);
+            }
+        }
+        if (!error || error->ee_origin != SO_EE_ORIGIN_TIMESTAMPING || sent_us == 0) continue;
+        const uint32_t key = error->ee_data;
+        auto it = std::find_if(stamps.pending.begin(), stamps.pending.end(),
+                               [key](const PendingTxStamp& stamp) { return stamp.key == key; });
+        if (it == stamps.pending.end() || it->send_us > sent_us) {
+            // The kernel numbered the sends differently than counted: the
+            // report belongs to the last send that started before the packet
+            // left, which it renumbers along with every send after it
+            auto last = std::find_if(stamps.pending.rbegin(), stamps.pending.rend(),
+                                     [sent_us](const PendingTxStamp& stamp) { return stamp.send_us <= sent_us; });
+            if (last == stamps.pending.rend()) continue;
+            it = std::prev(last.base());
+            const uint32_t shift = key - it->key;
+            for (auto renumber = it; renumber != stamps.pending.end(); ++renumber) renumber->key += shift;
+            stamps.next_key += shift;
+        }
+        // Sends before it had their timestamps lost
+        sent.push_back({ it->tag, it->send_us, sent_us });
+        stamps.pending.erase(stamps.pending.begin(), std::next(it));
+    }
+#else
+    (void)stamps;
+    (void)sock;
+#endif
+}
+
+bool try_recv(socket_t sock, void* data, size_t size, size_t& received) {
+    received = 0;
+#ifdef _WIN32
+    const int r = recv(sock, (char*)data, (int)size, 0);
+#else
+    const ssize_t r = recv(sock, data, size, MSG_DONTWAIT);
+#endif
+    if (r < 0) return would_block();
+    if (r == 0) return false;
+    received = (size_t)r;
+    return true;
+}
+
+void init_datagram_receiver(DatagramReceiver& receiver, socket_t sock, size_t max_size, bool gro,
+    bool timestamps) {
+    receiver.gro = false;
+    receiver.timestamps = false;
+#ifdef HAVE_UDP_GRO
+    int one = 1;
+    receiver.gro = gro && setsockopt(sock, SOL_UDP, UDP_GRO, &one, sizeof(one)) == 0;
+#else
+    (void)gro;
+#endif
+#ifdef HAVE_TIMESTAMPING
+    const int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    receiver.timestamps = timestamps && setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0;
+#else
+    (void)timestamps;
+#endif
+    (void)sock;
+    // A coalesced run can be as large as any datagram
+    receiver.slot_size = receiver.gro ? MAX_UDP_PAYLOAD : max_size;
+#ifdef __linux__
+    receiver.buffer.resize(receiver.slot_size * RECV_BATCH);
+#else
+    receiver.buffer.resize(receiver.slot_size);
+#endif
+    receiver.datagrams.reserve(receiver.gro ? RECV_BATCH * MAX_UDP_SEGMENTS : RECV_BATCH);
+}
+
+bool recv_datagrams(DatagramReceiver& receiver, socket_t sock) {
+    receiver.datagrams.clear();
+#ifdef __linux__
+    mmsghdr messages[RECV_BATCH] = {};
+    iovec vec[RECV_BATCH];
+    alignas(cmsghdr) char control[RECV_BATCH][CONTROL_SIZE];
+#ifdef HAVE_TIMESTAMPING
+    const int64_t offset_us = receiver.timestamps ? realtime_offset_us() : 0;
+#endif
+    for (size_t i = 0; i < RECV_BATCH; ++i) {
+        vec[i].iov_base = receiver.buffer.data() + i * receiver.slot_size;
+        vec[i].iov_len = receiver.slot_size;
+        messages[i].msg_hdr.msg_iov = &vec[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+        if (receiver.gro || receiver.timestamps) {
+            messages[i].msg_hdr.msg_control = control[i];
+            messages[i].msg_hdr.msg_controllen = sizeof(control[i]);
+        }
+    }
+    const int count = recvmmsg(sock, messages, RECV_BATCH, MSG_DONTWAIT, nullptr);
+    if (count < 0) return would_block();
+    if (count > 0) ++receiver.calls;
+    for (int i = 0; i < count; ++i) {
+        const msghdr& msg = messages[i].msg_hdr;
+        const uint8_t* data = (const uint8_t*)vec[i].iov_base;
+        const size_t size = messages[i].msg_len;
+        if (msg.msg_flags & MSG_TRUNC) continue;
+        // Without a UDP_GRO message the slot holds a single datagram
+        size_t segment = size;
+        uint64_t arrival_us = 0;
+        for (const cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR((msghdr*)&msg, (cmsghdr*)cmsg)) {
+#ifdef HAVE_UDP_GRO
+            if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                int gso_size = 0;
+                memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+                if (gso_size > 0) segment = (size_t)gso_size;
+            }
+#endif
+#ifdef HAVE_TIMESTAMPING
+            // A coalesced run carries the time its first datagram came in
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                KernelTimestamps ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                arrival_us = steady_from_realtime(ts.ts[0], offset_us);
+            }
+#endif
+        }
+        for (size_t offset = 0; offset < size; offset += segment) {
+            receiver.datagrams.push_back({ data + offset, std::min(segment, size - offset), arrival_us });
+        }
+    }
+#else
+#ifdef _WIN32
+    const int r = recv(sock, (char*)receiver.buffer.data(), (int)receiver.buffer.size(), 0);
+#else
+    const ssize_t r = recv(sock, receiver.buffer.data(), receiver.buffer.size(), MSG_DONTWAIT);
+#endif
+    if (r < 0) return would_block();
+    ++receiver.calls;
+    receiver.datagrams.push_back({ receiver.buffer.data(), (size_t)r, 0 });
+#endif
+    receiver.received += receiver.datagrams.size();
+    return true;
+}
+
+bool enable_busy_poll(socket_t sock, int usec) {
+#if defined(__linux__) && defined(SO_BUSY_POLL)
+    if (setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) != 0) return false;
+#ifdef SO_PREFER_BUSY_POLL
+    // Leaves the device's queue to the polling receiver while it keeps up,
+    // refused on kernels before 5.11
+    const int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one));
+#endif
+    return true;
+#else
+    (void)sock;
+    (void)usec;
+    return false;
+#endif
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+using socket_t = SOCKET;
+#else
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+using socket_t = int;
+#endif
+
+void close_socket(socket_t sock);
+
+// Switches the socket to non-blocking mode
+bool set_nonblocking(socket_t sock);
+
+// Lets the socket report writable only while fewer than `bytes` written bytes
+// are still unsent (TCP_NOTSENT_LOWAT), so a backlog builds up in the
+// caller's queue instead of the kernel's. Returns false where unsupported.
+bool set_unsent_limit(socket_t sock, int bytes);
+
+// Bytes written to the socket that have not left yet, -1 where unknown
+int socket_unsent_bytes(socket_t sock);
+
+// What the kernel knows about the sending side of a TCP connection
+struct TcpPathInfo {
+    uint64_t bytes_acked = 0;       // Delivered since the connection opened
+    uint64_t bytes_retransmitted = 0;
+    uint64_t bytes_in_flight = 0;   // Sent, not acknowledged yet
+    int64_t unsent_bytes = -1;      // Written, not sent yet, -1 where unknown
+    uint32_t rtt_us = 0;            // Smoothed
+    uint32_t min_rtt_us = 0;
+    uint64_t delivery_rate = 0;     // Latest sample, bits per second, 0 where unknown
+    bool app_limited = false;       // ... taken while the sender had nothing more to send
+};
+
+// Reads TCP_INFO (Linux) or SIO_TCP_INFO (Windows 10 1703+). Returns false
+// where neither is available.
+bool tcp_path_info(socket_t sock, TcpPathInfo& info);
+
+// Blocking loops over send/recv, return `len` on success and the failing
+// send/recv result (<= 0) otherwise
+int send_all(socket_t sock, const char* data, int len);
+int recv_all(socket_t sock, char* buf, int len);
+
+// Buffers handed to one sendmsg/WSASend call, well below IOV_MAX
+const size_t MAX_GATHER = 64;
+
+// One piece of a gathered send
+struct SendBuffer {
+    const void* data;
+    size_t size;
+};
+
+// Sends all buffers back to back with sendmsg/WSASend, so a message's header
+// and payload leave in one syscall. Partial writes resume mid-buffer.
+// `flags` go to sendmsg (ignored on Windows), `calls` receives the number of
+// successful syscalls.
+bool send_buffers(socket_t sock, const SendBuffer* buffers, size_t count,
+    int flags = 0, uint32_t* calls = nullptr);
+
+// Moves the position (`index`, `offset` bytes into it) past `sent` bytes,
+// for gathered sends that resume after a partial write
+void advance_send_buffers(const SendBuffer* buffers, size_t& index, size_t& offset, size_t sent);
+
+// One non-blocking gathered send. `sent` is 0 when the socket buffer is
+// full. Returns false on error.
+bool try_send_buffers(socket_t sock, const SendBuffer* buffers, size_t count, size_t& sent);
+
+// Most datagrams the kernel cuts one segmented send into (UDP_MAX_SEGMENTS)
+const size_t MAX_UDP_SEGMENTS = 64;
+// Largest UDP payload over IPv4, the most one segmented send or coalesced
+// receive carries
+const size_t MAX_UDP_PAYLOAD = 65507;
+
+// Whether the kernel can cut one large send on `sock` into datagrams:
+// UDP_SEGMENT (GSO, Linux 4.18+) or UDP_SEND_MSG_SIZE (USO, Windows 11)
+bool udp_segmentation_supported(socket_t sock);
+
+// Sends each buffer as its own datagram to `addr`, several per syscall
+// where sendmmsg exists. With `segment`, each run of equal-size datagrams
+// (its last one may be shorter) goes to the kernel as one buffer that it
+// cuts up, so a frame takes one or a few syscalls; when the device cannot
+// segment, the rest goes out datagram by datagram and `segmentation_refused`
+// is set, telling the caller to stop asking. Returns false when the socket
+// fails.
+bool send_datagrams(socket_t sock, const sockaddr_in& addr, const SendBuffer* datagrams, size_t count,
+    bool segment = false, bool* segmentation_refused = nullptr);
+
+// A stamped send waiting for its kernel transmit timestamp
+struct PendingTxStamp {
+    uint32_t key = 0;               // The kernel's number for it
+    uint64_t tag = 0;               // The caller's, such as the frame's capture time
+    uint64_t send_us = 0;           // When it was handed to the kernel
+};
+
+// A stamped send that left: `sent_us` is when its last datagram went to the
+// device, on protocol_timestamp_us's clock
+struct TxStamp {
+    uint64_t tag = 0;
+    uint64_t send_us = 0;
+    uint64_t sent_us = 0;
+};
+
+// Most stamped sends waiting for their timestamps, older ones are given up
+const size_t MAX_PENDING_TX_STAMPS = 1024;
+
+// Kernel transmit timestamps of chosen sends on a UDP socket
+// (SO_TIMESTAMPING, Linux). Only the sends that ask get one; the kernel
+// numbers them in order and hands each number back through the socket's
+// error queue with the time the packet left for the device, the end of the
+// time it spent in the kernel's own queues.
+struct TxTimestamps {
+    bool enabled = false;
+    std::mutex mutex;               // Stamped sends take turns, so the numbers stay in order
+    uint32_t next_key = 0;
+    std::deque<PendingTxStamp> pending;
+};
+
+// Returns false where the kernel cannot stamp sends on `sock`
+bool enable_tx_timestamps(TxTimestamps& stamps, socket_t sock);
+
+// send_datagrams that asks for the last datagram's transmit timestamp,
+// reported with `tag` by read_tx_timestamps. Without timestamps a plain
+// send_datagrams.
+bool send_stamped_datagrams(TxTimestamps& stamps, socket_t sock, const sockaddr_in& addr,
+    const SendBuffer* datagrams, size_t count, bool segment, uint64_t tag, bool* segmentation_refused = nullptr);
+
+// Moves the timestamps waiting in the socket's error queue into `sent`
+void read_tx_timestamps(TxTimestamps& stamps, socket_t sock, std::vector<TxStamp>& sent);
+
+// One non-blocking receive. `received` is 0 when nothing is waiting.
+// Returns false on error or when the peer closed the connection.
+bool try_recv(socket_t sock, void* data, size_t size, size_t& received);
+
+// A datagram in a DatagramReceiver's buffer
+struct ReceivedDatagram {
+    const uint8_t* data;
+    size_t size;
+    uint64_t arrival_us;    // Kernel receive timestamp on protocol_timestamp_us's clock, 0 = none
+};
+
+// Slots one recv_datagrams call fills
+const size_t RECV_BATCH = 16;
+
+// Batched receives from a UDP socket: recvmmsg into RECV_BATCH slots on
+// Linux, where UDP_GRO also lets the kernel hand over a run of datagrams
+// from one sender in a single slot, cut apart again here. Elsewhere one
+// recv per call.
+struct DatagramReceiver {
+    bool gro = false;
+    bool timestamps = false;                    // Datagrams carry the kernel's receive time
+    size_t slot_size = 0;
+    std::vector<uint8_t> buffer;
+    std::vector<ReceivedDatagram> datagrams;    // Of the last recv_datagrams call
+    uint64_t calls = 0;                         // Receive syscalls that returned data
+    uint64_t received = 0;                      // Datagrams they returned
+};
+
+// Sizes the slots for datagrams of up to `max_size` bytes. With `gro` the
+// socket gets UDP_GRO where the kernel has it, with `timestamps` software
+// receive timestamps (SO_TIMESTAMPING), taken when the device handed the
+// datagram over rather than when the application got to it.
+void init_datagram_receiver(DatagramReceiver& receiver, socket_t sock, size_t max_size, bool gro,
+    bool timestamps = false);
+
+// One non-blocking batch into receiver.datagrams, left empty when nothing is
+// waiting. Returns false on error.
+bool recv_datagrams(DatagramReceiver& receiver, socket_t sock);
+
+// Lets receives on `sock` poll the device's queue for up to `usec` instead
+// of waiting for its interrupt (SO_BUSY_POLL, with SO_PREFER_BUSY_POLL where
+// the kernel has it). Raising either needs CAP_NET_ADMIN. Returns false
+// where refused or unsupported.
+bool enable_busy_poll(socket_t sock, int usec);
@@ -0,0 +1,30 @@
+#include "transport.h"
+
+#include <cstring>
+
+bool parse_transport_type(const char* name, TransportType& type) {
+    if (strcmp(name, "poll") == 0) {
+        type = TransportType::POLL;
+    } else if (strcmp(name, "io_uring") == 0) {
+        type = TransportType::IO_URING;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* transport_type_name(TransportType type) {
+    return type == TransportType::IO_URING ? "io_uring" : "poll";
+}
+
+void init_transport(Transport& transport, socket_t sock) {
+    transport.sock = sock;
+}
+
+bool transport_send(Transport& transport, const SendBuffer* buffers, size_t count) {
+    return send_buffers(transport.sock, buffers, count);
+}
+
+bool transport_recv(Transport& transport, void* data, size_t size) {
+    return size == 0 || recv_all(transport.sock, (char*)data, (int)size) == (int)size;
+}
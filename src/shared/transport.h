@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "socket.h"
+
+// How the host's event loop moves viewer bytes
+enum class TransportType {
+    POLL,       // Readiness from the poller, then non-blocking send/recv calls
+    IO_URING,   // Sends and receives queued on one io_uring, see io_ring.h (Linux)
+};
+
+// Parses "poll" or "io_uring"
+bool parse_transport_type(const char* name, TransportType& type);
+const char* transport_type_name(TransportType type);
+
+// One connection driven by blocking calls from its own thread: the client,
+// and the host's viewers outside the event loop
+struct Transport {
+    socket_t sock;
+};
+
+// Wraps `sock`, which stays owned by the caller
+void init_transport(Transport& transport, socket_t sock);
+
+// Sends all buffers as one gathered write, continuing after partial writes
+bool transport_send(Transport& transport, const SendBuffer* buffers, size_t count);
+
+// Receives exactly `size` bytes, false on disconnect or error
+bool transport_recv(Transport& transport, void* data, size_t size);
@@ -0,0 +1,50 @@
+#include "worker_group.h"
+
+static void worker_loop(WorkerGroup& group, int index) {
+    unsigned long long seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(group.mutex);
+            group.work_cv.wait(lock, [&] { return group.stopping || group.generation != seen; });
+            if (group.stopping) return;
+            seen = group.generation;
+        }
+
+        group.job(index);
+
+        std::lock_guard<std::mutex> lock(group.mutex);
+        if (--group.pending == 0) {
+            group.done_cv.notify_one();
+        }
+    }
+}
+
+void start_workers(WorkerGroup& group, int count, std::function<void(int)> job) {
+    group.job = std::move(job);
+    group.stopping = false;
+    group.generation = 0;
+    group.pending = 0;
+    for (int i = 0; i < count; ++i) {
+        group.threads.emplace_back(worker_loop, std::ref(group), i);
+    }
+}
+
+void run_workers(WorkerGroup& group) {
+    std::unique_lock<std::mutex> lock(group.mutex);
+    group.pending = (int)group.threads.size();
+    ++group.generation;
+    group.work_cv.notify_all();
+    group.done_cv.wait(lock, [&] { return group.pending == 0; });
+}
+
+void stop_workers(WorkerGroup& group) {
+    {
+        std::lock_guard<std::mutex> lock(group.mutex);
+        group.stopping = true;
+    }
+    group.work_cv.notify_all();
+    for (auto& t : group.threads) {
+        if (t.joinable()) t.join();
+    }
+    group.threads.clear();
+}
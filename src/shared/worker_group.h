@@ -0,0 +1,29 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads that each run the same job once per batch, with the
+// worker index as argument. Used to encode/decode frame stripes in parallel.
+struct WorkerGroup {
+    std::vector<std::thread> threads;
+    std::function<void(int)> job;
+    std::mutex mutex;
+    std::condition_variable work_cv;
+    std::condition_variable done_cv;
+    unsigned long long generation = 0;
+    int pending = 0;
+    bool stopping = false;
+};
+
+// Starts `count` threads that wait for run_workers
+void start_workers(WorkerGroup& group, int count, std::function<void(int)> job);
+
+// Runs the job on every worker and blocks until all of them are done
+void run_workers(WorkerGroup& group);
+
+// Joins all threads, the group can be started again afterwards
+void stop_workers(WorkerGroup& group);
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdio>
+
+// Assertions for the test executables: a failed CHECK reports where and the
+// test goes on, main returns check_result() for CTest
+static int check_failures = 0;
+
+#define CHECK(condition)                                                                    \
+    do {                                                                                    \
+        if (!(condition)) {                                                                 \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            ++check_failures;                                                               \
+        }                                                                                   \
+    } while (0)
+
+static int check_result() {
+    if (check_failures > 0) std::fprintf(stderr, "%d checks failed\n", check_failures);
+    return check_failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,262 @@
+// CongestionController in simulated time: 60 fps video from each flow,
+// paced over half the frame interval as the host's pacer does, through one
+// LinkEmulator bottleneck. Clients send TRANSPORT_FEEDBACK every 50 ms and a
+// RECEIVER_REPORT every 500 ms, which reach the host a one-way delay later.
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <random>
+#include <vector>
+
+#include "check.h"
+#include "host/congestion.h"
+#include "shared/link_emulator.h"
+
+static const uint64_t TICK_US = 250;
+static const double FPS = 60;
+static const double PACING_SHARE = 0.5;
+static const int KEYFRAME_FRAMES = 240;         // Every 4 s, 3 times the size
+static const uint64_t FEEDBACK_INTERVAL_US = 50'000;
+static const uint64_t REPORT_INTERVAL_US = 500'000;
+static const size_t DATAGRAM_SIZE = 1200;
+static const double DELAY_MS = 20;
+static const int MIN_BITRATE = 300'000;
+static const int MAX_BITRATE = 20'000'000;
+
+struct Packet {
+    int flow;
+    uint16_t sequence;
+    size_t size;
+    uint64_t send_us;
+    uint64_t arrival_us;
+};
+
+struct Flow {
+    CongestionController cc;
+    uint64_t next_frame_us = 0;
+    int frame = 0;
+    uint16_t sequence = 0;
+    std::deque<Packet> paced;                   // Waiting for their send time
+    std::vector<std::pair<uint16_t, uint64_t>> arrivals;    // Since the last feedback
+    uint64_t expected = 0, received = 0, reported_expected = 0, reported_received = 0;
+    std::vector<uint64_t> received_bytes;       // Per second
+    std::vector<double> targets;                // At each 100 ms
+};
+
+struct Feedback {
+    int flow;
+    uint64_t due_us;
+    std::vector<std::pair<uint16_t, uint64_t>> arrivals;
+    bool report;
+    double loss;
+};
+
+// Link capacity from `at_us` on
+struct RateStep {
+    uint64_t at_us;
+    double rate_kbps;
+};
+
+struct Simulation {
+    LinkEmulator link;
+    std::vector<Flow> flows;
+    std::vector<std::vector<uint64_t>> queue_us;    // Queueing delay of each packet, per second of arrival
+};
+
+static void run(Simulation& sim, const std::vector<uint64_t>& starts, int start_bitrate,
+    const std::vector<RateStep>& steps, int seconds) {
+    init_link_emulator(sim.link, 0, 1);
+    sim.link.random.seed(3);
+    shape_link_emulator(sim.link, steps.front().rate_kbps, DELAY_MS, 300);
+    std::mt19937 random(5);
+    std::normal_distribution<double> frame_noise(1.0, 0.15);
+
+    sim.flows.assign(starts.size(), Flow());
+    for (size_t f = 0; f < starts.size(); ++f) {
+        Flow& flow = sim.flows[f];
+        init_congestion_controller(flow.cc, start_bitrate, MIN_BITRATE, MAX_BITRATE, CONGESTION_QUEUE_TARGET_US);
+        flow.next_frame_us = starts[f];
+        flow.received_bytes.assign(seconds + 1, 0);
+    }
+    sim.queue_us.assign(seconds + 1, {});
+
+    std::deque<Packet> in_flight;
+    std::deque<Feedback> feedback;
+    uint64_t next_feedback_us = FEEDBACK_INTERVAL_US, next_report_us = REPORT_INTERVAL_US;
+    size_t step = 1;
+    const uint64_t end_us = (uint64_t)seconds * 1'000'000;
+    for (uint64_t now = 0; now < end_us; now += TICK_US) {
+        if (step < steps.size() && now >= steps[step].at_us) sim.link.rate_bps = steps[step++].rate_kbps * 1000;
+
+        // The encoder hits the target it was given before the frame, which
+        // queues behind what is still paced
+        for (size_t f = 0; f < sim.flows.size(); ++f) {
+            Flow& flow = sim.flows[f];
+            if (now < flow.next_frame_us) continue;
+            const bool keyframe = flow.frame % KEYFRAME_FRAMES == 0;
+            double bits = flow.cc.target / FPS * std::max(0.3, frame_noise(random));
+            if (keyframe) bits *= 3;
+            const size_t count = std::max<size_t>(1, (size_t)std::ceil(bits / 8 / DATAGRAM_SIZE));
+            const uint64_t window_us = (uint64_t)((keyframe ? 1.0 : PACING_SHARE) * 1e6 / FPS);
+            for (size_t i = 0; i < count; ++i) {
+                uint64_t send_us = now + window_us * i / count;
+                if (!flow.paced.empty()) send_us = std::max(send_us, flow.paced.back().send_us);
+                flow.paced.push_back({ (int)f, flow.sequence++, DATAGRAM_SIZE, send_us, 0 });
+            }
+            ++flow.frame;
+            flow.next_frame_us += (uint64_t)(1e6 / FPS);
+        }
+
+        for (Flow& flow : sim.flows) {
+            while (!flow.paced.empty() && flow.paced.front().send_us <= now) {
+                Packet packet = flow.paced.front();
+                flow.paced.pop_front();
+                packet.send_us = now;
+                congestion_packet_sent(flow.cc, packet.sequence, packet.size, now);
+                ++flow.expected;
+                if (link_transmit(sim.link, now, packet.size, packet.arrival_us)) in_flight.push_back(packet);
+            }
+        }
+
+        // The bottleneck is first in, first out
+        while (!in_flight.empty() && in_flight.front().arrival_us <= now) {
+            const Packet& packet = in_flight.front();
+            Flow& flow = sim.flows[packet.flow];
+            flow.arrivals.emplace_back(packet.sequence, packet.arrival_us);
+            ++flow.received;
+            const size_t second = packet.arrival_us / 1'000'000;
+            flow.received_bytes[second] += packet.size;
+            sim.queue_us[second].push_back(packet.arrival_us - packet.send_us - (uint64_t)(DELAY_MS * 1000));
+            in_flight.pop_front();
+        }
+
+        const uint64_t back_us = now + (uint64_t)(DELAY_MS * 1000);
+        if (now >= next_feedback_us) {
+            next_feedback_us += FEEDBACK_INTERVAL_US;
+            for (size_t f = 0; f < sim.flows.size(); ++f) {
+                if (sim.flows[f].arrivals.empty()) continue;
+                feedback.push_back({ (int)f, back_us, std::move(sim.flows[f].arrivals), false, 0 });
+                sim.flows[f].arrivals.clear();
+            }
+        }
+        if (now >= next_report_us) {
+            next_report_us += REPORT_INTERVAL_US;
+            for (size_t f = 0; f < sim.flows.size(); ++f) {
+                Flow& flow = sim.flows[f];
+                const uint64_t expected = flow.expected - flow.reported_expected;
+                const uint64_t received = flow.received - flow.reported_received;
+                flow.reported_expected = flow.expected;
+                flow.reported_received = flow.received;
+                if (expected == 0) continue;
+                const double loss = expected > received ? (double)(expected - received) / expected : 0;
+                feedback.push_back({ (int)f, back_us, {}, true, loss });
+            }
+        }
+        while (!feedback.empty() && feedback.front().due_us <= now) {
+            const Feedback& message = feedback.front();
+            Flow& flow = sim.flows[message.flow];
+            if (message.report) {
+                congestion_report_loss(flow.cc, message.loss, now);
+            } else {
+                for (const auto& arrival : message.arrivals) congestion_packet_arrived(flow.cc, arrival.first, arrival.second);
+                congestion_update(flow.cc, (uint64_t)(2 * DELAY_MS * 1000), now);
+            }
+            feedback.pop_front();
+        }
+        if (now % 100'000 == 0) {
+            for (Flow& flow : sim.flows) flow.targets.push_back(flow.cc.target);
+        }
+    }
+}
+
+// Received rate of `flow` over seconds [from, to), bits per second
+static double throughput(const Flow& flow, int from, int to) {
+    uint64_t bytes = 0;
+    for (int s = from; s < to; ++s) bytes += flow.received_bytes[s];
+    return bytes * 8.0 / (to - from);
+}
+
+// Queueing delay below which `share` of the packets arriving in seconds
+// [from, to) waited
+static uint64_t queue_percentile(const Simulation& sim, int from, int to, double share) {
+    std::vector<uint64_t> delays;
+    for (int s = from; s < to; ++s) delays.insert(delays.end(), sim.queue_us[s].begin(), sim.queue_us[s].end());
+    if (delays.empty()) return 0;
+    std::sort(delays.begin(), delays.end());
+    return delays[(size_t)(share * (delays.size() - 1))];
+}
+
+// Seconds from `from` until the 100 ms target samples of `flow` stay within
+// [low, high] for a second, or -1
+static double settle_seconds(const Flow& flow, int from, double low, double high) {
+    int inside = 0;
+    for (size_t i = (size_t)from * 10; i < flow.targets.size(); ++i) {
+        inside = flow.targets[i] >= low && flow.targets[i] <= high ? inside + 1 : 0;
+        if (inside == 10) return (i - 9) / 10.0 - from;
+    }
+    return -1;
+}
+
+// One flow; the link drops from 8 to 4 Mbit/s at 30 s and goes back at 60 s
+static void test_rate_step() {
+    Simulation sim;
+    run(sim, { 0 }, 2'000'000, { { 0, 8000 }, { 30'000'000, 4000 }, { 60'000'000, 8000 } }, 90);
+    const Flow& flow = sim.flows[0];
+    for (int s = 0; s < 90; s += 5) {
+        std::printf("t=%2d s: target %5.0f kbps, received %5.0f kbps, queue p95 %5.1f ms\n", s, flow.targets[s * 10] / 1000,
+                    throughput(flow, s, s + 1) / 1000, queue_percentile(sim, s, s + 1, 0.95) / 1000.0);
+    }
+
+    const double down = settle_seconds(flow, 30, 0, 4'000'000);
+    const double up = settle_seconds(flow, 60, 4'000'000, 8'000'000);
+    std::printf("Below 4 Mbit/s %.1f s after the drop, above it %.1f s after the rise\n", down, up);
+    CHECK(down >= 0 && down <= 2);
+    CHECK(up >= 0 && up <= 20);
+
+    // Away from the steps the queue stays below the target, and the link is
+    // used rather than left idle
+    for (int from : { 10, 40, 80 }) {
+        const uint64_t p95_us = queue_percentile(sim, from, from + 10, 0.95);
+        const double capacity = from >= 30 && from < 60 ? 4e6 : 8e6;
+        const double used = throughput(flow, from, from + 10) / capacity;
+        std::printf("%d-%d s: queue p95 %.1f ms, %.0f%% of the link used\n", from, from + 10, p95_us / 1000.0, 100 * used);
+        CHECK(p95_us < CONGESTION_QUEUE_TARGET_US);
+        CHECK(used >= 0.4);
+    }
+    // The queue the drop left behind drains within a few seconds
+    CHECK(queue_percentile(sim, 33, 40, 0.95) < CONGESTION_QUEUE_TARGET_US);
+}
+
+// Three flows joining 10 s apart on a 12 Mbit/s link
+static void test_fairness() {
+    Simulation sim;
+    run(sim, { 0, 10'000'000, 20'000'000 }, 1'000'000, { { 0, 12000 } }, 90);
+    for (int s = 0; s < 90; s += 10) {
+        std::printf("t=%2d s:", s);
+        for (const Flow& flow : sim.flows) std::printf(" %5.0f", throughput(flow, s, s + 10) / 1000);
+        std::printf(" kbps, queue p95 %5.1f ms\n", queue_percentile(sim, s, s + 10, 0.95) / 1000.0);
+    }
+
+    // Jain's index over the last 40 s
+    double sum = 0, sum_squares = 0, lowest = 1e12, highest = 0;
+    for (const Flow& flow : sim.flows) {
+        const double rate = throughput(flow, 50, 90);
+        sum += rate;
+        sum_squares += rate * rate;
+        lowest = std::min(lowest, rate);
+        highest = std::max(highest, rate);
+    }
+    const double fairness = sum * sum / (sim.flows.size() * sum_squares);
+    std::printf("50-90 s: fairness index %.3f, lowest to highest %.2f, %.0f%% of the link used\n", fairness,
+                lowest / highest, 100 * sum / 12e6);
+    CHECK(fairness >= 0.9);
+    CHECK(lowest / highest >= 0.5);
+    CHECK(sum / 12e6 >= 0.4);
+    CHECK(queue_percentile(sim, 50, 90, 0.95) < CONGESTION_QUEUE_TARGET_US);
+}
+
+int main() {
+    test_rate_step();
+    test_fairness();
+    return check_result();
+}
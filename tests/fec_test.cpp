@@ -0,0 +1,129 @@
+// fec_encode/fec_decode round trips over every erasure pattern a group can
+// recover from, on the SSSE3 and on the scalar path
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "check.h"
+#include "shared/fec.h"
+
+// Not a multiple of 16, so the SSSE3 path leaves a scalar tail
+static const size_t SYMBOL_SIZE = 61;
+
+struct Group {
+    std::vector<std::vector<uint8_t>> sources;
+    std::vector<std::vector<uint8_t>> repairs;
+};
+
+static Group encode_group(FecScheme scheme, int source_count, int repair_count, std::mt19937& random) {
+    Group group;
+    group.sources.assign(source_count, std::vector<uint8_t>(SYMBOL_SIZE));
+    group.repairs.assign(repair_count, std::vector<uint8_t>(SYMBOL_SIZE));
+    for (auto& source : group.sources) {
+        for (uint8_t& byte : source) byte = (uint8_t)random();
+    }
+    std::vector<const uint8_t*> sources;
+    std::vector<uint8_t*> repairs;
+    for (auto& source : group.sources) sources.push_back(source.data());
+    for (auto& repair : group.repairs) repairs.push_back(repair.data());
+    fec_encode(scheme, sources.data(), source_count, repairs.data(), repair_count, SYMBOL_SIZE);
+    return group;
+}
+
+// Decodes with the symbols in `erased` (sources first, then repairs) lost
+static bool decodes(FecScheme scheme, const Group& group, const std::vector<bool>& erased) {
+    const int source_count = (int)group.sources.size();
+    std::vector<std::vector<uint8_t>> sources = group.sources;
+    std::vector<uint8_t*> source_pointers;
+    bool have[FEC_MAX_SOURCES];
+    for (int i = 0; i < source_count; ++i) {
+        have[i] = !erased[i];
+        if (!have[i]) memset(sources[i].data(), 0xA5, SYMBOL_SIZE);
+        source_pointers.push_back(sources[i].data());
+    }
+    std::vector<const uint8_t*> repairs;
+    std::vector<int> indices;
+    for (int j = 0; j < (int)group.repairs.size(); ++j) {
+        if (erased[source_count + j]) continue;
+        repairs.push_back(group.repairs[j].data());
+        indices.push_back(j);
+    }
+    if (!fec_decode(scheme, source_pointers.data(), have, source_count, repairs.data(), indices.data(),
+                    (int)repairs.size(), SYMBOL_SIZE)) {
+        return false;
+    }
+    return sources == group.sources;
+}
+
+// Calls `visit` with `erased` plus every set of at most `most` more symbols
+// from `first` on
+template <typename Visit>
+static void for_each_erasure(std::vector<bool>& erased, int first, int most, const Visit& visit) {
+    visit(erased);
+    if (most == 0) return;
+    for (int i = first; i < (int)erased.size(); ++i) {
+        erased[i] = true;
+        for_each_erasure(erased, i + 1, most - 1, visit);
+        erased[i] = false;
+    }
+}
+
+static void test_round_trips(FecScheme scheme, int source_count, int repair_count, std::mt19937& random) {
+    const Group group = encode_group(scheme, source_count, repair_count, random);
+    std::vector<bool> erased(source_count + repair_count, false);
+    int patterns = 0, failed = 0;
+    for_each_erasure(erased, 0, repair_count, [&](const std::vector<bool>& pattern) {
+        ++patterns;
+        if (!decodes(scheme, group, pattern)) ++failed;
+    });
+    std::printf("%-4s %3d+%d: %d erasure patterns, %d failed\n", fec_scheme_name(scheme), source_count, repair_count,
+                patterns, failed);
+    CHECK(failed == 0);
+
+    // One source more lost than there are repairs is beyond the code
+    if (source_count > repair_count) {
+        std::vector<bool> too_many(source_count + repair_count, false);
+        for (int i = 0; i <= repair_count; ++i) too_many[i] = true;
+        CHECK(!decodes(scheme, group, too_many));
+    }
+}
+
+static void test_codes(std::mt19937& random) {
+    test_round_trips(FecScheme::XOR, 1, 1, random);
+    test_round_trips(FecScheme::XOR, 32, 1, random);
+    test_round_trips(FecScheme::REED_SOLOMON, 1, 1, random);
+    test_round_trips(FecScheme::REED_SOLOMON, 5, 5, random);
+    test_round_trips(FecScheme::REED_SOLOMON, 16, 3, random);
+    test_round_trips(FecScheme::REED_SOLOMON, 32, 4, random);
+    test_round_trips(FecScheme::REED_SOLOMON, FEC_MAX_SOURCES, 2, random);
+}
+
+// Both paths must produce the same products
+static void test_paths_agree(std::mt19937& random) {
+    std::vector<uint8_t> source(1200 + 7);
+    for (uint8_t& byte : source) byte = (uint8_t)random();
+    for (int c = 0; c < 256; ++c) {
+        std::vector<uint8_t> simd(source.size(), 0x3C), scalar(source.size(), 0x3C);
+        fec_use_ssse3(true);
+        gf_mul_add(simd.data(), source.data(), (uint8_t)c, source.size());
+        fec_use_ssse3(false);
+        gf_mul_add(scalar.data(), source.data(), (uint8_t)c, source.size());
+        CHECK(simd == scalar);
+    }
+}
+
+int main() {
+    std::mt19937 random(1);
+    const bool ssse3 = fec_use_ssse3(true);
+    if (ssse3) {
+        std::printf("SSSE3 path\n");
+        test_codes(random);
+        test_paths_agree(random);
+    } else {
+        std::printf("No SSSE3 on this CPU, scalar path only\n");
+    }
+    fec_use_ssse3(false);
+    std::printf("Scalar path\n");
+    test_codes(random);
+    return check_result();
+}
@@ -0,0 +1,124 @@
+// Frames recovered by FEC: rtp_packetize output through LinkEmulator loss
+// into an RtpReassembler, per FEC scheme and loss level. The client's
+// receiver reports feed the loss back every 30 frames and a frame lost
+// without repair has the next IDR forced 3 frames later, about a round trip
+// at 60 fps.
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "check.h"
+#include "shared/link_emulator.h"
+#include "shared/rtp.h"
+
+static const int FRAMES = 900;
+static const int REPORT_FRAMES = 30;
+static const int KEYFRAME_DELAY_FRAMES = 3;
+
+// Annex-B access unit with NAL units of random size. Payload bytes are never
+// 0, so they hold no start codes.
+static std::vector<uint8_t> make_access_unit(bool keyframe, std::mt19937& random) {
+    std::vector<uint8_t> au;
+    auto add_nal = [&](uint8_t header, size_t size) {
+        static const uint8_t start_code[4] = { 0, 0, 0, 1 };
+        au.insert(au.end(), start_code, start_code + 4);
+        au.push_back(header);
+        for (size_t i = 1; i < size; ++i) au.push_back((uint8_t)(1 + random() % 255));
+    };
+    if (keyframe) {
+        add_nal(0x67, 20);
+        add_nal(0x68, 6);
+        add_nal(0x65, 40000 + random() % 40000);
+    } else {
+        const int slices = 1 + random() % 2;
+        for (int i = 0; i < slices; ++i) add_nal(0x41, 1000 + random() % 12000);
+    }
+    return au;
+}
+
+struct Recovery {
+    double intact = 0;          // Share of frames not lost
+    uint64_t recovered = 0;     // Frames FEC made whole
+    int corrupt = 0;            // Frames handed out that differ from what was sent
+};
+
+static Recovery run(FecScheme scheme, double min_ratio, double loss_percent) {
+    std::mt19937 random(7);
+    RtpPacketizer packetizer;
+    init_rtp_packetizer(packetizer, scheme, min_ratio);
+    RtpReassembler reassembler;
+    LinkEmulator link;
+    init_link_emulator(link, loss_percent, 1);
+    link.random.seed(11);
+
+    std::vector<std::vector<uint8_t>> sent;
+    Recovery result;
+    int keyframe_at = 0;
+    MessageHeader header;
+    std::vector<uint8_t> payload;
+    for (int i = 0; i < FRAMES; ++i) {
+        const bool keyframe = keyframe_at >= 0 && i >= keyframe_at;
+        if (keyframe) keyframe_at = -1;
+        sent.push_back(make_access_unit(keyframe, random));
+        VideoFrameHead head;
+        head.header.type = MSG_VIDEO_FRAME;
+        head.header.flags = keyframe ? MSG_FLAG_KEYFRAME : 0;
+        head.header.timestamp_us = i;
+        rtp_packetize(packetizer, head, sent.back().data(), sent.back().size());
+        for (const SendBuffer& datagram : packetizer.datagrams) {
+            if (!link_drops(link)) rtp_receive(reassembler, (const uint8_t*)datagram.data, datagram.size);
+        }
+        while (rtp_next_frame(reassembler, header, payload)) {
+            const std::vector<uint8_t>& au = sent[header.timestamp_us];
+            const size_t offset = sizeof(VideoFrameInfo);
+            if (payload.size() != offset + au.size() || memcmp(payload.data() + offset, au.data(), au.size()) != 0) {
+                ++result.corrupt;
+            }
+        }
+        if (reassembler.need_keyframe && keyframe_at < 0) keyframe_at = i + KEYFRAME_DELAY_FRAMES;
+        if (i % REPORT_FRAMES == REPORT_FRAMES - 1) {
+            ReceiverReport report;
+            rtp_receiver_report(reassembler, report);
+            const uint32_t expected = report.packets_expected;
+            const uint32_t lost = report.packets_lost;
+            if (expected > 0) rtp_report_loss(packetizer, (double)lost / expected);
+        }
+    }
+    result.intact = 1.0 - (double)reassembler.frames_lost / FRAMES;
+    result.recovered = reassembler.frames_recovered;
+    return result;
+}
+
+struct Expectation {
+    double loss_percent;
+    double min_intact[3];       // Without FEC, with XOR and with Reed-Solomon
+};
+
+int main() {
+    // With 10% repair packets at least, raised with the reported loss
+    const FecScheme schemes[3] = { FecScheme::NONE, FecScheme::XOR, FecScheme::REED_SOLOMON };
+    const Expectation expectations[] = {
+        { 0, { 1.0, 1.0, 1.0 } },
+        { 1, { 0.75, 0.97, 0.99 } },
+        { 2, { 0.55, 0.95, 0.97 } },
+        { 5, { 0.3, 0.8, 0.95 } },
+        { 10, { 0.15, 0.6, 0.93 } },
+    };
+    for (const Expectation& expected : expectations) {
+        double intact[3];
+        for (int s = 0; s < 3; ++s) {
+            const Recovery result = run(schemes[s], schemes[s] == FecScheme::NONE ? 0 : 0.1, expected.loss_percent);
+            std::printf("%4.0f%% loss, %-4s: %5.1f%% of frames intact, %llu recovered, %d corrupt\n",
+                        expected.loss_percent, fec_scheme_name(schemes[s]), 100 * result.intact,
+                        (unsigned long long)result.recovered, result.corrupt);
+            CHECK(result.corrupt == 0);
+            CHECK(result.intact >= expected.min_intact[s]);
+            if (schemes[s] != FecScheme::NONE && expected.loss_percent > 0) CHECK(result.recovered > 0);
+            if (schemes[s] == FecScheme::NONE) CHECK(result.recovered == 0);
+            intact[s] = result.intact;
+        }
+        // Reed-Solomon repairs any loss XOR repairs
+        CHECK(intact[2] >= intact[1]);
+    }
+    return check_result();
+}